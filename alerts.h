@@ -0,0 +1,478 @@
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <net/if.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "rates.h"
+#include "output.h"
+
+#define ALERT_MAX_RULES 64 //Rules a configuration may hold
+#define ALERT_NAME_LEN 64 //Longest rule name kept, longer ones are cut
+#define ALERT_TEXT_LEN 256 //Longest rule accepted
+#define ALERT_MAX_TOKENS 8 //Words of the longest rule
+#define ALERT_HOLDOFF_NS (60 * 1000000000ull) //A rule that fired on an interface stays quiet this long after its notice
+#define ALERT_BURST 64 //Notices sent at once before the rate limit applies
+#define ALERT_REFILL 10 //Notices per second past the burst
+#define ALERT_BASELINE_NS (10 * 60 * 1000000000ull) //Baseline of a deviation rule that does not name one
+
+/*Values a rule can watch*/
+enum alert_source {
+    ALERT_FIELD, //a rate field of the machine-readable formats, e.g. rx_bps or rx_drop_ratio
+    ALERT_RATE, //per-second rate of a rated counter, e.g. rx_dropped rate
+    ALERT_UP //1 if the operational state is up, 0 otherwise
+};
+
+/*Conditions a rule can test*/
+enum alert_kind {
+    ALERT_ABOVE, //value > threshold
+    ALERT_BELOW, //value < threshold
+    ALERT_DEVIATES //value is more than threshold standard deviations away from its baseline
+};
+
+/*Alert Rule is one compiled rule of the evaluation table*/
+struct alert_rule {
+    char name[ALERT_NAME_LEN]; //given before a colon, the rule itself otherwise
+    alert_source source;
+    int index; //rate field or rate the rule watches
+    alert_kind kind;
+    double threshold; //limit, or standard deviations of a deviation rule
+    uint64_t for_ns; //time the condition must hold before the rule fires
+    uint64_t baseline_ns; //window of the baseline of a deviation rule
+    double alpha_dt; //interval the smoothing factor of the baseline was computed for
+    double alpha;
+    int watch; //bit of the rate engine holds the tick kernels set for the condition, -1 if evaluated here
+};
+
+/*Alert State is what a rule knows about one interface*/
+struct alert_state {
+    uint64_t since_ns; //the condition holds since this sample, 0 while it does not
+    uint64_t notified_ns; //last firing notice, 0 if none was sent
+    uint64_t baseline_ns; //first sample of the baseline, 0 before it
+    double mean; //exponentially weighted mean and variance of the value
+    double variance;
+    bool is_firing;
+    bool is_notified; //the firing notice was sent, a resolved one follows it
+};
+
+/*Alert Engine evaluates every rule on every sample with rates*/
+/*the states of every interface and rule are allocated once, evaluating never allocates*/
+struct alert_engine {
+    alert_rule rules[ALERT_MAX_RULES];
+    int num_rules;
+    alert_state* states; //num_rules states per rate id
+    size_t max_interfaces;
+    double tokens; //notices that can be sent right now
+    uint64_t refill_ns; //timestamp the tokens were last refilled at
+    uint64_t fired; //firing notices sent
+    uint64_t resolved; //resolved notices sent
+    uint64_t suppressed; //firing notices held back by the hold-off or the rate limit
+};
+
+const char* const alert_state_names[] { "resolved", "firing" };
+
+/*Function is responsible for*/
+/*parsing a number with an optional k, M or G multiplier, % and /s*/
+/*returns false if text is not such a number*/
+bool alert_parse_value(const char* text, double* value) {
+    char* end;
+
+    *value = strtod(text, &end);
+    if(end == text) {
+        return false;
+    }
+    switch (*end) {
+    case 'k': *value *= 1e3; ++end; break;
+    case 'M': *value *= 1e6; ++end; break;
+    case 'G': *value *= 1e9; ++end; break;
+    }
+    if(*end == '%') {
+        *value /= 100;
+        ++end;
+    }
+    if(strcmp(end, "/s") == 0) {
+        end += 2;
+    }
+    return *end == '\0' && std::isfinite(*value);
+}
+
+/*Function is responsible for*/
+/*parsing a duration such as 500ms, 5s, 10m or 1h*/
+/*returns false if text is not a duration*/
+bool alert_parse_duration(const char* text, uint64_t* ns) {
+    char* end;
+    double value = strtod(text, &end);
+    double scale;
+
+    if(end == text || value < 0) {
+        return false;
+    }
+    if(strcmp(end, "ms") == 0) scale = 1e6;
+    else if(strcmp(end, "s") == 0) scale = 1e9;
+    else if(strcmp(end, "m") == 0 || strcmp(end, "min") == 0) scale = 60e9;
+    else if(strcmp(end, "h") == 0) scale = 3600e9;
+    else return false;
+    if(value * scale > 1e18) {
+        return false;
+    }
+    *ns = (uint64_t)(value * scale);
+    return true;
+}
+
+/*Function is responsible for*/
+/*finding the value a rule watches from the words naming it*/
+/*returns the number of words used, 0 if they name nothing*/
+int alert_parse_metric(char* const* tokens, int num_tokens, alert_rule* rule) {
+    if(num_tokens >= 2 && strcmp(tokens[1], "rate") == 0) {
+        for (int r = 0; r < RATE_COUNT; r++) {
+            if(strcmp(tokens[0], rate_name(r)) == 0) {
+                rule->source = ALERT_RATE;
+                rule->index = r;
+                return 2;
+            }
+        }
+        return 0;
+    }
+    for (int f = 0; f < NUM_RATE_FIELDS; f++) {
+        if(strcmp(tokens[0], rate_field_names[f]) == 0) {
+            rule->source = ALERT_FIELD;
+            rule->index = f;
+            return 1;
+        }
+    }
+    if(strcmp(tokens[0], "up") == 0) {
+        rule->source = ALERT_UP;
+        rule->index = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/*Alert Add Rule function is responsible for*/
+/*compiling a rule into the evaluation table, e.g.*/
+/*  drops: rx_dropped rate > 1000/s for 5s*/
+/*  rx_error_ratio > 0.1%*/
+/*  rx_bps deviates 4σ from 10m baseline*/
+/*returns false and points error at the reason if the rule is not understood*/
+bool alerts_add_rule(alert_engine* engine, const char* text, const char** error) {
+    char line[ALERT_TEXT_LEN], *tokens[ALERT_MAX_TOKENS], *save, *expr, *colon;
+    int num_tokens { 0 }, t;
+
+    if(engine->num_rules == ALERT_MAX_RULES) {
+        *error = "too many alert rules";
+        return false;
+    }
+    if(strlen(text) >= sizeof(line)) {
+        *error = "the alert rule is too long";
+        return false;
+    }
+    alert_rule* rule = &engine->rules[engine->num_rules];
+    memset(rule, 0, sizeof(*rule));
+    strcpy(line, text);
+    expr = line;
+    if((colon = strchr(line, ':')) != nullptr) { //named rule
+        *colon = '\0';
+        expr = colon + 1;
+        for (char* word = strtok_r(line, " \t", &save); word != nullptr; word = strtok_r(nullptr, " \t", &save)) {
+            if(rule->name[0] != '\0' || strlen(word) >= ALERT_NAME_LEN) {
+                *error = "the name of an alert rule is a single word";
+                return false;
+            }
+            strcpy(rule->name, word);
+        }
+    }
+    if(rule->name[0] == '\0') {
+        strncpy(rule->name, text + (expr - line) + strspn(expr, " \t"), ALERT_NAME_LEN - 1);
+    }
+    for (char* word = strtok_r(expr, " \t", &save); word != nullptr; word = strtok_r(nullptr, " \t", &save)) {
+        if(num_tokens == ALERT_MAX_TOKENS) {
+            *error = "the alert rule has too many words";
+            return false;
+        }
+        tokens[num_tokens++] = word;
+    }
+    if(num_tokens == 0 || (t = alert_parse_metric(tokens, num_tokens, rule)) == 0) {
+        *error = "an alert rule starts with a rate field, a rated counter followed by rate, or up";
+        return false;
+    }
+
+    if(t < num_tokens && (strcmp(tokens[t], ">") == 0 || strcmp(tokens[t], "<") == 0)) {
+        rule->kind = tokens[t][0] == '>' ? ALERT_ABOVE : ALERT_BELOW;
+        if(++t == num_tokens || !alert_parse_value(tokens[t++], &rule->threshold)) {
+            *error = "the threshold of an alert rule is a number, e.g. 1000/s, 2.5M or 0.1%";
+            return false;
+        }
+        if(t < num_tokens && strcmp(tokens[t], "for") == 0
+           && (++t == num_tokens || !alert_parse_duration(tokens[t++], &rule->for_ns))) {
+            *error = "for is followed by a duration, e.g. 500ms, 5s or 10m";
+            return false;
+        }
+    } else if(t < num_tokens && strcmp(tokens[t], "deviates") == 0) {
+        char* end;
+        rule->kind = ALERT_DEVIATES;
+        rule->baseline_ns = ALERT_BASELINE_NS;
+        if(++t == num_tokens || (rule->threshold = strtod(tokens[t], &end)) <= 0 || end == tokens[t]) {
+            *error = "deviates is followed by a number of standard deviations, e.g. 4σ";
+            return false;
+        }
+        ++t;
+        if(*end == '\0' && t < num_tokens) //the unit as a word of its own
+            end = tokens[t++];
+        if(strcmp(end, "σ") != 0 && strcmp(end, "sigma") != 0) {
+            *error = "the standard deviations are written as σ or sigma, e.g. 4σ";
+            return false;
+        }
+        if(t < num_tokens && strcmp(tokens[t], "from") == 0) {
+            if(++t == num_tokens || !alert_parse_duration(tokens[t++], &rule->baseline_ns) || rule->baseline_ns == 0) {
+                *error = "from is followed by the window of the baseline, e.g. 10m";
+                return false;
+            }
+            if(t < num_tokens && strcmp(tokens[t], "baseline") == 0)
+                ++t;
+        }
+    } else {
+        *error = "the value of an alert rule is followed by >, < or deviates";
+        return false;
+    }
+    if(t != num_tokens) {
+        *error = "unexpected words at the end of the alert rule";
+        return false;
+    }
+    ++engine->num_rules;
+    return true;
+}
+
+/*Function is responsible for*/
+/*allocating the states of every rule for up to max_interfaces interfaces*/
+/*and handing the thresholds on rates to the tick kernels of rates*/
+/*the rules were added before, while the options were read*/
+void alerts_init(alert_engine* engine, rate_engine* rates, size_t max_interfaces) {
+    for (int r = 0; r < engine->num_rules; r++) {
+        alert_rule* rule = &engine->rules[r];
+        rate_threshold threshold;
+        rule->watch = -1;
+        if(rule->kind == ALERT_DEVIATES || rule->source == ALERT_UP) {
+            continue;
+        }
+        if(rule->source == ALERT_FIELD) {
+            threshold = field_threshold(rule->index, rule->threshold, rule->kind == ALERT_BELOW);
+        } else {
+            threshold = rate_threshold { rule->index, -1, 1.0, rule->threshold, rule->kind == ALERT_BELOW };
+        }
+        rule->watch = rate_engine_watch(rates, &threshold);
+    }
+    engine->max_interfaces = max_interfaces;
+    engine->states = new alert_state[max_interfaces * engine->num_rules]();
+    engine->tokens = ALERT_BURST;
+    engine->refill_ns = 0;
+    engine->fired = engine->resolved = engine->suppressed = 0;
+}
+
+/*Function is responsible for*/
+/*releasing the states of the engine*/
+void alerts_free(alert_engine* engine) {
+    delete[] engine->states;
+    engine->states = nullptr;
+}
+
+/*Function is responsible for*/
+/*forgetting what the rules know about an interface, its rate id is handed out again*/
+void alerts_forget(alert_engine* engine, int id) {
+    if(engine->states != nullptr && id >= 0)
+        std::fill_n(&engine->states[(size_t)id * engine->num_rules], engine->num_rules, alert_state());
+}
+
+/*Function is responsible for*/
+/*taking a token of the rate limit, refilled at ALERT_REFILL per second up to ALERT_BURST*/
+/*returns false if the notice has to be held back*/
+bool alerts_take_token(alert_engine* engine, uint64_t now_ns) {
+    if(now_ns > engine->refill_ns) {
+        engine->tokens = std::min<double>(ALERT_BURST, engine->tokens + (now_ns - engine->refill_ns) * ALERT_REFILL / 1e9);
+        engine->refill_ns = now_ns;
+    }
+    if(engine->tokens < 1) {
+        return false;
+    }
+    engine->tokens -= 1;
+    return true;
+}
+
+/*Function is responsible for*/
+/*the value a rule watches in the rates of an interface*/
+inline double alert_value(const alert_rule* rule, const rate_engine* rates, const rate_state* state, const wire_sample* sample) {
+    switch (rule->source) {
+    case ALERT_FIELD: return rate_field(rates, state->id, rule->index);
+    case ALERT_RATE: return rates->rate[rate_at(rates, rule->index, state->id)];
+    default: return strcmp(sample->stats.operstate, "up") == 0 ? 1.0 : 0.0;
+    }
+}
+
+/*Alert Deviates function is responsible for*/
+/*testing a value against the exponentially weighted mean and variance of the interface*/
+/*and folding it into them, a baseline younger than its window never deviates*/
+bool alert_deviates(alert_rule* rule, alert_state* st, double value, uint64_t now_ns, double dt) {
+    if(st->baseline_ns == 0) {
+        st->baseline_ns = now_ns;
+        st->mean = value;
+        st->variance = 0;
+        return false;
+    }
+    if(dt != rule->alpha_dt) { //the interfaces share an interval, expm1 runs when it changes
+        rule->alpha = -expm1(-dt / rule->baseline_ns);
+        rule->alpha_dt = dt;
+    }
+    double diff = value - st->mean;
+    bool deviates = now_ns - st->baseline_ns >= rule->baseline_ns && st->variance > 0
+        && diff * diff > rule->threshold * rule->threshold * st->variance;
+    double step = rule->alpha * diff;
+    st->mean += step;
+    st->variance = (1 - rule->alpha) * (st->variance + diff * step);
+    return deviates;
+}
+
+/*Alert Notify function is responsible for*/
+/*writing a firing or resolved notice through the output in its format*/
+/*CSV has fixed columns, its notices go to stderr as text*/
+void alert_notify(sample_output* output, const alert_rule* rule, const alert_state* st, const wire_sample* sample, double value, bool is_firing) {
+    if(output->is_quiet) {
+        return;
+    }
+    if(output->format == FORMAT_CSV) {
+        const char* host = host_name(sample->stats.host);
+        fprintf(stderr, "Alert:%s interface:%s%s%s state:%s value:%.3f\n", rule->name, sample->interface,
+                host != nullptr ? " host:" : "", host != nullptr ? host : "", alert_state_names[is_firing], value);
+        return;
+    }
+    uint64_t time_ns = sample->timestamp_ns + output->epoch_offset_ns;
+    const char* host = host_name(sample->stats.host);
+    output_reserve(output);
+    switch (output->format) {
+    case FORMAT_JSON:
+        out_str(output, "{\"time_ns\":");
+        out_u64(output, time_ns);
+        out_str(output, ",\"alert\":\"");
+        out_name(output, rule->name, ALERT_NAME_LEN);
+        out_str(output, "\",\"interface\":\"");
+        out_name(output, sample->interface, IFNAMSIZ);
+        if(host != nullptr) {
+            out_str(output, "\",\"host\":\"");
+            out_name(output, host, HOST_NAME_LEN);
+        }
+        out_str(output, "\",\"state\":\"");
+        out_str(output, alert_state_names[is_firing]);
+        out_str(output, "\",\"value\":");
+        out_f64(output, value, 3);
+        if(rule->kind == ALERT_DEVIATES) {
+            out_str(output, ",\"baseline\":");
+            out_f64(output, st->mean, 3);
+        }
+        out_str(output, "}\n");
+        break;
+
+    case FORMAT_INFLUX:
+        out_str(output, OUTPUT_MEASUREMENT "_alert,interface=");
+        out_name(output, sample->interface, IFNAMSIZ);
+        if(host != nullptr) {
+            out_str(output, ",host=");
+            out_name(output, host, HOST_NAME_LEN);
+        }
+        out_str(output, ",alert=");
+        out_name(output, rule->name, ALERT_NAME_LEN);
+        out_str(output, " state=\"");
+        out_str(output, alert_state_names[is_firing]);
+        out_str(output, "\",value=");
+        out_f64(output, value, 3);
+        if(rule->kind == ALERT_DEVIATES) {
+            out_str(output, ",baseline=");
+            out_f64(output, st->mean, 3);
+        }
+        out_char(output, ' ');
+        out_u64(output, time_ns);
+        out_char(output, '\n');
+        break;
+
+    default: //FORMAT_TEXT
+        out_str(output, "Alert:");
+        out_name(output, rule->name, ALERT_NAME_LEN);
+        out_str(output, " interface:");
+        out_name(output, sample->interface, IFNAMSIZ);
+        if(host != nullptr) {
+            out_str(output, " host:");
+            out_name(output, host, HOST_NAME_LEN);
+        }
+        out_str(output, " state:");
+        out_str(output, alert_state_names[is_firing]);
+        out_str(output, " value:");
+        out_f64(output, value, 3);
+        if(rule->kind == ALERT_DEVIATES) {
+            out_str(output, " baseline:");
+            out_f64(output, st->mean, 3);
+        }
+        out_char(output, '\n');
+        break;
+    }
+}
+
+/*Alerts Evaluate function is responsible for*/
+/*running every rule of the table on a sample whose rates were just computed*/
+/*the thresholds on rates were compared by the tick kernels, the value is computed for the notices only*/
+/*a rule fires once its condition held for for_ns and resolves when it stops holding*/
+/*a firing notice is sent once per episode, at most once per ALERT_HOLDOFF_NS and within the rate limit*/
+void alerts_evaluate(alert_engine* engine, sample_output* output, const rate_state* state, const wire_sample* sample) {
+    if(!state->has_rate || state->id >= engine->max_interfaces) {
+        return;
+    }
+    alert_state* states = &engine->states[(size_t)state->id * engine->num_rules];
+    const rate_engine* rates = &output->rates;
+    uint64_t now_ns = sample->timestamp_ns;
+
+    for (int r = 0; r < engine->num_rules; r++) {
+        alert_rule* rule = &engine->rules[r];
+        alert_state* st = &states[r];
+        double value { 0 };
+        bool holds;
+
+        if(rule->watch >= 0) {
+            holds = (rates->holds[state->id] >> rule->watch) & 1;
+        } else {
+            value = alert_value(rule, rates, state, sample);
+            switch (rule->kind) {
+            case ALERT_ABOVE: holds = value > rule->threshold; break;
+            case ALERT_BELOW: holds = value < rule->threshold; break;
+            default: holds = alert_deviates(rule, st, value, now_ns, state->alpha_dt); break;
+            }
+        }
+        if(!holds) {
+            st->since_ns = 0;
+            if(st->is_firing && st->is_notified) {
+                alert_notify(output, rule, st, sample, rule->watch >= 0 ? alert_value(rule, rates, state, sample) : value, false);
+                ++engine->resolved;
+            }
+            st->is_firing = st->is_notified = false;
+            continue;
+        }
+        if(st->since_ns == 0)
+            st->since_ns = now_ns;
+        if(st->is_firing || now_ns - st->since_ns < rule->for_ns) {
+            continue;
+        }
+        st->is_firing = true;
+        if((st->notified_ns != 0 && now_ns - st->notified_ns < ALERT_HOLDOFF_NS) || !alerts_take_token(engine, now_ns)) {
+            ++engine->suppressed; //flapping, or a storm of alerts
+            continue;
+        }
+        st->notified_ns = now_ns;
+        st->is_notified = true;
+        alert_notify(output, rule, st, sample, rule->watch >= 0 ? alert_value(rule, rates, state, sample) : value, true);
+        ++engine->fired;
+    }
+}
+
+#endif //ALERTS_H
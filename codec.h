@@ -0,0 +1,262 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include "statistics.h"
+#include "protocol.h"
+
+#define CODEC_VALUES (NUM_COUNTERS + NUM_QUEUE_COUNTERS * MAX_QUEUES) //Counters then queue counters of a sample
+#define CODEC_VARINT_LEN 10 //Longest varint of a 64 bit value
+#define CODEC_MASK_LEN ((CODEC_VALUES + 7) / 8) //Bytes of the mask of the changed deltas
+#define CODEC_RECORD_LEN (2 * CODEC_VARINT_LEN + 1 + 3 * CODEC_VARINT_LEN + CODEC_MASK_LEN + CODEC_VALUES * CODEC_VARINT_LEN) //Upper bound of one encoded sample
+#define CODEC_OPERSTATE_MASK 0x07 //Flags of a record: operstate index
+#define CODEC_HAS_QUEUE_STATS 0x08 //the queue counters follow the counters
+#define CODEC_MISSED 0x10 //missed_ticks changed, its value follows
+#define CODEC_QUEUES 0x20 //the number of queues changed, both follow
+
+/*Codec State is what the encoder and the decoder remember of one interface*/
+/*every value is predicted to grow by its previous delta, only the misses are written*/
+struct codec_state {
+    uint64_t timestamp_ns;
+    uint64_t interval_ns; //previous timestamp delta
+    uint64_t missed_ticks;
+    uint16_t num_queues[NUM_QUEUE_DIRS];
+    bool is_first; //no record of the interface in the block yet, its values are written whole
+    uint64_t values[CODEC_VALUES];
+    uint64_t deltas[CODEC_VALUES];
+};
+
+/*Sample Codec compresses a stream of samples of many interfaces*/
+/*timestamps are written as delta-of-delta, every counter as the zigzag varint of its delta-of-delta*/
+/*and a mask leaves out the counters that grew by their previous delta, the quiet ones mostly*/
+/*the stream is cut into blocks that decode on their own, a state is reset by the first record of its block*/
+struct sample_codec {
+    codec_state* states; //indexed by the entry of the interface
+    uint32_t* blocks; //block every state was last written in
+    size_t num_states;
+    uint32_t block; //block being encoded or decoded, 0 before the first
+};
+
+/*Function is responsible for*/
+/*preparing a codec for num_states interfaces, the only allocation of the codec*/
+void codec_init(sample_codec* codec, size_t num_states) {
+    codec->states = new codec_state[num_states];
+    codec->blocks = new uint32_t[num_states]();
+    codec->num_states = num_states;
+    codec->block = 0;
+}
+
+/*Function is responsible for*/
+/*releasing the states of a codec*/
+void codec_free(sample_codec* codec) {
+    delete[] codec->states;
+    delete[] codec->blocks;
+    codec->states = nullptr;
+    codec->blocks = nullptr;
+}
+
+/*Function is responsible for*/
+/*starting a block, every interface starts over from zero*/
+inline void codec_block(sample_codec* codec) {
+    if(++codec->block == 0) { //wrapped, a state of block 0 must not look current
+        memset(codec->blocks, 0, codec->num_states * sizeof(uint32_t));
+        codec->block = 1;
+    }
+}
+
+/*Function is responsible for*/
+/*taking the state of an entry, reset if the block did not write it yet*/
+inline codec_state* codec_state_of(sample_codec* codec, uint32_t entry) {
+    codec_state* state = &codec->states[entry];
+    if(codec->blocks[entry] != codec->block) {
+        memset(state, 0, sizeof(*state));
+        state->is_first = true;
+        codec->blocks[entry] = codec->block;
+    }
+    return state;
+}
+
+/*Functions are responsible for*/
+/*writing and reading the varints, 7 bits per byte, low bits first*/
+inline uint8_t* codec_put(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+inline bool codec_get(const uint8_t** in, const uint8_t* end, uint64_t* value) {
+    const uint8_t* p = *in;
+    uint64_t result { 0 };
+
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if(byte < 0x80) {
+            *value = result;
+            *in = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint64_t zigzag(uint64_t value) {
+    return (value << 1) ^ (uint64_t)((int64_t)value >> 63);
+}
+
+inline uint64_t unzigzag(uint64_t value) {
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+/*Function is responsible for*/
+/*predicting no growth after the first record of a block, its deltas were whole values*/
+inline void codec_first_done(codec_state* state) {
+    if(state->is_first) {
+        state->is_first = false;
+        state->interval_ns = 0;
+        memset(state->deltas, 0, sizeof(state->deltas));
+    }
+}
+
+/*Function is responsible for*/
+/*listing the values a sample carries, the counters and the kept queue counters*/
+/*returns how many of indexes were filled*/
+inline int codec_values(const interface_stats* stats, uint8_t* indexes) {
+    int n { 0 };
+
+    for (int c = 0; c < NUM_COUNTERS; c++)
+        indexes[n++] = c;
+    if(stats->has_queue_stats) {
+        for (int c = 0; c < NUM_QUEUE_COUNTERS; c++) {
+            for (int q = 0; q < queues_kept(stats, queue_schema[c].dir); q++)
+                indexes[n++] = NUM_COUNTERS + c * MAX_QUEUES + q;
+        }
+    }
+    return n;
+}
+
+/*Function is responsible for*/
+/*reading value index of a sample*/
+inline uint64_t codec_value(const interface_stats* stats, int index) {
+    return index < NUM_COUNTERS ? stats->counters[index] : stats->queues[(index - NUM_COUNTERS) / MAX_QUEUES][(index - NUM_COUNTERS) % MAX_QUEUES];
+}
+
+/*Codec Encode function is responsible for*/
+/*appending a sample of entry to out, which has room for CODEC_RECORD_LEN bytes*/
+/*operstate is the index of the operstate string, below 8*/
+/*returns the bytes written*/
+size_t codec_encode(sample_codec* codec, uint32_t entry, uint8_t operstate, const wire_sample* sample, uint8_t* out) {
+    codec_state* state = codec_state_of(codec, entry);
+    const interface_stats* stats = &sample->stats;
+    uint8_t indexes[CODEC_VALUES];
+    uint8_t* start = out;
+    uint8_t* flags;
+    uint8_t* mask;
+    int n = codec_values(stats, indexes);
+
+    out = codec_put(out, entry);
+    flags = out++;
+    *flags = (operstate & CODEC_OPERSTATE_MASK) | (stats->has_queue_stats ? CODEC_HAS_QUEUE_STATS : 0);
+    uint64_t interval = sample->timestamp_ns - state->timestamp_ns;
+    out = codec_put(out, zigzag(interval - state->interval_ns));
+    state->timestamp_ns = sample->timestamp_ns;
+    state->interval_ns = interval;
+    if(sample->missed_ticks != state->missed_ticks) {
+        *flags |= CODEC_MISSED;
+        out = codec_put(out, sample->missed_ticks);
+        state->missed_ticks = sample->missed_ticks;
+    }
+    if(memcmp(stats->num_queues, state->num_queues, sizeof(state->num_queues)) != 0) {
+        *flags |= CODEC_QUEUES;
+        for (int d = 0; d < NUM_QUEUE_DIRS; d++)
+            out = codec_put(out, stats->num_queues[d]);
+        memcpy(state->num_queues, stats->num_queues, sizeof(state->num_queues));
+    }
+
+    mask = out;
+    out += (n + 7) / 8;
+    memset(mask, 0, (n + 7) / 8);
+    for (int i = 0; i < n; i++) {
+        uint64_t value = codec_value(stats, indexes[i]);
+        uint64_t delta = value - state->values[indexes[i]];
+        if(delta != state->deltas[indexes[i]]) { //off the prediction
+            mask[i / 8] |= 1 << (i % 8);
+            out = codec_put(out, zigzag(delta - state->deltas[indexes[i]]));
+            state->deltas[indexes[i]] = delta;
+        }
+        state->values[indexes[i]] = value;
+    }
+    codec_first_done(state);
+    return out - start;
+}
+
+/*Codec Decode function is responsible for*/
+/*reading the next sample from *in into entry, operstate and sample without allocating*/
+/*the interface and operstate strings are left to the caller*/
+/*returns false if the record is cut short or does not belong to the codec*/
+bool codec_decode(sample_codec* codec, const uint8_t** in, const uint8_t* end, uint32_t* entry, uint8_t* operstate, wire_sample* sample) {
+    interface_stats* stats = &sample->stats;
+    const uint8_t* p = *in;
+    uint8_t indexes[CODEC_VALUES];
+    uint64_t value;
+    uint8_t flags;
+
+    if(!codec_get(&p, end, &value) || value >= codec->num_states || p == end) {
+        return false;
+    }
+    *entry = value;
+    codec_state* state = codec_state_of(codec, *entry);
+    flags = *p++;
+    *operstate = flags & CODEC_OPERSTATE_MASK;
+    if(!codec_get(&p, end, &value)) {
+        return false;
+    }
+    state->interval_ns += unzigzag(value);
+    state->timestamp_ns += state->interval_ns;
+    if((flags & CODEC_MISSED) && !codec_get(&p, end, &state->missed_ticks)) {
+        return false;
+    }
+    for (int d = 0; (flags & CODEC_QUEUES) && d < NUM_QUEUE_DIRS; d++) {
+        if(!codec_get(&p, end, &value)) {
+            return false;
+        }
+        state->num_queues[d] = value;
+    }
+    sample->timestamp_ns = state->timestamp_ns;
+    sample->missed_ticks = state->missed_ticks;
+    stats->has_queue_stats = (flags & CODEC_HAS_QUEUE_STATS) != 0;
+    memcpy(stats->num_queues, state->num_queues, sizeof(state->num_queues));
+    stats->reserved = 0;
+    stats->host = 0;
+    memset(stats->queues, 0, sizeof(stats->queues));
+
+    int n = codec_values(stats, indexes);
+    const uint8_t* mask = p;
+    if(end - p < (n + 7) / 8) {
+        return false;
+    }
+    p += (n + 7) / 8;
+    for (int i = 0; i < n; i++) {
+        int index = indexes[i];
+        if(mask[i / 8] & (1 << (i % 8))) {
+            if(!codec_get(&p, end, &value)) {
+                return false;
+            }
+            state->deltas[index] += unzigzag(value);
+        }
+        state->values[index] += state->deltas[index];
+        if(index < NUM_COUNTERS) stats->counters[index] = state->values[index];
+        else stats->queues[(index - NUM_COUNTERS) / MAX_QUEUES][(index - NUM_COUNTERS) % MAX_QUEUES] = state->values[index];
+    }
+    codec_first_done(state);
+    *in = p;
+    return true;
+}
+
+#endif //CODEC_H
@@ -0,0 +1,254 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "netlink.h"
+#include "sysfs_collector.h"
+#include "self_metrics.h"
+
+#define MAX_PATTERNS 32 //Include and exclude patterns of a filter
+#define PATTERN_LEN 64 //Longest pattern
+#define DISCOVERY_RCVBUF (1 << 20) //Receive buffer asked for, a burst of link changes fits before ENOBUFS
+#define INOTIFY_BUF_LEN 65536 //Receive buffer of the inotify events
+
+/*Interface Filter selects interfaces by glob patterns*/
+/*a pattern starting with ! excludes what it matches*/
+struct interface_filter {
+    char patterns[MAX_PATTERNS][PATTERN_LEN];
+    size_t num_patterns;
+    bool has_include; //without an include pattern every interface that is not excluded matches
+};
+
+/*What happened to the interfaces under sysfs_root*/
+enum discovery_event {
+    DISCOVERY_ADD, //a matching interface appeared, or may have
+    DISCOVERY_REMOVE, //an interface disappeared or was renamed to a name the filter does not select
+    DISCOVERY_RESCAN //events were lost, every interface is reported again after this one
+};
+
+/*Interface Discovery follows the interfaces appearing and disappearing under sysfs_root*/
+/*through rtnetlink link notifications, or through inotify for any other directory*/
+/*every event names a single interface, so a churn never costs a full rescan*/
+struct interface_discovery {
+    int fd;
+    bool is_netlink;
+    char* buffer; //receive buffer allocated once at startup
+    const interface_filter* filter;
+    void (*handle)(discovery_event event, const char* interface, int index); //index is 0 if not known
+};
+
+/*Interface Filter Add function is responsible for*/
+/*adding the comma separated patterns of list to the filter*/
+/*returns false if a pattern is too long or there are too many*/
+bool interface_filter_add(interface_filter* filter, const char* list) {
+    const char* p = list;
+
+    while (*p != '\0') {
+        while (*p == ' ') //blanks after the commas, e.g. in a config file
+            ++p;
+        size_t len = strcspn(p, ",");
+        while (len > 0 && p[len-1] == ' ')
+            --len;
+        if(len > 0) {
+            if(len >= PATTERN_LEN || filter->num_patterns == MAX_PATTERNS) {
+                return false;
+            }
+            memcpy(filter->patterns[filter->num_patterns], p, len);
+            filter->patterns[filter->num_patterns][len] = '\0';
+            if(p[0] != '!')
+                filter->has_include = true;
+            ++filter->num_patterns;
+        }
+        p += strcspn(p, ",");
+        if(*p == ',')
+            ++p;
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*checking if an interface is selected by the filter, exclusions win*/
+bool interface_filter_match(const interface_filter* filter, const char* interface) {
+    bool is_included { !filter->has_include };
+
+    for (size_t i = 0; i < filter->num_patterns; i++) {
+        const char* pattern = filter->patterns[i];
+        if(pattern[0] == '!') {
+            if(fnmatch(pattern + 1, interface, 0) == 0)
+                return false;
+        } else if(!is_included && fnmatch(pattern, interface, 0) == 0) {
+            is_included = true;
+        }
+    }
+    return is_included;
+}
+
+/*Function is responsible for*/
+/*reporting an interface that appeared if the filter selects it*/
+/*hidden entries are how a directory is staged before it is moved in place*/
+/*returns false if the interface is not selected*/
+inline bool discovery_add(interface_discovery* discovery, const char* interface, int index) {
+    if(interface[0] == '.' || strnlen(interface, IFNAMSIZ) == IFNAMSIZ || !interface_filter_match(discovery->filter, interface)) {
+        return false;
+    }
+    discovery->handle(DISCOVERY_ADD, interface, index);
+    return true;
+}
+
+/*Discovery Scan function is responsible for*/
+/*reporting every matching interface under sysfs_root*/
+/*done once at startup and again only if events were lost*/
+bool discovery_scan(interface_discovery* discovery) {
+    DIR* dir;
+    struct dirent* entry;
+
+    if((dir = opendir(sysfs_root)) == nullptr) {
+        return false;
+    }
+    while ((entry = readdir(dir)) != nullptr) {
+        discovery_add(discovery, entry->d_name, discovery->is_netlink ? if_nametoindex(entry->d_name) : 0);
+    }
+    closedir(dir);
+    return true;
+}
+
+/*Discovery Open function is responsible for*/
+/*subscribing to link notifications for the real sysfs, or watching sysfs_root with inotify*/
+/*the existing interfaces are left to discovery_scan*/
+bool discovery_open(interface_discovery* discovery, const interface_filter* filter,
+                    void (*handle)(discovery_event event, const char* interface, int index)) {
+    memset(discovery, 0, sizeof(*discovery));
+    discovery->filter = filter;
+    discovery->handle = handle;
+    discovery->is_netlink = strcmp(sysfs_root, DEFAULT_SYSFS_ROOT) == 0; //sysfs does not generate inotify events
+
+    if(discovery->is_netlink) {
+        int rcvbuf { DISCOVERY_RCVBUF };
+        if((discovery->fd = netlink_open(RTMGRP_LINK)) < 0) {
+            return false;
+        }
+        setsockopt(discovery->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)); //best effort, ENOBUFS is handled anyway
+        discovery->buffer = new char[NETLINK_BUF_LEN];
+    } else {
+        if((discovery->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+            return false;
+        }
+        if(inotify_add_watch(discovery->fd, sysfs_root, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+            close(discovery->fd);
+            return false;
+        }
+        discovery->buffer = new char[INOTIFY_BUF_LEN];
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*telling the handler that events were lost and reporting every interface again*/
+void discovery_rescan(interface_discovery* discovery) {
+    discovery->handle(DISCOVERY_RESCAN, nullptr, 0);
+    if(!discovery_scan(discovery)) {
+        perror("Error while scanning the interfaces");
+    }
+}
+
+/*Function is responsible for*/
+/*turning the pending link notifications into events*/
+void discovery_read_netlink(interface_discovery* discovery) {
+    struct rtattr* attrs[IFLA_MAX+1];
+    ssize_t len;
+
+    while (true) {
+        self_count(SELF_SYSCALLS);
+        if((len = recv(discovery->fd, discovery->buffer, NETLINK_BUF_LEN, MSG_DONTWAIT)) < 0) {
+            if(errno == ENOBUFS) { //the socket overflowed, the lost links are only found by a rescan
+                discovery_rescan(discovery);
+                continue;
+            }
+            if(errno == EINTR)
+                continue;
+            break; //EAGAIN once drained
+        }
+        for (struct nlmsghdr* msg = (struct nlmsghdr*)discovery->buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if(msg->nlmsg_type != RTM_NEWLINK && msg->nlmsg_type != RTM_DELLINK) {
+                continue;
+            }
+            netlink_parse_link(msg, attrs, IFLA_MAX);
+            if(attrs[IFLA_IFNAME] == nullptr) {
+                continue;
+            }
+            char interface[IFNAMSIZ] { 0 };
+            strncpy(interface, (char*)RTA_DATA(attrs[IFLA_IFNAME]), IFNAMSIZ-1);
+            int index = ((struct ifinfomsg*)NLMSG_DATA(msg))->ifi_index;
+            //RTM_DELLINK is also sent when a link moves to another namespace
+            //RTM_NEWLINK on every flag change and rename, the handler ignores links it knows
+            if(msg->nlmsg_type == RTM_DELLINK || !discovery_add(discovery, interface, index)) {
+                discovery->handle(DISCOVERY_REMOVE, interface, index);
+            }
+        }
+    }
+}
+
+/*Function is responsible for*/
+/*turning the pending inotify events of sysfs_root into events*/
+void discovery_read_inotify(interface_discovery* discovery) {
+    ssize_t len;
+
+    while (true) {
+        self_count(SELF_SYSCALLS);
+        if((len = read(discovery->fd, discovery->buffer, INOTIFY_BUF_LEN)) < 0) {
+            if(errno == EINTR)
+                continue;
+            break; //EAGAIN once drained
+        }
+        for (char* p = discovery->buffer; p < discovery->buffer + len; ) {
+            struct inotify_event* event = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if(event->mask & IN_Q_OVERFLOW) {
+                discovery_rescan(discovery);
+            } else if(event->len == 0) {
+                continue;
+            } else if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                discovery_add(discovery, event->name, 0);
+            } else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                discovery->handle(DISCOVERY_REMOVE, event->name, 0);
+            }
+        }
+    }
+}
+
+/*Discovery Read function is responsible for*/
+/*draining the pending notifications without blocking*/
+void discovery_read(interface_discovery* discovery) {
+    if(discovery->is_netlink) {
+        discovery_read_netlink(discovery);
+    } else {
+        discovery_read_inotify(discovery);
+    }
+}
+
+/*Function is responsible for*/
+/*releasing the socket or the watch of the discovery*/
+void discovery_close(interface_discovery* discovery) {
+    if(discovery->buffer == nullptr) { //never opened
+        return;
+    }
+    close(discovery->fd);
+    delete[] discovery->buffer;
+    discovery->buffer = nullptr;
+    discovery->fd = -1;
+}
+
+#endif //DISCOVERY_H
@@ -0,0 +1,22 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <cstdint>
+#include <sys/epoll.h>
+
+/*Event Source is anything the epoll loop waits on*/
+struct event_source {
+    int fd;
+    void (*handle)(event_source* source);
+};
+
+/*Function is responsible for*/
+/*registering an event source in an epoll set*/
+inline bool event_source_add(int epoll_fd, event_source* source, uint32_t events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = source;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, source->fd, &event) == 0;
+}
+
+#endif //EVENT_LOOP_H
@@ -0,0 +1,562 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <charconv>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "rates.h"
+#include "output.h"
+#include "event_loop.h"
+#include "self_metrics.h"
+
+#define SCRAPE_REQUEST_LEN 2048 //Longest HTTP request head accepted
+#define SCRAPE_HEADER_LEN 256 //Room reserved in front of the body for the response head
+#define SCRAPE_LINE_LEN 512 //Upper bound of one exposition line, escaped host and interface included
+#define SCRAPE_TIMEOUT_NS 10000000000ull //Scrapers idle this long are dropped
+#define MAX_SCRAPERS 64 //Scrapers served at once, more are refused
+#define METRICS_BODY_LEN 65536 //Initial capacity of a rendered body, grown as needed
+
+const char* const response_not_found {
+    "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nNot Found\n"
+};
+const char* const response_bad_request {
+    "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\nContent-Length: 12\r\nConnection: close\r\n\r\nBad Request\n"
+};
+const char* const response_unavailable {
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/plain\r\nContent-Length: 15\r\nConnection: close\r\n\r\nNo samples yet\n"
+};
+
+/*Metrics Body is one rendering of the exposition, response head included*/
+/*shared by every scraper of a tick and kept alive until the last one is done*/
+struct metrics_body {
+    char* data; //head at data + start, body right after it
+    size_t capacity;
+    size_t start; //first byte of the response
+    size_t len; //bytes of the response
+    int refs; //scrapers still sending it
+    metrics_body* next; //bodies are pooled by the exporter
+};
+
+struct exporter;
+
+/*Scraper is one HTTP client of the exporter*/
+struct scraper {
+    event_source source; //must stay first, the loop hands scrapers out as event sources
+    exporter* owner;
+    char request[SCRAPE_REQUEST_LEN];
+    size_t request_len;
+    metrics_body* body; //rendering being sent, nullptr for the canned responses
+    const char* out; //response being sent
+    size_t out_len;
+    size_t sent;
+    uint64_t accepted_ns;
+    scraper* prev;
+    scraper* next;
+};
+
+/*Exporter serves the latest statistics in Prometheus text format*/
+/*the body is rendered once per tick and every scrape sends the same bytes*/
+struct exporter {
+    event_source source; //must stay first, the listening socket
+    int epoll_fd;
+    char path[sizeof(sockaddr_un::sun_path)]; //UNIX socket to remove on close, empty for TCP
+    wire_sample* latest; //last sample of every interface, indexed by rate_state::id
+    bool* has_sample;
+    size_t max_interfaces;
+    metrics_body* bodies; //pool of renderings, the current one included
+    metrics_body* current; //rendering of the last tick, nullptr before the first
+    scraper* scrapers;
+    size_t num_scrapers;
+    uint64_t scrapes; //responses sent
+    uint64_t renders; //ticks rendered
+};
+
+void exporter_accept(event_source* source);
+void scraper_handle(event_source* source);
+
+/*Function is responsible for*/
+/*opening the listening socket of the exporter*/
+/*address is a UNIX socket path, a port on the loopback or host:port*/
+int exporter_listen(const char* address, char* path) {
+    int fd;
+    path[0] = '\0';
+
+    if(strchr(address, '/') != nullptr) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address, sizeof(addr.sun_path)-1);
+        if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+            return -1;
+        }
+        unlink(addr.sun_path); //left over by a previous run
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        strcpy(path, addr.sun_path);
+    } else {
+        struct sockaddr_in addr;
+        const char* colon = strrchr(address, ':');
+        char host[INET_ADDRSTRLEN] { "127.0.0.1" };
+        int one { 1 };
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        if(colon != nullptr) {
+            if((size_t)(colon - address) >= sizeof(host)) {
+                return -1;
+            }
+            memcpy(host, address, colon - address);
+            host[colon - address] = '\0';
+            address = colon + 1;
+        }
+        if(inet_pton(AF_INET, host, &addr.sin_addr) != 1 || atoi(address) <= 0 || atoi(address) > 65535) {
+            errno = EINVAL;
+            return -1;
+        }
+        addr.sin_port = htons(atoi(address));
+        if((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if(listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*Exporter Init function is responsible for*/
+/*listening on address and registering the exporter in the epoll set*/
+bool exporter_init(exporter* exp, const char* address, int epoll_fd, size_t max_interfaces) {
+    memset(exp, 0, sizeof(*exp));
+    exp->source.handle = exporter_accept;
+    exp->epoll_fd = epoll_fd;
+    if((exp->source.fd = exporter_listen(address, exp->path)) < 0) {
+        return false;
+    }
+    exp->max_interfaces = max_interfaces;
+    exp->latest = new wire_sample[max_interfaces];
+    exp->has_sample = new bool[max_interfaces]();
+    return event_source_add(epoll_fd, &exp->source, EPOLLIN | EPOLLET);
+}
+
+/*Function is responsible for*/
+/*dropping a scraper and its reference to the body*/
+void scraper_close(scraper* client) {
+    exporter* exp = client->owner;
+
+    epoll_ctl(exp->epoll_fd, EPOLL_CTL_DEL, client->source.fd, NULL);
+    close(client->source.fd);
+    if(client->body != nullptr)
+        --client->body->refs;
+    if(client->prev != nullptr) client->prev->next = client->next;
+    else exp->scrapers = client->next;
+    if(client->next != nullptr) client->next->prev = client->prev;
+    --exp->num_scrapers;
+    delete client;
+}
+
+/*Function is responsible for*/
+/*closing every scraper and the listening socket*/
+void exporter_close(exporter* exp) {
+    if(exp->latest == nullptr) {
+        return;
+    }
+    while (exp->scrapers != nullptr)
+        scraper_close(exp->scrapers);
+    close(exp->source.fd);
+    if(exp->path[0] != '\0')
+        unlink(exp->path);
+    while (exp->bodies != nullptr) {
+        metrics_body* body = exp->bodies;
+        exp->bodies = body->next;
+        delete[] body->data;
+        delete body;
+    }
+    delete[] exp->latest;
+    delete[] exp->has_sample;
+    exp->latest = nullptr;
+}
+
+/*Function is responsible for*/
+/*keeping the latest sample of interface id for the next rendering*/
+inline void exporter_update(exporter* exp, uint32_t id, const wire_sample* sample) {
+    if(id < exp->max_interfaces) {
+        exp->latest[id] = *sample;
+        exp->has_sample[id] = true;
+    }
+}
+
+/*Function is responsible for*/
+/*dropping the sample of interface id once the interface is gone*/
+inline void exporter_forget(exporter* exp, uint32_t id) {
+    if(id < exp->max_interfaces)
+        exp->has_sample[id] = false;
+}
+
+/*Functions are responsible for*/
+/*appending to the body being rendered, growing it when a line may not fit*/
+void body_reserve(metrics_body* body) {
+    if(body->capacity - body->len >= SCRAPE_LINE_LEN) {
+        return;
+    }
+    char* data = new char[body->capacity * 2];
+    memcpy(data, body->data, body->len);
+    delete[] body->data;
+    body->data = data;
+    body->capacity *= 2;
+}
+
+inline void body_str(metrics_body* body, const char* str) {
+    size_t len = strlen(str);
+    memcpy(body->data + body->len, str, len);
+    body->len += len;
+}
+
+inline void body_u64(metrics_body* body, uint64_t value) {
+    body->len = std::to_chars(body->data + body->len, body->data + body->capacity, value).ptr - body->data;
+}
+
+inline void body_f64(metrics_body* body, double value) {
+    body->len = std::to_chars(body->data + body->len, body->data + body->capacity, value).ptr - body->data;
+}
+
+/*Function is responsible for*/
+/*appending the HELP and TYPE lines of a metric family*/
+void body_family(metrics_body* body, const char* name, const char* type, const char* help) {
+    body_reserve(body);
+    body_str(body, "# HELP ");
+    body_str(body, name);
+    body_str(body, " ");
+    body_str(body, help);
+    body_str(body, "\n# TYPE ");
+    body_str(body, name);
+    body_str(body, " ");
+    body_str(body, type);
+    body_str(body, "\n");
+}
+
+/*Function is responsible for*/
+/*appending a label value, escaping \ " and newlines*/
+inline void body_label(metrics_body* body, const char* value, size_t max_len) {
+    for (size_t i = 0; i < max_len && value[i] != '\0'; i++) {
+        if(value[i] == '\\' || value[i] == '"' || value[i] == '\n') body->data[body->len++] = '\\';
+        body->data[body->len++] = value[i] == '\n' ? 'n' : value[i];
+    }
+}
+
+/*Function is responsible for*/
+/*appending the name and the labels of the series of an interface, up to the value*/
+/*the interfaces of other hosts are told apart by a host label*/
+void body_series(metrics_body* body, const char* name, const rate_state* state, const char* label, const char* label_value) {
+    body_reserve(body);
+    body_str(body, name);
+    body_str(body, "{interface=\"");
+    body_label(body, state->interface, IFNAMSIZ);
+    body_str(body, "\"");
+    if(host_name(state->host) != nullptr) {
+        body_str(body, ",host=\"");
+        body_label(body, host_name(state->host), HOST_NAME_LEN);
+        body_str(body, "\"");
+    }
+    if(label != nullptr) {
+        body_str(body, ",");
+        body_str(body, label);
+        body_str(body, "=\"");
+        body_str(body, label_value);
+        body_str(body, "\"");
+    }
+    body_str(body, "} ");
+}
+
+const char* const queue_labels[MAX_QUEUES] { "0", "1", "2", "3", "4", "5", "6", "7" };
+static_assert(MAX_QUEUES == 8, "queue_labels needs a label per queue");
+
+const char* const rate_metric_names[NUM_RATE_FIELDS] {
+    "netmon_rx_bits_per_second", "netmon_tx_bits_per_second", "netmon_rx_packets_per_second", "netmon_tx_packets_per_second",
+    "netmon_rx_drop_ratio", "netmon_tx_drop_ratio", "netmon_rx_error_ratio", "netmon_tx_error_ratio"
+};
+
+const char* const ewma_metric_names[NUM_EWMA_FIELDS] {
+    "netmon_rx_bits_per_second_ewma", "netmon_tx_bits_per_second_ewma",
+    "netmon_rx_packets_per_second_ewma", "netmon_tx_packets_per_second_ewma"
+};
+
+/*Function is responsible for*/
+/*appending a self metric of a process, up to the value*/
+void body_self_series(metrics_body* body, const char* prefix, const char* name, const char* suffix, int process, const char* quantile) {
+    body_reserve(body);
+    body_str(body, prefix);
+    body_str(body, name);
+    body_str(body, suffix);
+    body_str(body, "{process=\"");
+    body_str(body, self_process_names[process]);
+    if(quantile != nullptr) {
+        body_str(body, "\",quantile=\"");
+        body_str(body, quantile);
+    }
+    body_str(body, "\"} ");
+}
+
+/*Function is responsible for*/
+/*appending the counters and the latency summaries of every process*/
+void body_self_metrics(metrics_body* body, const self_metrics* const* summaries) {
+    const double quantiles[] { 0.5, 0.9, 0.99 };
+    const char* const quantile_labels[] { "0.5", "0.9", "0.99" };
+    char name[64];
+
+    for (int c = 0; c < SELF_COUNTER_COUNT; c++) {
+        snprintf(name, sizeof(name), "netmon_self_%s_total", self_counter_names[c]);
+        body_family(body, name, "counter", "work networkMonitor and its monitors did, summed over the monitors");
+        for (int p = 0; p < SELF_PROCESSES; p++) {
+            body_self_series(body, "netmon_self_", self_counter_names[c], "_total", p, nullptr);
+            body_u64(body, summaries[p]->counters[c].load(std::memory_order_relaxed));
+            body_str(body, "\n");
+        }
+    }
+    body_family(body, "netmon_self_max_queue_depth", "gauge", "most samples ever found waiting for networkMonitor in one queue");
+    body_self_series(body, "netmon_self_", "max_queue_depth", "", SELF_PROCESSES - 1, nullptr);
+    body_u64(body, summaries[SELF_PROCESSES - 1]->max_queue_depth.load(std::memory_order_relaxed));
+    body_str(body, "\n");
+    for (int h = 0; h < HIST_COUNT; h++) {
+        snprintf(name, sizeof(name), "netmon_self_%s_seconds", self_histogram_names[h]);
+        body_family(body, name, "summary", "latency networkMonitor and its monitors measured on themselves");
+        for (int p = 0; p < SELF_PROCESSES; p++) {
+            const hdr_histogram* histogram = &summaries[p]->histograms[h];
+            if(histogram->count.load(std::memory_order_relaxed) == 0) continue;
+            for (int q = 0; q < 3; q++) {
+                body_self_series(body, "netmon_self_", self_histogram_names[h], "_seconds", p, quantile_labels[q]);
+                body_f64(body, histogram_quantile(histogram, quantiles[q]) / 1e9);
+                body_str(body, "\n");
+            }
+            body_self_series(body, "netmon_self_", self_histogram_names[h], "_seconds_sum", p, nullptr);
+            body_f64(body, histogram->sum.load(std::memory_order_relaxed) / 1e9);
+            body_str(body, "\n");
+            body_self_series(body, "netmon_self_", self_histogram_names[h], "_seconds_count", p, nullptr);
+            body_u64(body, histogram->count.load(std::memory_order_relaxed));
+            body_str(body, "\n");
+        }
+    }
+}
+
+/*Function is responsible for*/
+/*taking a body nobody is sending for the next rendering*/
+metrics_body* exporter_free_body(exporter* exp) {
+    for (metrics_body* body = exp->bodies; body != nullptr; body = body->next) {
+        if(body->refs == 0 && body != exp->current)
+            return body;
+    }
+    metrics_body* body = new metrics_body;
+    body->data = new char[METRICS_BODY_LEN];
+    body->capacity = METRICS_BODY_LEN;
+    body->refs = 0;
+    body->next = exp->bodies;
+    exp->bodies = body;
+    return body;
+}
+
+/*Exporter Render function is responsible for*/
+/*rendering the exposition of the tick once, with its response head in front*/
+/*and shutting down scrapers that stalled, their handler closes them*/
+/*summaries holds the self metrics of every process in self_process_names*/
+void exporter_render(exporter* exp, const rate_engine* rates, const self_metrics* const* summaries) {
+    metrics_body* body = exporter_free_body(exp);
+    char head[SCRAPE_HEADER_LEN];
+    uint64_t now = monotonic_ns();
+    int head_len;
+
+    for (scraper* client = exp->scrapers; client != nullptr; client = client->next) {
+        if(now - client->accepted_ns > SCRAPE_TIMEOUT_NS)
+            shutdown(client->source.fd, SHUT_RDWR); //may be among the events being handled, not freed here
+    }
+
+    body->len = SCRAPE_HEADER_LEN; //the head is written in front once the length is known
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        body_family(body, counter_schema[c].metric, "counter", counter_schema[c].help);
+        for (size_t i = 0; i <= rates->mask; i++) {
+            const rate_state* state = &rates->states[i];
+            if(state->interface[0] == '\0' || !exp->has_sample[state->id]) continue;
+            body_series(body, counter_schema[c].metric, state, nullptr, nullptr);
+            body_u64(body, exp->latest[state->id].stats.counters[c]);
+            body_str(body, "\n");
+        }
+    }
+    for (int c = 0; c < NUM_QUEUE_COUNTERS; c++) {
+        body_family(body, queue_schema[c].metric, "counter", queue_schema[c].help);
+        for (size_t i = 0; i <= rates->mask; i++) {
+            const rate_state* state = &rates->states[i];
+            const interface_stats* stats = &exp->latest[state->id].stats;
+            if(state->interface[0] == '\0' || !exp->has_sample[state->id] || !stats->has_queue_stats) continue;
+            for (int q = 0; q < queues_kept(stats, queue_schema[c].dir); q++) {
+                body_series(body, queue_schema[c].metric, state, "queue", queue_labels[q]);
+                body_u64(body, stats->queues[c][q]);
+                body_str(body, "\n");
+            }
+        }
+    }
+    body_family(body, "netmon_up", "gauge", "1 if the operational state of the link is up");
+    for (size_t i = 0; i <= rates->mask; i++) {
+        const rate_state* state = &rates->states[i];
+        if(state->interface[0] == '\0' || !exp->has_sample[state->id]) continue;
+        body_series(body, "netmon_up", state, nullptr, nullptr);
+        body_str(body, strcmp(exp->latest[state->id].stats.operstate, "up") == 0 ? "1\n" : "0\n");
+    }
+    body_family(body, "netmon_operstate_info", "gauge", "operational state of the link as a label");
+    for (size_t i = 0; i <= rates->mask; i++) {
+        const rate_state* state = &rates->states[i];
+        if(state->interface[0] == '\0' || !exp->has_sample[state->id]) continue;
+        body_series(body, "netmon_operstate_info", state, "operstate", exp->latest[state->id].stats.operstate);
+        body_str(body, "1\n");
+    }
+    for (int f = 0; f < NUM_RATE_FIELDS; f++) {
+        body_family(body, rate_metric_names[f], "gauge", f < 4 ? "rate over the last sampling interval" : "share of the packets lost over the last sampling interval");
+        for (size_t i = 0; i <= rates->mask; i++) {
+            const rate_state* state = &rates->states[i];
+            if(state->interface[0] == '\0' || !state->is_seeded) continue;
+            body_series(body, rate_metric_names[f], state, nullptr, nullptr);
+            body_f64(body, rate_field(rates, state->id, f));
+            body_str(body, "\n");
+        }
+    }
+    for (int f = 0; f < NUM_EWMA_FIELDS; f++) {
+        body_family(body, ewma_metric_names[f], "gauge", "exponentially weighted moving average of the rate");
+        for (size_t i = 0; i <= rates->mask; i++) {
+            const rate_state* state = &rates->states[i];
+            if(state->interface[0] == '\0' || !state->is_seeded) continue;
+            for (int w = 0; w < RATE_WINDOWS; w++) {
+                body_series(body, ewma_metric_names[f], state, "window", rate_window_names[w]);
+                body_f64(body, ewma_field(rates, state->id, w, f));
+                body_str(body, "\n");
+            }
+        }
+    }
+    body_self_metrics(body, summaries);
+
+    head_len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\nConnection: close\r\n\r\n", body->len - SCRAPE_HEADER_LEN);
+    body->start = SCRAPE_HEADER_LEN - head_len;
+    memcpy(body->data + body->start, head, head_len);
+    body->len -= body->start;
+    exp->current = body;
+    ++exp->renders;
+}
+
+/*Function is responsible for*/
+/*accepting every pending scraper*/
+void exporter_accept(event_source* source) {
+    exporter* exp = (exporter*)source;
+    int fd;
+
+    while ((fd = accept4(source->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if(exp->num_scrapers >= MAX_SCRAPERS) {
+            close(fd);
+            continue;
+        }
+        scraper* client = new scraper;
+        client->source.fd = fd;
+        client->source.handle = scraper_handle;
+        client->owner = exp;
+        client->request_len = 0;
+        client->body = nullptr;
+        client->out = nullptr;
+        client->out_len = client->sent = 0;
+        client->accepted_ns = monotonic_ns();
+        client->prev = nullptr;
+        client->next = exp->scrapers;
+        if(exp->scrapers != nullptr) exp->scrapers->prev = client;
+        exp->scrapers = client;
+        ++exp->num_scrapers;
+        if(!event_source_add(exp->epoll_fd, &client->source, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+            scraper_close(client);
+        }
+    }
+}
+
+/*Function is responsible for*/
+/*picking the response of a complete request head*/
+void scraper_respond(scraper* client) {
+    exporter* exp = client->owner;
+    const char* request = client->request;
+
+    if(strncmp(request, "GET ", 4) != 0) {
+        client->out = response_bad_request;
+    } else if(strncmp(request + 4, "/metrics", 8) != 0 || (request[12] != ' ' && request[12] != '?')) {
+        client->out = response_not_found;
+    } else if(exp->current == nullptr) {
+        client->out = response_unavailable;
+    } else { //the cached rendering, no formatting here
+        client->body = exp->current;
+        ++client->body->refs;
+        client->out = client->body->data + client->body->start;
+        client->out_len = client->body->len;
+        ++exp->scrapes;
+        return;
+    }
+    client->out_len = strlen(client->out);
+}
+
+/*Scraper Handle function is responsible for*/
+/*reading the request of a scraper and sending the response*/
+/*as far as the socket allows without blocking the loop*/
+void scraper_handle(event_source* source) {
+    scraper* client = (scraper*)source;
+    ssize_t ret;
+
+    while (client->out == nullptr) { //reading the request head
+        ret = recv(source->fd, client->request + client->request_len, SCRAPE_REQUEST_LEN - 1 - client->request_len, 0);
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if(ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if(ret <= 0) {
+            scraper_close(client);
+            return;
+        }
+        client->request_len += ret;
+        client->request[client->request_len] = '\0';
+        if(strstr(client->request, "\r\n\r\n") != nullptr || strstr(client->request, "\n\n") != nullptr) {
+            scraper_respond(client);
+        } else if(client->request_len == SCRAPE_REQUEST_LEN - 1) {
+            client->out = response_bad_request;
+            client->out_len = strlen(client->out);
+        }
+    }
+    while (client->sent < client->out_len) {
+        ret = send(source->fd, client->out + client->sent, client->out_len - client->sent, MSG_NOSIGNAL);
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return; //EPOLLOUT resumes here
+        }
+        if(ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if(ret < 0) {
+            break;
+        }
+        client->sent += ret;
+    }
+    scraper_close(client);
+}
+
+#endif //EXPORTER_H
@@ -0,0 +1,206 @@
+#ifndef FAKE_SYSFS_H
+#define FAKE_SYSFS_H
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cinttypes>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/stat.h>
+
+#include "sysfs_collector.h"
+
+#define FAKE_INTERFACE_PREFIX "fake" //Interfaces of a generated tree are named fake0, fake1, ...
+#define FAKE_COUNTERS 4 //Counters advanced on every tick
+
+//Counters advanced on every tick, indexed like fake_interface::fds
+const counter_id fake_counter_ids[FAKE_COUNTERS] { CTR_TX_BYTES, CTR_RX_BYTES, CTR_TX_PACKETS, CTR_RX_PACKETS };
+
+//Directories of an interface, parents first
+const char* const fake_sysfs_dirs[] { "", "/statistics", "/queues", "/queues/rx-0", "/queues/tx-0" };
+
+/*Fake Interface keeps the advancing attributes of one generated interface open*/
+struct fake_interface {
+    char name[IFNAMSIZ];
+    int fds[FAKE_COUNTERS];
+    uint64_t values[FAKE_COUNTERS];
+};
+
+/*Fake Sysfs is a directory laid out like /sys/class/net*/
+/*whose byte and packet counters advance every time it is ticked*/
+struct fake_sysfs {
+    char root[PATH_MAX];
+    fake_interface* interfaces;
+    size_t num_interfaces;
+    uint64_t ticks;
+    uint64_t next_name; //number in the name of the next interface created
+};
+
+/*Function is responsible for*/
+/*writing the decimal value of an attribute the way sysfs prints it*/
+bool fake_sysfs_write(int fd, uint64_t value) {
+    char text[SYSFS_VALUE_LEN];
+    int len = snprintf(text, sizeof(text), "%" PRIu64 "\n", value);
+    return pwrite(fd, text, len, 0) == len; //counters only grow, the old value is always overwritten
+}
+
+/*Function is responsible for*/
+/*creating the attribute path of interface with the given content*/
+/*returns the descriptor of the attribute, -1 on error*/
+int fake_sysfs_create_attr(const fake_sysfs* tree, const char* interface, const char* attr, const char* content) {
+    char path[PATH_MAX];
+    int fd;
+
+    if(snprintf(path, sizeof(path), "%s/%s/%s", tree->root, interface, attr) >= (int)sizeof(path)
+       || (fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        return -1;
+    }
+    if(write(fd, content, strlen(content)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*Fake Sysfs Create Interface function is responsible for*/
+/*writing every attribute of sysfs_collector for the next interface name*/
+/*the interface is staged under a hidden name and moved in place at once, as the kernel adds it*/
+/*returns false if the interface could not be written*/
+bool fake_sysfs_create_interface(fake_sysfs* tree, fake_interface* interface) {
+    char stage[IFNAMSIZ + 1], path[PATH_MAX], target[PATH_MAX];
+
+    for (int c = 0; c < FAKE_COUNTERS; c++) {
+        interface->fds[c] = -1;
+        interface->values[c] = 0;
+    }
+    snprintf(interface->name, IFNAMSIZ, FAKE_INTERFACE_PREFIX "%u", (unsigned int)tree->next_name++);
+    snprintf(stage, sizeof(stage), ".%s", interface->name);
+
+    for (const char* dir : fake_sysfs_dirs) {
+        if(snprintf(path, sizeof(path), "%s/%s%s", tree->root, stage, dir) >= (int)sizeof(path)
+           || (mkdir(path, 0755) < 0 && errno != EEXIST)) {
+            return false;
+        }
+    }
+    int fd = fake_sysfs_create_attr(tree, stage, "operstate", "up\n");
+    if(fd < 0) {
+        return false;
+    }
+    close(fd);
+    for (int a = 0; a < NUM_COUNTERS; a++) {
+        if((fd = fake_sysfs_create_attr(tree, stage, counter_schema[a].sysfs_path, "0\n")) < 0) {
+            return false;
+        }
+        int c = 0;
+        while (c < FAKE_COUNTERS && fake_counter_ids[c] != a)
+            ++c;
+        if(c < FAKE_COUNTERS) {
+            interface->fds[c] = fd; //kept open, written on every tick
+        } else {
+            close(fd);
+        }
+    }
+    if(snprintf(path, sizeof(path), "%s/%s", tree->root, stage) >= (int)sizeof(path)
+       || snprintf(target, sizeof(target), "%s/%s", tree->root, interface->name) >= (int)sizeof(target)
+       || rename(path, target) < 0) {
+        return false;
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*closing the counters of an interface and deleting its files*/
+void fake_sysfs_remove_interface(fake_sysfs* tree, fake_interface* interface) {
+    char path[PATH_MAX];
+
+    for (int c = 0; c < FAKE_COUNTERS; c++) {
+        if(interface->fds[c] >= 0)
+            close(interface->fds[c]);
+        interface->fds[c] = -1;
+    }
+    for (const char* prefix : { ".", "" }) { //staged or in place
+        for (int a = -1; a < NUM_COUNTERS; a++) {
+            const char* attr = a < 0 ? "operstate" : counter_schema[a].sysfs_path;
+            if(snprintf(path, sizeof(path), "%s/%s%s/%s", tree->root, prefix, interface->name, attr) < (int)sizeof(path))
+                unlink(path);
+        }
+        for (int d = sizeof(fake_sysfs_dirs) / sizeof(fake_sysfs_dirs[0]) - 1; d >= 0; d--) { //children first
+            if(snprintf(path, sizeof(path), "%s/%s%s%s", tree->root, prefix, interface->name, fake_sysfs_dirs[d]) < (int)sizeof(path))
+                rmdir(path);
+        }
+    }
+}
+
+/*Fake Sysfs Create function is responsible for*/
+/*generating num_interfaces interfaces with every attribute of sysfs_collector under root*/
+/*returns false if the tree could not be written*/
+bool fake_sysfs_create(fake_sysfs* tree, const char* root, size_t num_interfaces) {
+    memset(tree, 0, sizeof(*tree));
+    strncpy(tree->root, root, sizeof(tree->root)-1);
+    tree->interfaces = new fake_interface[num_interfaces]();
+    if(mkdir(root, 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+    for (size_t i = 0; i < num_interfaces; i++) {
+        ++tree->num_interfaces; //from now on the interface is removed with the tree
+        if(!fake_sysfs_create_interface(tree, &tree->interfaces[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*Fake Sysfs Replace function is responsible for*/
+/*removing interface i and creating one under a new name in its place*/
+/*the way veth pairs of short-lived containers come and go*/
+/*returns false if the new interface could not be written*/
+bool fake_sysfs_replace(fake_sysfs* tree, size_t i) {
+    fake_sysfs_remove_interface(tree, &tree->interfaces[i]);
+    return fake_sysfs_create_interface(tree, &tree->interfaces[i]);
+}
+
+/*Fake Sysfs Advance function is responsible for*/
+/*moving the counters of every interface forward by one tick*/
+/*interface i receives a few full sized frames and sends small ones, as a busy link would*/
+void fake_sysfs_advance(fake_sysfs* tree) {
+    ++tree->ticks;
+    for (size_t i = 0; i < tree->num_interfaces; i++) {
+        fake_interface* interface = &tree->interfaces[i];
+        uint64_t rx_packets = 10 + (i + tree->ticks) % 7;
+        uint64_t tx_packets = 5 + i % 3;
+        interface->values[0] += tx_packets * 64; //tx_bytes
+        interface->values[1] += rx_packets * 1500; //rx_bytes
+        interface->values[2] += tx_packets;
+        interface->values[3] += rx_packets;
+        for (int c = 0; c < FAKE_COUNTERS; c++)
+            fake_sysfs_write(interface->fds[c], interface->values[c]);
+    }
+}
+
+/*Function is responsible for*/
+/*closing the counters of the tree, the files stay in place*/
+void fake_sysfs_close(fake_sysfs* tree) {
+    for (size_t i = 0; i < tree->num_interfaces; i++) {
+        for (int c = 0; c < FAKE_COUNTERS; c++) {
+            if(tree->interfaces[i].fds[c] >= 0)
+                close(tree->interfaces[i].fds[c]);
+        }
+    }
+    delete[] tree->interfaces;
+    tree->interfaces = nullptr;
+}
+
+/*Function is responsible for*/
+/*closing the tree and deleting every file and directory it generated*/
+void fake_sysfs_remove(fake_sysfs* tree) {
+    for (size_t i = 0; i < tree->num_interfaces; i++)
+        fake_sysfs_remove_interface(tree, &tree->interfaces[i]);
+    rmdir(tree->root);
+    fake_sysfs_close(tree);
+}
+
+#endif //FAKE_SYSFS_H
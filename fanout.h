@@ -0,0 +1,561 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <charconv>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "rates.h"
+#include "output.h"
+#include "discovery.h"
+#include "event_loop.h"
+#include "self_metrics.h"
+
+#define FANOUT_FIELDS (NUM_COUNTERS + NUM_RATE_FIELDS) //Fields a subscriber can ask for, the counters then the rates
+#define FANOUT_RECORD_LEN 4096 //Upper bound of one encoded sample
+#define FANOUT_TICK_LEN 65536 //Initial capacity of an encoded tick, grown as needed
+#define FANOUT_QUEUE_TICKS 16 //Ticks queued per subscriber, the oldest one not being sent is dropped beyond
+#define FANOUT_IOV_LEN 256 //Pieces handed to one sendmsg call
+#define SUBSCRIBE_REQUEST_LEN 4096 //Longest subscription line accepted
+#define MAX_SUBSCRIBERS 1024 //Subscribers served at once, more are refused
+#define MAX_DECIMATION 1000000 //Largest every= of a subscription
+
+static_assert(FANOUT_FIELDS <= 64, "the fields of a subscription are a 64 bit mask");
+
+/*Fanout Record is where the pieces of one sample lie in an encoded tick*/
+struct fanout_record {
+    uint32_t id; //rate_state::id of the interface
+    char interface[IFNAMSIZ];
+    uint32_t offsets[FANOUT_FIELDS + 3]; //start of the head, of every field, of the tail, and the end of the record
+};
+
+/*Fanout Tick is every sample of a tick encoded once*/
+/*shared by every subscriber it is queued for and kept alive until the last one sent it*/
+struct fanout_tick {
+    char* data;
+    size_t capacity;
+    size_t len;
+    fanout_record* records;
+    size_t num_records;
+    size_t max_records;
+    int refs; //subscribers holding it in their queue
+    fanout_tick* next; //ticks are pooled by the server
+};
+
+struct fanout_server;
+
+/*Subscriber is one local client of the fan-out server*/
+/*it sends one line of key=value words and then receives its samples as JSON lines*/
+struct subscriber {
+    event_source source; //must stay first, the loop hands subscribers out as event sources
+    fanout_server* owner;
+    char request[SUBSCRIBE_REQUEST_LEN];
+    size_t request_len;
+    bool is_subscribed;
+    bool is_broken; //shut down, its handler closes it
+    bool is_blocked; //its socket was full, nothing is sent before EPOLLOUT
+    interface_filter filter;
+    uint64_t fields; //bit f is set if field f is sent
+    uint32_t every; //one tick out of every is sent
+    uint64_t ticks; //ticks published since it subscribed
+    uint8_t* matches; //per interface id, 0 not checked yet, 1 selected, 2 not selected
+    fanout_tick* queue[FANOUT_QUEUE_TICKS]; //ticks to send, oldest at head
+    size_t head;
+    size_t tail;
+    size_t sent; //bytes of the oldest tick already sent
+    uint64_t delivered; //ticks sent completely
+    uint64_t dropped; //ticks dropped because it did not keep up
+    subscriber* prev;
+    subscriber* next;
+};
+
+/*Fanout Server streams the samples to any number of local subscribers*/
+/*every tick is encoded once and each subscriber is sent its pieces of it*/
+/*a subscriber that does not keep up loses its oldest ticks, it never holds up the loop*/
+struct fanout_server {
+    event_source source; //must stay first, the listening socket
+    int epoll_fd;
+    char path[sizeof(sockaddr_un::sun_path)]; //removed on close
+    size_t max_interfaces;
+    int64_t epoch_offset_ns; //CLOCK_REALTIME - CLOCK_MONOTONIC, timestamps of the records
+    fanout_tick* ticks; //pool of encoded ticks, the current one included
+    fanout_tick* current; //tick being encoded
+    subscriber* subscribers;
+    size_t num_subscribers;
+    uint64_t accepted; //subscriptions accepted
+    uint64_t published; //ticks published
+    uint64_t delivered; //ticks sent completely, summed over the subscribers
+    uint64_t dropped; //ticks dropped, summed over the subscribers
+    uint64_t bytes; //bytes sent
+};
+
+void fanout_accept(event_source* source);
+void subscriber_handle(event_source* source);
+
+/*Function is responsible for*/
+/*naming field f of a subscription*/
+inline const char* fanout_field_name(int f) {
+    return f < NUM_COUNTERS ? counter_schema[f].name : rate_field_names[f - NUM_COUNTERS];
+}
+
+/*Function is responsible for*/
+/*taking a tick nobody is sending for the next encoding*/
+fanout_tick* fanout_free_tick(fanout_server* server) {
+    for (fanout_tick* tick = server->ticks; tick != nullptr; tick = tick->next) {
+        if(tick->refs == 0 && tick != server->current) {
+            tick->len = tick->num_records = 0;
+            return tick;
+        }
+    }
+    fanout_tick* tick = new fanout_tick;
+    tick->data = new char[FANOUT_TICK_LEN];
+    tick->capacity = FANOUT_TICK_LEN;
+    tick->max_records = server->max_interfaces;
+    tick->records = new fanout_record[tick->max_records];
+    tick->len = tick->num_records = 0;
+    tick->refs = 0;
+    tick->next = server->ticks;
+    server->ticks = tick;
+    return tick;
+}
+
+/*Fanout Init function is responsible for*/
+/*listening for subscribers on a UNIX socket and adding it to the loop*/
+bool fanout_init(fanout_server* server, const char* path, int epoll_fd, size_t max_interfaces, int64_t epoch_offset_ns) {
+    struct sockaddr_un addr;
+
+    memset(server, 0, sizeof(*server));
+    server->source.handle = fanout_accept;
+    server->epoll_fd = epoll_fd;
+    server->max_interfaces = max_interfaces;
+    server->epoch_offset_ns = epoch_offset_ns;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    if((server->source.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        return false;
+    }
+    unlink(addr.sun_path); //left over by a previous run
+    if(bind(server->source.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server->source.fd, SOMAXCONN) < 0) {
+        close(server->source.fd);
+        return false;
+    }
+    strcpy(server->path, addr.sun_path);
+    server->current = fanout_free_tick(server);
+    return event_source_add(epoll_fd, &server->source, EPOLLIN | EPOLLET);
+}
+
+/*Function is responsible for*/
+/*dropping a subscriber and its references to the ticks*/
+void subscriber_close(subscriber* sub) {
+    fanout_server* server = sub->owner;
+
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, sub->source.fd, NULL);
+    close(sub->source.fd);
+    for (size_t i = sub->head; i != sub->tail; i++)
+        --sub->queue[i % FANOUT_QUEUE_TICKS]->refs;
+    if(sub->prev != nullptr) sub->prev->next = sub->next;
+    else server->subscribers = sub->next;
+    if(sub->next != nullptr) sub->next->prev = sub->prev;
+    --server->num_subscribers;
+    delete[] sub->matches;
+    delete sub;
+}
+
+/*Function is responsible for*/
+/*closing every subscriber and the listening socket*/
+void fanout_close(fanout_server* server) {
+    if(server->current == nullptr) {
+        return;
+    }
+    while (server->subscribers != nullptr)
+        subscriber_close(server->subscribers);
+    close(server->source.fd);
+    unlink(server->path);
+    while (server->ticks != nullptr) {
+        fanout_tick* tick = server->ticks;
+        server->ticks = tick->next;
+        delete[] tick->data;
+        delete[] tick->records;
+        delete tick;
+    }
+    server->current = nullptr;
+}
+
+/*Function is responsible for*/
+/*forgetting which subscribers select interface id once the interface is gone*/
+void fanout_forget(fanout_server* server, uint32_t id) {
+    if(id >= server->max_interfaces) {
+        return;
+    }
+    for (subscriber* sub = server->subscribers; sub != nullptr; sub = sub->next)
+        sub->matches[id] = 0;
+}
+
+/*Functions are responsible for*/
+/*appending to the tick being encoded, the caller made room for a whole record*/
+inline void tick_str(fanout_tick* tick, const char* str) {
+    size_t len = strlen(str);
+    memcpy(tick->data + tick->len, str, len);
+    tick->len += len;
+}
+
+inline void tick_u64(fanout_tick* tick, uint64_t value) {
+    tick->len = std::to_chars(tick->data + tick->len, tick->data + tick->capacity, value).ptr - tick->data;
+}
+
+inline void tick_f64(fanout_tick* tick, double value, int precision) {
+    tick->len = std::to_chars(tick->data + tick->len, tick->data + tick->capacity, value,
+                              std::chars_format::fixed, precision).ptr - tick->data;
+}
+
+inline void tick_name(fanout_tick* tick, const char* name, size_t max_len) {
+    for (size_t i = 0; i < max_len && name[i] != '\0'; i++) {
+        if(name[i] == '"' || name[i] == '\\')
+            tick->data[tick->len++] = '\\';
+        tick->data[tick->len++] = (unsigned char)name[i] < 0x20 ? '?' : name[i];
+    }
+}
+
+/*Fanout Sample function is responsible for*/
+/*encoding a sample into the current tick, every field a piece of its own*/
+/*the rates are left out until the state has one*/
+void fanout_sample(fanout_server* server, const rate_engine* rates, const rate_state* state, const wire_sample* sample) {
+    fanout_tick* tick = server->current;
+
+    if(server->num_subscribers == 0) { //nobody would read it
+        return;
+    }
+    if(tick->capacity - tick->len < FANOUT_RECORD_LEN) {
+        char* data = new char[tick->capacity * 2];
+        memcpy(data, tick->data, tick->len);
+        delete[] tick->data;
+        tick->data = data;
+        tick->capacity *= 2;
+    }
+    if(tick->num_records == tick->max_records) { //late samples of the previous tick
+        fanout_record* records = new fanout_record[tick->max_records * 2];
+        memcpy(records, tick->records, tick->num_records * sizeof(fanout_record));
+        delete[] tick->records;
+        tick->records = records;
+        tick->max_records *= 2;
+    }
+    fanout_record* record = &tick->records[tick->num_records++];
+    record->id = state->id;
+    memcpy(record->interface, sample->interface, IFNAMSIZ);
+
+    record->offsets[0] = tick->len;
+    tick_str(tick, "{\"time_ns\":");
+    tick_u64(tick, sample->timestamp_ns + server->epoch_offset_ns);
+    if(host_name(state->host) != nullptr) {
+        tick_str(tick, ",\"host\":\"");
+        tick_name(tick, host_name(state->host), HOST_NAME_LEN);
+        tick_str(tick, "\"");
+    }
+    tick_str(tick, ",\"interface\":\"");
+    tick_name(tick, sample->interface, IFNAMSIZ);
+    tick_str(tick, "\",\"operstate\":\"");
+    tick_name(tick, sample->stats.operstate, OPERSTATE_LEN);
+    tick_str(tick, "\"");
+    for (int f = 0; f < FANOUT_FIELDS; f++) {
+        record->offsets[1 + f] = tick->len;
+        if(f >= NUM_COUNTERS && !state->has_rate) {
+            continue;
+        }
+        tick_str(tick, ",\"");
+        tick_str(tick, fanout_field_name(f));
+        tick_str(tick, "\":");
+        if(f < NUM_COUNTERS) tick_u64(tick, sample->stats.counters[f]);
+        else tick_f64(tick, rate_field(rates, state->id, f - NUM_COUNTERS), rate_precision(f - NUM_COUNTERS));
+    }
+    record->offsets[FANOUT_FIELDS + 1] = tick->len;
+    tick_str(tick, "}\n");
+    record->offsets[FANOUT_FIELDS + 2] = tick->len;
+}
+
+/*Function is responsible for*/
+/*checking if a subscriber selects the interface of a record, remembered per interface id*/
+inline bool subscriber_selects(subscriber* sub, const fanout_record* record) {
+    if(sub->matches[record->id] == 0)
+        sub->matches[record->id] = interface_filter_match(&sub->filter, record->interface) ? 1 : 2;
+    return sub->matches[record->id] == 1;
+}
+
+/*Subscriber View function is responsible for*/
+/*gathering the pieces of a tick a subscriber selects, past the first skip bytes*/
+/*adjacent pieces are merged, a subscriber of every field gets whole runs of records*/
+/*returns the number of pieces, is_complete is false if more did not fit in iov*/
+int subscriber_view(subscriber* sub, const fanout_tick* tick, size_t skip, struct iovec* iov, int max_iov, bool* is_complete) {
+    const uint64_t all_fields { FANOUT_FIELDS == 64 ? ~0ull : (1ull << FANOUT_FIELDS) - 1 };
+    uint32_t ranges[2 * (FANOUT_FIELDS + 2)];
+    int num_iov { 0 };
+
+    *is_complete = false;
+    for (size_t r = 0; r < tick->num_records; r++) {
+        const fanout_record* record = &tick->records[r];
+        int num_ranges { 0 };
+        if(!subscriber_selects(sub, record)) {
+            continue;
+        }
+        if((sub->fields & all_fields) == all_fields) {
+            ranges[num_ranges++] = record->offsets[0];
+            ranges[num_ranges++] = record->offsets[FANOUT_FIELDS + 2];
+        } else {
+            ranges[num_ranges++] = record->offsets[0];
+            ranges[num_ranges++] = record->offsets[1];
+            for (int f = 0; f < FANOUT_FIELDS; f++) {
+                if(sub->fields & (1ull << f)) {
+                    ranges[num_ranges++] = record->offsets[1 + f];
+                    ranges[num_ranges++] = record->offsets[2 + f];
+                }
+            }
+            ranges[num_ranges++] = record->offsets[FANOUT_FIELDS + 1];
+            ranges[num_ranges++] = record->offsets[FANOUT_FIELDS + 2];
+        }
+        for (int i = 0; i < num_ranges; i += 2) {
+            size_t start = ranges[i], len = ranges[i + 1] - ranges[i];
+            if(skip >= len) {
+                skip -= len;
+                continue;
+            }
+            start += skip;
+            len -= skip;
+            skip = 0;
+            if(num_iov > 0 && (char*)iov[num_iov - 1].iov_base + iov[num_iov - 1].iov_len == tick->data + start) {
+                iov[num_iov - 1].iov_len += len;
+            } else if(num_iov == max_iov) {
+                return num_iov;
+            } else {
+                iov[num_iov].iov_base = tick->data + start;
+                iov[num_iov++].iov_len = len;
+            }
+        }
+    }
+    *is_complete = true;
+    return num_iov;
+}
+
+/*Subscriber Flush function is responsible for*/
+/*sending the queued ticks of a subscriber as far as its socket takes them*/
+/*returns false if the subscriber is gone*/
+bool subscriber_flush(subscriber* sub) {
+    struct iovec iov[FANOUT_IOV_LEN];
+    struct msghdr msg;
+    bool is_complete;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+    while (sub->head != sub->tail) {
+        fanout_tick* tick = sub->queue[sub->head % FANOUT_QUEUE_TICKS];
+        msg.msg_iov = iov;
+        msg.msg_iovlen = subscriber_view(sub, tick, sub->sent, iov, FANOUT_IOV_LEN, &is_complete);
+        if(msg.msg_iovlen > 0) {
+            size_t len { 0 };
+            for (size_t i = 0; i < msg.msg_iovlen; i++)
+                len += iov[i].iov_len;
+            self_count(SELF_SYSCALLS);
+            if((ret = sendmsg(sub->source.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0) {
+                if(errno == EINTR)
+                    continue;
+                sub->is_blocked = errno == EAGAIN || errno == EWOULDBLOCK; //EPOLLOUT resumes here
+                return sub->is_blocked;
+            }
+            sub->sent += ret;
+            sub->owner->bytes += ret;
+            self_count(SELF_BYTES_OUT, ret);
+            if((size_t)ret < len || !is_complete) {
+                continue;
+            }
+        }
+        --tick->refs;
+        ++sub->head;
+        ++sub->delivered;
+        ++sub->owner->delivered;
+        sub->sent = 0;
+    }
+    return true;
+}
+
+/*Fanout Publish function is responsible for*/
+/*queueing the encoded tick for every subscriber it is due for and sending what the sockets take*/
+/*a full queue loses its oldest tick that is not being sent*/
+void fanout_publish(fanout_server* server) {
+    fanout_tick* tick = server->current;
+    bool is_complete;
+
+    if(tick == nullptr || tick->num_records == 0) {
+        return;
+    }
+    ++server->published;
+    for (subscriber* sub = server->subscribers; sub != nullptr; sub = sub->next) {
+        if(!sub->is_subscribed || sub->is_broken || sub->ticks++ % sub->every != 0) {
+            continue;
+        }
+        subscriber_view(sub, tick, 0, nullptr, 0, &is_complete); //stops at the first piece it selects
+        if(is_complete) { //selects nothing of it
+            continue;
+        }
+        if(sub->tail - sub->head == FANOUT_QUEUE_TICKS) {
+            size_t oldest = sub->sent > 0 ? sub->head + 1 : sub->head; //the tick being sent is finished first
+            --sub->queue[oldest % FANOUT_QUEUE_TICKS]->refs;
+            if(oldest != sub->head)
+                sub->queue[oldest % FANOUT_QUEUE_TICKS] = sub->queue[sub->head % FANOUT_QUEUE_TICKS];
+            ++sub->head;
+            ++sub->dropped;
+            ++server->dropped;
+        }
+        sub->queue[sub->tail++ % FANOUT_QUEUE_TICKS] = tick;
+        ++tick->refs;
+        if(!sub->is_blocked && !subscriber_flush(sub)) {
+            sub->is_broken = true;
+            shutdown(sub->source.fd, SHUT_RDWR); //may be among the events being handled, not freed here
+        }
+    }
+    server->current = nullptr; //reused at once if nobody queued it
+    server->current = fanout_free_tick(server);
+}
+
+/*Function is responsible for*/
+/*accepting every pending subscriber*/
+void fanout_accept(event_source* source) {
+    fanout_server* server = (fanout_server*)source;
+    int fd;
+
+    while ((fd = accept4(source->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if(server->num_subscribers >= MAX_SUBSCRIBERS) {
+            close(fd);
+            continue;
+        }
+        subscriber* sub = new subscriber;
+        memset(sub, 0, sizeof(*sub));
+        sub->source.fd = fd;
+        sub->source.handle = subscriber_handle;
+        sub->owner = server;
+        sub->matches = new uint8_t[server->max_interfaces]();
+        sub->next = server->subscribers;
+        if(server->subscribers != nullptr) server->subscribers->prev = sub;
+        server->subscribers = sub;
+        ++server->num_subscribers;
+        if(!event_source_add(server->epoll_fd, &sub->source, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+            subscriber_close(sub);
+        }
+    }
+}
+
+/*Subscriber Parse function is responsible for*/
+/*applying a subscription line of space separated key=value words*/
+/*interfaces=pattern[,pattern...] counters=field[,field...] every=ticks, anything left out selects everything*/
+/*returns false with the reason in error*/
+bool subscriber_parse(subscriber* sub, char* line, const char** error) {
+    char* save;
+
+    sub->fields = 0;
+    sub->every = 1;
+    for (char* word = strtok_r(line, " \t\r", &save); word != nullptr; word = strtok_r(nullptr, " \t\r", &save)) {
+        char* value = strchr(word, '=');
+        if(value == nullptr) {
+            *error = "expected key=value";
+            return false;
+        }
+        *value++ = '\0';
+        if(strcmp(word, "interfaces") == 0) {
+            if(!interface_filter_add(&sub->filter, value)) {
+                *error = "too many or too long interface patterns";
+                return false;
+            }
+        } else if(strcmp(word, "counters") == 0) {
+            char* field_save;
+            for (char* name = strtok_r(value, ",", &field_save); name != nullptr; name = strtok_r(nullptr, ",", &field_save)) {
+                int f { 0 };
+                while (f < FANOUT_FIELDS && strcmp(fanout_field_name(f), name) != 0)
+                    ++f;
+                if(f == FANOUT_FIELDS) {
+                    *error = "unknown counter";
+                    return false;
+                }
+                sub->fields |= 1ull << f;
+            }
+        } else if(strcmp(word, "every") == 0) {
+            char* end;
+            long every = strtol(value, &end, 10);
+            if(end == value || *end != '\0' || every < 1 || every > MAX_DECIMATION) {
+                *error = "every must be a number of ticks";
+                return false;
+            }
+            sub->every = every;
+        } else {
+            *error = "unknown key";
+            return false;
+        }
+    }
+    if(sub->fields == 0)
+        sub->fields = ~0ull;
+    return true;
+}
+
+/*Subscriber Handle function is responsible for*/
+/*reading the subscription line and sending the queued ticks*/
+/*anything sent after the subscription is ignored until the subscriber hangs up*/
+void subscriber_handle(event_source* source) {
+    subscriber* sub = (subscriber*)source;
+    char discard[256];
+    ssize_t ret;
+
+    while (true) {
+        if(sub->is_subscribed) {
+            ret = recv(source->fd, discard, sizeof(discard), 0);
+        } else {
+            ret = recv(source->fd, sub->request + sub->request_len, SUBSCRIBE_REQUEST_LEN - 1 - sub->request_len, 0);
+        }
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if(ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if(ret <= 0 || sub->is_broken) {
+            subscriber_close(sub);
+            return;
+        }
+        if(sub->is_subscribed) {
+            continue;
+        }
+        sub->request_len += ret;
+        sub->request[sub->request_len] = '\0';
+        char* end = strchr(sub->request, '\n');
+        const char* error { "subscription line too long" };
+        if(end == nullptr && sub->request_len < SUBSCRIBE_REQUEST_LEN - 1) {
+            continue;
+        }
+        if(end != nullptr) {
+            *end = '\0';
+            if(subscriber_parse(sub, sub->request, &error)) {
+                sub->is_subscribed = true;
+                ++sub->owner->accepted;
+                continue;
+            }
+        }
+        char response[128];
+        int len = snprintf(response, sizeof(response), "{\"error\":\"%s\"}\n", error);
+        send(source->fd, response, len, MSG_NOSIGNAL | MSG_DONTWAIT); //fits an empty socket buffer
+        subscriber_close(sub);
+        return;
+    }
+    sub->is_blocked = false;
+    if(!subscriber_flush(sub)) {
+        subscriber_close(sub);
+    }
+}
+
+#endif //FANOUT_H
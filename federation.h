@@ -0,0 +1,801 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <netdb.h>
+#include <net/if.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "rates.h"
+#include "codec.h"
+#include "recorder.h"
+#include "exporter.h"
+#include "event_loop.h"
+#include "self_metrics.h"
+
+#define FED_MAGIC 0x464e //"NF" in little endian
+#define FED_VERSION 1
+#define FED_BATCH_LEN 65536 //Largest batch including its header, a batch is sealed before it grows past it
+#define FED_BATCHES 64 //Sealed batches an uploader keeps to resume from, 4 MB
+#define FED_MAX_HOSTS 4096 //Hosts an aggregator follows at once, host 0 is the aggregator itself
+#define FED_MAX_ENTRIES 65536 //Interfaces of one compressed upload stream
+#define FED_RECORD_LEN (1 + IFNAMSIZ + (CODEC_RECORD_LEN > sizeof(wire_sample) ? CODEC_RECORD_LEN : sizeof(wire_sample))) //Upper bound of a record
+#define FED_RETRY_MIN_NS 1000000000ull //First wait before connecting to the aggregator again
+#define FED_RETRY_MAX_NS 30000000000ull //The wait doubles up to this
+#define FED_HOST_EXPIRE_NS 600000000000ull //A host away this long has its interfaces forgotten
+#define FED_COMPRESSED 0x01 //Flag of a hello and of its batches: the records are codec records
+
+/*Types of the messages between an uploader and an aggregator*/
+enum fed_type : uint8_t {
+    FED_HELLO = 1, //uploader -> aggregator, payload: fed_hello
+    FED_WELCOME, //aggregator -> uploader, seq: last batch the aggregator has of the session
+    FED_BATCH, //uploader -> aggregator, count records
+    FED_TYPE_COUNT
+};
+
+/*Header in front of every federation message, all fields are in host byte order*/
+struct fed_header {
+    uint32_t length; //message length including the header
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type; //fed_type
+    uint32_t count; //records of a batch
+    uint32_t flags; //FED_COMPRESSED
+    uint64_t seq; //batch number, from 1 in every session
+    uint64_t sent_ns; //CLOCK_REALTIME the batch was sealed
+};
+
+/*Payload of FED_HELLO*/
+struct fed_hello {
+    char host[HOST_NAME_LEN]; //name the interfaces of the uploader are tagged with
+    uint64_t session; //picked by every run of the uploader, a new one starts the sequence over
+    uint32_t max_entries; //codec entries of a compressed stream
+    uint32_t reserved;
+};
+
+static_assert(sizeof(fed_header) == 32, "fed_header layout changed");
+static_assert(sizeof(fed_hello) == 80, "fed_hello layout changed");
+
+/*States of the connection of an uploader*/
+enum fed_state {
+    FED_DISCONNECTED, //waiting for the next attempt
+    FED_CONNECTING, //connect in progress
+    FED_GREETING, //hello sent, waiting for the welcome
+    FED_STREAMING //sending the batches
+};
+
+/*Fed Uplink streams the samples of this host to an aggregator in batches*/
+/*the sealed batches stay in a ring, after a reconnect the ones the aggregator misses are sent again*/
+struct fed_uplink {
+    event_source source; //must stay first, the connection to the aggregator
+    int epoll_fd;
+    fed_state state;
+    struct sockaddr_storage addr; //aggregator, resolved once
+    socklen_t addr_len;
+    fed_hello hello;
+    bool is_compressed;
+    uint64_t batch_ns; //a batch is sealed once its first sample is this old, 0 seals every tick
+    int64_t epoch_offset_ns; //CLOCK_REALTIME - CLOCK_MONOTONIC, the samples travel in real time
+    sample_codec codec;
+    uint8_t* batches; //FED_BATCHES slots of FED_BATCH_LEN, batch seq is in slot seq % FED_BATCHES
+    uint32_t lens[FED_BATCHES];
+    uint64_t first_seq; //oldest batch kept
+    uint64_t next_seq; //batch being filled
+    uint64_t send_seq; //batch being sent
+    size_t sent; //bytes of send_seq sent so far
+    uint64_t opened_ns; //first sample of the batch being filled, 0 while it is empty
+    fed_header reply; //welcome being received
+    size_t reply_len;
+    uint64_t retry_ns; //next connection attempt
+    uint64_t backoff_ns;
+    uint64_t samples; //samples put into batches
+    uint64_t dropped; //samples that found no batch, the oldest one was being sent
+    uint64_t sealed; //batches sealed
+    uint64_t resent; //batches sent again after a reconnect
+    uint64_t lost; //batches dropped before the aggregator had them
+    uint64_t bytes; //bytes of the sealed batches
+    uint64_t reconnects;
+};
+
+/*Fed Host is what an aggregator remembers of an uploading host, across its reconnects*/
+struct fed_host {
+    uint64_t session;
+    uint64_t last_seq; //last batch merged
+    uint64_t left_ns; //CLOCK_MONOTONIC the host disconnected, 0 while connected or free
+    bool is_connected;
+};
+
+/*Fed Peer is the connection of an uploader to the aggregator*/
+struct fed_peer {
+    event_source source; //must stay first
+    struct fed_server* owner;
+    int host; //index in the host table, -1 before the hello
+    uint8_t* buffer; //received bytes, a whole batch fits
+    size_t len;
+    bool is_replaced; //its host connected again, what is left is dropped until its handler closes it
+    bool has_codec;
+    sample_codec codec; //decoder of a compressed stream
+    fed_peer* prev;
+    fed_peer* next;
+};
+
+/*Fed Server merges the samples of the uploading hosts into this networkMonitor*/
+/*every sample is tagged with its host and handed to on_sample like a local one*/
+struct fed_server {
+    event_source source; //must stay first, the listening socket
+    int epoll_fd;
+    char path[sizeof(sockaddr_un::sun_path)]; //UNIX socket to remove on close, empty for TCP
+    fed_host* hosts; //FED_MAX_HOSTS entries, 0 stays unused
+    char (*names)[HOST_NAME_LEN]; //name of every host, empty while the entry is free
+    fed_peer* peers;
+    size_t num_peers;
+    int64_t epoch_offset_ns;
+    void (*on_sample)(wire_sample* sample);
+    void (*on_forget)(uint16_t host); //the interfaces of a host that went away for good
+    uint64_t batches; //batches merged
+    uint64_t samples;
+    uint64_t gaps; //batches the uploaders lost
+    uint64_t duplicates; //batches received twice and skipped
+    uint64_t bytes;
+};
+
+/*Function is responsible for*/
+/*resolving host:port of an aggregator, a name is looked up once*/
+bool fed_resolve(const char* address, struct sockaddr_storage* addr, socklen_t* addr_len) {
+    char host[256];
+    const char* colon = strrchr(address, ':');
+    struct addrinfo hints, *result;
+
+    if(colon == nullptr || colon == address || (size_t)(colon - address) >= sizeof(host) || atoi(colon + 1) <= 0 || atoi(colon + 1) > 65535) {
+        return false;
+    }
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, colon + 1, &hints, &result) != 0) {
+        return false;
+    }
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+/*Function is responsible for*/
+/*checking that a header describes a message this side understands*/
+inline bool fed_valid(const fed_header* header) {
+    return header->magic == FED_MAGIC && header->version == FED_VERSION && header->length >= sizeof(fed_header)
+        && header->length <= FED_BATCH_LEN && header->type >= FED_HELLO && header->type < FED_TYPE_COUNT;
+}
+
+/*Function is responsible for*/
+/*filling the header of a message*/
+inline void fed_header_init(fed_header* header, fed_type type, size_t length, uint32_t count, uint32_t flags, uint64_t seq, uint64_t sent_ns) {
+    memset(header, 0, sizeof(*header));
+    header->length = length;
+    header->magic = FED_MAGIC;
+    header->version = FED_VERSION;
+    header->type = type;
+    header->count = count;
+    header->flags = flags;
+    header->seq = seq;
+    header->sent_ns = sent_ns;
+}
+
+/*Function is responsible for*/
+/*closing the connection to the aggregator and planning the next attempt*/
+void uplink_disconnect(fed_uplink* up, uint64_t now) {
+    if(up->source.fd >= 0) {
+        epoll_ctl(up->epoll_fd, EPOLL_CTL_DEL, up->source.fd, NULL);
+        close(up->source.fd);
+        up->source.fd = -1;
+    }
+    if(up->state == FED_STREAMING) {
+        std::cerr << "NetworkMonitor: lost the aggregator, batch " << up->send_seq << " onwards is sent again on reconnect" << std::endl;
+    }
+    up->state = FED_DISCONNECTED;
+    up->sent = 0; //the welcome resends from the start of a batch
+    up->retry_ns = now + up->backoff_ns;
+    up->backoff_ns = std::min<uint64_t>(up->backoff_ns * 2, FED_RETRY_MAX_NS);
+}
+
+/*Uplink Flush function is responsible for*/
+/*sending the sealed batches the aggregator does not have yet without blocking*/
+/*a full socket is resumed by EPOLLOUT*/
+void uplink_flush(fed_uplink* up) {
+    ssize_t ret;
+
+    while (up->state == FED_STREAMING && up->send_seq < up->next_seq) {
+        size_t slot = up->send_seq % FED_BATCHES;
+        self_count(SELF_SYSCALLS);
+        if((ret = send(up->source.fd, up->batches + slot * FED_BATCH_LEN + up->sent, up->lens[slot] - up->sent, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                uplink_disconnect(up, monotonic_ns());
+            return;
+        }
+        self_count(SELF_BYTES_OUT, ret);
+        if((up->sent += ret) == up->lens[slot]) {
+            ++up->send_seq;
+            up->sent = 0;
+            self_count(SELF_MESSAGES_OUT);
+        }
+    }
+}
+
+/*Function is responsible for*/
+/*picking up the stream where the aggregator left it, as far back as the ring reaches*/
+void uplink_welcome(fed_uplink* up, uint64_t last_seq) {
+    uint64_t resume = std::min(last_seq + 1, up->next_seq);
+
+    if(resume < up->first_seq) { //overwritten while disconnected
+        up->lost += up->first_seq - resume;
+        resume = up->first_seq;
+    }
+    up->resent += up->send_seq > resume ? up->send_seq - resume : 0;
+    up->send_seq = resume;
+    up->sent = 0;
+    up->state = FED_STREAMING;
+    up->backoff_ns = FED_RETRY_MIN_NS;
+    std::cout << "NetworkMonitor: streaming to the aggregator from batch " << resume << std::endl;
+}
+
+/*Uplink Handle function is responsible for*/
+/*finishing the connect, taking the welcome and resuming a blocked send*/
+void uplink_handle(event_source* source) {
+    fed_uplink* up = (fed_uplink*)source;
+    ssize_t ret;
+
+    if(up->state == FED_CONNECTING) {
+        int error { 0 };
+        socklen_t len { sizeof(error) };
+        fed_header header;
+        char message[sizeof(fed_header) + sizeof(fed_hello)];
+
+        getsockopt(source->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if(error == EINPROGRESS) {
+            return;
+        }
+        fed_header_init(&header, FED_HELLO, sizeof(message), 0, up->is_compressed ? FED_COMPRESSED : 0, 0, 0);
+        memcpy(message, &header, sizeof(header));
+        memcpy(message + sizeof(header), &up->hello, sizeof(up->hello));
+        self_count(SELF_SYSCALLS);
+        if(error != 0 || send(source->fd, message, sizeof(message), MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)sizeof(message)) {
+            uplink_disconnect(up, monotonic_ns());
+            return;
+        }
+        up->state = FED_GREETING;
+        up->reply_len = 0;
+    }
+    while (true) { //the aggregator only ever sends the welcome, anything else ends the connection
+        self_count(SELF_SYSCALLS);
+        if((ret = recv(source->fd, (char*)&up->reply + up->reply_len, sizeof(up->reply) - up->reply_len, MSG_DONTWAIT)) < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+        }
+        if(ret <= 0 || up->state != FED_GREETING) {
+            uplink_disconnect(up, monotonic_ns());
+            return;
+        }
+        if((up->reply_len += ret) == sizeof(up->reply)) {
+            if(!fed_valid(&up->reply) || up->reply.type != FED_WELCOME) {
+                uplink_disconnect(up, monotonic_ns());
+                return;
+            }
+            uplink_welcome(up, up->reply.seq);
+        }
+    }
+    uplink_flush(up);
+}
+
+/*Function is responsible for*/
+/*starting a non-blocking connect to the aggregator*/
+void uplink_connect(fed_uplink* up, uint64_t now) {
+    int one { 1 };
+
+    ++up->reconnects;
+    self_count(SELF_SYSCALLS, 3);
+    if((up->source.fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        uplink_disconnect(up, now);
+        return;
+    }
+    setsockopt(up->source.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); //a batch is written whole, nothing to coalesce
+    up->state = FED_CONNECTING;
+    if((connect(up->source.fd, (struct sockaddr*)&up->addr, up->addr_len) < 0 && errno != EINPROGRESS)
+       || !event_source_add(up->epoll_fd, &up->source, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+        uplink_disconnect(up, now);
+    }
+}
+
+/*Uplink Init function is responsible for*/
+/*preparing the ring of an uploader and connecting to the aggregator*/
+/*max_entries bounds the rate_state ids the samples are appended with*/
+bool uplink_init(fed_uplink* up, const struct sockaddr_storage* addr, socklen_t addr_len, const char* host, bool is_compressed,
+                 uint64_t batch_ns, size_t max_entries, int epoll_fd, int64_t epoch_offset_ns) {
+    memset(up, 0, sizeof(*up));
+    up->source.fd = -1;
+    up->source.handle = uplink_handle;
+    up->epoll_fd = epoll_fd;
+    up->addr = *addr;
+    up->addr_len = addr_len;
+    strncpy(up->hello.host, host, HOST_NAME_LEN-1);
+    up->hello.session = (uint64_t)epoch_offset_ns ^ ((uint64_t)getpid() << 32) ^ monotonic_ns();
+    up->hello.max_entries = max_entries;
+    up->is_compressed = is_compressed;
+    up->batch_ns = batch_ns;
+    up->epoch_offset_ns = epoch_offset_ns;
+    if(is_compressed) {
+        if(max_entries > FED_MAX_ENTRIES) {
+            return false;
+        }
+        codec_init(&up->codec, max_entries);
+    }
+    up->batches = new uint8_t[(size_t)FED_BATCHES * FED_BATCH_LEN];
+    up->first_seq = up->next_seq = up->send_seq = 1;
+    up->backoff_ns = FED_RETRY_MIN_NS;
+    uplink_connect(up, monotonic_ns());
+    return true;
+}
+
+/*Function is responsible for*/
+/*closing the connection and releasing the ring*/
+void uplink_close(fed_uplink* up) {
+    if(up->source.fd >= 0)
+        close(up->source.fd);
+    up->source.fd = -1;
+    if(up->is_compressed)
+        codec_free(&up->codec);
+    delete[] up->batches;
+    up->batches = nullptr;
+}
+
+/*Function is responsible for*/
+/*writing the header of the batch being filled and handing it to the sender*/
+void uplink_seal(fed_uplink* up) {
+    size_t slot = up->next_seq % FED_BATCHES;
+    fed_header* header = (fed_header*)(up->batches + slot * FED_BATCH_LEN);
+
+    fed_header_init(header, FED_BATCH, up->lens[slot], header->count, up->is_compressed ? FED_COMPRESSED : 0, up->next_seq,
+                    monotonic_ns() + up->epoch_offset_ns);
+    up->bytes += up->lens[slot];
+    ++up->sealed;
+    ++up->next_seq;
+    up->opened_ns = 0;
+    uplink_flush(up);
+}
+
+/*Function is responsible for*/
+/*starting the next batch in the ring, evicting the oldest one if the ring is full*/
+/*returns false if the oldest one is being sent, its bytes are partly on the wire*/
+bool uplink_open(fed_uplink* up, uint64_t now) {
+    if(up->next_seq - up->first_seq == FED_BATCHES) {
+        if(up->send_seq == up->first_seq && up->sent > 0) {
+            return false;
+        }
+        if(up->send_seq == up->first_seq) { //never sent, the aggregator will see a gap
+            ++up->lost;
+            ++up->send_seq;
+        }
+        ++up->first_seq;
+    }
+    size_t slot = up->next_seq % FED_BATCHES;
+    ((fed_header*)(up->batches + slot * FED_BATCH_LEN))->count = 0;
+    up->lens[slot] = sizeof(fed_header);
+    up->opened_ns = now;
+    if(up->is_compressed)
+        codec_block(&up->codec); //every batch decodes on its own, whatever was resent before it
+    return true;
+}
+
+/*Uplink Append function is responsible for*/
+/*putting a sample of interface id into the batch being filled, sealing it when the next one may not fit*/
+/*a compressed record is the interface name followed by a codec record, a plain one the wire_sample*/
+void uplink_append(fed_uplink* up, uint32_t id, const wire_sample* sample) {
+    uint64_t now = monotonic_ns();
+
+    if(up->opened_ns == 0 && !uplink_open(up, now)) {
+        ++up->dropped;
+        return;
+    }
+    size_t slot = up->next_seq % FED_BATCHES;
+    uint8_t* out = up->batches + slot * FED_BATCH_LEN + up->lens[slot];
+    wire_sample record = *sample;
+    record.timestamp_ns += up->epoch_offset_ns; //the aggregator reads the time in its own clock
+    if(up->is_compressed) {
+        uint8_t len = strnlen(record.interface, IFNAMSIZ-1);
+        *out++ = len;
+        memcpy(out, record.interface, len);
+        out += len;
+        out += codec_encode(&up->codec, id, operstate_index(record.stats.operstate), &record, out);
+    } else {
+        memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+    }
+    up->lens[slot] = out - (up->batches + slot * FED_BATCH_LEN);
+    ++((fed_header*)(up->batches + slot * FED_BATCH_LEN))->count;
+    ++up->samples;
+    if(FED_BATCH_LEN - up->lens[slot] < FED_RECORD_LEN) {
+        uplink_seal(up);
+    }
+}
+
+/*Uplink Tick function is responsible for*/
+/*sealing a batch that is old enough and reconnecting when the wait is over*/
+void uplink_tick(fed_uplink* up, uint64_t now) {
+    if(up->opened_ns != 0 && now - up->opened_ns >= up->batch_ns) {
+        uplink_seal(up);
+    }
+    if(up->state == FED_DISCONNECTED && now >= up->retry_ns) {
+        uplink_connect(up, now);
+    }
+}
+
+void fed_accept(event_source* source);
+void peer_handle(event_source* source);
+
+/*Fed Listen function is responsible for*/
+/*listening for uploaders on a UNIX socket path, host:port, or a port of every address*/
+/*a bare port takes IPv6 and IPv4 on one socket, or IPv4 alone without IPv6*/
+/*returns the socket, -1 with errno set if it cannot listen*/
+int fed_listen(const char* address, char* path) {
+    const char* colon = strrchr(address, ':');
+    const char* port = colon != nullptr ? colon + 1 : address;
+    struct addrinfo hints, *result { nullptr };
+    char host[256];
+    int fd, one { 1 }, zero { 0 };
+
+    if(strchr(address, '/') != nullptr) {
+        return exporter_listen(address, path);
+    }
+    path[0] = '\0';
+    if(atoi(port) <= 0 || atoi(port) > 65535 || (colon != nullptr && (size_t)(colon - address) >= sizeof(host))) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    if(colon == nullptr || colon == address) { //every address
+        struct sockaddr_in6 any6;
+        memset(&any6, 0, sizeof(any6));
+        any6.sin6_family = AF_INET6;
+        any6.sin6_addr = in6addr_any;
+        any6.sin6_port = htons(atoi(port));
+        if((fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0) {
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if(bind(fd, (struct sockaddr*)&any6, sizeof(any6)) == 0 && listen(fd, SOMAXCONN) == 0) {
+                return fd;
+            }
+            close(fd);
+        }
+        hints.ai_family = AF_INET; //no IPv6 on this host
+        if(getaddrinfo(nullptr, port, &hints, &result) != 0) {
+            errno = EINVAL;
+            return -1;
+        }
+    } else {
+        memcpy(host, address, colon - address);
+        host[colon - address] = '\0';
+        if(host[0] == '[' && host[strlen(host) - 1] == ']') { //[IPv6]:port
+            host[strlen(host) - 1] = '\0';
+            memmove(host, host + 1, strlen(host));
+        }
+        hints.ai_family = AF_UNSPEC;
+        if(getaddrinfo(host, port, &hints, &result) != 0) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if((fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, result->ai_addr, result->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+/*Fed Server Init function is responsible for*/
+/*listening for uploaders on [host:]port or a UNIX socket path, a bare port on every address*/
+bool fed_server_init(fed_server* server, const char* address, int epoll_fd, int64_t epoch_offset_ns,
+                     void (*on_sample)(wire_sample* sample), void (*on_forget)(uint16_t host)) {
+    memset(server, 0, sizeof(*server));
+    server->source.handle = fed_accept;
+    server->epoll_fd = epoll_fd;
+    server->epoch_offset_ns = epoch_offset_ns;
+    server->on_sample = on_sample;
+    server->on_forget = on_forget;
+    if((server->source.fd = fed_listen(address, server->path)) < 0) {
+        return false;
+    }
+    server->hosts = new fed_host[FED_MAX_HOSTS]();
+    server->names = new char[FED_MAX_HOSTS][HOST_NAME_LEN]();
+    return event_source_add(epoll_fd, &server->source, EPOLLIN | EPOLLET);
+}
+
+/*Function is responsible for*/
+/*dropping the connection of an uploader, its host is remembered for its return*/
+void peer_close(fed_peer* peer) {
+    fed_server* server = peer->owner;
+
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, peer->source.fd, NULL);
+    close(peer->source.fd);
+    if(peer->host > 0) {
+        server->hosts[peer->host].is_connected = false;
+        server->hosts[peer->host].left_ns = monotonic_ns();
+        std::cout << "NetworkMonitor: host " << server->names[peer->host] << " disconnected after batch "
+            << server->hosts[peer->host].last_seq << std::endl;
+    }
+    if(peer->prev != nullptr) peer->prev->next = peer->next;
+    else server->peers = peer->next;
+    if(peer->next != nullptr) peer->next->prev = peer->prev;
+    --server->num_peers;
+    if(peer->has_codec)
+        codec_free(&peer->codec);
+    delete[] peer->buffer;
+    delete peer;
+}
+
+/*Function is responsible for*/
+/*closing every connection and the listening socket*/
+void fed_server_close(fed_server* server) {
+    while (server->peers != nullptr)
+        peer_close(server->peers);
+    if(server->source.fd >= 0) {
+        close(server->source.fd);
+        server->source.fd = -1;
+    }
+    if(server->path[0] != '\0')
+        unlink(server->path);
+    delete[] server->hosts;
+    delete[] server->names;
+    server->hosts = nullptr;
+    server->names = nullptr;
+}
+
+/*Function is responsible for*/
+/*accepting every pending uploader*/
+void fed_accept(event_source* source) {
+    fed_server* server = (fed_server*)source;
+    int fd;
+
+    while ((fd = accept4(source->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        self_count(SELF_SYSCALLS);
+        if(server->num_peers >= FED_MAX_HOSTS - 1) {
+            close(fd);
+            continue;
+        }
+        fed_peer* peer = new fed_peer();
+        peer->source.fd = fd;
+        peer->source.handle = peer_handle;
+        peer->owner = server;
+        peer->host = -1;
+        peer->buffer = new uint8_t[FED_BATCH_LEN];
+        peer->next = server->peers;
+        if(server->peers != nullptr)
+            server->peers->prev = peer;
+        server->peers = peer;
+        ++server->num_peers;
+        if(!event_source_add(server->epoll_fd, &peer->source, EPOLLIN | EPOLLRDHUP | EPOLLET)) {
+            peer_close(peer);
+        }
+    }
+}
+
+/*Function is responsible for*/
+/*finding the entry of a host by its name, taking a free one for a new host*/
+/*returns 0 if the table is full*/
+int fed_find_host(fed_server* server, const char* name) {
+    int free_entry { 0 };
+
+    for (int h = 1; h < FED_MAX_HOSTS; h++) {
+        if(strncmp(server->names[h], name, HOST_NAME_LEN) == 0) {
+            return h;
+        }
+        if(free_entry == 0 && server->names[h][0] == '\0' && server->hosts[h].left_ns == 0 && !server->hosts[h].is_connected) {
+            free_entry = h;
+        }
+    }
+    if(free_entry != 0) {
+        strncpy(server->names[free_entry], name, HOST_NAME_LEN-1);
+    }
+    return free_entry;
+}
+
+/*Peer Hello function is responsible for*/
+/*tagging the connection with its host and telling the uploader where to resume*/
+/*a host that connects again replaces its previous connection, which is shut down and closed by its own handler*/
+bool peer_hello(fed_peer* peer, const fed_header* header, const uint8_t* payload) {
+    fed_server* server = peer->owner;
+    fed_hello hello;
+    fed_header welcome;
+
+    if(peer->host >= 0 || header->length != sizeof(fed_header) + sizeof(hello)) {
+        return false;
+    }
+    memcpy(&hello, payload, sizeof(hello));
+    hello.host[HOST_NAME_LEN-1] = '\0';
+    if(hello.host[0] == '\0' || (peer->host = fed_find_host(server, hello.host)) == 0) {
+        return false;
+    }
+    for (fed_peer* other = server->peers; other != nullptr; other = other->next) {
+        if(other != peer && other->host == peer->host) {
+            std::cout << "NetworkMonitor: host " << hello.host << " connected again, dropping its previous connection" << std::endl;
+            other->host = -1; //the host entry belongs to the new connection now
+            other->is_replaced = true;
+            shutdown(other->source.fd, SHUT_RDWR); //may be among the events being handled, not freed here
+            break;
+        }
+    }
+    fed_host* host = &server->hosts[peer->host];
+    if(host->session != hello.session) { //the uploader started over, its interfaces may have changed
+        if(host->session != 0)
+            server->on_forget(peer->host);
+        host->session = hello.session;
+        host->last_seq = 0;
+    }
+    host->is_connected = true;
+    host->left_ns = 0;
+    if(header->flags & FED_COMPRESSED) {
+        if(hello.max_entries == 0 || hello.max_entries > FED_MAX_ENTRIES) {
+            return false;
+        }
+        codec_init(&peer->codec, hello.max_entries);
+        peer->has_codec = true;
+    }
+    fed_header_init(&welcome, FED_WELCOME, sizeof(welcome), 0, 0, host->last_seq, 0);
+    self_count(SELF_SYSCALLS);
+    if(send(peer->source.fd, &welcome, sizeof(welcome), MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)sizeof(welcome)) {
+        return false;
+    }
+    std::cout << "NetworkMonitor: host " << hello.host << " connected, resuming after batch " << host->last_seq << std::endl;
+    return true;
+}
+
+/*Peer Batch function is responsible for*/
+/*merging the samples of a batch that was not merged before*/
+/*returns false if the batch is malformed*/
+bool peer_batch(fed_peer* peer, const fed_header* header, const uint8_t* payload) {
+    fed_server* server = peer->owner;
+    fed_host* host = &server->hosts[peer->host];
+    const uint8_t* p = payload;
+    const uint8_t* end = payload + header->length - sizeof(fed_header);
+    wire_sample sample;
+    uint32_t entry;
+    uint8_t operstate;
+
+    if(header->seq <= host->last_seq) { //sent again after a reconnect, merged already
+        ++server->duplicates;
+        return true;
+    }
+    if((header->flags & FED_COMPRESSED) != (peer->has_codec ? FED_COMPRESSED : 0)) {
+        return false;
+    }
+    server->gaps += header->seq - host->last_seq - 1;
+    host->last_seq = header->seq;
+    if(peer->has_codec)
+        codec_block(&peer->codec);
+    for (uint32_t i = 0; i < header->count; i++) {
+        if(peer->has_codec) {
+            if(p == end || *p >= IFNAMSIZ || end - p < 1 + *p) {
+                return false;
+            }
+            memset(sample.interface, 0, IFNAMSIZ);
+            memcpy(sample.interface, p + 1, *p);
+            p += 1 + *p;
+            if(!codec_decode(&peer->codec, &p, end, &entry, &operstate, &sample)) {
+                return false;
+            }
+            memset(sample.stats.operstate, 0, OPERSTATE_LEN);
+            strncpy(sample.stats.operstate, operstate_names[operstate < NUM_OPERSTATES ? operstate : 0], OPERSTATE_LEN-1);
+        } else {
+            if((size_t)(end - p) < sizeof(sample)) {
+                return false;
+            }
+            memcpy(&sample, p, sizeof(sample));
+            p += sizeof(sample);
+        }
+        sample.interface[IFNAMSIZ-1] = '\0';
+        sample.timestamp_ns -= server->epoch_offset_ns; //real time of the uploader, monotonic time here
+        sample.stats.host = peer->host;
+        server->on_sample(&sample);
+    }
+    ++server->batches;
+    server->samples += header->count;
+    return true;
+}
+
+/*Peer Handle function is responsible for*/
+/*draining an edge-triggered uploader connection and handling every message in it*/
+void peer_handle(event_source* source) {
+    fed_peer* peer = (fed_peer*)source;
+    fed_server* server = peer->owner;
+    fed_header header;
+    ssize_t ret;
+
+    while (true) {
+        self_count(SELF_SYSCALLS);
+        if((ret = recv(source->fd, peer->buffer + peer->len, FED_BATCH_LEN - peer->len, MSG_DONTWAIT)) < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+        }
+        if(ret <= 0) {
+            break;
+        }
+        self_count(SELF_BYTES_IN, ret);
+        server->bytes += ret;
+        if(peer->is_replaced) {
+            continue;
+        }
+        peer->len += ret;
+        size_t start { 0 };
+        bool is_valid { true };
+        while (peer->len - start >= sizeof(header)) {
+            memcpy(&header, peer->buffer + start, sizeof(header));
+            if(!fed_valid(&header)) {
+                is_valid = false;
+                break;
+            }
+            if(peer->len - start < header.length) {
+                break;
+            }
+            const uint8_t* payload = peer->buffer + start + sizeof(header);
+            self_count(SELF_MESSAGES_IN);
+            if(header.type == FED_HELLO) {
+                is_valid = peer_hello(peer, &header, payload);
+            } else {
+                is_valid = header.type == FED_BATCH && peer->host > 0 && peer_batch(peer, &header, payload);
+            }
+            if(!is_valid) {
+                break;
+            }
+            start += header.length;
+        }
+        if(!is_valid) {
+            std::cerr << "NetworkMonitor: malformed upload" << (peer->host > 0 ? " from " : "") << (peer->host > 0 ? server->names[peer->host] : "") << std::endl;
+            break;
+        }
+        memmove(peer->buffer, peer->buffer + start, peer->len - start);
+        peer->len -= start;
+    }
+    peer_close(peer);
+}
+
+/*Fed Server Tick function is responsible for*/
+/*forgetting the hosts that stayed away for FED_HOST_EXPIRE_NS*/
+void fed_server_tick(fed_server* server, uint64_t now) {
+    for (int h = 1; h < FED_MAX_HOSTS; h++) {
+        fed_host* host = &server->hosts[h];
+        if(!host->is_connected && host->left_ns != 0 && now - host->left_ns >= FED_HOST_EXPIRE_NS) {
+            std::cout << "NetworkMonitor: host " << server->names[h] << " is gone" << std::endl;
+            server->on_forget(h);
+            memset(host, 0, sizeof(*host));
+            server->names[h][0] = '\0';
+        }
+    }
+}
+
+#endif //FEDERATION_H
@@ -0,0 +1,351 @@
+#ifndef FLOW_SAMPLER_H
+#define FLOW_SAMPLER_H
+
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#include "protocol.h"
+#include "self_metrics.h"
+
+#define FLOW_BLOCK_LEN (1 << 16) //Block of the ring, handed to the monitor when full or after FLOW_BLOCK_TIMEOUT_MS
+#define FLOW_NUM_BLOCKS 16 //Blocks of the ring, 1 MB per interface
+#define FLOW_FRAME_LEN 256 //Frame size the ring is declared with, TPACKET_V3 packs the packets tighter
+#define FLOW_SNAP_LEN 128 //Bytes of a sampled packet copied into the ring, the headers are enough
+#define FLOW_BLOCK_TIMEOUT_MS 100 //A block that is not full is retired this late
+#define FLOW_SKETCH_DEPTH 4 //Rows of the count-min sketch
+#define FLOW_SKETCH_WIDTH 2048 //Cells per row, a power of 2; overestimates stay below 0.14% of the interval's bytes
+#define FLOW_TRACKED 64 //Flows the space-saving table follows, the largest FLOW_TOP_K are reported
+#define FLOW_MAX_EXT_HEADERS 8 //IPv6 extension headers skipped looking for the ports
+
+/*Flow Key is the 5-tuple of a packet, laid out like the start of a wire_flow*/
+struct flow_key {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t family;
+    uint8_t protocol;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(flow_key) == offsetof(wire_flow, bytes), "flow_key must prefix wire_flow");
+
+/*Flow Table finds the top talkers of an interval in fixed memory*/
+/*every packet goes into a count-min sketch, the FLOW_TRACKED largest flows are followed exactly*/
+/*once the table is full a flow whose estimate beats the smallest one takes its entry (space-saving)*/
+struct flow_table {
+    uint64_t bytes_sketch[FLOW_SKETCH_DEPTH][FLOW_SKETCH_WIDTH];
+    uint32_t packets_sketch[FLOW_SKETCH_DEPTH][FLOW_SKETCH_WIDTH];
+    uint64_t hashes[FLOW_TRACKED]; //compared before the keys
+    flow_key keys[FLOW_TRACKED];
+    uint64_t bytes[FLOW_TRACKED]; //sketch estimate when tracked, counted exactly from then on
+    uint64_t packets[FLOW_TRACKED];
+    int num_tracked;
+    int smallest; //entry with the fewest bytes, -1 if it has to be looked up again
+    uint64_t sampled; //packets of the interval, flows or not
+};
+
+/*Flow Sampler reads sampled packet headers of one interface from a TPACKET_V3 ring*/
+/*the kernel picks one packet out of sample_rate with a socket filter, nothing is allocated per packet*/
+struct flow_sampler {
+    int fd; //AF_PACKET socket, -1 while closed
+    uint8_t* ring;
+    unsigned int block; //next block to hand back to the kernel
+    uint32_t sample_rate;
+    uint64_t last_ns; //end of the previous report
+    flow_table table;
+};
+
+/*Function is responsible for*/
+/*emptying the table for the next interval*/
+void flow_table_reset(flow_table* table) {
+    memset(table->bytes_sketch, 0, sizeof(table->bytes_sketch));
+    memset(table->packets_sketch, 0, sizeof(table->packets_sketch));
+    table->num_tracked = 0;
+    table->smallest = -1;
+    table->sampled = 0;
+}
+
+/*Function is responsible for*/
+/*hashing a key, the rows of the sketch take their cells from both halves*/
+inline uint64_t flow_hash(const flow_key* key) {
+    uint64_t words[sizeof(flow_key) / 8], hash { 0x9e3779b97f4a7c15ull };
+
+    memcpy(words, key, sizeof(words));
+    for (uint64_t word : words) {
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    return hash ^ (hash >> 33);
+}
+
+/*Function is responsible for*/
+/*finding the entry of the smallest tracked flow*/
+inline int flow_table_smallest(flow_table* table) {
+    if(table->smallest < 0) {
+        table->smallest = 0;
+        for (int i = 1; i < table->num_tracked; i++) {
+            if(table->bytes[i] < table->bytes[table->smallest])
+                table->smallest = i;
+        }
+    }
+    return table->smallest;
+}
+
+/*Flow Table Add function is responsible for*/
+/*counting a packet of len bytes of a flow*/
+/*the sketch is updated conservatively, only the cells below the new estimate grow*/
+void flow_table_add(flow_table* table, const flow_key* key, uint32_t len) {
+    uint64_t hash = flow_hash(key), bytes { UINT64_MAX };
+    uint32_t cells[FLOW_SKETCH_DEPTH], packets { UINT32_MAX };
+    int entry;
+
+    for (int d = 0; d < FLOW_SKETCH_DEPTH; d++) {
+        cells[d] = ((uint32_t)hash + d * (uint32_t)((hash >> 32) | 1)) & (FLOW_SKETCH_WIDTH - 1);
+        bytes = std::min(bytes, table->bytes_sketch[d][cells[d]]);
+        packets = std::min(packets, table->packets_sketch[d][cells[d]]);
+    }
+    bytes += len;
+    ++packets;
+    for (int d = 0; d < FLOW_SKETCH_DEPTH; d++) {
+        table->bytes_sketch[d][cells[d]] = std::max(table->bytes_sketch[d][cells[d]], bytes);
+        table->packets_sketch[d][cells[d]] = std::max(table->packets_sketch[d][cells[d]], packets);
+    }
+
+    for (entry = 0; entry < table->num_tracked; entry++) {
+        if(table->hashes[entry] == hash && memcmp(&table->keys[entry], key, sizeof(*key)) == 0) {
+            table->bytes[entry] += len;
+            ++table->packets[entry];
+            if(entry == table->smallest)
+                table->smallest = -1;
+            return;
+        }
+    }
+    if(table->num_tracked < FLOW_TRACKED) {
+        entry = table->num_tracked++;
+    } else if(bytes > table->bytes[flow_table_smallest(table)]) {
+        entry = table->smallest;
+    } else { //a mouse, only the sketch remembers it
+        return;
+    }
+    table->hashes[entry] = hash;
+    table->keys[entry] = *key;
+    table->bytes[entry] = bytes;
+    table->packets[entry] = packets;
+    table->smallest = -1;
+}
+
+/*Flow Table Top function is responsible for*/
+/*writing the largest tracked flows into flows, largest first, scaled by the sample rate*/
+/*returns the number of flows written*/
+int flow_table_top(const flow_table* table, uint32_t sample_rate, wire_flow* flows) {
+    uint8_t order[FLOW_TRACKED];
+    int count = std::min(table->num_tracked, FLOW_TOP_K);
+
+    for (int i = 0; i < table->num_tracked; i++)
+        order[i] = i;
+    std::partial_sort(order, order + count, order + table->num_tracked,
+                      [table](uint8_t a, uint8_t b) { return table->bytes[a] > table->bytes[b]; });
+    for (int i = 0; i < count; i++) {
+        memset(&flows[i], 0, sizeof(flows[i]));
+        memcpy(&flows[i], &table->keys[order[i]], sizeof(flow_key));
+        flows[i].bytes = table->bytes[order[i]] * sample_rate;
+        flows[i].packets = table->packets[order[i]] * sample_rate;
+    }
+    return count;
+}
+
+/*Function is responsible for*/
+/*telling whether the packets of a protocol start with the two ports*/
+inline bool flow_has_ports(uint8_t protocol) {
+    return protocol == IPPROTO_TCP || protocol == IPPROTO_UDP || protocol == IPPROTO_SCTP || protocol == IPPROTO_UDPLITE;
+}
+
+/*Flow Parse function is responsible for*/
+/*taking the 5-tuple out of the captured network header of a packet*/
+/*returns false for anything but IPv4 and IPv6*/
+bool flow_parse(const uint8_t* data, uint32_t len, uint16_t ethertype, flow_key* key) {
+    uint32_t offset;
+    bool is_later_fragment { false };
+
+    memset(key, 0, sizeof(*key));
+    if(ethertype == ETH_P_8021Q && len >= 4) { //a tag the device left in place
+        ethertype = data[2] << 8 | data[3];
+        data += 4;
+        len -= 4;
+    }
+    if(ethertype == ETH_P_IP && len >= 20 && (data[0] >> 4) == 4) {
+        offset = (data[0] & 0x0f) * 4;
+        key->family = AF_INET;
+        key->protocol = data[9];
+        memcpy(key->src, data + 12, 4);
+        memcpy(key->dst, data + 16, 4);
+        is_later_fragment = ((data[6] << 8 | data[7]) & 0x1fff) != 0;
+    } else if(ethertype == ETH_P_IPV6 && len >= 40 && (data[0] >> 4) == 6) {
+        uint8_t next = data[6];
+        offset = 40;
+        key->family = AF_INET6;
+        memcpy(key->src, data + 8, 16);
+        memcpy(key->dst, data + 24, 16);
+        for (int h = 0; h < FLOW_MAX_EXT_HEADERS && offset + 8 <= len; h++) {
+            if(next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING || next == IPPROTO_DSTOPTS) {
+                next = data[offset];
+                offset += (data[offset + 1] + 1) * 8;
+            } else if(next == IPPROTO_FRAGMENT) {
+                is_later_fragment = ((data[offset + 2] << 8 | data[offset + 3]) & 0xfff8) != 0;
+                next = data[offset];
+                offset += 8;
+            } else {
+                break;
+            }
+        }
+        key->protocol = next;
+    } else {
+        return false;
+    }
+    if(flow_has_ports(key->protocol) && !is_later_fragment && offset + 4 <= len) {
+        key->src_port = data[offset] << 8 | data[offset + 1];
+        key->dst_port = data[offset + 2] << 8 | data[offset + 3];
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*closing the socket and unmapping the ring*/
+void flow_sampler_close(flow_sampler* sampler) {
+    if(sampler->ring != nullptr) {
+        munmap(sampler->ring, FLOW_BLOCK_LEN * FLOW_NUM_BLOCKS);
+        sampler->ring = nullptr;
+    }
+    if(sampler->fd >= 0) {
+        close(sampler->fd);
+        sampler->fd = -1;
+    }
+}
+
+/*Flow Sampler Open function is responsible for*/
+/*mapping a TPACKET_V3 ring of the interface that gets one packet out of sample_rate*/
+/*the socket is bound last so that no packet arrives before the filter is in place*/
+/*returns false with errno set if the ring cannot be set up*/
+bool flow_sampler_open(flow_sampler* sampler, const char* interface, uint32_t sample_rate) {
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    int version { TPACKET_V3 }, saved_errno;
+    struct sock_filter code[] {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_RANDOM) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, sample_rate },
+        { BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0 },
+        { BPF_RET | BPF_K, 0, 0, FLOW_SNAP_LEN },
+        { BPF_RET | BPF_K, 0, 0, 0 }
+    };
+    struct sock_fprog filter { 5, code };
+
+    sampler->ring = nullptr;
+    sampler->block = 0;
+    sampler->sample_rate = sample_rate;
+    flow_table_reset(&sampler->table);
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    if(sample_rate <= 1) { //every packet, only its headers
+        filter.len = 1;
+        filter.filter = &code[3];
+    }
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = FLOW_BLOCK_LEN;
+    req.tp_block_nr = FLOW_NUM_BLOCKS;
+    req.tp_frame_size = FLOW_FRAME_LEN;
+    req.tp_frame_nr = FLOW_BLOCK_LEN / FLOW_FRAME_LEN * FLOW_NUM_BLOCKS;
+    req.tp_retire_blk_tov = FLOW_BLOCK_TIMEOUT_MS;
+
+    self_count(SELF_SYSCALLS, 6);
+    if((addr.sll_ifindex = if_nametoindex(interface)) == 0
+       || (sampler->fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) { //protocol 0 receives nothing yet
+        sampler->fd = -1;
+        return false;
+    }
+    if(setsockopt(sampler->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0
+       || setsockopt(sampler->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0
+       || (sampler->ring = (uint8_t*)mmap(nullptr, FLOW_BLOCK_LEN * FLOW_NUM_BLOCKS, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, sampler->fd, 0)) == MAP_FAILED
+       || setsockopt(sampler->fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0
+       || bind(sampler->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        saved_errno = errno;
+        if(sampler->ring == MAP_FAILED)
+            sampler->ring = nullptr;
+        flow_sampler_close(sampler);
+        errno = saved_errno;
+        return false;
+    }
+    sampler->last_ns = monotonic_ns();
+    return true;
+}
+
+/*Flow Sampler Read function is responsible for*/
+/*counting every packet of the blocks the kernel retired and handing the blocks back*/
+/*a loopback packet is seen leaving and arriving, only its arrival is counted*/
+/*returns the number of packets read*/
+size_t flow_sampler_read(flow_sampler* sampler) {
+    size_t num_packets { 0 };
+    flow_key key;
+
+    while (true) {
+        tpacket_block_desc* desc = (tpacket_block_desc*)(sampler->ring + (size_t)sampler->block * FLOW_BLOCK_LEN);
+        if(!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            break;
+        }
+        const uint8_t* p = (const uint8_t*)desc + desc->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+            const tpacket3_hdr* packet = (const tpacket3_hdr*)p;
+            const sockaddr_ll* ll = (const sockaddr_ll*)(p + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+            if(ll->sll_hatype != ARPHRD_LOOPBACK || ll->sll_pkttype != PACKET_OUTGOING) {
+                ++sampler->table.sampled;
+                if(flow_parse(p + packet->tp_net, packet->tp_snaplen, ntohs(ll->sll_protocol), &key))
+                    flow_table_add(&sampler->table, &key, packet->tp_len);
+            }
+            p += packet->tp_next_offset;
+        }
+        num_packets += desc->hdr.bh1.num_pkts;
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        sampler->block = (sampler->block + 1) % FLOW_NUM_BLOCKS;
+    }
+    return num_packets;
+}
+
+/*Flow Sampler Report function is responsible for*/
+/*filling report with the top talkers since the previous report and starting the next interval*/
+/*packets in a block the kernel has not retired yet are counted in the next interval*/
+void flow_sampler_report(flow_sampler* sampler, wire_flows* report) {
+    struct tpacket_stats_v3 stats;
+    socklen_t len { sizeof(stats) };
+    uint64_t now = monotonic_ns();
+
+    flow_sampler_read(sampler);
+    memset(&stats, 0, sizeof(stats));
+    self_count(SELF_SYSCALLS);
+    getsockopt(sampler->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len); //the kernel resets them on every read
+    memset(report, 0, offsetof(wire_flows, flows));
+    report->timestamp_ns = now;
+    report->interval_ns = now - sampler->last_ns;
+    report->sample_rate = std::max<uint32_t>(sampler->sample_rate, 1);
+    report->sampled = sampler->table.sampled;
+    report->dropped = stats.tp_drops;
+    report->count = flow_table_top(&sampler->table, report->sample_rate, report->flows);
+    sampler->last_ns = now;
+    flow_table_reset(&sampler->table);
+}
+
+#endif //FLOW_SAMPLER_H
@@ -0,0 +1,261 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cfloat>
+
+#include "protocol.h"
+#include "rates.h"
+#include "spsc_queue.h"
+
+#define HISTORY_TIERS 2 //Number of rollup tiers behind the full resolution ring
+#define HISTORY_GRANULE 16 //Ring capacities are multiples of this, keeps every column on cache line boundaries
+#define DEFAULT_HISTORY_MB 16 //Sample memory of the history unless configured
+
+const uint64_t history_spans_ns[HISTORY_TIERS] { 10000000000ull, 60000000000ull };
+const char* const history_tier_names[HISTORY_TIERS] { "10s", "60s" };
+
+/*History Raw is the full resolution ring of one interface*/
+/*every counter is a column of its own*/
+struct history_raw {
+    size_t capacity;
+    size_t head; //next point to write
+    size_t count; //points held
+    uint64_t* timestamps; //CLOCK_MONOTONIC time of the sample
+    uint64_t* values[RATE_COUNT]; //cumulative counters
+};
+
+/*History Rollup is a ring of fixed length buckets of one interface*/
+/*holding the min/max/avg of the per-second rate of every counter*/
+struct history_rollup {
+    uint64_t span_ns; //length of a bucket
+    size_t capacity;
+    size_t head; //next bucket to write
+    size_t count; //buckets held
+    uint64_t* starts; //start of the bucket, a multiple of span_ns
+    float* min[RATE_COUNT];
+    float* max[RATE_COUNT];
+    float* avg[RATE_COUNT];
+
+    uint64_t open_start; //bucket being filled, written out once a later bucket starts
+    uint32_t open_count;
+    float open_min[RATE_COUNT];
+    float open_max[RATE_COUNT];
+    double open_sum[RATE_COUNT];
+};
+
+/*History Series is everything kept about one interface*/
+struct history_series {
+    history_raw raw;
+    history_rollup rollups[HISTORY_TIERS];
+};
+
+/*History Store is the fixed memory history of every interface*/
+/*all the columns are carved out of a single allocation made at startup*/
+struct history_store {
+    char* memory;
+    size_t len; //bytes of sample memory in use, at most the budget
+    history_series* series; //indexed by rate_state::id
+    size_t num_series;
+};
+
+/*Range of a ring as at most two contiguous runs of slots*/
+struct history_span {
+    size_t begin[2];
+    size_t end[2];
+};
+
+/*Function is responsible for*/
+/*taking the next len bytes of the store memory*/
+inline void* history_carve(char** cursor, size_t len) {
+    void* ptr = *cursor;
+    *cursor += len;
+    return ptr;
+}
+
+/*Function is responsible for*/
+/*stepping a ring index forward*/
+inline size_t history_next(size_t index, size_t capacity) {
+    return index + 1 == capacity ? 0 : index + 1;
+}
+
+/*History Init function is responsible for*/
+/*splitting budget bytes between num_series interfaces and their tiers*/
+/*half of it holds full resolution points, the rest is shared by the rollups*/
+/*returns false if the budget cannot hold a useful history*/
+bool history_init(history_store* store, size_t num_series, size_t budget) {
+    const size_t raw_len = sizeof(uint64_t) * (1 + RATE_COUNT);
+    const size_t rollup_len = sizeof(uint64_t) + 3 * sizeof(float) * RATE_COUNT;
+    size_t per_series, raw_cap, rollup_cap;
+    char* cursor;
+
+    memset(store, 0, sizeof(*store));
+    if(num_series == 0) {
+        return false;
+    }
+    per_series = budget / num_series;
+    raw_cap = per_series / 2 / raw_len / HISTORY_GRANULE * HISTORY_GRANULE;
+    rollup_cap = per_series / 2 / HISTORY_TIERS / rollup_len / HISTORY_GRANULE * HISTORY_GRANULE;
+    if(raw_cap == 0 || rollup_cap == 0) {
+        return false;
+    }
+
+    store->len = num_series * (raw_cap * raw_len + HISTORY_TIERS * rollup_cap * rollup_len);
+    if((store->memory = (char*)aligned_alloc(CACHE_LINE, store->len)) == nullptr) {
+        return false;
+    }
+    memset(store->memory, 0, store->len); //fault the pages in now rather than on the first ticks
+    store->series = new history_series[num_series]();
+    store->num_series = num_series;
+
+    cursor = store->memory;
+    for (size_t s = 0; s < num_series; s++) {
+        history_raw* raw = &store->series[s].raw;
+        raw->capacity = raw_cap;
+        raw->timestamps = (uint64_t*)history_carve(&cursor, raw_cap * sizeof(uint64_t));
+        for (int c = 0; c < RATE_COUNT; c++)
+            raw->values[c] = (uint64_t*)history_carve(&cursor, raw_cap * sizeof(uint64_t));
+
+        for (int t = 0; t < HISTORY_TIERS; t++) {
+            history_rollup* rollup = &store->series[s].rollups[t];
+            rollup->span_ns = history_spans_ns[t];
+            rollup->capacity = rollup_cap;
+            rollup->starts = (uint64_t*)history_carve(&cursor, rollup_cap * sizeof(uint64_t));
+            for (int c = 0; c < RATE_COUNT; c++) {
+                rollup->min[c] = (float*)history_carve(&cursor, rollup_cap * sizeof(float));
+                rollup->max[c] = (float*)history_carve(&cursor, rollup_cap * sizeof(float));
+                rollup->avg[c] = (float*)history_carve(&cursor, rollup_cap * sizeof(float));
+            }
+        }
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*releasing the memory of the store*/
+void history_free(history_store* store) {
+    free(store->memory);
+    delete[] store->series;
+    memset(store, 0, sizeof(*store));
+}
+
+/*Function is responsible for*/
+/*emptying a series before its id is given to another interface*/
+void history_clear(history_series* series) {
+    series->raw.head = series->raw.count = 0;
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        series->rollups[t].head = series->rollups[t].count = 0;
+        series->rollups[t].open_count = 0;
+    }
+}
+
+/*Function is responsible for*/
+/*writing the open bucket of a rollup into its ring*/
+void history_close_bucket(history_rollup* rollup) {
+    size_t slot = rollup->head;
+
+    rollup->starts[slot] = rollup->open_start;
+    for (int c = 0; c < RATE_COUNT; c++) {
+        rollup->min[c][slot] = rollup->open_min[c];
+        rollup->max[c][slot] = rollup->open_max[c];
+        rollup->avg[c][slot] = rollup->open_sum[c] / rollup->open_count;
+    }
+    rollup->head = history_next(slot, rollup->capacity);
+    if(rollup->count < rollup->capacity)
+        ++rollup->count;
+    rollup->open_count = 0;
+}
+
+/*History Append function is responsible for*/
+/*storing a sample at full resolution and folding its rates into the rollups*/
+/*rate is nullptr when the rate engine could not compute one for the sample*/
+void history_append(history_series* series, const wire_sample* sample, const double* rate) {
+    history_raw* raw = &series->raw;
+    size_t slot = raw->head;
+
+    raw->timestamps[slot] = sample->timestamp_ns;
+    for (int c = 0; c < RATE_COUNT; c++)
+        raw->values[c][slot] = sample->stats.counters[rate_counters.ids[c]];
+    raw->head = history_next(slot, raw->capacity);
+    if(raw->count < raw->capacity)
+        ++raw->count;
+
+    if(rate == nullptr) {
+        return;
+    }
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        history_rollup* rollup = &series->rollups[t];
+        uint64_t start = sample->timestamp_ns - sample->timestamp_ns % rollup->span_ns;
+
+        if(rollup->open_count > 0 && start != rollup->open_start)
+            history_close_bucket(rollup);
+        if(rollup->open_count == 0) {
+            rollup->open_start = start;
+            for (int c = 0; c < RATE_COUNT; c++) {
+                rollup->open_min[c] = FLT_MAX;
+                rollup->open_max[c] = 0;
+                rollup->open_sum[c] = 0;
+            }
+        }
+        for (int c = 0; c < RATE_COUNT; c++) {
+            float value = rate[c];
+            if(value < rollup->open_min[c]) rollup->open_min[c] = value;
+            if(value > rollup->open_max[c]) rollup->open_max[c] = value;
+            rollup->open_sum[c] += rate[c];
+        }
+        ++rollup->open_count;
+    }
+}
+
+/*History Range function is responsible for*/
+/*finding the slots of a ring whose time lies in [from_ns, to_ns]*/
+/*times must grow from the oldest slot to the newest, as every ring here does*/
+/*returns the number of slots in the range*/
+size_t history_range(const uint64_t* times, size_t capacity, size_t head, size_t count,
+                     uint64_t from_ns, uint64_t to_ns, history_span* span) {
+    size_t oldest = (head + capacity - count) % capacity;
+    size_t l { 0 }, h { count }, lo, hi;
+
+    //binary search over the logical order of the ring
+    while (l < h) { //first slot at or after from_ns
+        size_t mid = l + (h - l) / 2;
+        if(times[(oldest + mid) % capacity] < from_ns) l = mid + 1;
+        else h = mid;
+    }
+    lo = l;
+    h = count;
+    while (l < h) { //first slot after to_ns
+        size_t mid = l + (h - l) / 2;
+        if(times[(oldest + mid) % capacity] <= to_ns) l = mid + 1;
+        else h = mid;
+    }
+    hi = l;
+
+    size_t first = (oldest + lo) % capacity, num = hi - lo;
+    span->begin[0] = first;
+    span->end[0] = first + num < capacity ? first + num : capacity;
+    span->begin[1] = 0;
+    span->end[1] = num - (span->end[0] - span->begin[0]);
+    return num;
+}
+
+/*Function is responsible for*/
+/*printing bucket slot of a rollup into data*/
+int format_rollup(char* data, size_t len, const char* interface, int tier, const history_rollup* rollup, size_t slot) {
+    int written = snprintf(data, len, "history %s %s start:%.3f", interface, history_tier_names[tier], rollup->starts[slot] / 1e9);
+
+    for (int c = 0; c < RATE_COUNT && written > 0 && (size_t)written < len; c++) {
+        written += snprintf(data + written, len - written, " %s:%.0f/%.0f/%.0f", rate_name(c),
+            rollup->min[c][slot], rollup->avg[c][slot], rollup->max[c][slot]);
+    }
+    if(written > 0 && (size_t)written < len - 1) {
+        data[written++] = '\n';
+        data[written] = '\0';
+    }
+    return written;
+}
+
+#endif //HISTORY_H
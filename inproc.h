@@ -0,0 +1,312 @@
+#ifndef INPROC_H
+#define INPROC_H
+
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "sysfs_collector.h"
+#include "netlink.h"
+#include "spsc_queue.h"
+#include "scheduler.h"
+#include "self_metrics.h"
+
+#define WORKER_QUEUE_TICKS 4 //Ticks of samples a worker queue can hold before it drops
+
+/*Sample handed from a worker to the aggregator*/
+struct queued_sample {
+    uint64_t sent_ns; //CLOCK_MONOTONIC time the sample was queued
+    uint32_t slot; //slot of the pool the sample was taken for
+    wire_sample sample;
+};
+
+/*Worker Entry is one slot of the pool owned by a worker*/
+/*the aggregator may change the wanted interface at any time*/
+/*and the worker picks the change up on its next tick*/
+struct worker_entry {
+    std::atomic<uint32_t> seq; //seqlock of wanted, odd while the aggregator writes it
+    char wanted[IFNAMSIZ]; //interface the slot should collect, empty to stop
+    uint32_t applied; //seq of the wanted interface being collected, worker only
+};
+
+/*Collector Worker gathers the statistics of a shard of the slots*/
+/*and hands them to the aggregator through its own queue*/
+/*slot s of the pool is entry s / num_workers of worker s % num_workers*/
+struct collector_worker {
+    std::thread thread;
+    size_t index; //position of the worker in the pool
+    worker_entry* entries;
+    size_t num_entries;
+    size_t num_interfaces; //entries being collected
+    std::atomic<uint32_t> changes; //bumped by the aggregator whenever an entry changed
+    uint32_t seen_changes; //changes the worker applied, worker only
+    char (*interfaces)[IFNAMSIZ]; //interface of every entry, empty if the entry is free
+    sysfs_collector* sysfs; //one per entry with the sysfs backend
+    netlink_collector netlink; //one dump per tick with the netlink backend
+    interface_stats* stats; //scratch space of the netlink backend
+    spsc_queue<queued_sample> queue;
+    sample_scheduler scheduler; //ticks of the worker, in phase with every other worker
+    self_metrics* metrics; //self metrics of the worker thread
+};
+
+/*Collector Pool is a fixed set of workers collecting inside networkMonitor*/
+/*for a fixed number of slots whose interfaces come and go*/
+struct collector_pool {
+    collector_worker* workers;
+    size_t num_workers;
+    size_t num_slots;
+    collector_backend backend;
+    uint64_t interval_ns; //sampling interval
+    int notify_fd; //eventfd signalled by the workers once per tick
+    int stop_fd; //eventfd signalled by the aggregator on shutdown
+    std::atomic<bool> is_running;
+};
+
+/*Function is responsible for*/
+/*sleeping until the next tick of the worker or until the pool is stopped*/
+/*returns false if the pool is stopped*/
+bool collector_worker_wait(collector_pool* pool, collector_worker* worker) {
+    struct pollfd pfds[2] { { worker->scheduler.fd, POLLIN, 0 }, { pool->stop_fd, POLLIN, 0 } };
+
+    while (pool->is_running.load(std::memory_order_relaxed)) {
+        self_count(SELF_SYSCALLS);
+        if(poll(pfds, 2, -1) > 0 && (pfds[0].revents & POLLIN) && scheduler_consume(&worker->scheduler) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*Collector Worker Apply function is responsible for*/
+/*switching the entries the aggregator changed to their wanted interface*/
+/*an entry caught in the middle of a change is applied on the next tick*/
+void collector_worker_apply(collector_pool* pool, collector_worker* worker) {
+    uint32_t changes = worker->changes.load(std::memory_order_acquire);
+    char wanted[IFNAMSIZ];
+    bool is_done { true };
+
+    if(changes == worker->seen_changes) {
+        return;
+    }
+    for (size_t e = 0; e < worker->num_entries; e++) {
+        worker_entry* entry = &worker->entries[e];
+        uint32_t seq = entry->seq.load(std::memory_order_acquire);
+        if(seq == entry->applied) {
+            continue;
+        }
+        memcpy(wanted, entry->wanted, IFNAMSIZ);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if((seq & 1) || entry->seq.load(std::memory_order_relaxed) != seq) { //still being written
+            is_done = false;
+            continue;
+        }
+        entry->applied = seq;
+        if(worker->interfaces[e][0] != '\0') {
+            --worker->num_interfaces;
+            if(pool->backend == BACKEND_SYSFS)
+                sysfs_collector_close(&worker->sysfs[e]);
+        }
+        memcpy(worker->interfaces[e], wanted, IFNAMSIZ);
+        if(pool->backend == BACKEND_NETLINK) {
+            memcpy(worker->netlink.interfaces[e], wanted, IFNAMSIZ);
+            worker->netlink.indexes[e] = 0;
+        }
+        if(wanted[0] != '\0') {
+            ++worker->num_interfaces;
+            if(pool->backend == BACKEND_SYSFS)
+                sysfs_collector_init(&worker->sysfs[e], wanted);
+        }
+    }
+    if(is_done)
+        worker->seen_changes = changes;
+}
+
+/*Collector Worker Main function is responsible for*/
+/*sampling the shard on every tick until the pool is stopped*/
+void collector_worker_main(collector_pool* pool, collector_worker* worker) {
+    queued_sample item;
+    uint64_t one { 1 }, start;
+
+    self_block = worker->metrics;
+    do { //first sample right away, the next ones on the ticks
+        collector_worker_apply(pool, worker);
+        if(worker->num_interfaces == 0) {
+            continue;
+        }
+        if(pool->backend == BACKEND_NETLINK) {
+            start = monotonic_ns();
+            netlink_collector_read(&worker->netlink, worker->stats);
+            self_record(HIST_COLLECT, monotonic_ns() - start);
+        }
+        item.sent_ns = monotonic_ns();
+        item.sample.timestamp_ns = item.sent_ns; //a dump reads the whole shard at once
+        item.sample.missed_ticks = worker->scheduler.missed;
+        for (size_t e = 0; e < worker->num_entries; e++) {
+            if(worker->interfaces[e][0] == '\0') {
+                continue;
+            }
+            item.slot = e * pool->num_workers + worker->index;
+            memcpy(item.sample.interface, worker->interfaces[e], IFNAMSIZ);
+            if(pool->backend == BACKEND_NETLINK) {
+                item.sample.stats = worker->stats[e];
+            } else {
+                item.sample.timestamp_ns = monotonic_ns();
+                sysfs_collector_read(&worker->sysfs[e], &item.sample.stats);
+                self_record(HIST_COLLECT, monotonic_ns() - item.sample.timestamp_ns);
+            }
+            start = monotonic_ns();
+            spsc_push(&worker->queue, item);
+            self_record(HIST_PUBLISH, monotonic_ns() - start);
+        }
+        self_count(SELF_SAMPLES, worker->num_interfaces);
+        self_count(SELF_SYSCALLS);
+        if(write(pool->notify_fd, &one, sizeof(one)) < 0) { //wake the aggregator once per tick
+            perror("Error while notifying the aggregator");
+        }
+    } while (collector_worker_wait(pool, worker));
+}
+
+/*Collector Pool Set function is responsible for*/
+/*making a slot collect interface, or nothing if interface is empty*/
+/*called by the aggregator only, the worker switches on its next tick*/
+void collector_pool_set(collector_pool* pool, size_t slot, const char* interface) {
+    collector_worker* worker = &pool->workers[slot % pool->num_workers];
+    worker_entry* entry = &worker->entries[slot / pool->num_workers];
+    uint32_t seq = entry->seq.load(std::memory_order_relaxed);
+
+    entry->seq.store(seq + 1, std::memory_order_relaxed); //odd: change in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    memset(entry->wanted, 0, IFNAMSIZ);
+    memcpy(entry->wanted, interface, strnlen(interface, IFNAMSIZ-1));
+    entry->seq.store(seq + 2, std::memory_order_release);
+    worker->changes.fetch_add(1, std::memory_order_release);
+}
+
+/*Collector Pool Start function is responsible for*/
+/*sharding num_slots slots across num_workers threads and starting them*/
+/*slot i starts with interfaces[i], an empty name leaves it free*/
+/*worker w writes its self metrics to blocks[w]*/
+bool collector_pool_start(collector_pool* pool, const char (*interfaces)[IFNAMSIZ], size_t num_slots, size_t num_workers,
+                          collector_backend backend, uint64_t interval_ns, self_metrics* blocks) {
+    if(num_workers > num_slots)
+        num_workers = num_slots;
+    if(num_workers == 0)
+        num_workers = 1;
+
+    pool->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pool->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(pool->notify_fd < 0 || pool->stop_fd < 0) {
+        return false;
+    }
+    pool->backend = backend;
+    pool->interval_ns = interval_ns;
+    pool->num_workers = num_workers;
+    pool->num_slots = num_slots;
+    pool->workers = new collector_worker[num_workers];
+    pool->is_running.store(true);
+
+    for (size_t w = 0; w < num_workers; w++) {
+        collector_worker* worker = &pool->workers[w];
+        worker->index = w;
+        worker->num_entries = (num_slots - w + num_workers - 1) / num_workers;
+        worker->num_interfaces = 0;
+        worker->entries = new worker_entry[worker->num_entries]();
+        worker->changes.store(0);
+        worker->seen_changes = 0;
+        worker->interfaces = new char[worker->num_entries][IFNAMSIZ]();
+        worker->sysfs = nullptr;
+        worker->stats = nullptr;
+        worker->metrics = &blocks[w];
+        if(backend == BACKEND_NETLINK) {
+            worker->stats = new interface_stats[worker->num_entries];
+            const char** names = new const char*[worker->num_entries];
+            for (size_t e = 0; e < worker->num_entries; e++)
+                names[e] = worker->interfaces[e];
+            bool is_open = netlink_collector_init(&worker->netlink, names, worker->num_entries);
+            delete[] names;
+            if(!is_open) {
+                return false;
+            }
+        } else {
+            worker->sysfs = new sysfs_collector[worker->num_entries]();
+        }
+        spsc_init(&worker->queue, worker->num_entries * WORKER_QUEUE_TICKS);
+        if(!scheduler_start(&worker->scheduler, interval_ns, 0)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < num_slots; i++) {
+        if(interfaces[i][0] != '\0')
+            collector_pool_set(pool, i, interfaces[i]);
+    }
+    for (size_t w = 0; w < num_workers; w++) {
+        pool->workers[w].thread = std::thread(collector_worker_main, pool, &pool->workers[w]);
+    }
+    return true;
+}
+
+/*Collector Pool Drain function is responsible for*/
+/*handing every queued sample of every worker to handle*/
+/*returns the number of samples drained*/
+size_t collector_pool_drain(collector_pool* pool, void (*handle)(const queued_sample*)) {
+    queued_sample item;
+    uint64_t ticks;
+    size_t count { 0 };
+
+    self_count(SELF_SYSCALLS);
+    if(read(pool->notify_fd, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN) {
+        perror("Error while reading the worker notification");
+    }
+    for (size_t w = 0; w < pool->num_workers; w++) {
+        size_t depth { 0 };
+        while (spsc_pop(&pool->workers[w].queue, &item)) {
+            handle(&item);
+            ++depth;
+        }
+        self_queue_depth(pool->workers[w].metrics, depth);
+        count += depth;
+    }
+    return count;
+}
+
+/*Collector Pool Stop function is responsible for*/
+/*stopping and joining the workers and releasing their resources*/
+void collector_pool_stop(collector_pool* pool) {
+    uint64_t one { 1 };
+
+    pool->is_running.store(false);
+    if(write(pool->stop_fd, &one, sizeof(one)) < 0) {
+        perror("Error while stopping the workers");
+    }
+    for (size_t w = 0; w < pool->num_workers; w++) {
+        collector_worker* worker = &pool->workers[w];
+        if(worker->thread.joinable())
+            worker->thread.join();
+        if(pool->backend == BACKEND_NETLINK) {
+            netlink_collector_close(&worker->netlink);
+            delete[] worker->stats;
+        } else {
+            for (size_t e = 0; e < worker->num_entries; e++) {
+                if(worker->interfaces[e][0] != '\0')
+                    sysfs_collector_close(&worker->sysfs[e]);
+            }
+            delete[] worker->sysfs;
+        }
+        delete[] worker->entries;
+        delete[] worker->interfaces;
+        spsc_free(&worker->queue);
+        scheduler_stop(&worker->scheduler);
+    }
+    delete[] pool->workers;
+    pool->workers = nullptr;
+    close(pool->notify_fd);
+    close(pool->stop_fd);
+}
+
+#endif //INPROC_H
@@ -16,49 +16,122 @@ Date: 11/19/2021
 #include <cstring>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <fstream>
 #include <iostream>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
 
 #include "params.h"
+#include "sysfs_collector.h"
+#include "netlink.h"
+#include "shm_channel.h"
+#include "flow_sampler.h"
+#include "scheduler.h"
+#include "self_metrics.h"
 
 static void signal_handler(int signal); //siganl handler
 void socket_setup(); //socket setuper
-void get_statistics(char* data);  // statistics gatherer
+void get_statistics(wire_sample* sample);  // statistics gatherer
+void handle_link_change(); // link state reaction
+void publish_statistics(const wire_sample* sample); // statistics sender
+void publish_flows(); // top talkers sender
 
-char buffer[BUF_LEN];
+char buffer[FRAME_MAX_LEN]; //outgoing frame
+frame_reader reader; //incoming frames
 char interface[IFNAMSIZ];
+collector_backend backend { BACKEND_SYSFS }; //statistics backend
+sysfs_collector collector; //persistent sysfs descriptors of the interface
+netlink_collector nl_collector; //netlink socket and receive buffer
+link_watch watch; //RTNLGRP_LINK subscription for the interface
+shm_channel channel; //shared memory passed by networkMonitor
+shm_slot* slot { nullptr }; //slot of the interface, samples go to the socket if null
+self_region region; //self metrics shared with networkMonitor
+sample_scheduler scheduler; //sampling ticks
+flow_sampler sampler { -1 }; //sampled packets of the interface, closed unless a sample rate is given
+wire_flows flows; //top talkers of the last interval
 
 int client_fd;
 bool is_running;
+bool is_link_up { true }; //link state last reported to networkMonitor
 
 int main(int argc, char const *argv[]) {
-    //The interface must be passed as an argument
-    if (argc != 2) {
+    //The interface must be passed as an argument, everything else is optional
+    int opt;
+    long interval_ms { DEFAULT_INTERVAL_MS };
+    long sample_rate { 0 }; //sample one packet out of this many for the top talkers, 0 samples none
+    while ((opt = getopt(argc, (char* const*)argv, "b:i:s:R:M:u:F:")) != -1) {
+        switch (opt) {
+        case 'b': //statistics backend
+            if(!parse_backend(optarg, &backend)) {
+                std::cerr << "InterfaceMonitor: unknown backend " << optarg << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i': //sampling interval in milliseconds
+            interval_ms = atol(optarg);
+            if(!interval_valid(interval_ms)) {
+                std::cerr << "InterfaceMonitor: invalid interval " << optarg << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's': { //"<memfd>:<slot>" of the shared memory transport
+            int shm_fd;
+            unsigned int slot_index;
+            if(sscanf(optarg, "%d:%u", &shm_fd, &slot_index) != 2 || !shm_channel_attach(&channel, shm_fd)
+                || slot_index >= channel.header->num_slots) {
+                std::cerr << "InterfaceMonitor: invalid shared memory slot " << optarg << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            slot = &channel.slots[slot_index];
+            break;
+        }
+        case 'F': //flow sample rate
+            sample_rate = atol(optarg);
+            if(sample_rate < 0 || sample_rate > UINT32_MAX) {
+                std::cerr << "InterfaceMonitor: invalid flow sample rate " << optarg << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R': //directory of the sysfs interfaces
+            sysfs_root = optarg;
+            break;
+        case 'u': //socket networkMonitor listens on
+            socket_path = optarg;
+            break;
+        case 'M': { //"<memfd>:<block>" of the self metrics
+            int metrics_fd;
+            unsigned int block;
+            if(sscanf(optarg, "%d:%u", &metrics_fd, &block) != 2 || !self_region_attach(&region, metrics_fd)
+                || block >= region.header->num_blocks) {
+                std::cerr << "InterfaceMonitor: invalid self metrics block " << optarg << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            self_block = &region.blocks[block];
+            break;
+        }
+        default:
+            std::cerr << "Usage: " << argv[0] << " [-b backend] [-i interval_ms] [-F flow_sample_rate] [-s memfd:slot] [-M memfd:block] [-R sysfs_root] [-u socket_path] interface" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1) {
         std::cerr << "InterfaceMonitor: invalid number of arguments" << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    int entropy; //entropy counter
-    bool permitted { true }; //permission flag
-
-    int key_fd = open(key_file, O_RDONLY);
-    if(ioctl(key_fd, RNDGETENTCNT, &entropy) < 0) { //check if called by parent
-        std::cout << strerror(errno) << std::endl;
-        permitted = false;
-    } 
-    if(entropy > 10) {
-        std::cout << "InterfaceMonitor: Permission not granted" << std::endl;
-        permitted = false;
+    //Only networkMonitor hands out a self metrics block, the memfd is inherited through exec
+    bool permitted { region.header != nullptr }; //permission flag
+    if(!permitted) {
+        std::cout << "InterfaceMonitor: Permission not granted, the monitor is started by networkMonitor" << std::endl;
     }
-    close(key_fd);
 
     if(permitted) {
-        char data[320];
-        int ret, len;
+        wire_sample sample; //latest statistics of the interface
+        frame_header header;
+        const char* payload;
         
         //Set up a signal handler to terminate the program gracefully
         struct sigaction action;
@@ -71,45 +144,93 @@ int main(int argc, char const *argv[]) {
             print_error((char*)"Error while setting action for a signal", true);
         }
 
-        strncpy(interface, argv[1], BUF_LEN); //The interface has been passed as an argument
+        strncpy(interface, argv[optind], IFNAMSIZ-1); //The interface has been passed as an argument
+        if(backend == BACKEND_NETLINK) {
+            const char* interfaces[] { interface };
+            if(!netlink_collector_init(&nl_collector, interfaces, 1)) { //open the netlink socket once
+                print_error((char*)"Error while creating the netlink socket", true);
+            }
+        } else {
+            sysfs_collector_init(&collector, interface); //open the sysfs attributes once
+        }
+
+        if(!link_watch_open(&watch, interface)) { //subscribe to link notifications
+            print_error((char*)"Error while subscribing to link notifications", true);
+        }
+
+        if(sample_rate > 0 && !flow_sampler_open(&sampler, interface, sample_rate)) { //the counters are sampled anyway
+            print_error((char*)"Error while opening the flow sampler", false);
+        }
 
         //Setup socket connection
         socket_setup();
 
-        //Send "ready" message
-        send(client_fd, buffer, "ready");
-        //Receive "monitor" message
-        receive(client_fd, buffer);
-
+        //Send "ready" message carrying the interface name
+        wire_hello hello;
+        memset(&hello, 0, sizeof(hello));
+        strncpy(hello.interface, interface, IFNAMSIZ-1);
+        frame_reader_init(&reader);
+        send(client_fd, buffer, MSG_READY, &hello, sizeof(hello), 1);
 
         //If message is "monitor" then start monitoring
-        if(strcmp("monitor", buffer) == 0) {
+        if(receive(client_fd, &reader, &header, &payload) && header.type == MSG_MONITOR) {
             //Send "monitoring" message
-            send(client_fd, buffer, "monitoring");    
+            send(client_fd, buffer, MSG_MONITORING);
+
+            //Sample on the interval boundaries shared with every other monitor
+            if(!scheduler_start(&scheduler, interval_ms * 1000000ull, 0)) {
+                print_error((char*)"Error while creating the sampling timer", true);
+            }
+            struct pollfd pfds[3] { { scheduler.fd, POLLIN, 0 }, { watch.fd, POLLIN, 0 }, { sampler.fd, POLLIN, 0 } }; //a negative fd is ignored
+            handle_link_change(); //the link may already be down
+
+            get_statistics(&sample); //first sample right away, the next ones on the ticks
+            publish_statistics(&sample);
 
             is_running = true;
             while(is_running) {
-                get_statistics(data); //get interface statistics
-
-                if(!is_link_up(interface)) { //check if link is down
-                    send(client_fd, buffer, "link_down"); //notify networkMonitor
-                    receive(client_fd, buffer); //wait for signal to set link up
-                    if(strcmp("link_up", buffer) == 0) {
-                        set_link_up(interface, 1); // set link up
-                    }
+                self_count(SELF_SYSCALLS);
+                if(poll(pfds, 3, -1) <= 0) { //SIGINT interrupts the wait
+                    continue;
+                }
+                if((pfds[1].revents & POLLIN) && link_watch_read(&watch)) { //react to link changes as they are delivered
+                    handle_link_change();
+                    get_statistics(&sample); //report the new state right away
+                    publish_statistics(&sample);
+                }
+                if(pfds[2].revents & POLLERR) { //e.g. ENETDOWN, reading the error clears it
+                    int error;
+                    socklen_t len { sizeof(error) };
+                    getsockopt(sampler.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                }
+                if(pfds[2].revents & POLLIN) { //hand the retired blocks back before the ring fills up
+                    flow_sampler_read(&sampler);
+                }
+                if((pfds[0].revents & POLLIN) && scheduler_consume(&scheduler) > 0) {
+                    get_statistics(&sample); //get interface statistics
+                    publish_flows(); //who made them grow, networkMonitor writes it after the sample
+                    publish_statistics(&sample); //send interface statistics
                 }
-
-                send(client_fd, buffer, data); //send interface statistics
-                sleep(1);
             }
+            scheduler_stop(&scheduler);
         }
 
         //Send "done" message
-        send(client_fd, buffer, "done");
+        send(client_fd, buffer, MSG_DONE);
         close(client_fd);
+        link_watch_close(&watch);
+        flow_sampler_close(&sampler);
+        shm_channel_close(&channel);
+        self_block = &self_fallback;
+        self_region_close(&region);
+        if(backend == BACKEND_NETLINK) {
+            netlink_collector_close(&nl_collector);
+        } else {
+            sysfs_collector_close(&collector);
+        }
     }
 
-    std::cout << "InterfaceMonitor(" << getpid() << "): finished" << std::endl;
+    std::cout << "InterfaceMonitor(" << getpid() << "): finished, " << scheduler.missed << " missed ticks" << std::endl;
 
     return 0;
 }
@@ -132,7 +253,7 @@ static void signal_handler(int signal) {
 }
 
 /*Socket Setup function is responsible for*/
-/*connecting to the socket file in /tmp */
+/*connecting to the socket file of networkMonitor */
 void socket_setup() {
     struct sockaddr_un client_addr;
 
@@ -146,7 +267,7 @@ void socket_setup() {
     //Set the socket path to a local socket file
     strncpy(client_addr.sun_path, socket_path, sizeof(client_addr.sun_path)-1);
     #ifdef DEBUG
-        std::cout << "Client: server_addr.sun_path - " << server_addr.sun_path << std::endl;
+        std::cout << "Client: client_addr.sun_path - " << client_addr.sun_path << std::endl;
     #endif
 
     #ifdef DEBUG
@@ -159,106 +280,55 @@ void socket_setup() {
     }
 }
 
-/*Get Statistics function is responsible for*/
-/*gathering statistics from given inteface*/
-/*putting information into data*/
-void get_statistics(char* data) {
-    char interface_path[BUF_LEN];
-
-    std::string operstate;
-    unsigned int carrier_up_count { 0 };
-    unsigned int carrier_down_count { 0 };
-
-    unsigned int tx_bytes { 0 };
-    unsigned int rx_bytes { 0 };
-    unsigned int tx_packets { 0 };
-    unsigned int rx_packets { 0 };
-    unsigned int tx_dropped { 0 };
-    unsigned int rx_dropped { 0 };
-    unsigned int tx_errors { 0 };            
-    unsigned int rx_errors { 0 };
-
-    std::ifstream infile;
-    sprintf(interface_path, "/sys/class/net/%s/operstate", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> operstate;
-        infile.close();
-    }
-    
-    sprintf(interface_path, "/sys/class/net/%s/carrier_up_count", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> carrier_up_count;
-        infile.close();
-    }
-    
-    sprintf(interface_path, "/sys/class/net/%s/carrier_down_count", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> carrier_down_count;
-        infile.close();
+/*Handle Link Change function is responsible for*/
+/*telling networkMonitor when the link goes down and when it is up again*/
+/*networkMonitor remediates the link on its own, the sampling goes on meanwhile*/
+void handle_link_change() {
+    if(watch.is_present && link_watch_is_up(&watch) != is_link_up) { //report transitions only
+        is_link_up = !is_link_up;
+        send(client_fd, buffer, is_link_up ? MSG_LINK_UP : MSG_LINK_DOWN);
     }
+}
 
-    sprintf(interface_path, "/sys/class/net/%s/statistics/tx_bytes", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> tx_bytes;
-        infile.close();
-    }
-    
-    sprintf(interface_path, "/sys/class/net/%s/statistics/rx_bytes", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> rx_bytes;
-        infile.close();
-    }
-    
-    sprintf(interface_path, "/sys/class/net/%s/statistics/tx_packets", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> tx_packets;
-        infile.close();
-    }
-    
-    sprintf(interface_path, "/sys/class/net/%s/statistics/rx_packets", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> rx_packets;
-        infile.close();
+/*Publish Statistics function is responsible for*/
+/*handing a sample to networkMonitor through the chosen transport*/
+void publish_statistics(const wire_sample* sample) {
+    uint64_t start = monotonic_ns();
+    if(slot != nullptr) {
+        shm_slot_write(slot, sample); //no syscall, networkMonitor reads the slot on its own
+    } else {
+        send(client_fd, buffer, MSG_SAMPLES, sample, sizeof(*sample), 1);
     }
+    self_record(HIST_PUBLISH, monotonic_ns() - start);
+    self_count(SELF_SAMPLES);
+}
 
-    sprintf(interface_path, "/sys/class/net/%s/statistics/tx_dropped", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> tx_dropped;
-        infile.close();
+/*Publish Flows function is responsible for*/
+/*sending the top talkers of the interval the sample about to be sent ends*/
+/*an interval without any sampled packet is not reported*/
+void publish_flows() {
+    if(sampler.fd < 0) {
+        return;
     }
-    
-    sprintf(interface_path, "/sys/class/net/%s/statistics/rx_dropped", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> rx_dropped;
-        infile.close();
+    flow_sampler_report(&sampler, &flows);
+    if(flows.sampled > 0 || flows.dropped > 0) {
+        send(client_fd, buffer, MSG_FLOWS, &flows, sizeof(flows), 1);
     }
+}
 
-    sprintf(interface_path, "/sys/class/net/%s/statistics/tx_errors", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> tx_errors;
-        infile.close();
-    }
-    
-    sprintf(interface_path, "/sys/class/net/%s/statistics/rx_errors", interface);
-    infile.open(interface_path);
-    if(infile.is_open()) {
-        infile >> rx_errors;
-        infile.close();
+/*Get Statistics function is responsible for*/
+/*gathering statistics from given inteface*/
+/*putting information into sample*/
+void get_statistics(wire_sample* sample) {
+    memcpy(sample->interface, interface, IFNAMSIZ);
+    sample->timestamp_ns = monotonic_ns();
+    sample->missed_ticks = scheduler.missed;
+
+    //a missing interface is reported with zeroed statistics
+    if(backend == BACKEND_NETLINK) {
+        netlink_collector_read(&nl_collector, &sample->stats);
+    } else {
+        sysfs_collector_read(&collector, &sample->stats);
     }
-
-    sprintf(data, "Interface:%s state:%s up_count:%d down_count:%d\n"
-        "rx_bytes:%d rx_dropped:%d rx_errors:%d rx_packets:%d\n"
-        "tx_bytes:%d tx_dropped:%d tx_errors:%d tx_packets:%d\n",
-        interface, operstate.c_str(), carrier_up_count, carrier_down_count, rx_bytes,
-        rx_dropped, rx_errors, rx_packets, tx_bytes, tx_dropped, tx_errors, tx_packets);
-}
\ No newline at end of file
+    self_record(HIST_COLLECT, monotonic_ns() - sample->timestamp_ns);
+}
@@ -0,0 +1,479 @@
+#ifndef NETLINK_H
+#define NETLINK_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/genetlink.h>
+#include <linux/if_link.h>
+
+#include "statistics.h"
+#include "self_metrics.h"
+
+#define NETLINK_BUF_LEN 32768 //Receive buffer length, the kernel never builds a dump chunk bigger than 32 KiB
+#define NETLINK_TIMEOUT 1000 //Milliseconds to wait for a reply to a request
+#define QSTATS_FAMILY "netdev" //Generic netlink family of the queue counters, Linux 6.9 and later
+#define QSTATS_CMD_GET 12 //NETDEV_CMD_QSTATS_GET
+#define QSTATS_SCOPE_QUEUE 1 //NETDEV_QSTATS_SCOPE_QUEUE, a message per queue instead of per device
+
+//Operational states as printed by /sys/class/net/<interface>/operstate, indexed by IF_OPER_*
+const char* const operstate_names[] {
+    "unknown", "notpresent", "down", "lowerlayerdown", "testing", "dormant", "up"
+};
+
+/*Netlink Collector gathers the statistics of all monitored interfaces*/
+/*from the rtnetlink link messages using a single receive buffer*/
+struct netlink_collector {
+    int fd;
+    uint32_t seq;
+    char* buffer; //receive buffer allocated once at startup
+    size_t num_links;
+    char (*interfaces)[IFNAMSIZ];
+    int* indexes; //cached interface index, 0 if not known yet
+    int genl_fd; //generic netlink socket of the queue counters, -1 without them
+    uint16_t qstats_family; //id of QSTATS_FAMILY
+};
+
+/*Netlink Open function is responsible for*/
+/*creating a NETLINK_ROUTE socket subscribed to the given multicast groups*/
+int netlink_open(uint32_t groups) {
+    struct sockaddr_nl addr;
+    int fd;
+
+    if((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*Function is responsible for*/
+/*appending an attribute to a request, the caller made room for it*/
+void netlink_add_attr(struct nlmsghdr* header, uint16_t type, const void* data, size_t len) {
+    struct rtattr* attr = (struct rtattr*)((char*)header + NLMSG_ALIGN(header->nlmsg_len));
+    attr->rta_type = type;
+    attr->rta_len = RTA_LENGTH(len);
+    memset(RTA_DATA(attr), 0, RTA_ALIGN(attr->rta_len) - RTA_LENGTH(0));
+    memcpy(RTA_DATA(attr), data, len);
+    header->nlmsg_len = NLMSG_ALIGN(header->nlmsg_len) + RTA_ALIGN(attr->rta_len);
+}
+
+/*Function is responsible for*/
+/*requesting RTM_GETLINK for the given interface or for every interface if nullptr*/
+bool netlink_request_link(int fd, uint32_t seq, const char* interface) {
+    struct {
+        struct nlmsghdr header;
+        struct ifinfomsg info;
+        char attrs[RTA_SPACE(IFNAMSIZ)];
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(request.info));
+    request.header.nlmsg_type = RTM_GETLINK;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = seq;
+    request.info.ifi_family = AF_UNSPEC;
+
+    if(interface == nullptr) {
+        request.header.nlmsg_flags |= NLM_F_DUMP;
+    } else { //the kernel looks the link up by IFLA_IFNAME when no index is given
+        netlink_add_attr(&request.header, IFLA_IFNAME, interface, strnlen(interface, IFNAMSIZ-1) + 1);
+    }
+
+    self_count(SELF_SYSCALLS);
+    return send(fd, &request, request.header.nlmsg_len, 0) >= 0;
+}
+
+/*Function is responsible for*/
+/*indexing the attributes of a link message by type*/
+void netlink_parse_link(struct nlmsghdr* msg, struct rtattr** attrs, int max) {
+    struct ifinfomsg* info = (struct ifinfomsg*)NLMSG_DATA(msg);
+    struct rtattr* attr = IFLA_RTA(info);
+    int len = IFLA_PAYLOAD(msg);
+
+    memset(attrs, 0, sizeof(*attrs) * (max + 1));
+    for (; RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        if(attr->rta_type <= max)
+            attrs[attr->rta_type] = attr;
+    }
+}
+
+/*Function is responsible for*/
+/*converting the attributes of a link message into interface statistics*/
+void netlink_fill_stats(struct rtattr** attrs, interface_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    if(attrs[IFLA_OPERSTATE] != nullptr) {
+        uint8_t operstate = *(uint8_t*)RTA_DATA(attrs[IFLA_OPERSTATE]);
+        if(operstate >= sizeof(operstate_names) / sizeof(operstate_names[0]))
+            operstate = 0; //IF_OPER_UNKNOWN
+        strncpy(stats->operstate, operstate_names[operstate], OPERSTATE_LEN-1);
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        const counter_desc* desc = &counter_schema[c];
+        struct rtattr* attr = attrs[desc->netlink_attr];
+        if(attr == nullptr || RTA_PAYLOAD(attr) < (size_t)desc->netlink_offset + desc->netlink_width) {
+            continue; //older kernels send a shorter attribute
+        }
+        if(desc->netlink_width == 8) {
+            memcpy(&stats->counters[c], (char*)RTA_DATA(attr) + desc->netlink_offset, 8); //attribute is only 4-byte aligned
+        } else {
+            uint32_t value;
+            memcpy(&value, (char*)RTA_DATA(attr) + desc->netlink_offset, 4);
+            stats->counters[c] = value;
+        }
+    }
+    if(attrs[IFLA_NUM_TX_QUEUES] != nullptr)
+        stats->num_queues[QUEUE_TX] = *(uint32_t*)RTA_DATA(attrs[IFLA_NUM_TX_QUEUES]);
+    if(attrs[IFLA_NUM_RX_QUEUES] != nullptr)
+        stats->num_queues[QUEUE_RX] = *(uint32_t*)RTA_DATA(attrs[IFLA_NUM_RX_QUEUES]);
+}
+
+/*Function is responsible for*/
+/*finding which monitored interface a link message belongs to*/
+/*returns -1 if the link is not monitored*/
+int netlink_find_link(netlink_collector* collector, int index, struct rtattr* name) {
+    if(name == nullptr) {
+        return -1;
+    }
+    for (size_t i = 0; i < collector->num_links; i++) {
+        if(collector->indexes[i] == index && strncmp(collector->interfaces[i], (char*)RTA_DATA(name), IFNAMSIZ) == 0)
+            return i;
+    }
+    for (size_t i = 0; i < collector->num_links; i++) {
+        if(strncmp(collector->interfaces[i], (char*)RTA_DATA(name), IFNAMSIZ) == 0) {
+            collector->indexes[i] = index; //interface is new or was re-created
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*Genl Family function is responsible for*/
+/*resolving the id of a generic netlink family by name, buffer receives the reply*/
+/*returns 0 if the kernel does not have the family*/
+uint16_t genl_family(int fd, char* buffer, const char* name) {
+    struct {
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        char attrs[RTA_SPACE(GENL_NAMSIZ)];
+    } request;
+    ssize_t len;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    request.header.nlmsg_type = GENL_ID_CTRL;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.genl.cmd = CTRL_CMD_GETFAMILY;
+    request.genl.version = 1;
+    netlink_add_attr(&request.header, CTRL_ATTR_FAMILY_NAME, name, strlen(name) + 1);
+    if(send(fd, &request, request.header.nlmsg_len, 0) < 0 || (len = recv(fd, buffer, NETLINK_BUF_LEN, 0)) < 0) {
+        return 0;
+    }
+    for (struct nlmsghdr* msg = (struct nlmsghdr*)buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+        if(msg->nlmsg_type != GENL_ID_CTRL) {
+            return 0; //NLMSG_ERROR, ENOENT for an unknown family
+        }
+        int attrs_len = msg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        for (struct rtattr* attr = (struct rtattr*)((char*)NLMSG_DATA(msg) + GENL_HDRLEN); RTA_OK(attr, attrs_len); attr = RTA_NEXT(attr, attrs_len)) {
+            if(attr->rta_type == CTRL_ATTR_FAMILY_ID)
+                return *(uint16_t*)RTA_DATA(attr);
+        }
+    }
+    return 0;
+}
+
+/*Function is responsible for*/
+/*preparing the collector for the given interfaces*/
+bool netlink_collector_init(netlink_collector* collector, const char* const* interfaces, size_t num) {
+    memset(collector, 0, sizeof(*collector));
+    collector->genl_fd = -1;
+    if((collector->fd = netlink_open(0)) < 0) {
+        return false;
+    }
+    collector->buffer = new char[NETLINK_BUF_LEN];
+    if((collector->genl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC)) >= 0
+       && (collector->qstats_family = genl_family(collector->genl_fd, collector->buffer, QSTATS_FAMILY)) == 0) {
+        close(collector->genl_fd); //no queue counters on this kernel
+        collector->genl_fd = -1;
+    }
+    collector->num_links = num;
+    collector->interfaces = new char[num][IFNAMSIZ];
+    collector->indexes = new int[num]{ 0 };
+    for (size_t i = 0; i < num; i++) {
+        strncpy(collector->interfaces[i], interfaces[i], IFNAMSIZ-1);
+        collector->interfaces[i][IFNAMSIZ-1] = '\0';
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*releasing the socket and memory of the collector*/
+void netlink_collector_close(netlink_collector* collector) {
+    if(collector->fd >= 0)
+        close(collector->fd);
+    if(collector->genl_fd >= 0)
+        close(collector->genl_fd);
+    delete[] collector->buffer;
+    delete[] collector->interfaces;
+    delete[] collector->indexes;
+    memset(collector, 0, sizeof(*collector));
+    collector->fd = -1;
+    collector->genl_fd = -1;
+}
+
+/*Function is responsible for*/
+/*reading a variable width unsigned attribute, 4 or 8 bytes*/
+inline uint64_t netlink_get_uint(const struct rtattr* attr) {
+    if(RTA_PAYLOAD(attr) >= sizeof(uint64_t)) {
+        uint64_t value;
+        memcpy(&value, RTA_DATA(attr), sizeof(value)); //attribute is only 4-byte aligned
+        return value;
+    }
+    return *(const uint32_t*)RTA_DATA(attr);
+}
+
+/*Netlink Qstats Read function is responsible for*/
+/*filling the queue counters of the monitored interfaces from one qstats dump*/
+/*the links must have been read first, queues are matched by ifindex*/
+/*a kernel or driver refusing the request is not asked again*/
+void netlink_qstats_read(netlink_collector* collector, interface_stats* stats) {
+    struct {
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        char attrs[2 * RTA_SPACE(sizeof(uint32_t))];
+    } request;
+    uint32_t scope { QSTATS_SCOPE_QUEUE };
+    bool done { false };
+    ssize_t len;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    request.header.nlmsg_type = collector->qstats_family;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.header.nlmsg_seq = ++collector->seq;
+    request.genl.cmd = QSTATS_CMD_GET;
+    request.genl.version = 1;
+    netlink_add_attr(&request.header, QSTATS_A_SCOPE, &scope, sizeof(scope));
+    if(collector->num_links == 1) { //only the queues of the one interface
+        uint32_t index = collector->indexes[0];
+        netlink_add_attr(&request.header, QSTATS_A_IFINDEX, &index, sizeof(index));
+    }
+    self_count(SELF_SYSCALLS);
+    if(send(collector->genl_fd, &request, request.header.nlmsg_len, 0) < 0) {
+        return;
+    }
+
+    while (!done) {
+        self_count(SELF_SYSCALLS);
+        if((len = recv(collector->genl_fd, collector->buffer, NETLINK_BUF_LEN, 0)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        for (struct nlmsghdr* msg = (struct nlmsghdr*)collector->buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if(msg->nlmsg_seq != collector->seq) {
+                continue;
+            }
+            if(msg->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+            if(msg->nlmsg_type == NLMSG_ERROR) { //EOPNOTSUPP from a driver or a kernel without queue counters
+                close(collector->genl_fd);
+                collector->genl_fd = -1;
+                return;
+            }
+            struct rtattr* attrs[QSTATS_A_TX_BYTES+1] { nullptr };
+            int attrs_len = msg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+            for (struct rtattr* attr = (struct rtattr*)((char*)NLMSG_DATA(msg) + GENL_HDRLEN); RTA_OK(attr, attrs_len); attr = RTA_NEXT(attr, attrs_len)) {
+                if(attr->rta_type <= QSTATS_A_TX_BYTES)
+                    attrs[attr->rta_type] = attr;
+            }
+            if(attrs[QSTATS_A_IFINDEX] == nullptr || attrs[QSTATS_A_QUEUE_TYPE] == nullptr || attrs[QSTATS_A_QUEUE_ID] == nullptr) {
+                continue;
+            }
+            int index = netlink_get_uint(attrs[QSTATS_A_IFINDEX]);
+            uint64_t dir = netlink_get_uint(attrs[QSTATS_A_QUEUE_TYPE]), queue = netlink_get_uint(attrs[QSTATS_A_QUEUE_ID]);
+            if(dir >= NUM_QUEUE_DIRS || queue >= MAX_QUEUES) {
+                continue;
+            }
+            for (size_t i = 0; i < collector->num_links; i++) {
+                if(collector->indexes[i] != index) continue;
+                stats[i].has_queue_stats = 1;
+                for (int c = 0; c < NUM_QUEUE_COUNTERS; c++) {
+                    if(queue_schema[c].dir == dir && attrs[queue_schema[c].qstats_attr] != nullptr)
+                        stats[i].queues[c][queue] = netlink_get_uint(attrs[queue_schema[c].qstats_attr]);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/*Netlink Collector Read function is responsible for*/
+/*filling stats[i] for every monitored interface from one RTM_GETLINK round trip*/
+/*a single interface is requested by name, several are taken from one dump*/
+/*returns the number of interfaces found, missing ones are zeroed*/
+int netlink_collector_read(netlink_collector* collector, interface_stats* stats) {
+    struct rtattr* attrs[IFLA_MAX+1];
+    bool is_dump { collector->num_links > 1 };
+    bool done { false };
+    int found { 0 };
+    ssize_t len;
+
+    memset(stats, 0, sizeof(*stats) * collector->num_links);
+    if(!netlink_request_link(collector->fd, ++collector->seq, is_dump ? nullptr : collector->interfaces[0])) {
+        return -1;
+    }
+
+    while (!done) {
+        self_count(SELF_SYSCALLS);
+        if((len = recv(collector->fd, collector->buffer, NETLINK_BUF_LEN, 0)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        for (struct nlmsghdr* msg = (struct nlmsghdr*)collector->buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if(msg->nlmsg_seq != collector->seq) {
+                continue; //late answer to an earlier request
+            }
+            if(msg->nlmsg_type == NLMSG_DONE || msg->nlmsg_type == NLMSG_ERROR) {
+                done = true; //NLMSG_ERROR is ENODEV if a single interface is missing
+                break;
+            }
+            if(msg->nlmsg_type != RTM_NEWLINK) {
+                continue;
+            }
+            netlink_parse_link(msg, attrs, IFLA_MAX);
+            int i = netlink_find_link(collector, ((struct ifinfomsg*)NLMSG_DATA(msg))->ifi_index, attrs[IFLA_IFNAME]);
+            if(i >= 0) {
+                netlink_fill_stats(attrs, &stats[i]);
+                ++found;
+            }
+            if(!is_dump) {
+                done = true;
+            }
+        }
+    }
+    if(collector->genl_fd >= 0 && found > 0) {
+        netlink_qstats_read(collector, stats);
+    }
+    return found;
+}
+
+/*Link Watch follows the state of one interface through*/
+/*RTNLGRP_LINK notifications instead of polling its flags*/
+struct link_watch {
+    int fd;
+    uint32_t seq;
+    char* buffer; //receive buffer allocated once at startup
+    char interface[IFNAMSIZ];
+    unsigned int flags; //IFF_* flags of the last notification
+    uint8_t operstate; //IF_OPER_* of the last notification
+    bool is_present; //interface exists
+};
+
+/*Function is responsible for*/
+/*applying a link message to the watch*/
+/*returns true if the message changed the watched interface*/
+bool link_watch_update(link_watch* watch, struct nlmsghdr* msg) {
+    struct rtattr* attrs[IFLA_MAX+1];
+    struct ifinfomsg* info = (struct ifinfomsg*)NLMSG_DATA(msg);
+
+    netlink_parse_link(msg, attrs, IFLA_MAX);
+    if(attrs[IFLA_IFNAME] == nullptr || strncmp(watch->interface, (char*)RTA_DATA(attrs[IFLA_IFNAME]), IFNAMSIZ) != 0) {
+        return false;
+    }
+
+    unsigned int flags = msg->nlmsg_type == RTM_DELLINK ? 0 : info->ifi_flags;
+    uint8_t operstate = attrs[IFLA_OPERSTATE] != nullptr ? *(uint8_t*)RTA_DATA(attrs[IFLA_OPERSTATE]) : 0;
+    bool is_present = msg->nlmsg_type != RTM_DELLINK;
+    bool changed = flags != watch->flags || operstate != watch->operstate || is_present != watch->is_present;
+
+    watch->flags = flags;
+    watch->operstate = operstate;
+    watch->is_present = is_present;
+    return changed;
+}
+
+/*Link Watch Read function is responsible for*/
+/*draining pending notifications without blocking*/
+/*returns true if the watched interface changed*/
+bool link_watch_read(link_watch* watch) {
+    bool changed { false };
+    ssize_t len;
+
+    while ((len = recv(watch->fd, watch->buffer, NETLINK_BUF_LEN, MSG_DONTWAIT)) != 0) {
+        self_count(SELF_SYSCALLS);
+        if(len < 0) {
+            if(errno == ENOBUFS) { //notifications were lost, ask for the current state again
+                netlink_request_link(watch->fd, ++watch->seq, watch->interface);
+                continue;
+            }
+            break; //EAGAIN once drained
+        }
+        for (struct nlmsghdr* msg = (struct nlmsghdr*)watch->buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if(msg->nlmsg_type == RTM_NEWLINK || msg->nlmsg_type == RTM_DELLINK) {
+                changed |= link_watch_update(watch, msg);
+            } else if(msg->nlmsg_type == NLMSG_ERROR && msg->nlmsg_seq == watch->seq && watch->is_present) {
+                watch->is_present = false; //requested interface does not exist
+                watch->flags = 0;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+/*Link Watch Open function is responsible for*/
+/*subscribing to RTNLGRP_LINK and requesting the current state of the interface*/
+bool link_watch_open(link_watch* watch, const char* interface) {
+    memset(watch, 0, sizeof(*watch));
+    if((watch->fd = netlink_open(RTMGRP_LINK)) < 0) {
+        return false;
+    }
+    watch->buffer = new char[NETLINK_BUF_LEN];
+    strncpy(watch->interface, interface, IFNAMSIZ-1);
+    watch->is_present = true; //until the kernel says otherwise
+    if(!netlink_request_link(watch->fd, ++watch->seq, watch->interface)) {
+        return false;
+    }
+
+    struct pollfd pfd { watch->fd, POLLIN, 0 };
+    if(poll(&pfd, 1, NETLINK_TIMEOUT) > 0) { //wait for the initial state
+        link_watch_read(watch);
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*releasing the socket and memory of the watch*/
+void link_watch_close(link_watch* watch) {
+    if(watch->fd >= 0)
+        close(watch->fd);
+    delete[] watch->buffer;
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = -1;
+}
+
+/*Function is responsible for*/
+/*checking if the watched interface is administratively up*/
+inline bool link_watch_is_up(const link_watch* watch) {
+    return watch->is_present && (watch->flags & IFF_UP);
+}
+
+#endif //NETLINK_H
@@ -6,33 +6,211 @@
 #include <fstream>
 #include <sys/un.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <climits>
+#include <getopt.h>
+#include <algorithm>
+#include <time.h>
 #include <unistd.h>
+#include <spawn.h>
 
 #include "params.h"
+#include "statistics.h"
+#include "inproc.h"
+#include "shm_channel.h"
+#include "scheduler.h"
+#include "rates.h"
+#include "history.h"
+#include "output.h"
+#include "recorder.h"
+#include "event_loop.h"
+#include "exporter.h"
+#include "self_metrics.h"
+#include "discovery.h"
+#include "alerts.h"
+#include "remediation.h"
+#include "fanout.h"
+#include "federation.h"
+
+#define MAX_EVENTS 256 //Maximum number of events handled per wakeup
+#define MAX_WORKERS 4 //Default upper bound of the in-process worker pool
+#define TICK_PHASE 10 //The slots are read and the output written this fraction of an interval after the monitors sampled
+#define HISTORY_DUMP_NS (15 * 60 * 1000000000ull) //SIGUSR2 prints the rollups of this much recent time
+#define DEFAULT_MAX_INTERFACES 256 //Monitor slots of a discovering networkMonitor unless configured
+#define DEFAULT_MAX_REMOTE 1024 //Interfaces of the uploading hosts an aggregator follows unless configured
+
+/*States of the monitor handshake*/
+enum conn_state {
+    CONN_AWAIT_READY, //waiting for "ready", answered with "monitor"
+    CONN_AWAIT_MONITORING, //waiting for "monitoring"
+    CONN_MONITORING //receiving samples
+};
+
+/*Connection of an interface monitor*/
+struct connection {
+    event_source source; //must stay first, the loop hands connections out as event sources
+    int fd;
+    conn_state state;
+    char interface[IFNAMSIZ];
+    frame_reader reader;
+    uint64_t accepted_ns; //start of the handshake
+    int slot; //slot of the monitor, -1 until it named its interface
+    self_metrics* metrics; //block of the monitor, nullptr until it named its interface
+    uint64_t queued; //samples received in the current drain
+    connection* prev;
+    connection* next;
+};
 
 static void signal_handler(int sig);
+void usage(const char* name);
+bool set_option(int opt, const char* value);
+void load_config(const char* path);
+void validate_options();
+void notify_ready();
 void get_interfaces();
+void allocate_slots(size_t num_slots);
+void discover_interfaces();
+void start_monitor(size_t slot);
+void remove_interface(size_t slot);
 void socket_setup();
 void network_monitor();
+void accept_connections(event_source* source);
+void handle_connection(event_source* source);
+void handle_workers(event_source* source);
+void handle_links(event_source* source);
+void handle_remediations(event_source* source);
+void handle_phase(event_source* source);
+void handle_discovery(event_source* source);
+void handle_remote_sample(wire_sample* sample);
+void sample_merged(rate_state* state, wire_sample* sample);
+void forget_host(uint16_t host);
+void reap_monitors();
+void dump_history();
+void summarize_monitors();
+void dump_self_metrics();
 void exit_handler(int ev, void *arg);
 
-char** interfaces { nullptr }; //2d char array to store interfaces got from a user
-pid_t* child_pids { nullptr }; //array to store children PIDs
-int* child_fds { nullptr }; //array to store children FDs
-size_t num_child { 0 }; //number of children spawned
+char (*interfaces)[IFNAMSIZ] { nullptr }; //interface of every monitor slot, empty while the slot is free
+int* interface_indexes { nullptr }; //ifindex of the interface of every slot, 0 if not known
+pid_t* child_pids { nullptr }; //monitor process of every slot, 0 once it exited
+bool* link_ups { nullptr }; //IFF_UP last notified for the interface of every slot in inproc mode
+uint64_t* reported_ticks { nullptr }; //last tick the interface of every slot reported in
+uint64_t tick_number { 1 }; //tick whose samples are being merged
+size_t num_reported { 0 }; //interfaces that reported in this tick
+size_t num_child { 0 }; //interfaces being monitored
+size_t max_child { DEFAULT_MAX_INTERFACES }; //monitor slots, fixed at startup
+interface_filter filter; //patterns selecting the interfaces, asked for interactively without any
+interface_discovery discovery; //interfaces appearing and disappearing while monitoring
+connection* connections { nullptr }; //list of the monitor connections
+sample_output output; //rates, history and printing of the samples
+size_t history_mb { DEFAULT_HISTORY_MB }; //memory budget of the history
+output_format format { FORMAT_TEXT }; //how the samples are written
+exporter metrics; //Prometheus endpoint
+alert_engine alerts; //rules evaluated on every sample with rates
+remediation_engine remediation; //sets the links that went down up again
+size_t max_remediations { DEFAULT_MAX_REMEDIATIONS }; //links set up at the same time, 0 leaves them down
+const char* metrics_address { nullptr }; //serve the metrics on this port or UNIX socket if set
+fanout_server fanout; //streams the samples to local subscribers
+const char* subscribe_path { nullptr }; //accept subscribers on this UNIX socket if set
+recorder rec; //segments every sample is appended to
+const char* record_prefix { nullptr }; //record the samples if set
+size_t segment_mb { DEFAULT_SEGMENT_MB }; //size the segments rotate at
+fed_server federation; //merges the samples of the uploading hosts
+const char* listen_address { nullptr }; //aggregate the hosts uploading to this [host:]port or UNIX socket if set
+size_t max_remote { DEFAULT_MAX_REMOTE }; //interfaces of the uploading hosts followed at once
+fed_uplink uplink; //streams the samples of this host to an aggregator
+const char* upstream_address { nullptr }; //upload to this host:port if set
+struct sockaddr_storage upstream_addr; //upstream_address resolved
+socklen_t upstream_len;
+const char* node_name { nullptr }; //name the uploaded interfaces are tagged with, the host name unless set
+char node_name_buffer[HOST_NAME_LEN];
+long upload_ms { 0 }; //a batch is sealed once this old, 0 uploads every tick
+bool upload_compressed { false }; //upload codec records instead of whole samples
+size_t max_series { 0 }; //interfaces with rates and history, the monitor slots and the remote ones
+self_region region; //self metrics of networkMonitor in block 0, of every monitor or worker after it
+self_metrics monitors_summary; //blocks of the monitors or workers merged
+self_metrics retired_summary; //blocks of the monitors that exited, keeps the totals from going backwards
     
-char buffer[BUF_LEN];
+collector_backend backend { BACKEND_SYSFS }; //statistics backend used by the monitors
+bool inproc { false }; //collect inside this process instead of forking monitors
+long flow_sample_rate { 0 }; //the monitors sample one packet out of this many for the top talkers, 0 samples none
+size_t num_workers { 0 }; //size of the in-process worker pool
+collector_pool pool; //in-process workers
+char* link_buffer { nullptr }; //receive buffer of the in-process link notifications
+sample_transport transport { TRANSPORT_SOCKET }; //how the monitors hand over their samples
+shm_channel channel; //slots of the shared memory transport
+long interval_ms { DEFAULT_INTERVAL_MS }; //sampling interval of every monitor
+sample_scheduler phase_scheduler; //end of every tick, shortly after the monitors sampled
+
+const char* output_path { nullptr }; //write the samples to this file instead of stdout
+int output_fd { STDOUT_FILENO }; //where the samples are written
+
+char buffer[FRAME_MAX_LEN]; //outgoing frame
 bool is_running;
-bool is_parent;
-int master_fd;
+bool is_dump_requested { false }; //SIGUSR2 arrived, print the history
+bool is_self_dump_requested { false }; //SIGUSR1 arrived, print the self metrics
+bool is_child_exited { false }; //SIGCHLD arrived, reap the monitors
+int master_fd { -1 };
+int epoll_fd;
 
-int main() {
-    if(getuid()) {
-        std::cerr << "NetworkMonitor: the program must be run with root privileges" << std::endl;
-        exit(EXIT_FAILURE);
+//Every long option is also a key of the config file
+const struct option long_options[] {
+    { "config", required_argument, NULL, 'c' },
+    { "interfaces", required_argument, NULL, 'I' },
+    { "max-interfaces", required_argument, NULL, 'n' },
+    { "backend", required_argument, NULL, 'b' },
+    { "inproc", no_argument, NULL, 'p' },
+    { "workers", required_argument, NULL, 'w' },
+    { "transport", required_argument, NULL, 't' },
+    { "interval", required_argument, NULL, 'i' },
+    { "history-mb", required_argument, NULL, 'H' },
+    { "record", required_argument, NULL, 'r' },
+    { "segment-mb", required_argument, NULL, 'S' },
+    { "format", required_argument, NULL, 'f' },
+    { "output", required_argument, NULL, 'o' },
+    { "metrics", required_argument, NULL, 'm' },
+    { "subscribers", required_argument, NULL, 'u' },
+    { "sysfs-root", required_argument, NULL, 'R' },
+    { "socket", required_argument, NULL, 's' },
+    { "monitor", required_argument, NULL, 'e' },
+    { "alert", required_argument, NULL, 'a' },
+    { "max-remediations", required_argument, NULL, 'A' },
+    { "flow-sample", required_argument, NULL, 'F' },
+    { "listen", required_argument, NULL, 'L' },
+    { "max-remote-interfaces", required_argument, NULL, 'E' },
+    { "upstream", required_argument, NULL, 'U' },
+    { "host-name", required_argument, NULL, 'N' },
+    { "upload-ms", required_argument, NULL, 'B' },
+    { "upload-compress", no_argument, NULL, 'Z' },
+    { NULL, 0, NULL, 0 }
+};
+const char short_options[] { "c:I:n:b:pw:t:i:H:r:S:f:o:m:u:R:s:e:a:A:F:L:E:U:N:B:Z" };
+
+int main(int argc, char* argv[]) {
+    int opt;
+    //The config files are applied first so that the command line overrides them
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+        if(opt == 'c') {
+            load_config(optarg);
+        } else if(opt == '?') {
+            usage(argv[0]);
+        }
+    }
+    optind = 0; //parse the command line again from the start
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+        if(opt != 'c' && !set_option(opt, optarg)) {
+            usage(argv[0]);
+        }
     }
+    if(optind != argc) {
+        std::cerr << "NetworkMonitor: unexpected argument " << argv[optind] << std::endl;
+        usage(argv[0]);
+    }
+    validate_options(); //nothing is started before every option is known to be usable
+
     //Setup exit handler
     on_exit(exit_handler, NULL);
 
@@ -41,60 +219,405 @@ int main() {
     action.sa_handler = signal_handler;
     sigemptyset(&action.sa_mask);
     action.sa_flags = 0;
-    if(sigaction(SIGINT, &action, NULL) < 0) {
+    if(sigaction(SIGINT, &action, NULL) < 0 || sigaction(SIGTERM, &action, NULL) < 0 || sigaction(SIGUSR1, &action, NULL) < 0
+       || sigaction(SIGUSR2, &action, NULL) < 0 || sigaction(SIGCHLD, &action, NULL) < 0) {
         print_error((char*)"Error while setting action for a signal", true);
     }
 
-    //Get interfaces from the user
-    get_interfaces();
+    if(filter.num_patterns == 0 && listen_address != nullptr) {
+        allocate_slots(0); //an aggregator alone, every interface is uploaded
+    } else if(filter.num_patterns == 0) {
+        get_interfaces(); //Get interfaces from the user
+    } else {
+        discover_interfaces(); //Follow the interfaces matching the patterns
+    }
+    max_series = max_child + (listen_address != nullptr ? max_remote : 0);
+    if(!output_init(&output, max_series, history_mb << 20, format, output_fd)) {
+        std::cerr << "NetworkMonitor: " << history_mb << " MB cannot hold the history of " << max_series << " interfaces" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    output.on_sample = sample_merged;
+    alerts_init(&alerts, &output.rates, max_series);
+    if(record_prefix != nullptr && !recorder_init(&rec, record_prefix, segment_mb << 20, interval_ms)) {
+        print_error((char*)"Error while creating the recording", true);
+    }
+    if(!self_region_create(&region, 1 + (inproc ? num_workers : max_child))) { //shared with the monitors through exec
+        print_error((char*)"Error while creating the self metrics", true);
+    }
+    self_block = &region.blocks[0];
+
+    is_running = true;  
+
+    if(inproc) {
+        //Collect every interface with a few threads of this process
+        if(!collector_pool_start(&pool, interfaces, max_child, num_workers, backend, interval_ms * 1000000ull, &region.blocks[1])) {
+            print_error((char*)"Error while starting the workers", true);
+        }
+        std::cout << "NetworkMonitor(" << getpid() << "): monitoring " << num_child << " interfaces with "
+            << pool.num_workers << " workers" << std::endl;
+        notify_ready();
+        network_monitor();
+        collector_pool_stop(&pool);
+        std::cout << "NetworkMonitor(" << getpid() << "): finished" << std::endl;
+        return 0;
+    }
 
     //Setup socket
     socket_setup();
 
-    is_running = true;  
-    is_parent = true;
-    child_pids = new pid_t[num_child]; //allocate memory
-    int key_fd = open(key_file, O_RDONLY); //open keyfile
+    if(transport == TRANSPORT_SHM && !shm_channel_create(&channel, max_child)) { //one slot per monitor
+        print_error((char*)"Error while creating the shared memory", true);
+    }
+
+    //Every monitor is spawned before any is waited for, they start up side by side
+    for (size_t i = 0; i < max_child; i++) {
+        if(interfaces[i][0] != '\0')
+            start_monitor(i);
+    }
+    notify_ready();
+    network_monitor(); //actual monitoring
+
+    std::cout << "NetworkMonitor(" << getpid() << "): finished" << std::endl;
+
+    return 0;
+}
 
-    for (size_t i = 0; i < num_child && is_parent; i++) {
-        if(ioctl(key_fd, RNDZAPENTCNT, 0) < 0) { //Set entropy to zero
-            std::cout << strerror(errno) << std::endl;
+/*Usage function is responsible for*/
+/*printing the options and exiting*/
+void usage(const char* name) {
+    std::cerr << "Usage: " << name << " [-c config_file] [-I pattern[,!pattern...] [-n max_interfaces]] [-b sysfs|netlink] [-t socket|shm] [-i interval_ms]"
+        << " [-f text|json|influx|csv] [-o output_file] [-m [host:]port|socket_path] [-u subscriber_socket] [-R sysfs_root] [-s socket_path] [-e monitor_executable]"
+        << " [-H history_mb] [-r record_prefix [-S segment_mb]] [--inproc [-w workers]] [-a alert_rule]... [-A max_remediations] [-F flow_sample_rate]"
+        << " [-L [host:]port|socket_path [-E max_remote_interfaces]] [-U host:port [-N host_name] [-B upload_ms] [-Z]]" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+/*Function is responsible for*/
+/*parsing the value of a flag given in a config file*/
+bool parse_flag(const char* value, bool* flag) {
+    if(value == nullptr || strcmp(value, "") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+        *flag = true;
+    } else if(strcmp(value, "no") == 0 || strcmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+        *flag = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*Set Option function is responsible for*/
+/*applying an option of the command line or of a config file*/
+/*value is kept, it must outlive the program's use of it*/
+/*returns false after printing why the value is invalid*/
+bool set_option(int opt, const char* value) {
+    switch (opt) {
+    case 'b': //statistics backend
+        if(!parse_backend(value, &backend)) {
+            std::cerr << "NetworkMonitor: unknown backend " << value << " (expected sysfs or netlink)" << std::endl;
+            return false;
         }
-        child_pids[i] = fork(); //Fork child
-        if(child_pids[i] == 0) {
-            #ifdef DEBUG
-                std::cout << "NetworkMonitor child: PID - " << getpid() << std::endl;
-            #endif
-            is_parent = false;
-            close(master_fd); //close copied fd
-            close(key_fd); //close copied fd
-            execlp(interface_monitor, interface_monitor, interfaces[i], NULL); //execute file
-            print_error((char*)"Error while executing child file", false); //should not get here
+        break;
+    case 'p': //worker threads instead of monitor processes
+        if(!parse_flag(value, &inproc)) {
+            std::cerr << "NetworkMonitor: inproc is yes or no, not " << value << std::endl;
+            return false;
+        }
+        break;
+    case 'w': //number of worker threads
+        if(atoi(value) < 1) {
+            std::cerr << "NetworkMonitor: the number of workers must be positive" << std::endl;
+            return false;
         }
+        num_workers = atoi(value);
+        break;
+    case 't': //sample transport of the monitor processes
+        if(!parse_transport(value, &transport)) {
+            std::cerr << "NetworkMonitor: unknown transport " << value << " (expected socket or shm)" << std::endl;
+            return false;
+        }
+        break;
+    case 'i': //sampling interval in milliseconds
+        interval_ms = atol(value);
+        if(!interval_valid(interval_ms)) {
+            std::cerr << "NetworkMonitor: the interval must be between " << MIN_INTERVAL_MS << " and " << MAX_INTERVAL_MS << " ms" << std::endl;
+            return false;
+        }
+        break;
+    case 'H': //memory budget of the history
+        if(atoi(value) < 1) {
+            std::cerr << "NetworkMonitor: the history budget must be at least 1 MB" << std::endl;
+            return false;
+        }
+        history_mb = atoi(value);
+        break;
+    case 'r': //record every sample into segments named after the prefix
+        record_prefix = value;
+        break;
+    case 'S': //size of a segment
+        if(atoi(value) < 1) {
+            std::cerr << "NetworkMonitor: the segment size must be at least 1 MB" << std::endl;
+            return false;
+        }
+        segment_mb = atoi(value);
+        break;
+    case 'f': //format of the samples
+        if(!parse_format(value, &format)) {
+            std::cerr << "NetworkMonitor: unknown format " << value << " (expected text, json, influx or csv)" << std::endl;
+            return false;
+        }
+        break;
+    case 'o': //append the samples to a file, - is stdout
+        output_path = strcmp(value, "-") == 0 ? nullptr : value;
+        break;
+    case 'm': //serve the metrics on [host:]port or a UNIX socket path
+        metrics_address = value;
+        break;
+    case 'u': //stream the samples to the subscribers of a UNIX socket
+        subscribe_path = value;
+        break;
+    case 'R': //look the interfaces up in another directory, e.g. a generated tree
+        sysfs_root = value;
+        break;
+    case 's': //socket the monitors connect to
+        socket_path = value;
+        break;
+    case 'e': //interfaceMonitor executable
+        interface_monitor = value;
+        break;
+    case 'I': //monitor the interfaces matching the patterns as they come and go
+        if(!interface_filter_add(&filter, value)) {
+            std::cerr << "NetworkMonitor: at most " << MAX_PATTERNS << " patterns of up to " << PATTERN_LEN - 1 << " characters are accepted" << std::endl;
+            return false;
+        }
+        break;
+    case 'a': { //alert rule, given once per rule
+        const char* error;
+        if(!alerts_add_rule(&alerts, value, &error)) {
+            std::cerr << "NetworkMonitor: " << error << ": " << value << std::endl;
+            return false;
+        }
+        break;
     }
-    if(is_parent) {
-        network_monitor(); //actual monitoring 
+    case 'A': //links set up at the same time
+        if(!isdigit((unsigned char)*value)) {
+            std::cerr << "NetworkMonitor: the number of remediations must be a count, 0 disables them" << std::endl;
+            return false;
+        }
+        max_remediations = atoi(value);
+        break;
+    case 'F': //sample rate of the top talkers
+        flow_sample_rate = atol(value);
+        if(!isdigit((unsigned char)*value) || flow_sample_rate > UINT32_MAX) {
+            std::cerr << "NetworkMonitor: the flow sample rate must be a count of packets, 0 samples none" << std::endl;
+            return false;
+        }
+        break;
+    case 'L': //aggregate the hosts uploading to [host:]port or a UNIX socket path
+        listen_address = value;
+        break;
+    case 'E': //interfaces of the uploading hosts
+        if(atoi(value) < 1) {
+            std::cerr << "NetworkMonitor: the number of remote interfaces must be positive" << std::endl;
+            return false;
+        }
+        max_remote = atoi(value);
+        break;
+    case 'U': //upload the samples to an aggregator
+        upstream_address = value;
+        break;
+    case 'N': //name the uploaded interfaces are tagged with
+        if(*value == '\0' || strlen(value) >= HOST_NAME_LEN) {
+            std::cerr << "NetworkMonitor: the host name must have 1 to " << HOST_NAME_LEN - 1 << " characters" << std::endl;
+            return false;
+        }
+        node_name = value;
+        break;
+    case 'B': //age a batch is uploaded at
+        upload_ms = atol(value);
+        if(!isdigit((unsigned char)*value) || upload_ms > 60000) {
+            std::cerr << "NetworkMonitor: the upload interval must be between 0 and 60000 ms, 0 uploads every tick" << std::endl;
+            return false;
+        }
+        break;
+    case 'Z': //upload codec records
+        if(!parse_flag(value, &upload_compressed)) {
+            std::cerr << "NetworkMonitor: upload-compress is yes or no, not " << value << std::endl;
+            return false;
+        }
+        break;
+    case 'n': //monitor slots of the discovered interfaces
+        if(atoi(value) < 1) {
+            std::cerr << "NetworkMonitor: the number of interfaces must be positive" << std::endl;
+            return false;
+        }
+        max_child = atoi(value);
+        break;
+    default:
+        return false;
     }
-    
-    close(key_fd);
+    return true;
+}
 
-    std::cout << "NetworkMonitor(" << getpid() << "): finished" << std::endl;
+/*Function is responsible for*/
+/*removing the blanks around a piece of a config line*/
+char* trim(char* str) {
+    char* end;
 
-    return 0;
+    while (isspace((unsigned char)*str))
+        ++str;
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        --end;
+    *end = '\0';
+    return str;
+}
+
+/*Load Config function is responsible for*/
+/*applying the key = value lines of a config file, keys are the long options*/
+/*blank lines and lines starting with # are skipped, any error exits*/
+void load_config(const char* path) {
+    char line[PATH_MAX + 64];
+    size_t line_number { 0 };
+    FILE* file;
+
+    if((file = fopen(path, "re")) == nullptr) {
+        std::cerr << "NetworkMonitor: cannot read the config file " << path << ": " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        ++line_number;
+        char* key = trim(line);
+        if(*key == '\0' || *key == '#') {
+            continue;
+        }
+        char* value = strchr(key, '=');
+        if(value != nullptr) {
+            *value++ = '\0';
+            value = trim(value);
+            key = trim(key);
+        }
+        const struct option* option = long_options;
+        while (option->name != nullptr && strcmp(option->name, key) != 0)
+            ++option;
+        bool is_valid { option->name != nullptr && option->val != 'c' };
+        if(is_valid && option->has_arg == required_argument && (value == nullptr || *value == '\0')) {
+            std::cerr << "NetworkMonitor: " << key << " needs a value" << std::endl;
+            is_valid = false;
+        } else if(is_valid) {
+            is_valid = set_option(option->val, value == nullptr ? nullptr : strdup(value)); //the options keep pointing at the value
+        } else {
+            std::cerr << "NetworkMonitor: unknown key " << key << std::endl;
+        }
+        if(!is_valid) {
+            std::cerr << "NetworkMonitor: in " << path << " at line " << line_number << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(file);
+}
+
+/*Validate Options function is responsible for*/
+/*checking once, before anything is started, that the options can be used together*/
+void validate_options() {
+    struct stat st;
+
+    if(getuid()) {
+        std::cerr << "NetworkMonitor: the program must be run with root privileges" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(num_workers == 0) {
+        num_workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), MAX_WORKERS);
+    }
+    if(stat(sysfs_root, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        std::cerr << "NetworkMonitor: " << sysfs_root << " is not a directory of interfaces" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    bool is_aggregator_only { filter.num_patterns == 0 && listen_address != nullptr };
+    if(!inproc && !is_aggregator_only && access(interface_monitor, X_OK) < 0) {
+        std::cerr << "NetworkMonitor: cannot execute the monitor " << interface_monitor << ": " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(inproc && flow_sample_rate > 0) {
+        std::cerr << "NetworkMonitor: the flows are sampled by the monitor processes, flow-sample cannot be used with inproc" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(!inproc && strlen(socket_path) >= sizeof(((struct sockaddr_un*)nullptr)->sun_path)) {
+        std::cerr << "NetworkMonitor: the socket path " << socket_path << " is too long" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(upstream_address != nullptr && !fed_resolve(upstream_address, &upstream_addr, &upstream_len)) {
+        std::cerr << "NetworkMonitor: cannot resolve the upstream " << upstream_address << " (expected host:port)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(upstream_address != nullptr && node_name == nullptr) {
+        if(gethostname(node_name_buffer, sizeof(node_name_buffer)) < 0 || node_name_buffer[0] == '\0') {
+            std::cerr << "NetworkMonitor: cannot read the host name, pass --host-name" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        node_name_buffer[HOST_NAME_LEN-1] = '\0';
+        node_name = node_name_buffer;
+    }
+    if(filter.num_patterns == 0 && listen_address == nullptr && !isatty(STDIN_FILENO)) { //nobody to ask, e.g. a service
+        std::cerr << "NetworkMonitor: no interfaces configured, pass --interfaces or set interfaces in the config file" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(upstream_address != nullptr && upload_compressed && max_child + (listen_address != nullptr ? max_remote : 0) > FED_MAX_ENTRIES) {
+        std::cerr << "NetworkMonitor: a compressed upload carries at most " << FED_MAX_ENTRIES << " interfaces" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(output_path != nullptr && (output_fd = open(output_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+        std::cerr << "NetworkMonitor: cannot open the output " << output_path << ": " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*Function is responsible for*/
+/*telling systemd that the startup is over when run as a Type=notify service*/
+void notify_ready() {
+    const char* path = getenv("NOTIFY_SOCKET");
+    struct sockaddr_un addr;
+    int fd;
+
+    if(path == nullptr || (path[0] != '/' && path[0] != '@') || strlen(path) >= sizeof(addr.sun_path)) {
+        return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    if(addr.sun_path[0] == '@') //abstract namespace
+        addr.sun_path[0] = '\0';
+    if((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+        return;
+    }
+    sendto(fd, "READY=1", 7, MSG_NOSIGNAL, (struct sockaddr*)&addr, offsetof(struct sockaddr_un, sun_path) + strlen(path));
+    close(fd);
 }
 
 /*Signal Handler is responsible for*/
-/*handling SIGINT siganl */
+/*handling SIGINT, SIGTERM, SIGUSR1, SIGUSR2 and SIGCHLD signals */
 static void signal_handler(int sig) {
     switch (sig) {
     case SIGINT:
-        std::cout << "NetworkMonitor: SIGINT signal received" << std::endl;
+    case SIGTERM: //how a service manager stops it
+        std::cout << "NetworkMonitor: " << (sig == SIGINT ? "SIGINT" : "SIGTERM") << " signal received" << std::endl;
         if(is_running) { //Check if monitoring was started
             is_running = false;
         } else {
-            exit(EXIT_FAILURE); //Exit if SIGINT was sent during user input
+            exit(EXIT_FAILURE); //Exit if the signal was sent during user input
         }
         break;
+
+    case SIGUSR1: //printed by the monitoring loop
+        is_self_dump_requested = true;
+        break;
+
+    case SIGUSR2: //printed by the monitoring loop
+        is_dump_requested = true;
+        break;
+
+    case SIGCHLD: //reaped by the monitoring loop
+        is_child_exited = true;
+        break;
     
     default:
         std::cout << "NetworkMonitor: undefined signal received" << std::endl;
@@ -102,16 +625,28 @@ static void signal_handler(int sig) {
     }
 }
 
+/*Function is responsible for*/
+/*allocating the monitor slots, every one of them free*/
+void allocate_slots(size_t num_slots) {
+    max_child = num_slots;
+    interfaces = new char[num_slots][IFNAMSIZ]();
+    interface_indexes = new int[num_slots]();
+    child_pids = new pid_t[num_slots]();
+    link_ups = new bool[num_slots];
+    std::fill(link_ups, link_ups + num_slots, true);
+    reported_ticks = new uint64_t[num_slots]();
+}
+
 /*Get Interfaces function is responsible for*/
 /*taking and validating user input related to interfaces*/
 void get_interfaces() {
     std::string intf;
-    char interface_path[BUF_LEN];
+    char interface_path[PATH_MAX];
 
     std::cout << "How many interfaces do you want to monitor: ";
-    size_t num_interfaces = get_int_in_range(1, QUEUE); //get number of interface ranging from 1 to QUEUE
+    size_t num_interfaces = get_int_in_range(1, INT_MAX); //get number of interface
 
-    interfaces = new char*[num_interfaces]{ nullptr }; //Allocate memory for array
+    allocate_slots(num_interfaces); //Allocate memory for array
     num_child = num_interfaces; //set global var
 
     for (size_t i = 0; i < num_interfaces; i++) {
@@ -120,14 +655,13 @@ void get_interfaces() {
             std::cin >> intf;
 
             memset(interface_path, 0, sizeof(interface_path));
-            sprintf(interface_path, "/sys/class/net/%s", intf.c_str()); //Get interface path 
+            snprintf(interface_path, sizeof(interface_path), "%s/%s", sysfs_root, intf.c_str()); //Get interface path
             #ifdef DEBUG
                 std::cout << i+1 << "interface_path: " << interface_path << std::endl;
             #endif
-            if(!file_exists(interface_path)) { //Check if filepath exists
+            if(intf.length() >= IFNAMSIZ || !file_exists(interface_path)) { //Check if filepath exists
                 std::cout << "The interface entered does not exist. Try again: ";
             } else {
-                interfaces[i] = new char[intf.length() + 1]; //Allocate memory for interface
                 strcpy(interfaces[i], intf.c_str());
                 #ifdef DEBUG
                     std::cout << "interfaces[" << i << "] " << interfaces[i] << std::endl;
@@ -138,14 +672,181 @@ void get_interfaces() {
     }
 }
 
+/*Add Interface function is responsible for*/
+/*claiming a free slot for an interface and starting its monitor once monitoring*/
+/*a known ifindex under another name means the interface was renamed*/
+void add_interface(const char* interface, int index) {
+    ssize_t free_slot { -1 };
+
+    for (size_t i = 0; i < max_child; i++) {
+        if(interfaces[i][0] == '\0') {
+            if(free_slot < 0 && child_pids[i] == 0) //the previous monitor of the slot exited
+                free_slot = i;
+        } else if(strncmp(interfaces[i], interface, IFNAMSIZ) == 0) {
+            if(index != 0)
+                interface_indexes[i] = index;
+            return; //already monitored
+        } else if(index != 0 && interface_indexes[i] == index) {
+            std::cout << "NetworkMonitor: interface " << interfaces[i] << " was renamed to " << interface << std::endl;
+            remove_interface(i);
+        }
+    }
+    if(free_slot < 0) {
+        std::cerr << "NetworkMonitor: no free slot for the interface " << interface << ", raise --max-interfaces" << std::endl;
+        return;
+    }
+    strncpy(interfaces[free_slot], interface, IFNAMSIZ-1);
+    interface_indexes[free_slot] = index;
+    link_ups[free_slot] = true;
+    ++num_child;
+    if(is_running) {
+        std::cout << "NetworkMonitor: interface " << interface << " appeared" << std::endl;
+        start_monitor(free_slot);
+    }
+}
+
+/*Remove Interface function is responsible for*/
+/*stopping the monitor of a slot and dropping what is known about its interface*/
+/*a process slot stays taken until its monitor exited*/
+void remove_interface(size_t slot) {
+    int id = output_forget(&output, interfaces[slot]);
+
+    if(id >= 0 && metrics_address != nullptr)
+        exporter_forget(&metrics, id);
+    if(id >= 0 && subscribe_path != nullptr)
+        fanout_forget(&fanout, id);
+    alerts_forget(&alerts, id);
+    remediation_forget(&remediation, slot);
+    if(reported_ticks[slot] == tick_number) {
+        reported_ticks[slot] = 0;
+        --num_reported;
+    }
+    if(inproc) {
+        collector_pool_set(&pool, slot, "");
+    } else if(child_pids[slot] > 0) {
+        kill(child_pids[slot], SIGINT);
+    }
+    interfaces[slot][0] = '\0';
+    interface_indexes[slot] = 0;
+    --num_child;
+}
+
+/*Function is responsible for*/
+/*applying an interface that appeared or disappeared while monitoring*/
+void handle_discovery_event(discovery_event event, const char* interface, int index) {
+    switch (event) {
+    case DISCOVERY_ADD:
+        add_interface(interface, index);
+        break;
+
+    case DISCOVERY_REMOVE: //by name, or by ifindex if the interface was renamed
+        for (size_t i = 0; i < max_child; i++) {
+            if(interfaces[i][0] != '\0' && (strncmp(interfaces[i], interface, IFNAMSIZ) == 0 || (index != 0 && interface_indexes[i] == index))) {
+                std::cout << "NetworkMonitor: interface " << interfaces[i] << " is gone" << std::endl;
+                remove_interface(i);
+                break;
+            }
+        }
+        break;
+
+    case DISCOVERY_RESCAN: { //drop what disappeared unnoticed, the scan adds what appeared
+        char path[PATH_MAX];
+        std::cerr << "NetworkMonitor: interface events were lost, rescanning " << sysfs_root << std::endl;
+        for (size_t i = 0; i < max_child; i++) {
+            snprintf(path, sizeof(path), "%s/%s", sysfs_root, interfaces[i]);
+            if(interfaces[i][0] != '\0' && !file_exists(path))
+                remove_interface(i);
+        }
+        break;
+    }
+    }
+}
+
+/*Discover Interfaces function is responsible for*/
+/*finding the interfaces matching the patterns and subscribing to the ones that follow*/
+void discover_interfaces() {
+    allocate_slots(max_child);
+    if(!discovery_open(&discovery, &filter, handle_discovery_event)) {
+        print_error((char*)"Error while subscribing to interface changes", true);
+    }
+    if(!discovery_scan(&discovery)) {
+        print_error((char*)"Error while listing the interfaces", true);
+    }
+    std::cout << "NetworkMonitor: " << num_child << " interfaces match, up to " << max_child << " are monitored as they come and go" << std::endl;
+}
+
+/*Start Monitor function is responsible for*/
+/*handing the interface of a slot to a worker, or spawning its interfaceMonitor*/
+/*the spawn returns once the monitor was executed, without waiting for it to connect*/
+void start_monitor(size_t slot) {
+    if(inproc) {
+        collector_pool_set(&pool, slot, interfaces[slot]);
+        return;
+    }
+    char interval[16], shm_slot[32], block[32], sample_rate[16];
+    const char* args[20];
+    int num_args { 0 };
+    snprintf(interval, sizeof(interval), "%ld", interval_ms);
+    snprintf(shm_slot, sizeof(shm_slot), "%d:%zu", channel.fd, slot); //memfd stays open across exec
+    snprintf(block, sizeof(block), "%d:%zu", region.fd, slot + 1); //only a spawned monitor holds it, the permission to run
+    for (const char* arg : { interface_monitor, "-b", backend_names[backend], "-i", (const char*)interval, "-M", (const char*)block,
+                             "-R", sysfs_root, "-u", socket_path })
+        args[num_args++] = arg;
+    if(transport == TRANSPORT_SHM) {
+        args[num_args++] = "-s";
+        args[num_args++] = shm_slot;
+    }
+    if(flow_sample_rate > 0) {
+        snprintf(sample_rate, sizeof(sample_rate), "%ld", flow_sample_rate);
+        args[num_args++] = "-F";
+        args[num_args++] = sample_rate;
+    }
+    args[num_args++] = interfaces[slot];
+    args[num_args] = nullptr;
+
+    //every other descriptor is close-on-exec, so nothing has to be closed in between
+    int ret = posix_spawn(&child_pids[slot], interface_monitor, nullptr, nullptr, (char* const*)args, environ);
+    if(ret != 0) {
+        errno = ret;
+        print_error((char*)"Error while spawning the monitor", false);
+        child_pids[slot] = 0;
+        remove_interface(slot);
+    }
+}
+
+/*Reap Monitors function is responsible for*/
+/*freeing the slots of the monitors that exited*/
+/*a monitor that exited on its own takes its interface with it*/
+void reap_monitors() {
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t i = 0; i < max_child; i++) {
+            if(child_pids[i] != pid) {
+                continue;
+            }
+            child_pids[i] = 0;
+            if(interfaces[i][0] != '\0') {
+                std::cout << "NetworkMonitor: the monitor of the interface " << interfaces[i] << " exited" << std::endl;
+                remove_interface(i);
+            }
+            self_metrics_merge(&retired_summary, &region.blocks[i + 1]); //the next monitor of the slot starts from zero
+            self_metrics_clear(&region.blocks[i + 1]);
+            retired_summary.queue_depth.store(0, std::memory_order_relaxed); //nothing is left queued by an exited monitor
+            break;
+        }
+    }
+}
+
 /*Socket Setup function is responsible for*/
-/*creating socket and linking it to the file in /tmp */
+/*creating socket and linking it to the socket file */
 void socket_setup() {
     struct sockaddr_un master_addr;
 
     //Create the socket
     memset(&master_addr, 0, sizeof(master_addr));
-    if((master_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) { //setup global fd
+    if((master_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) { //setup global fd
         print_error((char*)"Error while creating the socket", true);
     }
 
@@ -153,15 +854,30 @@ void socket_setup() {
     //Set the socket path to a local socket file
     strncpy(master_addr.sun_path, socket_path, sizeof(master_addr.sun_path)-1);
     #ifdef DEBUG
-        std::cout << "NetworkMonitor: server_addr.sun_path - " << server_addr.sun_path << endl;
+        std::cout << "NetworkMonitor: master_addr.sun_path - " << master_addr.sun_path << std::endl;
     #endif
 
     #ifdef DEBUG
         std::cout << "NetworkMonitor: bind()" << std::endl;
     #endif
-    //Bind socket 
+    //Bind socket, a file left behind by a networkMonitor that was killed is replaced
     if(bind(master_fd, (struct sockaddr*)&master_addr, sizeof(master_addr)) < 0) {
-        print_error((char*)"Error while binding the socket", true);
+        int probe_fd;
+        if(errno != EADDRINUSE || (probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+            print_error((char*)"Error while binding the socket", true);
+        }
+        bool is_stale = connect(probe_fd, (struct sockaddr*)&master_addr, sizeof(master_addr)) < 0 && errno == ECONNREFUSED;
+        close(probe_fd);
+        if(!is_stale) {
+            std::cerr << "NetworkMonitor: another networkMonitor listens on " << socket_path << std::endl;
+            int fd = master_fd;
+            master_fd = -1; //the socket file belongs to the other one
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+        if(unlink(socket_path) < 0 || bind(master_fd, (struct sockaddr*)&master_addr, sizeof(master_addr)) < 0) {
+            print_error((char*)"Error while binding the socket", true);
+        }
     }
 
     #ifdef DEBUG
@@ -169,83 +885,649 @@ void socket_setup() {
     #endif
     std::cout << "NetworkMonitor(" << getpid() << "): waiting for the interfaces..." << std::endl;
     //Start listening for a new connection
-    if(listen(master_fd, QUEUE) == -1) {
+    if(listen(master_fd, SOMAXCONN) == -1) {
         print_error((char*)"Error while listening", true);
     }
 }
 
+/*Function is responsible for*/
+/*checking that the peer of a connection is one of the spawned monitors*/
+bool is_monitor_peer(int fd) {
+    struct ucred cred;
+    socklen_t len { sizeof(cred) };
+
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        return false;
+    }
+    for (size_t i = 0; i < max_child; i++) {
+        if(child_pids[i] == cred.pid)
+            return child_pids[i] != 0;
+    }
+    return false;
+}
+
+/*Function is responsible for*/
+/*making the given socket non-blocking*/
+void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        print_error((char*)"Error while making the socket non-blocking", false);
+    }
+}
+
+/*Function is responsible for*/
+/*closing a connection and forgetting about it*/
+void close_connection(connection* conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if(conn->prev != nullptr) conn->prev->next = conn->next;
+    else connections = conn->next;
+    if(conn->next != nullptr) conn->next->prev = conn->prev;
+    delete conn;
+}
+
+/*Function is responsible for*/
+/*registering an event source in the epoll loop*/
+bool add_event_source(event_source* source, uint32_t events) {
+    return event_source_add(epoll_fd, source, events);
+}
+
+/*Accept Connections function is responsible for*/
+/*accepting every pending monitor on the master socket*/
+void accept_connections(event_source* source) {
+    int fd;
+
+    while ((fd = accept4(source->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if(!is_monitor_peer(fd)) { //the socket file can be reached by anyone
+            std::cerr << "NetworkMonitor: refused a connection that does not come from a monitor" << std::endl;
+            close(fd);
+            continue;
+        }
+        connection* conn = new connection;
+        conn->source.fd = fd;
+        conn->source.handle = handle_connection;
+        conn->fd = fd;
+        conn->state = CONN_AWAIT_READY;
+        conn->interface[0] = '\0';
+        conn->accepted_ns = monotonic_ns();
+        conn->slot = -1;
+        conn->metrics = nullptr;
+        conn->queued = 0;
+        frame_reader_init(&conn->reader);
+        conn->prev = nullptr;
+        conn->next = connections;
+        if(connections != nullptr) connections->prev = conn;
+        connections = conn;
+
+        if(!add_event_source(&conn->source, EPOLLIN | EPOLLRDHUP | EPOLLET)) {
+            print_error((char*)"Error while adding connection to epoll", false);
+            close_connection(conn);
+            continue;
+        }
+        #ifdef DEBUG
+            std::cout << "NetworkMonitor: incoming connection " << fd << std::endl;
+        #endif
+    }
+    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        print_error((char*)"Error while accepting connection on the socket", false);
+    }
+}
+
+/*Merge Sample function is responsible for*/
+/*handing a sample of this host or of an uploading one to the output*/
+/*it is buffered and recorded once the tick computed its rates*/
+void merge_sample(wire_sample* sample) {
+    output_sample(&output, sample);
+    self_count(SELF_SAMPLES);
+}
+
+/*Sample Merged function is responsible for*/
+/*recording, exporting, fanning out and alerting on a sample the output just buffered*/
+/*only the samples of this host are uploaded*/
+void sample_merged(rate_state* state, wire_sample* sample) {
+    if(record_prefix != nullptr && !recorder_append(&rec, state->id, sample)) {
+        print_error((char*)"Error while rotating the recording, recording stopped", false);
+        record_prefix = nullptr;
+    }
+    if(metrics_address != nullptr) {
+        exporter_update(&metrics, state->id, sample);
+    }
+    if(subscribe_path != nullptr) {
+        fanout_sample(&fanout, &output.rates, state, sample);
+    }
+    if(alerts.num_rules > 0) {
+        alerts_evaluate(&alerts, &output, state, sample);
+    }
+    if(upstream_address != nullptr && sample->stats.host == 0) {
+        uplink_append(&uplink, state->id, sample);
+    }
+}
+
+/*Write Tick function is responsible for*/
+/*writing the samples merged in this tick and starting the next one*/
+void write_tick() {
+    output_flush(&output);
+    if(subscribe_path != nullptr)
+        fanout_publish(&fanout);
+    ++tick_number;
+    num_reported = 0;
+}
+
+/*Handle Sample function is responsible for*/
+/*merging a sample received from the monitor or worker of a slot, writing the tick once every interface reported*/
+/*an aggregator writes at the phase, the uploads arrive at any time*/
+void handle_sample(size_t slot, wire_sample* sample) {
+    merge_sample(sample);
+    if(reported_ticks[slot] != tick_number) { //a late sample of the previous tick is not counted twice
+        reported_ticks[slot] = tick_number;
+        ++num_reported;
+    }
+    if(listen_address == nullptr && num_reported >= num_child) { //every interface reported this tick
+        write_tick();
+    }
+}
+
+/*Function is responsible for*/
+/*merging a sample of an uploading host, tagged with the host*/
+void handle_remote_sample(wire_sample* sample) {
+    merge_sample(sample);
+}
+
+/*Forget Host function is responsible for*/
+/*dropping every interface of an uploading host that went away for good*/
+void forget_host(uint16_t host) {
+    for (size_t i = 0; i <= output.rates.mask; i++) {
+        //the removal shifts the following entries back, i is looked at again
+        while (output.rates.states[i].interface[0] != '\0' && output.rates.states[i].host == host) {
+            char interface[IFNAMSIZ];
+            memcpy(interface, output.rates.states[i].interface, IFNAMSIZ);
+            int id = output_forget(&output, interface, host);
+            if(metrics_address != nullptr)
+                exporter_forget(&metrics, id);
+            if(subscribe_path != nullptr)
+                fanout_forget(&fanout, id);
+            alerts_forget(&alerts, id);
+        }
+    }
+}
+
+/*Function is responsible for*/
+/*handling a sample taken out of a worker queue*/
+/*samples queued before the slot was given to another interface are dropped*/
+void handle_queued_sample(const queued_sample* item) {
+    wire_sample sample = item->sample;
+    self_record(HIST_RECEIVE, monotonic_ns() - item->sent_ns);
+    if(strncmp(interfaces[item->slot], sample.interface, IFNAMSIZ) == 0)
+        handle_sample(item->slot, &sample);
+}
+
+/*Handle Workers function is responsible for*/
+/*draining the worker queues once a worker finished a tick*/
+void handle_workers(event_source* source) {
+    collector_pool_drain(&pool, handle_queued_sample);
+}
+
+/*Link Changed function is responsible for*/
+/*handing a link of a slot that went down or came back to the remediation*/
+void link_changed(size_t slot, bool is_up) {
+    if(remediation.links == nullptr) { //remediation disabled
+        return;
+    }
+    if(is_up) {
+        remediation_link_up(&remediation, slot, monotonic_ns());
+    } else {
+        remediation_link_down(&remediation, slot, interfaces[slot], monotonic_ns());
+    }
+}
+
+/*Handle Links function is responsible for*/
+/*following the state of the monitored links as the kernel reports it*/
+/*the in-process counterpart of the link_down/link_up messages*/
+void handle_links(event_source* source) {
+    struct rtattr* attrs[IFLA_MAX+1];
+    ssize_t len;
+
+    while ((len = recv(source->fd, link_buffer, NETLINK_BUF_LEN, MSG_DONTWAIT)) > 0) {
+        for (struct nlmsghdr* msg = (struct nlmsghdr*)link_buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if(msg->nlmsg_type != RTM_NEWLINK) {
+                continue;
+            }
+            netlink_parse_link(msg, attrs, IFLA_MAX);
+            if(attrs[IFLA_IFNAME] == nullptr) {
+                continue;
+            }
+            for (size_t i = 0; i < max_child; i++) {
+                if(interfaces[i][0] != '\0' && strncmp(interfaces[i], (char*)RTA_DATA(attrs[IFLA_IFNAME]), IFNAMSIZ) == 0) {
+                    bool is_up = ((struct ifinfomsg*)NLMSG_DATA(msg))->ifi_flags & IFF_UP;
+
+                    if(is_up != link_ups[i]) { //carrier, MTU or promisc changes are notified too
+                        link_ups[i] = is_up;
+                        link_changed(i, is_up);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*Handle Remediations function is responsible for*/
+/*taking the finished link actions back from the remediation workers*/
+void handle_remediations(event_source* source) {
+    remediation_handle_results(&remediation, monotonic_ns());
+}
+
+/*Handle Frame function is responsible for*/
+/*advancing the state machine of a connection with a received frame*/
+/*returns false if the connection has to be closed*/
+bool handle_frame(connection* conn, const frame_header* header, const char* payload) {
+    switch (conn->state) {
+    case CONN_AWAIT_READY: {
+        wire_hello hello;
+        //"ready" carries the interface of the monitor
+        if(header->type != MSG_READY || !frame_record(header, payload, 0, &hello, sizeof(hello))) {
+            return false;
+        }
+        memcpy(conn->interface, hello.interface, IFNAMSIZ);
+        conn->interface[IFNAMSIZ-1] = '\0';
+        for (size_t i = 0; i < max_child && conn->slot < 0; i++) { //the monitor of interfaces[i] writes block i + 1
+            if(interfaces[i][0] != '\0' && strncmp(interfaces[i], conn->interface, IFNAMSIZ) == 0) {
+                conn->slot = i;
+                conn->metrics = &region.blocks[i + 1];
+            }
+        }
+        send(conn->fd, buffer, MSG_MONITOR); //start interface monitor
+        conn->state = CONN_AWAIT_MONITORING;
+        return true;
+    }
+    case CONN_AWAIT_MONITORING:
+        if(header->type != MSG_MONITORING) {
+            return false;
+        }
+        std::cout << "NetworkMonitor: starting the monitor for the interface " << conn->interface << std::endl;
+        self_record(HIST_HANDSHAKE, monotonic_ns() - conn->accepted_ns);
+        conn->state = CONN_MONITORING;
+        return true;
+
+    case CONN_MONITORING:
+        if(header->type == MSG_DONE) { //close connection if client is done
+            return false;
+        } else if(header->type == MSG_LINK_DOWN || header->type == MSG_LINK_UP) { //remediated without holding the monitor
+            if(conn->slot >= 0 && strncmp(interfaces[conn->slot], conn->interface, IFNAMSIZ) == 0)
+                link_changed(conn->slot, header->type == MSG_LINK_UP);
+        } else if(header->type == MSG_SAMPLES) {
+            wire_sample sample;
+
+            self_record(HIST_RECEIVE, monotonic_ns() - header->sent_ns);
+            if(conn->slot < 0 || strncmp(interfaces[conn->slot], conn->interface, IFNAMSIZ) != 0) { //removed, the monitor is stopping
+                return true;
+            }
+            for (size_t i = 0; frame_record(header, payload, i, &sample, sizeof(sample)); i++) {
+                handle_sample(conn->slot, &sample);
+                ++conn->queued;
+            }
+        } else if(header->type == MSG_FLOWS) { //top talkers of the interval the next sample ends
+            wire_flows flows;
+
+            if(conn->slot >= 0 && strncmp(interfaces[conn->slot], conn->interface, IFNAMSIZ) == 0
+               && frame_record(header, payload, 0, &flows, sizeof(flows)))
+                output_hold_flows(&output, conn->interface, &flows);
+        }
+        return true;
+    }
+    return false;
+}
+
+/*Handle Connection function is responsible for*/
+/*draining an edge-triggered connection and handling every frame in it*/
+void handle_connection(event_source* source) {
+    connection* conn = (connection*)source;
+    frame_header header; //header of the last received frame
+    const char* payload; //payload of the last received frame
+    ssize_t ret;
+    int next;
+
+    while (true) {
+        if((ret = frame_reader_fill(&conn->reader, conn->fd)) == 0) { //connection lost
+            break;
+        }
+        if(ret < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) { //drained
+                if(conn->metrics != nullptr && conn->queued > 0)
+                    self_queue_depth(conn->metrics, conn->queued);
+                conn->queued = 0;
+                return;
+            }
+            if(errno == EINTR) {
+                continue;
+            }
+            print_error((char*)"Error while receiving", false);
+            break;
+        }
+        //A single read may carry several frames
+        while ((next = frame_reader_next(&conn->reader, &header, &payload)) > 0) {
+            if(!handle_frame(conn, &header, payload)) {
+                break;
+            }
+        }
+        if(next != 0) { //the monitor is done or does not speak the protocol
+            if(next < 0)
+                std::cerr << "NetworkMonitor: malformed frame on connection " << conn->fd << std::endl;
+            break;
+        }
+    }
+    close_connection(conn);
+}
+
+/*Scan Channel function is responsible for*/
+/*handling every slot that got a new sample since the last scan*/
+void scan_channel() {
+    wire_sample sample;
+    uint64_t sent_ns;
+    uint32_t seq;
+
+    for (uint32_t i = 0; i < channel.header->num_slots; i++) {
+        if(interfaces[i][0] == '\0') { //free, or its monitor is stopping
+            continue;
+        }
+        seq = shm_slot_read(&channel.slots[i], &sample, &sent_ns); //0 while being written, read at the next tick
+        bool is_new = seq != 0 && seq != channel.last_seq[i];
+        self_queue_depth(&region.blocks[i + 1], is_new); //a slot holds a single sample
+        if(is_new) {
+            channel.last_seq[i] = seq;
+            self_record(HIST_RECEIVE, monotonic_ns() - sent_ns);
+            if(strncmp(interfaces[i], sample.interface, IFNAMSIZ) == 0) //not the last sample of the previous monitor
+                handle_sample(i, &sample);
+        }
+    }
+}
+
+/*Handle Phase function is responsible for*/
+/*reading the shared memory slots, writing the output of the tick*/
+/*and rendering the metrics scraped until the next one*/
+/*samples of monitors that were late are written here*/
+void handle_phase(event_source* source) {
+    if(scheduler_consume(&phase_scheduler) > 0) {
+        if(channel.header != nullptr)
+            scan_channel();
+        write_tick();
+        if(remediation.waiting > 0)
+            remediation_schedule(&remediation, monotonic_ns());
+        if(upstream_address != nullptr)
+            uplink_tick(&uplink, monotonic_ns());
+        if(listen_address != nullptr)
+            fed_server_tick(&federation, monotonic_ns());
+        if(metrics_address != nullptr) {
+            summarize_monitors();
+            const self_metrics* summaries[SELF_PROCESSES] { &region.blocks[0], &monitors_summary };
+            exporter_render(&metrics, &output.rates, summaries);
+        }
+    }
+}
+
+/*Handle Discovery function is responsible for*/
+/*applying the interfaces that appeared or disappeared since the last wakeup*/
+void handle_discovery(event_source* source) {
+    discovery_read(&discovery);
+}
+
 /*Network Monitor is responsible for*/
 /*accepting and managing connection on the socket*/
 void network_monitor() {
-    fd_set active_fd_set; //set for the active FDs
-    fd_set read_fd_set; //set for ready to be read FDs
-    int counter { 0 }, ret, len; //Local counter 
+    struct epoll_event events[MAX_EVENTS];
+    event_source master_source { master_fd, accept_connections };
+    event_source workers_source { -1, handle_workers };
+    event_source links_source { -1, handle_links };
+    event_source phase_source { -1, handle_phase };
+    event_source discovery_source { discovery.fd, handle_discovery };
+    event_source remediation_source { -1, handle_remediations };
+    int ready;
 
-    FD_ZERO(&read_fd_set); //zeroth the set
-    FD_ZERO(&active_fd_set); //zeroth the set
-    FD_SET(master_fd, &active_fd_set); //Add the master_fd to the socket set
-
-    int max_fd = master_fd; //Sockets will be selected from max-fd + 1
-    child_fds = new int[num_child];
+    if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        print_error((char*)"Error while creating epoll", true);
+    }
+    if(inproc) {
+        workers_source.fd = pool.notify_fd;
+        if(!add_event_source(&workers_source, EPOLLIN)) {
+            print_error((char*)"Error while adding the workers to epoll", true);
+        }
+        if((links_source.fd = netlink_open(RTMGRP_LINK)) < 0 || !add_event_source(&links_source, EPOLLIN)) {
+            print_error((char*)"Error while subscribing to link notifications", true);
+        }
+        link_buffer = new char[NETLINK_BUF_LEN];
+    } else {
+        set_nonblocking(master_fd);
+        if(!add_event_source(&master_source, EPOLLIN | EPOLLET)) {
+            print_error((char*)"Error while adding the socket to epoll", true);
+        }
+    }
+    //read the slots and write the output shortly after every monitor sampled
+    if(!scheduler_start(&phase_scheduler, interval_ms * 1000000ull, interval_ms * 1000000ull / TICK_PHASE)) {
+        print_error((char*)"Error while creating the tick timer", true);
+    }
+    phase_source.fd = phase_scheduler.fd;
+    if(!add_event_source(&phase_source, EPOLLIN)) {
+        print_error((char*)"Error while adding the tick timer to epoll", true);
+    }
+    if(discovery.buffer != nullptr && !add_event_source(&discovery_source, EPOLLIN)) {
+        print_error((char*)"Error while adding the interface changes to epoll", true);
+    }
+    if(metrics_address != nullptr && !exporter_init(&metrics, metrics_address, epoll_fd, max_series)) {
+        print_error((char*)"Error while listening for metrics scrapes", true);
+    }
+    if(subscribe_path != nullptr && !fanout_init(&fanout, subscribe_path, epoll_fd, max_series, output.epoch_offset_ns)) {
+        print_error((char*)"Error while listening for subscribers", true);
+    }
+    if(listen_address != nullptr) {
+        if(!fed_server_init(&federation, listen_address, epoll_fd, output.epoch_offset_ns, handle_remote_sample, forget_host)) {
+            print_error((char*)"Error while listening for uploading hosts", true);
+        }
+        host_names = federation.names; //the samples and the exports name the host of a remote interface
+    }
+    if(upstream_address != nullptr && !uplink_init(&uplink, &upstream_addr, upstream_len, node_name, upload_compressed,
+                                                   upload_ms * 1000000ull, max_series, epoll_fd, output.epoch_offset_ns)) {
+        print_error((char*)"Error while starting the upload", true);
+    }
+    if(max_remediations > 0 && max_child > 0) {
+        if(!remediation_start(&remediation, max_child, max_remediations)) {
+            print_error((char*)"Error while starting the link remediation", true);
+        }
+        remediation_source.fd = remediation.done_fd;
+        if(!add_event_source(&remediation_source, EPOLLIN)) {
+            print_error((char*)"Error while adding the link remediation to epoll", true);
+        }
+    }
 
     while(is_running) {
         //Block until an input arrives on one or more sockets
-        read_fd_set = active_fd_set;
-        if(select(max_fd+1, &read_fd_set, NULL, NULL, NULL) >= 0) { //select connection
-            //Service all the sockets with input pending
-            if(FD_ISSET(master_fd, &read_fd_set) && counter <= num_child) { //Connection request on the master socket
-                if((child_fds[counter] = accept(master_fd, NULL, 0)) >= 0) {
-                    std::cout << "NetworkMonitor: starting the monitor for the interface " << interfaces[counter] << std::endl;
-                    std::cout << "NetworkMonitor: incoming connection " << child_fds[counter] << std::endl; 
-                    FD_SET(child_fds[counter], &active_fd_set);
-
-                    receive(child_fds[counter], buffer);
-                    #ifdef DEBUG
-                        std::cout << "NetworkMonitor: received '" << buffer << "'" << std::endl;
-                    #endif
-
-                    if(strcmp(buffer, "ready") == 0) {
-                        send(child_fds[counter], buffer, "monitor"); //start interface monitor
-                        receive(child_fds[counter], buffer);
-                        #ifdef DEBUG
-                            std::cout << "NetworkMonitor: received '" << buffer << "'" << std::endl;
-                        #endif
-                    }
+        self_count(SELF_SYSCALLS);
+        if((ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1)) < 0) {
+            if(errno != EINTR)
+                print_error((char*)"Error while waiting for events", false);
+            ready = 0;
+        }
+        //Service only the sockets with input pending
+        for (int i = 0; i < ready && is_running; i++) {
+            event_source* source = (event_source*)events[i].data.ptr;
+            source->handle(source);
+        }
+        if(is_dump_requested) {
+            is_dump_requested = false;
+            dump_history();
+        }
+        if(is_self_dump_requested) {
+            is_self_dump_requested = false;
+            dump_self_metrics();
+        }
+        if(is_child_exited) {
+            is_child_exited = false;
+            reap_monitors();
+        }
+    }
 
-                    if(max_fd < child_fds[counter]) max_fd = child_fds[counter];
-                    ++counter;
-                } else {
-                    print_error((char*)"Error while accepting connection on the socket", false);        
-                }
-            } else {
-                for (int i = 0; i < num_child; i++) {//Find which client sent the data
-                    if (FD_ISSET(child_fds[i], &read_fd_set) && is_running) {
-                        memset(buffer, 0, BUF_LEN);
-                        receive(child_fds[i], buffer);
-
-                        if(strcmp(buffer, "done") == 0) { //close connection if client is done
-                            FD_CLR(child_fds[i], &active_fd_set);
-                            close(child_fds[i]);
-                        } else if(strcmp(buffer, "link_down") == 0) { //check if link is down
-                            send(child_fds[i], buffer, "link_up"); //set up link 
-                        } else {
-                            std::cout << buffer << std::endl;
-                        }
-                
-                    }
+    if(inproc) {
+        close(links_source.fd);
+        delete[] link_buffer;
+        link_buffer = nullptr;
+    } else { //kill children
+        struct timespec wait { 1, 0 };
+        for (size_t i = 0; i < max_child; i++) {
+            if(child_pids[i] > 0)
+                kill(child_pids[i], SIGINT);
+        }
+        while (nanosleep(&wait, &wait) < 0 && errno == EINTR); //every exiting monitor interrupts the wait
+        while (connections != nullptr) {
+            close_connection(connections);
+        }
+        shm_channel_close(&channel);
+    }
+    output_flush(&output);
+    std::cout << "NetworkMonitor: " << phase_scheduler.missed << " missed ticks, " << output.samples
+        << " samples written in " << output.writes << " writes" << std::endl;
+    scheduler_stop(&phase_scheduler);
+    discovery_close(&discovery);
+    if(metrics_address != nullptr) {
+        std::cout << "NetworkMonitor: served " << metrics.scrapes << " scrapes of " << metrics.renders << " renderings" << std::endl;
+        exporter_close(&metrics);
+    }
+    if(subscribe_path != nullptr) {
+        std::cout << "NetworkMonitor: published " << fanout.published << " ticks to " << fanout.accepted << " subscribers, "
+            << fanout.delivered << " delivered, " << fanout.dropped << " dropped, " << fanout.bytes << " bytes" << std::endl;
+        fanout_close(&fanout);
+    }
+    if(remediation.links != nullptr) {
+        std::cout << "NetworkMonitor: " << remediation.flaps << " link flaps, " << remediation.actions << " remediations ("
+            << remediation.failures << " failed), " << remediation.recoveries << " links recovered, " << remediation.damped << " damped" << std::endl;
+        remediation_stop(&remediation);
+    }
+    if(listen_address != nullptr) {
+        std::cout << "NetworkMonitor: merged " << federation.samples << " samples in " << federation.batches << " batches, "
+            << federation.bytes << " bytes, " << federation.gaps << " batches lost, " << federation.duplicates << " sent twice" << std::endl;
+        fed_server_close(&federation);
+        host_names = nullptr;
+    }
+    if(upstream_address != nullptr) {
+        std::cout << "NetworkMonitor: uploaded " << uplink.samples << " samples in " << uplink.sealed << " batches, "
+            << uplink.bytes << " bytes, " << uplink.resent << " sent again, " << uplink.lost << " lost, " << uplink.dropped
+            << " samples dropped, " << uplink.reconnects << " connection attempts" << std::endl;
+        uplink_close(&uplink);
+    }
+    close(epoll_fd);
+
+    uint64_t wraps { 0 }, resets { 0 };
+    for (size_t i = 0; i <= output.rates.mask; i++) {
+        wraps += output.rates.states[i].wraps;
+        resets += output.rates.states[i].resets;
+    }
+    std::cout << "NetworkMonitor: " << wraps << " counter wraps, " << resets << " counter resets" << std::endl;
+    if(alerts.num_rules > 0) {
+        std::cout << "NetworkMonitor: " << alerts.fired << " alerts fired, " << alerts.resolved << " resolved, "
+            << alerts.suppressed << " held back" << std::endl;
+        alerts_free(&alerts);
+    }
+    if(rec.names != nullptr) {
+        std::cout << "NetworkMonitor: recorded " << rec.records << " samples in " << rec.sequence + 1 << " segments, "
+            << (rec.values > 0 ? (double)rec.bytes / rec.values : 0) << " bytes per counter" << std::endl;
+        recorder_close(&rec);
+    }
+    dump_self_metrics();
+}
+
+/*Dump History function is responsible for*/
+/*printing the recent rollups of every interface*/
+void dump_history() {
+    char data[2 * BUF_LEN];
+
+    output_flush(&output);
+    uint64_t now = monotonic_ns();
+    uint64_t since = now > HISTORY_DUMP_NS ? now - HISTORY_DUMP_NS : 0;
+    history_span span;
+
+    for (size_t i = 0; i <= output.rates.mask; i++) {
+        const rate_state* state = &output.rates.states[i];
+        if(state->interface[0] == '\0') {
+            continue;
+        }
+        const history_series* series = &output.history.series[state->id];
+        char label[HOST_NAME_LEN + IFNAMSIZ];
+        if(host_name(state->host) != nullptr)
+            snprintf(label, sizeof(label), "%s/%s", host_name(state->host), state->interface);
+        else
+            snprintf(label, sizeof(label), "%s", state->interface);
+        for (int t = 0; t < HISTORY_TIERS; t++) {
+            const history_rollup* rollup = &series->rollups[t];
+            history_range(rollup->starts, rollup->capacity, rollup->head, rollup->count, since, now, &span);
+            for (int run = 0; run < 2; run++) {
+                for (size_t slot = span.begin[run]; slot < span.end[run]; slot++) {
+                    format_rollup(data, sizeof(data), label, t, rollup, slot);
+                    std::cout << data;
                 }
             }
         }
-        sleep(1);
     }
+    std::cout << "NetworkMonitor: history holds " << output.history.series[0].raw.capacity << " samples and "
+        << output.history.series[0].rollups[0].capacity << " buckets per tier of each interface in "
+        << (output.history.len >> 10) << " KB" << std::endl;
+}
+
+/*Function is responsible for*/
+/*merging the blocks of every monitor or worker into monitors_summary*/
+void summarize_monitors() {
+    self_metrics_clear(&monitors_summary);
+    self_metrics_merge(&monitors_summary, &retired_summary);
+    for (uint32_t b = 1; b < region.header->num_blocks; b++)
+        self_metrics_merge(&monitors_summary, &region.blocks[b]);
+}
+
+/*Function is responsible for*/
+/*printing the counters per tick and the latency percentiles of a block*/
+void print_self_metrics(const char* name, const self_metrics* block) {
+    const double quantiles[] { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t ticks = block->counters[SELF_TICKS];
+
+    std::cout << "NetworkMonitor: self metrics of " << name << ": " << ticks << " ticks";
+    for (int c = SELF_MISSED_TICKS; c < SELF_COUNTER_COUNT; c++) {
+        std::cout << ", " << self_counter_names[c] << " " << block->counters[c];
+        if(c != SELF_MISSED_TICKS && ticks > 0)
+            std::cout << " (" << (double)block->counters[c] / ticks << "/tick)";
+    }
+    std::cout << std::endl;
+    for (int h = 0; h < HIST_COUNT; h++) {
+        const hdr_histogram* histogram = &block->histograms[h];
+        if(histogram->count == 0) {
+            continue;
+        }
+        std::cout << "NetworkMonitor: " << name << " " << self_histogram_names[h] << " latency min/p50/p90/p99/p99.9/max "
+            << histogram->min / 1000.0;
+        for (double q : quantiles)
+            std::cout << "/" << histogram_quantile(histogram, q) / 1000.0;
+        std::cout << "/" << histogram->max / 1000.0 << " us over " << histogram->count << std::endl;
+    }
+}
+
+/*Dump Self Metrics function is responsible for*/
+/*printing what networkMonitor and its monitors or workers cost themselves*/
+/*and the queues that ever held more than one tick of samples*/
+void dump_self_metrics() {
+    output_flush(&output);
+    summarize_monitors();
+    print_self_metrics("networkMonitor", &region.blocks[0]);
+    print_self_metrics(inproc ? "workers" : "monitors", &monitors_summary);
 
-    //kill children
-    for (size_t i = 0; i < num_child; i++) {
-        kill(child_pids[i], SIGINT);
-        sleep(1);
-        FD_CLR(child_fds[i], &active_fd_set);
-        close(child_fds[i]);
-    }    
+    uint32_t deepest { 0 };
+    for (uint32_t b = 1; b < region.header->num_blocks; b++) {
+        const self_metrics* block = &region.blocks[b];
+        if((inproc || interfaces[b - 1][0] != '\0') && block->max_queue_depth > region.blocks[deepest].max_queue_depth)
+            deepest = b;
+        if(!inproc && interfaces[b - 1][0] != '\0' && block->max_queue_depth > 1) {
+            std::cout << "NetworkMonitor: queue of " << interfaces[b - 1] << " held " << block->queue_depth
+                << " samples, at most " << block->max_queue_depth << std::endl;
+        }
+    }
+    if(deepest > 0) {
+        std::cout << "NetworkMonitor: deepest queue of " << (inproc ? "worker " + std::to_string(deepest - 1) : std::string(interfaces[deepest - 1]))
+            << " held at most " << region.blocks[deepest].max_queue_depth << " samples" << std::endl;
+    }
 }
 
 /* Exit Handler that is responsible for releasing locks */
@@ -255,19 +1537,21 @@ void exit_handler(int ev, void *arg) {
         std::cout << "closing file descriptors" << std::endl;
     #endif
     //Close file descriptors
-    close(master_fd);
-    //Remove the socket file from /tmp
-    unlink(socket_path);
+    if(master_fd >= 0) {
+        close(master_fd);
+        //Remove the socket file from /tmp
+        unlink(socket_path);
+    }
 
     //Release dynamically allocated memory
     if(interfaces != nullptr) {
         #ifdef DEBUG
             std::cout << "deleting interfaces" << std::endl;
         #endif
-        for (size_t i = 0; i < num_child; i++)
-            if(interfaces[i] != nullptr)
-                delete[] interfaces[i];
         delete[] interfaces;
+        delete[] interface_indexes;
+        delete[] link_ups;
+        delete[] reported_ticks;
     } else {
         #ifdef DEBUG
             std::cout << "interfaces already deallocated" << std::endl;
@@ -284,15 +1568,5 @@ void exit_handler(int ev, void *arg) {
             std::cout << "child_pids already deallocated" << std::endl;
         #endif
     }
-
-    if(child_fds != nullptr) {
-        #ifdef DEBUG
-            std::cout << "deleting child_fds" << std::endl;
-        #endif
-        delete[] child_fds;
-    } else {
-        #ifdef DEBUG
-            std::cout << "child_fds already deallocated" << std::endl;
-        #endif
-    }
+    output_free(&output);
 }
\ No newline at end of file
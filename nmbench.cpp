@@ -0,0 +1,1441 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <csignal>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "rates.h"
+#include "history.h"
+#include "scheduler.h"
+#include "sysfs_collector.h"
+#include "fake_sysfs.h"
+#include "output.h"
+#include "alerts.h"
+#include "fanout.h"
+#include "recorder.h"
+#include "flow_sampler.h"
+#include "federation.h"
+
+#define BENCH_INTERFACES 1000 //Interfaces appended to on every tick
+#define BENCH_TICKS 2000 //Ticks appended per interface
+#define BENCH_HISTORY_MB 256 //Budget of the benchmarked history
+#define BENCH_SCANS 200 //Range scans timed
+#define BENCH_INTERVAL_NS 1000000000ull //Time between generated samples, fills 200 buckets of the 10s rollup
+#define BENCH_RATE_TICKS 200 //Ticks of every interface run through each rate kernel
+#define BENCH_CHECK_TICKS 2000 //Ticks of every interface compared between the kernels
+#define BENCH_ALERT_TICKS 500 //Ticks of every interface the alert rules are evaluated on
+#define BENCH_CODEC_TICKS 100 //Ticks of every interface run through the codec
+#define BENCH_CODEC_BYTES 64 //Encoded bytes budgeted per sample, far above what typical traffic takes
+#define BENCH_SUBSCRIBERS 100 //Subscribers the ticks are fanned out to
+#define BENCH_FANOUT_INTERFACES 100 //Interfaces of every fanned out tick
+#define BENCH_FANOUT_TICKS 200 //Ticks fanned out per subscription
+#define BENCH_FLOWS 100000 //Flows of the generated traffic, their sizes are heavy-tailed
+#define BENCH_FLOW_PACKETS 2000000 //Generated packets counted by the flow table
+#define BENCH_RING_PACKETS 20000 //Packets sent over lo and read back from the ring
+#define BENCH_RING_BURST 256 //Packets sent before the ring is read
+#define BENCH_UPLINKS 1000 //Hosts uploading to the benchmarked aggregator
+#define BENCH_UPLINK_INTERFACES 8 //Interfaces of every uploading host
+#define BENCH_UPLINK_TICKS 50 //Batches uploaded by every host
+
+#define MAX_BENCH_SIZES 16 //Interface counts of one end-to-end run
+#define MAX_BENCH_INTERFACES 4096 //Largest generated tree, the benchmark keeps 15 descriptors per interface open
+#define BENCH_SIZES "1,10,100,1000" //Interface counts measured unless configured
+#define BENCH_RUN_INTERVAL_MS 250 //Sampling interval of the measured networkMonitor
+#define BENCH_RUN_SECONDS 5 //Measured window of every interface count
+#define BENCH_TRACE_SECONDS 2 //Window the syscalls are counted in, tracing slows the monitors down
+#define BENCH_WARMUP_TICKS 2 //Ticks skipped once every interface reported
+#define BENCH_START_TIMEOUT_NS 60000000000ull //Time the monitors get to report every interface
+#define BENCH_COLLECTOR_SAMPLES 200000 //Samples timed by the collector benchmark
+#define BENCH_SPARE_FDS 256 //Descriptors left to the benchmark besides the tree and the collectors
+#define BENCH_READ_LEN (1 << 20) //Chunk the output of networkMonitor is read in
+
+const char network_monitor[] { "./networkMonitor" }; //benchmarked executable, started with the fake tree
+
+/*Bench Result holds everything measured at one interface count*/
+struct bench_result {
+    size_t num_interfaces;
+    double collector_cpu_ns; //CPU time of one sysfs_collector_read
+    uint64_t samples; //samples written by networkMonitor in the measured window
+    double cpu_ns_per_sample; //CPU time of networkMonitor and its monitors per written sample
+    uint64_t latency_ns[4]; //sample timestamp to networkMonitor output: p50, p90, p99, max
+    double syscalls_per_tick[2]; //networkMonitor, monitors
+    double syscalls_per_sample;
+    uint64_t rss_kb[2]; //networkMonitor, sum of the monitors
+};
+
+/*Traced Task is a thread of networkMonitor or of a monitor whose syscalls are counted*/
+struct traced_task {
+    pid_t tid;
+    bool is_monitor;
+    bool is_attached;
+    uint64_t stops; //syscall entries and exits
+};
+
+void bench_history();
+void bench_rates();
+void bench_alerts();
+void bench_codec();
+void bench_fanout();
+void bench_flows();
+void bench_federation();
+void bench_end_to_end(size_t* sizes, int num_sizes, char** extra_args, int num_extra_args);
+void generate_tree(const char* root, size_t num_interfaces);
+
+long run_interval_ms { BENCH_RUN_INTERVAL_MS }; //sampling interval of the end-to-end runs and of the generator
+long run_seconds { BENCH_RUN_SECONDS }; //measured window of the end-to-end runs
+long churn_per_minute { 0 }; //interfaces the generator replaces every minute
+std::atomic<bool> is_measuring { false }; //samples read now count towards the latency
+std::atomic<uint64_t> samples_read { 0 }; //sample lines read from networkMonitor
+std::vector<uint64_t> latencies; //owned by the reader thread until it is joined
+std::string last_line; //last line that was not a sample, explains a failed start
+std::atomic<bool> is_advancing { false }; //the advancing thread keeps ticking the tree
+volatile sig_atomic_t is_generating { false }; //the generator runs until SIGINT
+
+/*NMBench is responsible for*/
+/*timing the hot paths of networkMonitor without any interface*/
+/*-e runs networkMonitor end to end on generated trees and prints JSON*/
+/*-g generates a tree to point networkMonitor --sysfs-root at*/
+int main(int argc, char* argv[]) {
+    size_t sizes[MAX_BENCH_SIZES];
+    int num_sizes { 0 }, opt;
+    const char* size_list { BENCH_SIZES };
+    const char* tree_root { nullptr };
+    bool is_end_to_end { false };
+
+    while ((opt = getopt(argc, argv, "en:i:d:g:c:")) != -1) {
+        switch (opt) {
+        case 'e': //end to end runs of networkMonitor
+            is_end_to_end = true;
+            break;
+        case 'n': //comma separated interface counts
+            size_list = optarg;
+            break;
+        case 'i': //sampling interval in milliseconds
+            run_interval_ms = atol(optarg);
+            if(!interval_valid(run_interval_ms)) {
+                std::cerr << "NMBench: the interval must be between " << MIN_INTERVAL_MS << " and " << MAX_INTERVAL_MS << " ms" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd': //measured seconds per interface count
+            run_seconds = atol(optarg);
+            if(run_seconds < 1) {
+                std::cerr << "NMBench: the duration must be at least 1 second" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'g': //generate a tree and keep it advancing
+            tree_root = optarg;
+            break;
+        case 'c': //interfaces of the generated tree replaced per minute
+            churn_per_minute = atol(optarg);
+            if(churn_per_minute < 0) {
+                std::cerr << "NMBench: the churn must not be negative" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            std::cerr << "Usage: " << argv[0] << " [-e [-n sizes] [-i interval_ms] [-d seconds] [-- networkMonitor options]]"
+                << " | [-g root [-n interfaces] [-i interval_ms] [-c churn_per_minute]]" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (const char* p = size_list; *p != '\0' && num_sizes < MAX_BENCH_SIZES; ) {
+        char* end;
+        long size = strtol(p, &end, 10);
+        if(end == p || size < 1 || size > MAX_BENCH_INTERFACES) {
+            std::cerr << "NMBench: invalid interface count in " << size_list << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        sizes[num_sizes++] = size;
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if(tree_root != nullptr) {
+        generate_tree(tree_root, sizes[0]);
+    } else if(is_end_to_end) {
+        bench_end_to_end(sizes, num_sizes, argv + optind, argc - optind);
+    } else {
+        bench_history();
+        bench_rates();
+        bench_alerts();
+        bench_codec();
+        bench_fanout();
+        bench_flows();
+        bench_federation();
+    }
+    return 0;
+}
+
+/*Function is responsible for*/
+/*printing the result of a benchmark*/
+void report(const char* name, uint64_t ops, uint64_t ns, const char* unit) {
+    std::cout << name << ": " << (double)ns / ops << " ns/" << unit << ", "
+        << ops * 1e9 / ns / 1e6 << " M" << unit << "/s" << std::endl;
+}
+
+/*Bench Tick function is responsible for*/
+/*staging a sample of every interface and running the rate kernel once over them, as output_tick does*/
+/*has_rate tells which interfaces got rates*/
+void bench_tick(rate_engine* engine, rate_state** states, const wire_sample* samples, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        rate_stage(engine, states[i], &samples[i]);
+    rate_engine_tick(engine);
+    for (size_t i = 0; i < count; i++) {
+        if(rate_is_staged(engine, states[i]))
+            rate_settle(engine, states[i]);
+    }
+}
+
+/*Function is responsible for*/
+/*copying the rates of an interface out of the arrays of the engine*/
+inline void bench_rates_of(const rate_engine* engine, const rate_state* state, double* rate) {
+    for (int r = 0; r < RATE_COUNT; r++)
+        rate[r] = engine->rate[rate_at(engine, r, state->id)];
+}
+
+/*Bench History function is responsible for*/
+/*timing appends to every interface and range scans of a full ring*/
+void bench_history() {
+    history_store store;
+    rate_engine engine;
+    wire_sample* samples = new wire_sample[BENCH_INTERFACES]();
+    rate_state** states = new rate_state*[BENCH_INTERFACES];
+    double rate[RATE_COUNT];
+    history_span span;
+    uint64_t start, points { 0 }, checksum { 0 };
+
+    rate_engine_init(&engine, BENCH_INTERFACES);
+    if(!history_init(&store, BENCH_INTERFACES, (size_t)BENCH_HISTORY_MB << 20)) {
+        std::cerr << "NMBench: cannot allocate the history" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+        snprintf(samples[i].interface, IFNAMSIZ, "bench%zu", i);
+        states[i] = rate_engine_find(&engine, samples[i].interface);
+    }
+
+    //Append: the rates of the tick and a history append per interface, as output_tick does
+    start = monotonic_ns();
+    for (uint64_t tick = 1; tick <= BENCH_TICKS; tick++) {
+        for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+            wire_sample* sample = &samples[i];
+            sample->timestamp_ns = tick * BENCH_INTERVAL_NS;
+            sample->stats.counters[CTR_RX_BYTES] += 1500 * (i + tick % 7);
+            sample->stats.counters[CTR_RX_PACKETS] += i + tick % 7;
+            sample->stats.counters[CTR_TX_BYTES] += 64 * tick;
+            sample->stats.counters[CTR_TX_PACKETS] += tick;
+        }
+        bench_tick(&engine, states, samples, BENCH_INTERFACES);
+        for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+            bench_rates_of(&engine, states[i], rate);
+            history_append(&store.series[states[i]->id], &samples[i], states[i]->has_rate ? rate : nullptr);
+        }
+    }
+    report("history_append", (uint64_t)BENCH_TICKS * BENCH_INTERFACES, monotonic_ns() - start, "sample");
+
+    //Range scan: the newest half of a full resolution ring, every counter
+    const history_raw* raw = &store.series[BENCH_INTERFACES / 2].raw;
+    uint64_t to = raw->timestamps[(raw->head + raw->capacity - 1) % raw->capacity];
+    uint64_t from = to - raw->count / 2 * BENCH_INTERVAL_NS;
+    start = monotonic_ns();
+    for (int scan = 0; scan < BENCH_SCANS; scan++) {
+        history_range(raw->timestamps, raw->capacity, raw->head, raw->count, from, to, &span);
+        for (int c = 0; c < RATE_COUNT; c++) {
+            for (int run = 0; run < 2; run++) {
+                for (size_t slot = span.begin[run]; slot < span.end[run]; slot++)
+                    checksum += raw->values[c][slot];
+                points += span.end[run] - span.begin[run];
+            }
+        }
+    }
+    report("history_scan_raw", points, monotonic_ns() - start, "value");
+
+    //Range scan: every bucket of the 10s rollup of every interface
+    points = 0;
+    float peak { 0 };
+    start = monotonic_ns();
+    for (size_t s = 0; s < store.num_series; s++) {
+        const history_rollup* rollup = &store.series[s].rollups[0];
+        history_range(rollup->starts, rollup->capacity, rollup->head, rollup->count, 0, UINT64_MAX, &span);
+        for (int run = 0; run < 2; run++) {
+            for (size_t slot = span.begin[run]; slot < span.end[run]; slot++)
+                peak = rollup->max[RATE_RX_BYTES][slot] > peak ? rollup->max[RATE_RX_BYTES][slot] : peak;
+            points += span.end[run] - span.begin[run];
+        }
+    }
+    report("history_scan_rollup", points, monotonic_ns() - start, "bucket");
+
+    std::cout << "history: " << (store.len >> 20) << " MB, " << raw->capacity << " samples and "
+        << store.series[0].rollups[0].capacity << " buckets per tier per interface (checksum "
+        << checksum << ", peak " << peak << ")" << std::endl;
+
+    history_free(&store);
+    rate_engine_free(&engine);
+    delete[] states;
+    delete[] samples;
+}
+
+/*Function is responsible for*/
+/*next value of a xorshift generator, the generated counters are the same on every run*/
+inline uint64_t bench_random(uint64_t* seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+/*Function is responsible for*/
+/*moving the rated counters of a generated sample forward by one tick*/
+/*the first half of the counters is 32-bit and wraps, and now and then the interface is re-created*/
+void bench_advance(wire_sample* sample, uint64_t* seed) {
+    uint64_t* counters = &sample->stats.counters[rate_counters.ids[0]];
+    if(bench_random(seed) % 997 == 0) { //reset
+        for (int c = 0; c < RATE_COUNT; c++)
+            counters[c] = bench_random(seed) % 1000;
+        return;
+    }
+    for (int c = 0; c < RATE_COUNT; c++) {
+        uint64_t step = bench_random(seed) >> (c < RATE_COUNT / 2 ? 36 : c * 4 + 16);
+        counters[c] = c < RATE_COUNT / 2 ? (counters[c] + step) & 0xffffffffull : counters[c] + step;
+    }
+}
+
+/*Function is responsible for*/
+/*comparing everything the tick leaves for an interface in two engines*/
+bool bench_same_rates(const rate_engine* a, const rate_state* sa, const rate_engine* b, const rate_state* sb) {
+    for (int r = 0; r < RATE_COUNT; r++) {
+        if(a->prev[rate_at(a, r, sa->id)] != b->prev[rate_at(b, r, sb->id)]
+           || memcmp(&a->rate[rate_at(a, r, sa->id)], &b->rate[rate_at(b, r, sb->id)], sizeof(double)) != 0) {
+            return false;
+        }
+        for (int w = 0; w < RATE_WINDOWS; w++) {
+            if(memcmp(&a->ewma[ewma_at(a, w, r, sa->id)], &b->ewma[ewma_at(b, w, r, sb->id)], sizeof(double)) != 0)
+                return false;
+        }
+    }
+    return a->holds[sa->id] == b->holds[sb->id] && sa->last_ns == sb->last_ns && sa->wraps == sb->wraps
+        && sa->resets == sb->resets && sa->is_seeded == sb->is_seeded && sa->has_rate == sb->has_rate;
+}
+
+/*Function is responsible for*/
+/*watching every rate field and a few rates, as the alert rules of bench_alerts do*/
+void bench_watch(rate_engine* engine) {
+    static const double limits[NUM_RATE_FIELDS] { 2e9, 2e9, 1e5, 1e5, 0.01, 0.01, 0.001, 0.001 };
+    for (int f = 0; f < NUM_RATE_FIELDS; f++) {
+        rate_threshold field = field_threshold(f, limits[f], false);
+        rate_engine_watch(engine, &field);
+    }
+    for (int r = 0; r < RATE_COUNT; r++) {
+        rate_threshold rate { r, -1, 1.0, 1000, r % 2 == 0 };
+        rate_engine_watch(engine, &rate);
+    }
+}
+
+/*Bench Rates function is responsible for*/
+/*checking that the rate kernel picked for this CPU gives the bits of the scalar one*/
+/*on counters that wrap, reset and come at uneven intervals, then timing the tick of both kernels*/
+/*over every interface, thresholds included*/
+void bench_rates() {
+    rate_kernel_fn picked = rate_kernel;
+    rate_engine engines[2];
+    rate_state** states = new rate_state*[2 * BENCH_INTERFACES];
+    wire_sample* samples = new wire_sample[BENCH_INTERFACES]();
+    uint64_t seed { 88172645463325252ull }, updates { 0 }, mismatches { 0 }, wraps { 0 }, resets { 0 };
+
+    for (int e = 0; e < 2; e++) {
+        rate_engine_init(&engines[e], BENCH_INTERFACES);
+        bench_watch(&engines[e]);
+    }
+    for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+        snprintf(samples[i].interface, IFNAMSIZ, "bench%zu", i);
+        states[i] = rate_engine_find(&engines[0], samples[i].interface);
+        states[BENCH_INTERFACES + i] = rate_engine_find(&engines[1], samples[i].interface);
+    }
+
+    //Bit-exact check through the tick, as output_tick runs it
+    for (uint64_t tick = 1; tick <= BENCH_CHECK_TICKS; tick++) {
+        for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+            wire_sample* sample = &samples[i];
+            if(bench_random(&seed) % 101 != 0) //now and then a duplicate
+                sample->timestamp_ns = tick * BENCH_INTERVAL_NS + bench_random(&seed) % (BENCH_INTERVAL_NS / 10);
+            bench_advance(sample, &seed);
+        }
+        rate_kernel = rate_kernel_scalar;
+        bench_tick(&engines[0], states, samples, BENCH_INTERFACES);
+        rate_kernel = picked;
+        bench_tick(&engines[1], states + BENCH_INTERFACES, samples, BENCH_INTERFACES);
+        for (size_t i = 0; i < BENCH_INTERFACES; i++)
+            mismatches += !bench_same_rates(&engines[0], states[i], &engines[1], states[BENCH_INTERFACES + i]);
+        updates += BENCH_INTERFACES;
+    }
+    for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+        wraps += states[i]->wraps;
+        resets += states[i]->resets;
+    }
+    const char* name = picked == rate_kernel_scalar ? "scalar" : "avx2";
+    std::cout << "rate_kernel: " << name << " picked, " << mismatches << " of " << updates
+        << " updates differ from the scalar kernel (" << wraps << " wraps, " << resets << " resets)" << std::endl;
+    if(mismatches > 0) {
+        std::cerr << "NMBench: the " << name << " rate kernel is not bit-exact" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    //Throughput: the tick of every interface, staging, the kernel with the thresholds and settling
+    uint64_t* counters = new uint64_t[(size_t)BENCH_RATE_TICKS * BENCH_INTERFACES * RATE_COUNT];
+    for (size_t t = 0; t < BENCH_RATE_TICKS; t++) {
+        for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+            for (int c = 0; c < RATE_COUNT; c++) {
+                uint64_t* value = &counters[(t * BENCH_INTERFACES + i) * RATE_COUNT + c];
+                *value = (t > 0 ? value[-(long)(BENCH_INTERFACES * RATE_COUNT)] : 0) + (bench_random(&seed) >> 40);
+            }
+        }
+    }
+    for (rate_kernel_fn kernel : { (rate_kernel_fn)rate_kernel_scalar, picked }) {
+        double checksum { 0 };
+        uint64_t ns { 0 }, kernel_ns { 0 };
+        rate_engine_free(&engines[0]);
+        rate_engine_init(&engines[0], BENCH_INTERFACES);
+        bench_watch(&engines[0]);
+        for (size_t i = 0; i < BENCH_INTERFACES; i++)
+            states[i] = rate_engine_find(&engines[0], samples[i].interface);
+        rate_kernel = kernel;
+        for (size_t t = 0; t < BENCH_RATE_TICKS; t++) {
+            for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+                samples[i].timestamp_ns = (t + 1) * BENCH_INTERVAL_NS;
+                memcpy(&samples[i].stats.counters[rate_counters.ids[0]], &counters[(t * BENCH_INTERFACES + i) * RATE_COUNT], RATE_COUNT * sizeof(uint64_t));
+            }
+            uint64_t start = monotonic_ns();
+            for (size_t i = 0; i < BENCH_INTERFACES; i++)
+                rate_stage(&engines[0], states[i], &samples[i]);
+            uint64_t kernel_start = monotonic_ns();
+            rate_engine_tick(&engines[0]);
+            kernel_ns += monotonic_ns() - kernel_start;
+            for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+                if(rate_is_staged(&engines[0], states[i]))
+                    rate_settle(&engines[0], states[i]);
+            }
+            ns += monotonic_ns() - start;
+        }
+        for (size_t i = 0; i < BENCH_INTERFACES; i++)
+            checksum += engines[0].ewma[ewma_at(&engines[0], 0, 0, states[i]->id)] + (double)engines[0].holds[states[i]->id];
+        std::cout << (kernel == rate_kernel_scalar ? "rate_tick_scalar: " : "rate_tick_avx2: ")
+            << (double)ns / (BENCH_RATE_TICKS * BENCH_INTERFACES) << " ns/interface, "
+            << (double)BENCH_RATE_TICKS * BENCH_INTERFACES * 1e3 / ns << " interfaces/us, the kernel alone "
+            << (double)BENCH_RATE_TICKS * BENCH_INTERFACES * 1e3 / kernel_ns << " interfaces/us with "
+            << engines[0].num_thresholds << " thresholds (checksum " << checksum << ")" << std::endl;
+        if(picked == rate_kernel_scalar)
+            break;
+    }
+    rate_kernel = picked;
+    for (int e = 0; e < 2; e++)
+        rate_engine_free(&engines[e]);
+    delete[] counters;
+    delete[] states;
+    delete[] samples;
+}
+
+//Rules of the alert benchmark, every kind of value and condition
+const char* const bench_alert_rules[] {
+    "rx_bps > 10G", "tx_bps > 10G", "rx_pps > 1M", "tx_pps > 1M", "rx_drop_ratio > 1%", "tx_drop_ratio > 1%",
+    "rx_error_ratio > 0.1%", "tx_error_ratio > 0.1%", "rx_dropped rate > 1000/s for 5s", "tx_dropped rate > 1000/s for 5s",
+    "rx_errors rate > 100/s for 5s", "tx_errors rate > 100/s for 5s", "rx_bps < 1 for 1m", "tx_bps < 1 for 1m", "up < 1",
+    "rx_bytes rate > 1G/s for 10s", "rx_bps deviates 4σ from 10m baseline", "tx_bps deviates 4σ from 10m baseline",
+    "rx_pps deviates 4σ from 10m baseline", "tx_pps deviates 4σ from 10m baseline"
+};
+
+/*Bench Alerts function is responsible for*/
+/*timing the evaluation of 20 rules on every interface of a tick, notices are written to /dev/null*/
+void bench_alerts() {
+    const int num_rules = sizeof(bench_alert_rules) / sizeof(bench_alert_rules[0]);
+    sample_output out;
+    alert_engine engine {};
+    wire_sample* samples = new wire_sample[BENCH_INTERFACES]();
+    rate_state** states = new rate_state*[BENCH_INTERFACES];
+    uint64_t seed { 2463534242ull }, ns { 0 };
+    const char* error;
+    int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    for (const char* rule : bench_alert_rules) {
+        if(!alerts_add_rule(&engine, rule, &error)) {
+            std::cerr << "NMBench: " << error << ": " << rule << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(!output_init(&out, BENCH_INTERFACES, (size_t)BENCH_HISTORY_MB << 20, FORMAT_JSON, fd)) {
+        std::cerr << "NMBench: cannot allocate the history" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    alerts_init(&engine, &out.rates, BENCH_INTERFACES);
+    for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+        snprintf(samples[i].interface, IFNAMSIZ, "bench%zu", i);
+        strcpy(samples[i].stats.operstate, "up");
+        states[i] = rate_engine_find(&out.rates, samples[i].interface);
+    }
+
+    for (uint64_t tick = 1; tick <= BENCH_ALERT_TICKS; tick++) {
+        for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+            samples[i].timestamp_ns = tick * BENCH_INTERVAL_NS;
+            for (int c = 0; c < RATE_COUNT; c++)
+                samples[i].stats.counters[rate_counters.ids[c]] += bench_random(&seed) >> 44;
+        }
+        uint64_t start = monotonic_ns(); //the thresholds are compared by the kernel of the tick
+        bench_tick(&out.rates, states, samples, BENCH_INTERFACES);
+        for (size_t i = 0; i < BENCH_INTERFACES; i++)
+            alerts_evaluate(&engine, &out, states[i], &samples[i]);
+        ns += monotonic_ns() - start;
+    }
+    std::cout << "rate tick and alerts_evaluate: " << ns / 1e3 / BENCH_ALERT_TICKS << " us/tick for " << BENCH_INTERFACES << " interfaces x "
+        << num_rules << " rules, " << (double)ns / ((uint64_t)BENCH_ALERT_TICKS * BENCH_INTERFACES * num_rules) << " ns/rule ("
+        << engine.fired << " fired, " << engine.suppressed << " held back)" << std::endl;
+
+    alerts_free(&engine);
+    output_free(&out);
+    close(fd);
+    delete[] states;
+    delete[] samples;
+}
+
+/*Bench Link is the traffic profile of a generated interface*/
+struct bench_link {
+    uint64_t bytes_per_s; //received, a third of it is sent
+    uint64_t packet_len;
+};
+
+/*Function is responsible for*/
+/*moving a sample one tick of typical traffic forward: steady byte and packet rates within 10%,*/
+/*now and then a few drops, a little multicast, the error counters quiet, the queues sharing the traffic*/
+void bench_traffic(wire_sample* sample, const bench_link* link, uint64_t tick, uint64_t* seed) {
+    interface_stats* stats = &sample->stats;
+    uint64_t rx = link->bytes_per_s * (90 + bench_random(seed) % 21) / 100;
+    uint64_t tx = link->bytes_per_s / 3 * (90 + bench_random(seed) % 21) / 100;
+
+    sample->timestamp_ns = tick * BENCH_INTERVAL_NS + bench_random(seed) % 40000; //wakeups late by up to 40 us
+    stats->counters[CTR_RX_BYTES] += rx;
+    stats->counters[CTR_TX_BYTES] += tx;
+    stats->counters[CTR_RX_PACKETS] += rx / link->packet_len;
+    stats->counters[CTR_TX_PACKETS] += tx / link->packet_len;
+    stats->counters[CTR_MULTICAST] += bench_random(seed) % 3;
+    if(bench_random(seed) % 100 == 0)
+        stats->counters[CTR_RX_DROPPED] += bench_random(seed) % 10;
+    for (int q = 0; stats->has_queue_stats && q < queues_kept(stats, QUEUE_RX); q++) {
+        stats->queues[QCTR_RX_BYTES][q] += rx / stats->num_queues[QUEUE_RX];
+        stats->queues[QCTR_RX_PACKETS][q] += rx / link->packet_len / stats->num_queues[QUEUE_RX];
+    }
+    for (int q = 0; stats->has_queue_stats && q < queues_kept(stats, QUEUE_TX); q++) {
+        stats->queues[QCTR_TX_BYTES][q] += tx / stats->num_queues[QUEUE_TX];
+        stats->queues[QCTR_TX_PACKETS][q] += tx / link->packet_len / stats->num_queues[QUEUE_TX];
+    }
+}
+
+/*Function is responsible for*/
+/*generating the interfaces of the codec benchmark, a quarter of them with queue counters*/
+void bench_links(wire_sample* samples, bench_link* links, uint64_t* seed) {
+    for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+        memset(&samples[i], 0, sizeof(samples[i]));
+        snprintf(samples[i].interface, IFNAMSIZ, "bench%zu", i);
+        links[i].bytes_per_s = 1000ull << (bench_random(seed) % 20); //1 kB/s up to 500 MB/s
+        links[i].packet_len = 64 + bench_random(seed) % 1437;
+        if(i % 4 == 0) {
+            samples[i].stats.has_queue_stats = 1;
+            samples[i].stats.num_queues[QUEUE_RX] = samples[i].stats.num_queues[QUEUE_TX] = 4;
+        }
+    }
+}
+
+/*Bench Codec function is responsible for*/
+/*measuring the size and the speed of the sample codec on typical traffic of every interface*/
+/*and checking that every sample decodes to the one encoded*/
+void bench_codec() {
+    const size_t num_samples = (size_t)BENCH_CODEC_TICKS * BENCH_INTERFACES;
+    sample_codec encoder, decoder;
+    wire_sample* samples = new wire_sample[BENCH_INTERFACES];
+    bench_link* links = new bench_link[BENCH_INTERFACES];
+    uint8_t* data = new uint8_t[num_samples * BENCH_CODEC_BYTES + CODEC_RECORD_LEN];
+    size_t* blocks = new size_t[num_samples * BENCH_CODEC_BYTES / SEGMENT_BLOCK_LEN + 2]; //end of every block
+    size_t len { 0 }, block_start { 0 }, num_blocks { 0 }, values { 0 };
+    uint64_t seed { 362436069ull }, encode_ns { 0 }, decode_ns { 0 }, mismatches { 0 };
+    uint8_t operstate { 0 };
+    uint32_t entry;
+    wire_sample decoded;
+
+    codec_init(&encoder, BENCH_INTERFACES);
+    codec_init(&decoder, BENCH_INTERFACES);
+    bench_links(samples, links, &seed);
+    codec_block(&encoder);
+    for (uint64_t tick = 1; tick <= BENCH_CODEC_TICKS && len + BENCH_INTERFACES * CODEC_RECORD_LEN <= num_samples * BENCH_CODEC_BYTES; tick++) {
+        for (size_t i = 0; i < BENCH_INTERFACES; i++)
+            bench_traffic(&samples[i], &links[i], tick, &seed);
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < BENCH_INTERFACES; i++) {
+            if(len - block_start + CODEC_RECORD_LEN > SEGMENT_BLOCK_LEN) { //cut like the recorder does
+                blocks[num_blocks++] = block_start = len;
+                codec_block(&encoder);
+            }
+            len += codec_encode(&encoder, i, 1, &samples[i], data + len);
+        }
+        encode_ns += monotonic_ns() - start;
+        for (size_t i = 0; i < BENCH_INTERFACES; i++)
+            values += NUM_COUNTERS + (samples[i].stats.has_queue_stats ? NUM_QUEUE_COUNTERS * 4 : 0);
+    }
+    blocks[num_blocks++] = len;
+
+    for (int pass = 0; pass < 2; pass++) { //timed, then checked against the regenerated traffic
+        const uint8_t* p = data;
+        uint64_t start = monotonic_ns();
+        seed = 362436069ull;
+        bench_links(samples, links, &seed);
+        for (size_t b = 0, n = 0; b < num_blocks; b++) {
+            codec_block(&decoder);
+            while (p < data + blocks[b] && codec_decode(&decoder, &p, data + blocks[b], &entry, &operstate, &decoded)) {
+                if(pass == 0) {
+                    continue;
+                }
+                if(n % BENCH_INTERFACES == 0) {
+                    for (size_t i = 0; i < BENCH_INTERFACES; i++)
+                        bench_traffic(&samples[i], &links[i], n / BENCH_INTERFACES + 1, &seed);
+                }
+                const wire_sample* sample = &samples[n % BENCH_INTERFACES];
+                if(entry != n++ % BENCH_INTERFACES || decoded.timestamp_ns != sample->timestamp_ns
+                   || memcmp(&decoded.stats.num_queues, &sample->stats.num_queues, sizeof(interface_stats) - offsetof(interface_stats, num_queues)) != 0)
+                    ++mismatches;
+            }
+        }
+        if(pass == 0)
+            decode_ns = monotonic_ns() - start;
+    }
+    std::cout << "codec: " << (double)len / num_samples << " bytes/sample, " << (double)len / values << " bytes/counter ("
+        << sizeof(interface_stats) + 2 * sizeof(uint64_t) << " bytes/sample raw), encode " << (double)encode_ns / num_samples << " ns/sample "
+        << values * 1e3 / encode_ns << " Mcounters/s, decode " << (double)decode_ns / num_samples << " ns/sample "
+        << values * 1e3 / decode_ns << " Mcounters/s, " << num_blocks << " blocks, " << mismatches << " mismatches" << std::endl;
+
+    codec_free(&encoder);
+    codec_free(&decoder);
+    delete[] blocks;
+    delete[] data;
+    delete[] links;
+    delete[] samples;
+}
+
+/*Function is responsible for*/
+/*handling the ready events of the fan-out server without waiting, returns the time it took*/
+uint64_t bench_dispatch(int epoll_fd) {
+    struct epoll_event events[64];
+    uint64_t start = monotonic_ns();
+    int ready;
+
+    while ((ready = epoll_wait(epoll_fd, events, 64, 0)) > 0) {
+        for (int i = 0; i < ready; i++) {
+            event_source* source = (event_source*)events[i].data.ptr;
+            source->handle(source);
+        }
+    }
+    return monotonic_ns() - start;
+}
+
+/*Function is responsible for*/
+/*reading everything the fan-out server sent to the subscribers so far*/
+void bench_drain(const int* fds, int num_fds, char* data, size_t len) {
+    for (int i = 0; i < num_fds; i++) {
+        while (recv(fds[i], data, len, MSG_DONTWAIT) > 0);
+    }
+}
+
+/*Function is responsible for*/
+/*timing the encoding and the fan-out of every tick to BENCH_SUBSCRIBERS subscribers of a request*/
+/*a stalled run never reads the subscribers, its ticks have to be dropped instead of holding up the loop*/
+void bench_fanout_run(const char* name, const char* request, bool is_stalled) {
+    fanout_server server;
+    rate_engine engine;
+    wire_sample* samples = new wire_sample[BENCH_FANOUT_INTERFACES]();
+    rate_state** states = new rate_state*[BENCH_FANOUT_INTERFACES];
+    char* data = new char[BENCH_READ_LEN];
+    int fds[BENCH_SUBSCRIBERS];
+    uint64_t seed { 88172645463325252ull }, ns { 0 };
+    char path[64];
+    struct sockaddr_un addr;
+    int epoll_fd;
+
+    snprintf(path, sizeof(path), "/tmp/nmbench-fanout-%d", getpid());
+    if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 || !fanout_init(&server, path, epoll_fd, BENCH_FANOUT_INTERFACES, 0)) {
+        perror("NMBench: cannot listen for subscribers");
+        exit(EXIT_FAILURE);
+    }
+    rate_engine_init(&engine, BENCH_FANOUT_INTERFACES);
+    for (size_t i = 0; i < BENCH_FANOUT_INTERFACES; i++) {
+        snprintf(samples[i].interface, IFNAMSIZ, "bench%zu", i);
+        strcpy(samples[i].stats.operstate, "up");
+        states[i] = rate_engine_find(&engine, samples[i].interface);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    for (int i = 0; i < BENCH_SUBSCRIBERS; i++) {
+        if((fds[i] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 || connect(fds[i], (struct sockaddr*)&addr, sizeof(addr)) < 0
+           || send(fds[i], request, strlen(request), 0) < 0) {
+            perror("NMBench: cannot subscribe");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (server.accepted < BENCH_SUBSCRIBERS)
+        bench_dispatch(epoll_fd);
+
+    for (uint64_t tick = 1; tick <= BENCH_FANOUT_TICKS; tick++) {
+        for (size_t i = 0; i < BENCH_FANOUT_INTERFACES; i++) {
+            samples[i].timestamp_ns = tick * BENCH_INTERVAL_NS;
+            bench_advance(&samples[i], &seed);
+        }
+        bench_tick(&engine, states, samples, BENCH_FANOUT_INTERFACES);
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < BENCH_FANOUT_INTERFACES; i++)
+            fanout_sample(&server, &engine, states[i], &samples[i]);
+        fanout_publish(&server);
+        ns += monotonic_ns() - start;
+        if(is_stalled) {
+            continue;
+        }
+        while (server.delivered < tick * BENCH_SUBSCRIBERS) { //the subscribers keep up, what is left is sent on EPOLLOUT
+            bench_drain(fds, BENCH_SUBSCRIBERS, data, BENCH_READ_LEN);
+            ns += bench_dispatch(epoll_fd);
+        }
+    }
+    std::cout << "fanout " << name << ": " << ns / 1e3 / BENCH_FANOUT_TICKS << " us/tick for " << BENCH_SUBSCRIBERS << " subscribers of "
+        << BENCH_FANOUT_INTERFACES << " interfaces, " << (double)ns / ((uint64_t)BENCH_FANOUT_TICKS * BENCH_SUBSCRIBERS) << " ns/subscriber, "
+        << server.bytes * 1e3 / ns << " MB/s (" << server.delivered << " ticks delivered, " << server.dropped << " dropped)" << std::endl;
+
+    for (int i = 0; i < BENCH_SUBSCRIBERS; i++)
+        close(fds[i]);
+    fanout_close(&server);
+    close(epoll_fd);
+    rate_engine_free(&engine);
+    delete[] data;
+    delete[] states;
+    delete[] samples;
+}
+
+/*Bench Fanout function is responsible for*/
+/*timing the fan-out of the ticks to subscribers of everything, of a few fields, and to stalled ones*/
+void bench_fanout() {
+    bench_fanout_run("all", "\n", false);
+    bench_fanout_run("filtered", "interfaces=bench1* counters=rx_bytes,tx_bytes,rx_bps,tx_bps\n", false);
+    bench_fanout_run("stalled", "\n", true);
+}
+
+/*Bench Flow Table function is responsible for*/
+/*timing the flow table on generated heavy-tailed traffic and comparing its top talkers with the exact ones*/
+void bench_flow_table() {
+    flow_table* table = new flow_table;
+    flow_key* keys = new flow_key[BENCH_FLOWS];
+    uint32_t* packets = new uint32_t[BENCH_FLOW_PACKETS];
+    uint64_t* bytes = new uint64_t[BENCH_FLOWS](); //exact bytes of every flow
+    std::vector<std::pair<uint64_t, uint32_t>> largest(BENCH_FLOWS); //bytes and flow
+    wire_flow top[FLOW_TOP_K];
+    uint64_t seed { 88172645463325252ull }, ns;
+    int found { 0 };
+    double max_error { 0 };
+
+    for (uint32_t f = 0; f < BENCH_FLOWS; f++) {
+        memset(&keys[f], 0, sizeof(keys[f]));
+        keys[f].family = AF_INET;
+        keys[f].protocol = f % 3 == 0 ? IPPROTO_UDP : IPPROTO_TCP;
+        keys[f].src[0] = 10; //10.f/8, the flow can be told from its source
+        keys[f].src[1] = f >> 16;
+        keys[f].src[2] = f >> 8;
+        keys[f].src[3] = f;
+        keys[f].dst[0] = 192;
+        keys[f].dst[1] = 168;
+        keys[f].dst[3] = f % 7;
+        keys[f].src_port = 1024 + f % 50000;
+        keys[f].dst_port = f % 2 == 0 ? 443 : 80;
+    }
+    for (uint32_t p = 0; p < BENCH_FLOW_PACKETS; p++) { //log-uniform flow numbers, about Zipf with exponent 1
+        packets[p] = (uint32_t)pow(BENCH_FLOWS, (bench_random(&seed) >> 11) * 0x1p-53) - 1;
+        bytes[packets[p]] += 64 + packets[p] * 37 % 1400;
+    }
+
+    flow_table_reset(table);
+    uint64_t start = monotonic_ns();
+    for (uint32_t p = 0; p < BENCH_FLOW_PACKETS; p++)
+        flow_table_add(table, &keys[packets[p]], 64 + packets[p] * 37 % 1400);
+    int count = flow_table_top(table, 1, top);
+    ns = monotonic_ns() - start;
+
+    for (uint32_t f = 0; f < BENCH_FLOWS; f++)
+        largest[f] = { bytes[f], f };
+    std::partial_sort(largest.begin(), largest.begin() + FLOW_TOP_K, largest.end(), std::greater<std::pair<uint64_t, uint32_t>>());
+    for (int i = 0; i < count; i++) {
+        uint32_t f = top[i].src[1] << 16 | top[i].src[2] << 8 | top[i].src[3];
+        for (int k = 0; k < FLOW_TOP_K; k++)
+            found += largest[k].second == f;
+        max_error = std::max(max_error, fabs((double)top[i].bytes - bytes[f]) / bytes[f]);
+    }
+    report("flows table", BENCH_FLOW_PACKETS, ns, "packet");
+    std::cout << "flows table: " << found << " of the " << FLOW_TOP_K << " largest of " << BENCH_FLOWS << " flows found, "
+        << max_error * 100 << "% largest error of their bytes, " << sizeof(flow_table) / 1024 << " KB per interface" << std::endl;
+
+    delete[] bytes;
+    delete[] packets;
+    delete[] keys;
+    delete table;
+}
+
+/*Bench Flow Ring function is responsible for*/
+/*sending UDP datagrams over lo and timing how fast the sampler reads them back from its ring*/
+/*skipped without the privileges of a packet socket*/
+void bench_flow_ring() {
+    flow_sampler* sampler = new flow_sampler;
+    struct sockaddr_in addr;
+    socklen_t addr_len { sizeof(addr) };
+    char data[512], discard[2048];
+    wire_flows flows;
+    size_t num_read { 0 };
+    uint64_t ns { 0 };
+    int fds[2];
+
+    if(!flow_sampler_open(sampler, "lo", 1)) {
+        std::cout << "flows ring: skipped, " << strerror(errno) << std::endl;
+        delete sampler;
+        return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    memset(data, 'x', sizeof(data));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 2; i++) {
+        fds[i] = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        bind(fds[i], (struct sockaddr*)&addr, sizeof(addr));
+    }
+    getsockname(fds[1], (struct sockaddr*)&addr, &addr_len);
+    connect(fds[0], (struct sockaddr*)&addr, sizeof(addr));
+    flow_sampler_report(sampler, &flows); //whatever lo carried before
+
+    for (int p = 0; p < BENCH_RING_PACKETS; p++) {
+        send(fds[0], data, sizeof(data), 0);
+        if(p % BENCH_RING_BURST == BENCH_RING_BURST - 1 || p == BENCH_RING_PACKETS - 1) {
+            while (recv(fds[1], discard, sizeof(discard), MSG_DONTWAIT) > 0)
+                ;
+            uint64_t start = monotonic_ns();
+            num_read += flow_sampler_read(sampler);
+            ns += monotonic_ns() - start;
+        }
+    }
+    usleep(2 * FLOW_BLOCK_TIMEOUT_MS * 1000); //the last block is retired by its timeout
+    uint64_t start = monotonic_ns();
+    num_read += flow_sampler_read(sampler);
+    ns += monotonic_ns() - start;
+    flow_sampler_report(sampler, &flows);
+
+    const wire_flow* top = &flows.flows[0];
+    bool is_ours = flows.count > 0 && top->protocol == IPPROTO_UDP && top->dst_port == ntohs(addr.sin_port);
+    report("flows ring", std::max<size_t>(num_read, 1), ns, "packet");
+    std::cout << "flows ring: top flow " << (is_ours ? "is" : "is not") << " the generated one, " << (is_ours ? top->packets : 0)
+        << " of " << BENCH_RING_PACKETS << " packets, " << flows.dropped << " dropped, " << FLOW_BLOCK_LEN * FLOW_NUM_BLOCKS / 1024
+        << " KB ring" << std::endl;
+
+    close(fds[0]);
+    close(fds[1]);
+    flow_sampler_close(sampler);
+    delete sampler;
+}
+
+/*Bench Flows function is responsible for*/
+/*timing the top talkers, in the table on generated traffic and through the ring on lo*/
+void bench_flows() {
+    bench_flow_table();
+    bench_flow_ring();
+}
+
+rate_engine merged_rates; //rates of the samples merged by the benchmarked aggregator
+
+/*Function is responsible for*/
+/*merging a sample of an uploading host into the rates, as networkMonitor does first*/
+void bench_merge(wire_sample* sample) {
+    rate_update(&merged_rates, rate_engine_find(&merged_rates, sample->interface, sample->stats.host), sample);
+}
+
+/*Function is responsible for*/
+/*forgetting nothing, no host stays away during the benchmark*/
+void bench_forget(uint16_t host) {
+}
+
+/*Bench Federation Run function is responsible for*/
+/*timing BENCH_UPLINKS hosts uploading a batch per tick to one aggregator over UNIX sockets*/
+/*the time covers the batching, the sends and the merge into the rates, checked against what was uploaded*/
+void bench_federation_run(const char* name, bool is_compressed) {
+    fed_server server;
+    fed_uplink* uplinks = new fed_uplink[BENCH_UPLINKS];
+    wire_sample* samples = new wire_sample[BENCH_UPLINK_INTERFACES]();
+    struct sockaddr_storage addr;
+    struct sockaddr_un* unix_addr = (struct sockaddr_un*)&addr;
+    uint64_t seed { 88172645463325252ull }, ns { 0 }, bytes { 0 };
+    char path[64], host[HOST_NAME_LEN];
+    int epoll_fd;
+
+    snprintf(path, sizeof(path), "/tmp/nmbench-federation-%d", getpid());
+    if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 || !fed_server_init(&server, path, epoll_fd, 0, bench_merge, bench_forget)) {
+        perror("NMBench: cannot listen for uploads");
+        exit(EXIT_FAILURE);
+    }
+    rate_engine_init(&merged_rates, BENCH_UPLINKS * BENCH_UPLINK_INTERFACES);
+    memset(&addr, 0, sizeof(addr));
+    unix_addr->sun_family = AF_UNIX;
+    strcpy(unix_addr->sun_path, path);
+    std::cout.setstate(std::ios::failbit); //every host connecting and leaving is announced
+    for (int u = 0; u < BENCH_UPLINKS; u++) {
+        snprintf(host, sizeof(host), "host%d", u);
+        if(!uplink_init(&uplinks[u], &addr, sizeof(struct sockaddr_un), host, is_compressed, 0, BENCH_UPLINK_INTERFACES, epoll_fd, 0)) {
+            std::cerr << "NMBench: cannot start the upload of " << host << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        bench_dispatch(epoll_fd); //accepted before the backlog fills up
+    }
+    for (int u = 0; u < BENCH_UPLINKS; u++) {
+        while (uplinks[u].state != FED_STREAMING)
+            bench_dispatch(epoll_fd);
+    }
+    std::cout.clear();
+    for (size_t i = 0; i < BENCH_UPLINK_INTERFACES; i++) {
+        snprintf(samples[i].interface, IFNAMSIZ, "bench%zu", i);
+        strcpy(samples[i].stats.operstate, "up");
+    }
+
+    for (uint64_t tick = 1; tick <= BENCH_UPLINK_TICKS; tick++) {
+        for (size_t i = 0; i < BENCH_UPLINK_INTERFACES; i++) { //every host uploads the same counters, the merge does not care
+            samples[i].timestamp_ns = tick * BENCH_INTERVAL_NS;
+            bench_advance(&samples[i], &seed);
+        }
+        uint64_t start = monotonic_ns();
+        for (int u = 0; u < BENCH_UPLINKS; u++) {
+            for (size_t i = 0; i < BENCH_UPLINK_INTERFACES; i++)
+                uplink_append(&uplinks[u], i, &samples[i]);
+            uplink_tick(&uplinks[u], start);
+        }
+        while (server.batches < tick * BENCH_UPLINKS)
+            bench_dispatch(epoll_fd);
+        ns += monotonic_ns() - start;
+    }
+    for (int u = 0; u < BENCH_UPLINKS; u++)
+        bytes += uplinks[u].bytes;
+    uint64_t merged = (uint64_t)BENCH_UPLINKS * BENCH_UPLINK_INTERFACES * BENCH_UPLINK_TICKS;
+    std::cout << "federation " << name << ": " << ns / 1e3 / BENCH_UPLINK_TICKS << " us/tick for " << BENCH_UPLINKS << " hosts of "
+        << BENCH_UPLINK_INTERFACES << " interfaces, " << (double)ns / merged << " ns/sample, " << (double)bytes / merged << " bytes/sample ("
+        << server.samples << " of " << merged << " samples merged, " << merged_rates.count << " interfaces, " << server.gaps << " batches lost)" << std::endl;
+
+    std::cout.setstate(std::ios::failbit);
+    for (int u = 0; u < BENCH_UPLINKS; u++)
+        uplink_close(&uplinks[u]);
+    fed_server_close(&server);
+    std::cout.clear();
+    close(epoll_fd);
+    rate_engine_free(&merged_rates);
+    delete[] samples;
+    delete[] uplinks;
+}
+
+/*Bench Federation function is responsible for*/
+/*timing an aggregator fed whole samples and codec records*/
+void bench_federation() {
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) { //both ends of every upload are open in this process
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    bench_federation_run("raw", false);
+    bench_federation_run("compressed", true);
+}
+
+/*Function is responsible for*/
+/*reading CLOCK_REALTIME in nanoseconds, the clock of the machine-readable timestamps*/
+uint64_t realtime_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/*Function is responsible for*/
+/*reading the CPU time this process consumed in nanoseconds*/
+uint64_t process_cpu_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/*Function is responsible for*/
+/*sleeping for ns unless SIGINT arrives*/
+void sleep_ns(uint64_t ns) {
+    struct timespec delay { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+    nanosleep(&delay, NULL);
+}
+
+/*Function is responsible for*/
+/*stopping the generator on SIGINT*/
+static void signal_handler(int sig) {
+    is_generating = false;
+}
+
+/*Generate Tree function is responsible for*/
+/*writing a tree of num_interfaces interfaces and advancing it on every interval until SIGINT*/
+/*with a churn the oldest interfaces are replaced by new ones, spread over the ticks*/
+void generate_tree(const char* root, size_t num_interfaces) {
+    fake_sysfs tree;
+    struct sigaction action;
+    uint64_t replaced { 0 };
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigemptyset(&action.sa_mask);
+    if(sigaction(SIGINT, &action, NULL) < 0 || sigaction(SIGTERM, &action, NULL) < 0) {
+        perror("Error while setting action for a signal");
+        exit(EXIT_FAILURE);
+    }
+    if(!fake_sysfs_create(&tree, root, num_interfaces)) {
+        perror("Error while generating the tree");
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "NMBench: " << num_interfaces << " interfaces " FAKE_INTERFACE_PREFIX "0.. under " << root
+        << " advancing every " << run_interval_ms << " ms, replacing " << churn_per_minute << " per minute, run networkMonitor --sysfs-root " << root << std::endl;
+    is_generating = true;
+    while (is_generating) {
+        fake_sysfs_advance(&tree);
+        uint64_t due = tree.ticks * run_interval_ms * churn_per_minute / 60000;
+        for (; replaced < due && is_generating; replaced++) {
+            if(!fake_sysfs_replace(&tree, replaced % tree.num_interfaces)) {
+                perror("Error while replacing an interface");
+                is_generating = false;
+            }
+        }
+        sleep_ns(run_interval_ms * 1000000ull);
+    }
+    std::cout << "NMBench: stopped after " << tree.ticks << " ticks and " << replaced << " replaced interfaces, the tree is left in place" << std::endl;
+    fake_sysfs_close(&tree);
+}
+
+/*Function is responsible for*/
+/*advancing the tree on every interval while the end-to-end run lasts*/
+void advance_tree(fake_sysfs* tree) {
+    while (is_advancing) {
+        fake_sysfs_advance(tree);
+        sleep_ns(run_interval_ms * 1000000ull);
+    }
+}
+
+/*Read Output function is responsible for*/
+/*draining the CSV output of networkMonitor, counting the samples*/
+/*and measuring how long ago each was taken while is_measuring is set*/
+void read_output(int fd) {
+    char* buffer = new char[BENCH_READ_LEN];
+    size_t len { 0 };
+    ssize_t ret;
+
+    while ((ret = read(fd, buffer + len, BENCH_READ_LEN - len)) > 0 || (ret < 0 && errno == EINTR)) {
+        if(ret < 0) {
+            continue;
+        }
+        uint64_t now = realtime_ns(); //every line of the chunk became readable by now
+        char* line = buffer;
+        char* end = buffer + len + ret;
+        char* newline;
+        while ((newline = (char*)memchr(line, '\n', end - line)) != nullptr) {
+            if(*line >= '0' && *line <= '9') { //samples start with their timestamp
+                uint64_t time_ns = parse_u64(line, newline - line);
+                if(is_measuring) {
+                    latencies.push_back(now > time_ns ? now - time_ns : 0);
+                }
+                samples_read.fetch_add(1, std::memory_order_relaxed);
+            } else if(newline > line) {
+                last_line.assign(line, newline - line);
+            }
+            line = newline + 1;
+        }
+        len = end - line;
+        if(len == BENCH_READ_LEN) { //no line that long is ever written
+            len = 0;
+        }
+        memmove(buffer, line, len);
+    }
+    delete[] buffer;
+}
+
+/*Function is responsible for*/
+/*listing the thread ids of process pid*/
+void list_tasks(pid_t pid, bool is_monitor, std::vector<traced_task>* tasks) {
+    char path[64];
+    struct dirent* entry;
+    DIR* dir;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    if((dir = opendir(path)) == nullptr) {
+        return;
+    }
+    while ((entry = readdir(dir)) != nullptr) {
+        if(entry->d_name[0] >= '0' && entry->d_name[0] <= '9')
+            tasks->push_back(traced_task { (pid_t)atoi(entry->d_name), is_monitor, false, 0 });
+    }
+    closedir(dir);
+}
+
+/*Function is responsible for*/
+/*listing the processes whose parent is pid*/
+void list_children(pid_t pid, std::vector<pid_t>* children) {
+    char path[PATH_MAX], stat[512];
+    struct dirent* entry;
+    DIR* dir;
+    int fd;
+
+    if((dir = opendir("/proc")) == nullptr) {
+        return;
+    }
+    while ((entry = readdir(dir)) != nullptr) {
+        if(entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            continue;
+        }
+        ssize_t len = read(fd, stat, sizeof(stat)-1);
+        close(fd);
+        if(len <= 0) {
+            continue;
+        }
+        stat[len] = '\0';
+        const char* fields = strrchr(stat, ')'); //the command name may contain anything
+        int ppid;
+        if(fields != nullptr && sscanf(fields, ") %*c %d", &ppid) == 1 && ppid == pid)
+            children->push_back(atoi(entry->d_name));
+    }
+    closedir(dir);
+}
+
+/*Function is responsible for*/
+/*summing the time every thread of pid spent on a CPU in nanoseconds*/
+uint64_t task_cpu_ns(pid_t pid) {
+    std::vector<traced_task> tasks;
+    char path[64], schedstat[128];
+    uint64_t total { 0 };
+    int fd;
+
+    list_tasks(pid, false, &tasks);
+    for (const traced_task& task : tasks) {
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/schedstat", pid, task.tid);
+        if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            continue;
+        }
+        ssize_t len = read(fd, schedstat, sizeof(schedstat)-1);
+        close(fd);
+        if(len > 0)
+            total += parse_u64(schedstat, len);
+    }
+    return total;
+}
+
+/*Function is responsible for*/
+/*reading the resident set size of pid in KB*/
+uint64_t rss_kb(pid_t pid) {
+    char path[64], line[256];
+    uint64_t rss { 0 };
+    FILE* status;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if((status = fopen(path, "r")) == nullptr) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), status) != nullptr) {
+        if(sscanf(line, "VmRSS: %" SCNu64, &rss) == 1)
+            break;
+    }
+    fclose(status);
+    return rss;
+}
+
+/*Function is responsible for*/
+/*finding the traced task of tid in tasks sorted by tid*/
+traced_task* find_task(std::vector<traced_task>* tasks, pid_t tid) {
+    auto it = std::lower_bound(tasks->begin(), tasks->end(), tid,
+                               [](const traced_task& task, pid_t tid) { return task.tid < tid; });
+    return it != tasks->end() && it->tid == tid ? &*it : nullptr;
+}
+
+/*Trace Syscalls function is responsible for*/
+/*counting the syscall stops of every task for window_ns with ptrace, the way strace -c does*/
+/*signals that arrive meanwhile are passed on, every task is detached afterwards*/
+/*returns the length of the window the syscalls were counted in*/
+uint64_t trace_syscalls(std::vector<traced_task>* tasks, uint64_t window_ns) {
+    size_t num_attached { 0 };
+    bool is_detaching { false };
+    int status;
+
+    std::sort(tasks->begin(), tasks->end(), [](const traced_task& a, const traced_task& b) { return a.tid < b.tid; });
+    for (traced_task& task : *tasks) {
+        if(ptrace(PTRACE_SEIZE, task.tid, 0, PTRACE_O_TRACESYSGOOD) == 0) {
+            task.is_attached = true;
+            ++num_attached;
+            ptrace(PTRACE_INTERRUPT, task.tid, 0, 0); //the first stop starts the syscall tracing
+        }
+    }
+
+    uint64_t start = monotonic_ns();
+    uint64_t end = start + window_ns;
+    while (num_attached > 0) {
+        if(!is_detaching && monotonic_ns() >= end) {
+            is_detaching = true; //every task stops once more to be detached
+            end = monotonic_ns();
+            for (traced_task& task : *tasks) {
+                if(task.is_attached)
+                    ptrace(PTRACE_INTERRUPT, task.tid, 0, 0);
+            }
+        }
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if(tid < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        traced_task* task = find_task(tasks, tid);
+        if(task == nullptr || !task->is_attached) {
+            continue;
+        }
+        if(WIFEXITED(status) || WIFSIGNALED(status)) {
+            task->is_attached = false;
+            --num_attached;
+            continue;
+        }
+        if(!WIFSTOPPED(status)) {
+            continue;
+        }
+
+        int sig = WSTOPSIG(status), inject { 0 };
+        if(sig == (SIGTRAP | 0x80)) { //syscall entry or exit
+            if(!is_detaching)
+                ++task->stops;
+        } else if((status >> 16) == 0) { //a signal on its way to the task
+            inject = sig;
+        }
+        if(is_detaching) {
+            ptrace(PTRACE_DETACH, tid, 0, inject);
+            task->is_attached = false;
+            --num_attached;
+        } else {
+            ptrace(PTRACE_SYSCALL, tid, 0, inject);
+        }
+    }
+    return end - start;
+}
+
+/*Function is responsible for*/
+/*timing sysfs_collector_read over every interface of the tree*/
+/*or over as many as the descriptor limit keeps open next to the tree*/
+void bench_collector(const fake_sysfs* tree, bench_result* result) {
+    struct rlimit limit;
+    size_t num_interfaces = tree->num_interfaces;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        size_t spare = limit.rlim_cur > (rlim_t)(BENCH_SPARE_FDS + num_interfaces * FAKE_COUNTERS)
+            ? limit.rlim_cur - BENCH_SPARE_FDS - num_interfaces * FAKE_COUNTERS : 0;
+        num_interfaces = std::max<size_t>(1, std::min(num_interfaces, spare / (NUM_COUNTERS + 1)));
+    }
+    sysfs_collector* collectors = new sysfs_collector[num_interfaces];
+    interface_stats stats;
+    size_t rounds = std::max<size_t>(1, BENCH_COLLECTOR_SAMPLES / num_interfaces);
+
+    for (size_t i = 0; i < num_interfaces; i++) {
+        sysfs_collector_init(&collectors[i], tree->interfaces[i].name);
+        if(!collectors[i].is_open) {
+            perror("Error while opening the generated attributes");
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint64_t start = process_cpu_ns();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < num_interfaces; i++)
+            sysfs_collector_read(&collectors[i], &stats);
+    }
+    result->collector_cpu_ns = (double)(process_cpu_ns() - start) / (rounds * num_interfaces);
+    for (size_t i = 0; i < num_interfaces; i++)
+        sysfs_collector_close(&collectors[i]);
+    delete[] collectors;
+}
+
+/*Function is responsible for*/
+/*starting networkMonitor on every interface of the tree with its stdout connected to a pipe*/
+pid_t start_monitor(const fake_sysfs* tree, char** extra_args, int num_extra_args, int* out_fd) {
+    int out_pipe[2];
+    char interval[16], max_interfaces[16];
+    pid_t pid;
+
+    if(pipe2(out_pipe, O_CLOEXEC) < 0 || (pid = fork()) < 0) {
+        perror("Error while starting networkMonitor");
+        exit(EXIT_FAILURE);
+    }
+    if(pid == 0) {
+        //the options of the benchmark come last so that they win over the extra ones
+        const char** args = new const char*[num_extra_args + 14];
+        int num_args { 0 };
+        snprintf(interval, sizeof(interval), "%ld", run_interval_ms);
+        snprintf(max_interfaces, sizeof(max_interfaces), "%zu", tree->num_interfaces);
+        args[num_args++] = network_monitor;
+        for (int i = 0; i < num_extra_args; i++)
+            args[num_args++] = extra_args[i];
+        for (const char* arg : { "-i", (const char*)interval, "-R", (const char*)tree->root, "-f", "csv",
+                                 "-I", "*", "-n", (const char*)max_interfaces })
+            args[num_args++] = arg;
+        args[num_args] = nullptr;
+        dup2(out_pipe[1], STDOUT_FILENO);
+        execv(network_monitor, (char* const*)args);
+        perror("Error while executing networkMonitor");
+        _exit(EXIT_FAILURE);
+    }
+    close(out_pipe[1]);
+    *out_fd = out_pipe[0];
+    return pid;
+}
+
+/*Bench Run function is responsible for*/
+/*measuring networkMonitor end to end on a tree of num_interfaces interfaces*/
+void bench_run(size_t num_interfaces, char** extra_args, int num_extra_args, bench_result* result) {
+    char path[] { "/tmp/nmbench.XXXXXX" };
+    fake_sysfs tree;
+    int out_fd, status;
+
+    memset(result, 0, sizeof(*result));
+    result->num_interfaces = num_interfaces;
+    if(mkdtemp(path) == nullptr || !fake_sysfs_create(&tree, path, num_interfaces)) {
+        perror("Error while generating the tree");
+        exit(EXIT_FAILURE);
+    }
+    sysfs_root = tree.root;
+    bench_collector(&tree, result);
+
+    //networkMonitor collects the tree while it advances
+    is_advancing = true;
+    std::thread advancer(advance_tree, &tree);
+    pid_t pid = start_monitor(&tree, extra_args, num_extra_args, &out_fd);
+    samples_read = 0;
+    latencies.clear();
+    last_line.clear();
+    std::thread reader(read_output, out_fd);
+
+    //Wait for every interface to report, then for the monitors to settle
+    uint64_t deadline = monotonic_ns() + BENCH_START_TIMEOUT_NS;
+    while (samples_read < num_interfaces) {
+        if(waitpid(pid, &status, WNOHANG) == pid || monotonic_ns() > deadline) {
+            std::cerr << "NMBench: networkMonitor did not report " << num_interfaces << " interfaces";
+            if(!last_line.empty()) //racy, only read to explain the failure
+                std::cerr << ", its last words: " << last_line;
+            std::cerr << std::endl;
+            kill(pid, SIGKILL);
+            exit(EXIT_FAILURE);
+        }
+        sleep_ns(10000000);
+    }
+    sleep_ns(BENCH_WARMUP_TICKS * run_interval_ms * 1000000ull);
+
+    std::vector<pid_t> pids { pid }; //networkMonitor first, then the monitors it forked
+    list_children(pid, &pids);
+
+    //CPU time, latency and memory over the measured window
+    uint64_t cpu { 0 }, samples = samples_read;
+    for (pid_t p : pids)
+        cpu -= task_cpu_ns(p);
+    is_measuring = true;
+    sleep_ns(run_seconds * 1000000000ull);
+    is_measuring = false;
+    for (pid_t p : pids)
+        cpu += task_cpu_ns(p);
+    result->samples = samples_read - samples;
+    result->cpu_ns_per_sample = result->samples > 0 ? (double)cpu / result->samples : 0;
+    for (size_t i = 0; i < pids.size(); i++)
+        result->rss_kb[i > 0] += rss_kb(pids[i]);
+
+    //Syscalls of every thread over a shorter traced window
+    std::vector<traced_task> tasks;
+    for (size_t i = 0; i < pids.size(); i++)
+        list_tasks(pids[i], i > 0, &tasks);
+    samples = samples_read;
+    uint64_t window_ns = trace_syscalls(&tasks, BENCH_TRACE_SECONDS * 1000000000ull);
+    samples = samples_read - samples;
+    double ticks = (double)window_ns / (run_interval_ms * 1000000ull);
+    uint64_t syscalls[2] { 0, 0 };
+    for (const traced_task& task : tasks)
+        syscalls[task.is_monitor] += task.stops / 2; //an entry and an exit stop per syscall
+    for (int i = 0; i < 2; i++)
+        result->syscalls_per_tick[i] = syscalls[i] / ticks;
+    result->syscalls_per_sample = samples > 0 ? (double)(syscalls[0] + syscalls[1]) / samples : 0;
+
+    //Stop networkMonitor, the reader finishes once every monitor closed its stdout
+    kill(pid, SIGINT);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    reader.join();
+    close(out_fd);
+    is_advancing = false;
+    advancer.join();
+    fake_sysfs_remove(&tree);
+
+    std::sort(latencies.begin(), latencies.end());
+    if(!latencies.empty()) {
+        const double quantiles[3] { 0.5, 0.9, 0.99 };
+        for (int q = 0; q < 3; q++)
+            result->latency_ns[q] = latencies[(size_t)(quantiles[q] * (latencies.size() - 1))];
+        result->latency_ns[3] = latencies.back();
+    }
+}
+
+/*Bench End To End function is responsible for*/
+/*running networkMonitor at every interface count and printing the results as JSON*/
+void bench_end_to_end(size_t* sizes, int num_sizes, char** extra_args, int num_extra_args) {
+    bench_result* results = new bench_result[num_sizes];
+    struct rlimit limit;
+
+    if(getuid()) {
+        std::cerr << "NMBench: networkMonitor must be run with root privileges" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) { //the collector benchmark keeps the whole tree open
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < num_sizes; i++) {
+        std::cerr << "NMBench: " << sizes[i] << " interfaces..." << std::endl;
+        bench_run(sizes[i], extra_args, num_extra_args, &results[i]);
+    }
+
+    std::string args;
+    for (int i = 0; i < num_extra_args; i++)
+        args += (i > 0 ? " " : "") + std::string(extra_args[i]);
+    printf("{\"benchmark\":\"networkMonitor\",\"interval_ms\":%ld,\"seconds\":%ld,\"trace_seconds\":%d,\"args\":\"",
+           run_interval_ms, run_seconds, BENCH_TRACE_SECONDS);
+    for (char c : args) {
+        if(c == '"' || c == '\\')
+            putchar('\\');
+        putchar((unsigned char)c < 0x20 ? '?' : c);
+    }
+    printf("\",\"results\":[");
+    for (int i = 0; i < num_sizes; i++) {
+        const bench_result* r = &results[i];
+        printf("%s\n{\"interfaces\":%zu,\"collector_cpu_ns_per_sample\":%.1f,\"samples\":%" PRIu64 ","
+               "\"cpu_ns_per_sample\":%.1f,\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f},"
+               "\"syscalls_per_tick\":{\"networkMonitor\":%.1f,\"monitors\":%.1f,\"total\":%.1f},"
+               "\"syscalls_per_sample\":%.2f,\"rss_kb\":{\"networkMonitor\":%" PRIu64 ",\"monitors\":%" PRIu64 ",\"total\":%" PRIu64 "}}",
+               i > 0 ? "," : "", r->num_interfaces, r->collector_cpu_ns, r->samples, r->cpu_ns_per_sample,
+               r->latency_ns[0] / 1e3, r->latency_ns[1] / 1e3, r->latency_ns[2] / 1e3, r->latency_ns[3] / 1e3,
+               r->syscalls_per_tick[0], r->syscalls_per_tick[1], r->syscalls_per_tick[0] + r->syscalls_per_tick[1],
+               r->syscalls_per_sample, r->rss_kb[0], r->rss_kb[1], r->rss_kb[0] + r->rss_kb[1]);
+    }
+    printf("\n]}\n");
+    delete[] results;
+}
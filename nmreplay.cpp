@@ -0,0 +1,132 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <time.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "output.h"
+#include "recorder.h"
+
+void replay(segment_reader* readers, int num_segments);
+
+sample_output output; //same rates, history and printing as networkMonitor
+segment_reader* readers { nullptr }; //every segment given on the command line
+host_table hosts; //hosts of the interfaces of an aggregator recording
+bool is_quiet { false }; //update the rates and the history without printing
+double speed { 0 }; //multiple of real time to replay at, 0 for as fast as possible
+size_t history_mb { DEFAULT_HISTORY_MB }; //memory budget of the history
+output_format format { FORMAT_TEXT }; //how the samples are written
+
+/*NMReplay is responsible for*/
+/*feeding recorded segments through the output path of networkMonitor*/
+int main(int argc, char* argv[]) {
+    uint32_t max_interfaces { 1 };
+    int opt, num_segments;
+
+    while ((opt = getopt(argc, argv, "qx:H:f:")) != -1) {
+        switch (opt) {
+        case 'q': //rates and history only, no printing
+            is_quiet = true;
+            break;
+        case 'x': //pace the samples at a multiple of real time
+            speed = atof(optarg);
+            if(speed < 0) {
+                std::cerr << "NMReplay: the speed must not be negative" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'H': //memory budget of the history
+            if(atoi(optarg) < 1) {
+                std::cerr << "NMReplay: the history budget must be at least 1 MB" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            history_mb = atoi(optarg);
+            break;
+        case 'f': //format of the samples
+            if(!parse_format(optarg, &format)) {
+                std::cerr << "NMReplay: unknown format " << optarg << " (expected text, json, influx or csv)" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if(optind >= argc) {
+        std::cerr << "Usage: " << argv[0] << " [-q] [-x speed] [-f text|json|influx|csv] [-H history_mb] segment..." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    num_segments = argc - optind;
+    readers = new segment_reader[num_segments];
+    hosts.names = new char[MAX_RECORDED_HOSTS][HOST_NAME_LEN]();
+    hosts.count = 1;
+    for (int i = 0; i < num_segments; i++) {
+        if(!segment_open(&readers[i], argv[optind + i], &hosts)) {
+            std::cerr << "NMReplay: " << argv[optind + i] << " is not a readable segment" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if(readers[i].header->num_interfaces > max_interfaces)
+            max_interfaces = readers[i].header->num_interfaces;
+    }
+    if(hosts.count > 1) //recorded by an aggregator, the samples name their hosts
+        host_names = hosts.names;
+    if(!output_init(&output, max_interfaces, history_mb << 20, format, STDOUT_FILENO)) {
+        std::cerr << "NMReplay: " << history_mb << " MB cannot hold the history of " << max_interfaces << " interfaces" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    output.is_quiet = is_quiet;
+    output.epoch_offset_ns = readers[0].header->start_realtime_ns - readers[0].header->start_monotonic_ns; //wall clock of the recording
+    replay(readers, num_segments);
+
+    for (int i = 0; i < num_segments; i++)
+        segment_close(&readers[i]);
+    delete[] readers;
+    delete[] hosts.names;
+    output_free(&output);
+    return 0;
+}
+
+/*Function is responsible for*/
+/*sleeping until the CLOCK_MONOTONIC time ns*/
+void sleep_until(uint64_t ns) {
+    struct timespec deadline { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+/*Replay function is responsible for*/
+/*handing every record of every segment to the output in order*/
+void replay(segment_reader* readers, int num_segments) {
+    wire_sample sample;
+    uint64_t count { 0 }, first_ns { 0 }, last_ns { 0 }, tick_ns { 0 };
+    uint64_t start = monotonic_ns();
+
+    memset(&sample, 0, sizeof(sample));
+    for (int i = 0; i < num_segments; i++) {
+        uint64_t half_interval_ns = readers[i].header->interval_ms * 500000ull;
+        while (segment_next(&readers[i], &sample)) {
+            if(count++ == 0)
+                first_ns = tick_ns = sample.timestamp_ns;
+            if(sample.timestamp_ns >= tick_ns + half_interval_ns) { //next tick, the previous one gets its rates first
+                output_tick(&output);
+                if(speed > 0) {
+                    output_write(&output);
+                    sleep_until(start + (uint64_t)((sample.timestamp_ns - first_ns) / speed));
+                }
+                tick_ns = sample.timestamp_ns;
+            }
+            last_ns = sample.timestamp_ns;
+            output_sample(&output, &sample);
+        }
+    }
+    output_flush(&output);
+
+    uint64_t elapsed = monotonic_ns() - start;
+    std::cerr << "NMReplay: " << count << " samples from " << num_segments << " segments in "
+        << elapsed / 1e6 << " ms, " << (elapsed > 0 ? count * 1e9 / elapsed : 0) << " samples/s, "
+        << (elapsed > 0 ? (double)(last_ns - first_ns) / elapsed : 0) << "x real time, " << output.writes << " writes" << std::endl;
+}
@@ -0,0 +1,629 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <charconv>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "rates.h"
+#include "history.h"
+
+#define OUTPUT_BUF_LEN (1 << 20) //Output buffered per tick before a write is forced
+#define OUTPUT_RECORD_LEN 8192 //Upper bound of one formatted sample in any format
+#define OUTPUT_MEASUREMENT "netmon" //Measurement name of the InfluxDB line protocol
+#define NUM_RATE_FIELDS 8 //Rates and ratios written next to the counters
+#define NUM_EWMA_FIELDS 4 //Smoothed rates written per EWMA window
+
+/*Formats the samples can be written in*/
+enum output_format {
+    FORMAT_TEXT, //the original human readable statistics followed by the rates
+    FORMAT_JSON, //one JSON object per line
+    FORMAT_INFLUX, //InfluxDB line protocol
+    FORMAT_CSV, //comma separated values with a header line
+    FORMAT_COUNT
+};
+
+const char* const format_names[FORMAT_COUNT] { "text", "json", "influx", "csv" };
+
+const char* const rate_field_names[NUM_RATE_FIELDS] {
+    "rx_bps", "tx_bps", "rx_pps", "tx_pps", "rx_drop_ratio", "tx_drop_ratio", "rx_error_ratio", "tx_error_ratio"
+};
+
+const char* const ewma_field_names[RATE_WINDOWS][NUM_EWMA_FIELDS] {
+    { "rx_bps_1s", "tx_bps_1s", "rx_pps_1s", "tx_pps_1s" },
+    { "rx_bps_10s", "tx_bps_10s", "rx_pps_10s", "tx_pps_10s" },
+    { "rx_bps_60s", "tx_bps_60s", "rx_pps_60s", "tx_pps_60s" }
+};
+
+/*Function is called with every sample once its rates are known and it was buffered*/
+typedef void (*sample_fn)(rate_state* state, wire_sample* sample);
+
+/*Sample Output is the path every sample takes in networkMonitor*/
+/*shared by live monitoring and the replay of recordings*/
+/*the samples of a tick wait for one run of the rate kernel, then are formatted into one buffer and written at once*/
+struct sample_output {
+    rate_engine rates; //previous sample and smoothed rates of every interface
+    history_store history; //recent samples and rollups of every interface
+    wire_sample* staged; //sample of every rate id waiting for the rates of the tick
+    wire_flows* flows; //top talkers of every rate id, written after its next sample
+    bool* has_flows; //flows holds a report
+    sample_fn on_sample; //called with every sample taken by the rate engine, nullptr if nothing follows the output
+    bool is_quiet; //update the rates and the history without printing
+    output_format format;
+    int fd; //where the samples are written
+    char* buffer; //samples formatted since the last write
+    size_t len;
+    size_t pending; //samples in the buffer
+    bool is_header_written; //the CSV header line was written
+    int64_t epoch_offset_ns; //CLOCK_REALTIME - CLOCK_MONOTONIC, timestamps of the machine-readable formats
+    uint64_t samples; //samples written
+    uint64_t writes; //write calls made
+};
+
+/*Function is responsible for*/
+/*converting a format name into an output_format*/
+bool parse_format(const char* name, output_format* format) {
+    for (int i = 0; i < FORMAT_COUNT; i++) {
+        if(strcmp(name, format_names[i]) == 0) {
+            *format = (output_format)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*Function is responsible for*/
+/*preparing the output for up to max_interfaces interfaces written to fd*/
+/*returns false if history_bytes cannot hold their history*/
+bool output_init(sample_output* output, size_t max_interfaces, size_t history_bytes, output_format format, int fd) {
+    struct timespec realtime;
+
+    rate_engine_init(&output->rates, max_interfaces);
+    output->staged = new wire_sample[max_interfaces];
+    output->flows = new wire_flows[max_interfaces];
+    output->has_flows = new bool[max_interfaces]();
+    output->on_sample = nullptr;
+    output->is_quiet = false;
+    output->format = format;
+    output->fd = fd;
+    output->buffer = new char[OUTPUT_BUF_LEN];
+    output->len = output->pending = 0;
+    output->is_header_written = false;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    output->epoch_offset_ns = (int64_t)((uint64_t)realtime.tv_sec * 1000000000ull + realtime.tv_nsec) - (int64_t)monotonic_ns();
+    output->samples = output->writes = 0;
+    return history_init(&output->history, max_interfaces, history_bytes);
+}
+
+/*Output Write function is responsible for*/
+/*writing every buffered sample with a single write call*/
+void output_write(sample_output* output) {
+    size_t done { 0 };
+    ssize_t ret;
+
+    while (done < output->len) {
+        self_count(SELF_SYSCALLS);
+        if((ret = write(output->fd, output->buffer + done, output->len - done)) < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("Error while writing the samples");
+            break;
+        }
+        done += ret;
+        ++output->writes;
+        self_count(SELF_BYTES_OUT, ret);
+    }
+    output->len = output->pending = 0;
+}
+
+/*Function is responsible for*/
+/*writing what is left and releasing the output*/
+/*samples staged since the last tick are dropped, what follows the output may be gone already*/
+void output_free(sample_output* output) {
+    if(output->buffer != nullptr) {
+        output_write(output);
+        delete[] output->buffer;
+        output->buffer = nullptr;
+    }
+    delete[] output->staged;
+    delete[] output->flows;
+    delete[] output->has_flows;
+    output->staged = nullptr;
+    rate_engine_free(&output->rates);
+    history_free(&output->history);
+}
+
+/*Output Forget function is responsible for*/
+/*dropping the rates and the history of an interface that is no longer monitored*/
+/*returns the id the interface had, -1 if it never reported*/
+int output_forget(sample_output* output, const char* interface, uint16_t host = 0) {
+    int id = rate_engine_remove(&output->rates, interface, host);
+    if(id >= 0) {
+        history_clear(&output->history.series[id]);
+        output->has_flows[id] = false;
+    }
+    return id;
+}
+
+/*Functions are responsible for*/
+/*appending to the buffer, the caller made room for a whole record*/
+inline void out_char(sample_output* output, char c) {
+    output->buffer[output->len++] = c;
+}
+
+inline void out_str(sample_output* output, const char* str) {
+    size_t len = strlen(str);
+    memcpy(output->buffer + output->len, str, len);
+    output->len += len;
+}
+
+inline void out_u64(sample_output* output, uint64_t value) {
+    output->len = std::to_chars(output->buffer + output->len, output->buffer + OUTPUT_BUF_LEN, value).ptr - output->buffer;
+}
+
+inline void out_f64(sample_output* output, double value, int precision) {
+    output->len = std::to_chars(output->buffer + output->len, output->buffer + OUTPUT_BUF_LEN, value,
+                                std::chars_format::fixed, precision).ptr - output->buffer;
+}
+
+/*Function is responsible for*/
+/*appending an interface or operstate name escaped for the format*/
+void out_name(sample_output* output, const char* name, size_t max_len) {
+    for (size_t i = 0; i < max_len && name[i] != '\0'; i++) {
+        char c = name[i];
+        if(output->format == FORMAT_JSON && (c == '"' || c == '\\')) {
+            out_char(output, '\\');
+        } else if(output->format == FORMAT_INFLUX && (c == ',' || c == '=' || c == ' ' || c == '"' || c == '\\')) {
+            out_char(output, '\\');
+        } else if(output->format == FORMAT_CSV && c == '"') {
+            out_char(output, '"');
+        }
+        out_char(output, (unsigned char)c < 0x20 ? '?' : c);
+    }
+}
+
+/*Function is responsible for*/
+/*the comparison of rate field f with a limit, as the tick kernels run it*/
+rate_threshold field_threshold(int f, double limit, bool is_below) {
+    static const int rates[NUM_RATE_FIELDS] { RATE_RX_BYTES, RATE_TX_BYTES, RATE_RX_PACKETS, RATE_TX_PACKETS,
+                                              RATE_RX_DROPPED, RATE_TX_DROPPED, RATE_RX_ERRORS, RATE_TX_ERRORS };
+    static const int packets[NUM_RATE_FIELDS] { -1, -1, -1, -1, RATE_RX_PACKETS, RATE_TX_PACKETS, RATE_RX_PACKETS, RATE_TX_PACKETS };
+    return rate_threshold { rates[f], packets[f], f < 2 ? 8.0 : 1.0, limit, is_below };
+}
+
+/*Function is responsible for*/
+/*computing rate field f of an interface, per second or as a ratio*/
+inline double rate_field(const rate_engine* engine, uint32_t id, int f) {
+    rate_threshold field = field_threshold(f, 0, false);
+    return rate_threshold_value(engine, &field, id);
+}
+
+/*Function is responsible for*/
+/*computing smoothed field f of window w, bits or packets per second*/
+inline double ewma_field(const rate_engine* engine, uint32_t id, int w, int f) {
+    static const int counters[NUM_EWMA_FIELDS] { RATE_RX_BYTES, RATE_TX_BYTES, RATE_RX_PACKETS, RATE_TX_PACKETS };
+    return engine->ewma[ewma_at(engine, w, counters[f], id)] * (f < 2 ? 8 : 1);
+}
+
+/*Function is responsible for*/
+/*number of decimals written for rate field f*/
+inline int rate_precision(int f) {
+    return f < 4 ? 1 : 6;
+}
+
+/*Function is responsible for*/
+/*appending the field name of counter c of queue q*/
+inline void out_queue_field(sample_output* output, int c, int q) {
+    out_str(output, queue_dir_names[queue_schema[c].dir]);
+    out_str(output, "_queue");
+    out_u64(output, q);
+    out_char(output, '_');
+    out_str(output, queue_schema[c].unit);
+}
+
+/*Function is responsible for*/
+/*appending the CSV header line*/
+/*the host column is there only while other hosts are aggregated*/
+void format_csv_header(sample_output* output) {
+    out_str(output, host_names != nullptr ? "time_ns,host,interface,operstate" : "time_ns,interface,operstate");
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        out_char(output, ',');
+        out_str(output, counter_schema[c].name);
+    }
+    for (int c = 0; c < NUM_QUEUE_COUNTERS; c++) {
+        for (int q = 0; q < MAX_QUEUES; q++) {
+            out_char(output, ',');
+            out_queue_field(output, c, q);
+        }
+    }
+    for (int f = 0; f < NUM_RATE_FIELDS; f++) {
+        out_char(output, ',');
+        out_str(output, rate_field_names[f]);
+    }
+    for (int w = 0; w < RATE_WINDOWS; w++) {
+        for (int f = 0; f < NUM_EWMA_FIELDS; f++) {
+            out_char(output, ',');
+            out_str(output, ewma_field_names[w][f]);
+        }
+    }
+    out_char(output, '\n');
+}
+
+/*Function is responsible for*/
+/*appending the separator and the name of a field, CSV has the names in its header*/
+inline void out_field(sample_output* output, const char* name) {
+    if(output->format == FORMAT_CSV) {
+        out_char(output, ',');
+        return;
+    }
+    out_str(output, output->format == FORMAT_JSON ? ",\"" : ",");
+    out_str(output, name);
+    out_str(output, output->format == FORMAT_JSON ? "\":" : "=");
+}
+
+/*Format Record function is responsible for*/
+/*appending a sample and its rates in one of the machine-readable formats*/
+/*state is nullptr when no rate is known for the sample yet*/
+void format_record(sample_output* output, const wire_sample* sample, const rate_state* state) {
+    uint64_t time_ns = sample->timestamp_ns + output->epoch_offset_ns;
+    const char* host = host_name(sample->stats.host);
+
+    switch (output->format) {
+    case FORMAT_JSON:
+        out_str(output, "{\"time_ns\":");
+        out_u64(output, time_ns);
+        if(host != nullptr) {
+            out_str(output, ",\"host\":\"");
+            out_name(output, host, HOST_NAME_LEN);
+            out_char(output, '"');
+        }
+        out_str(output, ",\"interface\":\"");
+        out_name(output, sample->interface, IFNAMSIZ);
+        out_str(output, "\",\"operstate\":\"");
+        out_name(output, sample->stats.operstate, OPERSTATE_LEN);
+        out_char(output, '"');
+        break;
+
+    case FORMAT_INFLUX:
+        out_str(output, OUTPUT_MEASUREMENT ",interface=");
+        out_name(output, sample->interface, IFNAMSIZ);
+        if(host != nullptr) {
+            out_str(output, ",host=");
+            out_name(output, host, HOST_NAME_LEN);
+        }
+        out_str(output, " operstate=\"");
+        out_name(output, sample->stats.operstate, OPERSTATE_LEN);
+        out_char(output, '"');
+        break;
+
+    default: //FORMAT_CSV
+        out_u64(output, time_ns);
+        if(host_names != nullptr) {
+            out_str(output, ",\"");
+            out_name(output, host != nullptr ? host : "", HOST_NAME_LEN);
+            out_char(output, '"');
+        }
+        out_str(output, ",\"");
+        out_name(output, sample->interface, IFNAMSIZ);
+        out_str(output, "\",");
+        out_name(output, sample->stats.operstate, OPERSTATE_LEN);
+        break;
+    }
+
+    //every counter of the schema, then the kept queues
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        out_field(output, counter_schema[c].name);
+        out_u64(output, sample->stats.counters[c]);
+        if(output->format == FORMAT_INFLUX)
+            out_char(output, 'i');
+    }
+    for (int c = 0; c < NUM_QUEUE_COUNTERS; c++) {
+        int num_queues = sample->stats.has_queue_stats ? queues_kept(&sample->stats, queue_schema[c].dir) : 0;
+        for (int q = 0; q < (output->format == FORMAT_CSV ? MAX_QUEUES : num_queues); q++) {
+            if(output->format == FORMAT_CSV) { //fixed columns, empty for the queues not known
+                out_char(output, ',');
+            } else {
+                out_str(output, output->format == FORMAT_JSON ? ",\"" : ",");
+                out_queue_field(output, c, q);
+                out_str(output, output->format == FORMAT_JSON ? "\":" : "=");
+            }
+            if(q < num_queues) {
+                out_u64(output, sample->stats.queues[c][q]);
+                if(output->format == FORMAT_INFLUX)
+                    out_char(output, 'i');
+            }
+        }
+    }
+
+    for (int f = 0; f < NUM_RATE_FIELDS + RATE_WINDOWS * NUM_EWMA_FIELDS; f++) {
+        bool is_ewma = f >= NUM_RATE_FIELDS;
+        int w = (f - NUM_RATE_FIELDS) / NUM_EWMA_FIELDS, e = (f - NUM_RATE_FIELDS) % NUM_EWMA_FIELDS;
+        if(output->format == FORMAT_CSV) { //fixed columns, empty until the rates are known
+            out_char(output, ',');
+        } else if(state == nullptr) {
+            break;
+        } else {
+            out_str(output, output->format == FORMAT_JSON ? ",\"" : ",");
+            out_str(output, is_ewma ? ewma_field_names[w][e] : rate_field_names[f]);
+            out_str(output, output->format == FORMAT_JSON ? "\":" : "=");
+        }
+        if(state != nullptr) {
+            if(is_ewma) out_f64(output, ewma_field(&output->rates, state->id, w, e), 1);
+            else out_f64(output, rate_field(&output->rates, state->id, f), rate_precision(f));
+        }
+    }
+
+    if(output->format == FORMAT_JSON) {
+        out_char(output, '}');
+    } else if(output->format == FORMAT_INFLUX) {
+        out_char(output, ' ');
+        out_u64(output, time_ns);
+    }
+    out_char(output, '\n');
+}
+
+/*Function is responsible for*/
+/*making room for another record, writing the buffer out if needed*/
+inline void output_reserve(sample_output* output) {
+    if(OUTPUT_BUF_LEN - output->len < OUTPUT_RECORD_LEN)
+        output_write(output);
+}
+
+/*Function is responsible for*/
+/*appending the name of an IP protocol, its number if it has none here*/
+void out_protocol(sample_output* output, uint8_t protocol) {
+    switch (protocol) {
+    case IPPROTO_TCP: out_str(output, "tcp"); break;
+    case IPPROTO_UDP: out_str(output, "udp"); break;
+    case IPPROTO_ICMP: out_str(output, "icmp"); break;
+    case IPPROTO_ICMPV6: out_str(output, "icmpv6"); break;
+    case IPPROTO_SCTP: out_str(output, "sctp"); break;
+    case IPPROTO_UDPLITE: out_str(output, "udplite"); break;
+    case IPPROTO_GRE: out_str(output, "gre"); break;
+    case IPPROTO_ESP: out_str(output, "esp"); break;
+    default: out_u64(output, protocol); break;
+    }
+}
+
+/*Function is responsible for*/
+/*appending an IPv4 or IPv6 address of a flow*/
+inline void out_address(sample_output* output, uint8_t family, const uint8_t* address) {
+    if(inet_ntop(family, address, output->buffer + output->len, INET6_ADDRSTRLEN) != nullptr)
+        output->len += strlen(output->buffer + output->len);
+}
+
+/*Output Flows function is responsible for*/
+/*writing the top talkers an interface reported, in the format of the samples*/
+/*JSON takes a line per report, the other formats a line per flow; CSV has fixed columns, its flows go to stderr as text*/
+void output_flows(sample_output* output, const char* interface, const wire_flows* report) {
+    uint64_t time_ns = report->timestamp_ns + output->epoch_offset_ns;
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+    if(output->is_quiet) {
+        return;
+    }
+    if(output->format == FORMAT_CSV) {
+        for (int i = 0; i < report->count && i < FLOW_TOP_K; i++) {
+            const wire_flow* flow = &report->flows[i];
+            inet_ntop(flow->family, flow->src, src, sizeof(src));
+            inet_ntop(flow->family, flow->dst, dst, sizeof(dst));
+            fprintf(stderr, "Flow:%s protocol:%u src:%s sport:%u dst:%s dport:%u bytes:%" PRIu64 " packets:%" PRIu64 "\n", interface,
+                    flow->protocol, src, flow->src_port, dst, flow->dst_port, flow->bytes, flow->packets);
+        }
+        return;
+    }
+    output_reserve(output);
+    if(output->format == FORMAT_JSON) {
+        out_str(output, "{\"time_ns\":");
+        out_u64(output, time_ns);
+        out_str(output, ",\"interface\":\"");
+        out_name(output, interface, IFNAMSIZ);
+        out_str(output, "\",\"sample_rate\":");
+        out_u64(output, report->sample_rate);
+        out_str(output, ",\"sampled\":");
+        out_u64(output, report->sampled);
+        out_str(output, ",\"dropped\":");
+        out_u64(output, report->dropped);
+        out_str(output, ",\"flows\":[");
+    }
+    for (int i = 0; i < report->count && i < FLOW_TOP_K; i++) {
+        const wire_flow* flow = &report->flows[i];
+        double bps = report->interval_ns > 0 ? flow->bytes * 8e9 / report->interval_ns : 0;
+        switch (output->format) {
+        case FORMAT_JSON:
+            out_str(output, i == 0 ? "{\"protocol\":\"" : ",{\"protocol\":\"");
+            out_protocol(output, flow->protocol);
+            out_str(output, "\",\"src\":\"");
+            out_address(output, flow->family, flow->src);
+            out_str(output, "\",\"src_port\":");
+            out_u64(output, flow->src_port);
+            out_str(output, ",\"dst\":\"");
+            out_address(output, flow->family, flow->dst);
+            out_str(output, "\",\"dst_port\":");
+            out_u64(output, flow->dst_port);
+            out_str(output, ",\"bytes\":");
+            out_u64(output, flow->bytes);
+            out_str(output, ",\"packets\":");
+            out_u64(output, flow->packets);
+            out_str(output, ",\"bps\":");
+            out_f64(output, bps, 1);
+            out_char(output, '}');
+            break;
+
+        case FORMAT_INFLUX:
+            out_str(output, OUTPUT_MEASUREMENT "_flow,interface=");
+            out_name(output, interface, IFNAMSIZ);
+            out_str(output, ",protocol=");
+            out_protocol(output, flow->protocol);
+            out_str(output, ",src=");
+            out_address(output, flow->family, flow->src);
+            out_str(output, ",src_port=");
+            out_u64(output, flow->src_port);
+            out_str(output, ",dst=");
+            out_address(output, flow->family, flow->dst);
+            out_str(output, ",dst_port=");
+            out_u64(output, flow->dst_port);
+            out_str(output, " bytes=");
+            out_u64(output, flow->bytes);
+            out_str(output, "i,packets=");
+            out_u64(output, flow->packets);
+            out_str(output, "i,bps=");
+            out_f64(output, bps, 1);
+            out_char(output, ' ');
+            out_u64(output, time_ns);
+            out_char(output, '\n');
+            break;
+
+        default: //FORMAT_TEXT
+            out_str(output, "Flow:");
+            out_name(output, interface, IFNAMSIZ);
+            out_str(output, " protocol:");
+            out_protocol(output, flow->protocol);
+            out_str(output, " src:");
+            out_address(output, flow->family, flow->src);
+            out_str(output, " sport:");
+            out_u64(output, flow->src_port);
+            out_str(output, " dst:");
+            out_address(output, flow->family, flow->dst);
+            out_str(output, " dport:");
+            out_u64(output, flow->dst_port);
+            out_str(output, " bps:");
+            out_f64(output, bps, 1);
+            out_str(output, " packets:");
+            out_u64(output, flow->packets);
+            out_char(output, '\n');
+            break;
+        }
+    }
+    if(output->format == FORMAT_JSON) {
+        out_str(output, "]}\n");
+    }
+}
+
+/*Function is responsible for*/
+/*holding the top talkers an interface reported until its next sample is written, they follow it*/
+void output_hold_flows(sample_output* output, const char* interface, const wire_flows* report) {
+    rate_state* state = rate_engine_find(&output->rates, interface);
+
+    if(state == nullptr) { //no room for the interface, its samples are written without rates at once
+        output_flows(output, interface, report);
+        return;
+    }
+    if(output->has_flows[state->id]) { //the sample of the previous report never came
+        output_flows(output, interface, &output->flows[state->id]);
+    }
+    output->flows[state->id] = *report;
+    output->has_flows[state->id] = true;
+}
+
+/*Output Emit function is responsible for*/
+/*adding a sample to the history and the buffer once its rates are known*/
+/*and handing it to what follows the output, with the top talkers held for it*/
+void output_emit(sample_output* output, rate_state* state, wire_sample* sample) {
+    bool has_rate = state != nullptr && state->has_rate;
+    int len;
+
+    if(state != nullptr) {
+        double rate[RATE_COUNT];
+        for (int r = 0; r < RATE_COUNT && has_rate; r++)
+            rate[r] = output->rates.rate[rate_at(&output->rates, r, state->id)];
+        history_append(&output->history.series[state->id], sample, has_rate ? rate : nullptr);
+    }
+    if(!output->is_quiet) {
+        output_reserve(output);
+        if(output->format == FORMAT_CSV && !output->is_header_written) {
+            format_csv_header(output);
+            output->is_header_written = true;
+        }
+        if(output->format == FORMAT_TEXT) {
+            int room { OUTPUT_RECORD_LEN };
+            if(host_name(sample->stats.host) != nullptr) { //the host goes in front, the record stays within its bound
+                size_t start = output->len;
+                out_str(output, "Host:");
+                out_name(output, host_name(sample->stats.host), HOST_NAME_LEN);
+                out_char(output, ' ');
+                room -= output->len - start;
+            }
+            char* data = output->buffer + output->len;
+            len = format_statistics(data, room, sample->interface, &sample->stats);
+            if(has_rate && len > 0 && len < room) {
+                len += format_rates(data + len, room - len, &output->rates, state->id);
+            }
+            output->len += len < room - 1 ? len : room - 2;
+            out_char(output, '\n');
+        } else {
+            format_record(output, sample, has_rate ? state : nullptr);
+        }
+        ++output->pending;
+        ++output->samples;
+    }
+    if(state != nullptr && output->has_flows[state->id]) {
+        output_flows(output, sample->interface, &output->flows[state->id]);
+        output->has_flows[state->id] = false;
+    }
+    if(output->on_sample != nullptr && state != nullptr) {
+        output->on_sample(state, sample);
+    }
+}
+
+/*Output Tick function is responsible for*/
+/*running the rate kernel once over every interface and emitting the samples staged for it*/
+/*in the order of their rate ids*/
+void output_tick(sample_output* output) {
+    rate_engine* rates = &output->rates;
+
+    if(rates->staged == 0) {
+        return;
+    }
+    rate_engine_tick(rates);
+    for (uint32_t id = 0; id < rates->next_id && rates->staged > 0; id++) {
+        if(rates->dt[id] == 0) { //nothing staged
+            continue;
+        }
+        rate_state* state = rate_engine_state(rates, id);
+        rate_settle(rates, state);
+        output_emit(output, state, &output->staged[id]);
+    }
+}
+
+/*Function is responsible for*/
+/*running the tick and writing everything buffered*/
+void output_flush(sample_output* output) {
+    output_tick(output);
+    output_write(output);
+}
+
+/*Output Sample function is responsible for*/
+/*staging a sample for the rates of the tick, or emitting it at once if no rate can come from it*/
+/*an interface whose previous sample still waits gets it through the scalar kernel first*/
+void output_sample(sample_output* output, wire_sample* sample) {
+    rate_state* state;
+
+    sample->interface[IFNAMSIZ-1] = '\0';
+    sample->stats.operstate[OPERSTATE_LEN-1] = '\0';
+    if((state = rate_engine_find(&output->rates, sample->interface, sample->stats.host)) == nullptr) {
+        output_emit(output, nullptr, sample);
+        return;
+    }
+    if(rate_is_staged(&output->rates, state)) { //two samples of the interface in one tick
+        rate_kernel_scalar(&output->rates, state->id, state->id + 1);
+        rate_settle(&output->rates, state);
+        output_emit(output, state, &output->staged[state->id]);
+    }
+    if(rate_stage(&output->rates, state, sample)) {
+        output->staged[state->id] = *sample;
+    } else {
+        output_emit(output, state, sample);
+    }
+}
+
+#endif //OUTPUT_H
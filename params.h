@@ -5,14 +5,16 @@
 #include <sys/stat.h>
 #include <net/if.h>
 #include <netinet/in.h>
-#include <linux/random.h>
+
+#include "protocol.h"
 
 #define BUF_LEN 350 //Buffer Length
-#define QUEUE 10 //Maximum number of connections
 
-const char socket_path[] { "/tmp/networkMonitor" }; //path to the socket file
-const char interface_monitor[] { "./interfaceMonitor" }; //interface monitor executable name
-const char key_file[] { "/dev/urandom" }; //key file path 
+#define DEFAULT_SOCKET_PATH "/tmp/networkMonitor" //Socket the monitors connect to unless configured
+#define DEFAULT_INTERFACE_MONITOR "./interfaceMonitor" //Monitor executable unless configured
+
+const char* socket_path { DEFAULT_SOCKET_PATH }; //path to the socket file
+const char* interface_monitor { DEFAULT_INTERFACE_MONITOR }; //interface monitor executable name
 
 /*Print Error function is responsible for*/
 /*printing error messages and exiting on demand*/
@@ -73,71 +75,77 @@ inline bool file_exists (const char* pathname) {
 }
 
 /*Send function is a wrapper for the socket send */
-void send(int fd, char* buffer, const char* msg) {
-    int len, ret;
-    len = sprintf(buffer, msg, NULL)+1;
-    if((ret = send(fd, buffer, len, 0)) == -1) {
+/*that encodes the message as a frame in buffer */
+void send(int fd, char* buffer, message_type type, const void* payload = nullptr, size_t len = 0, uint16_t count = 0) {
+    size_t frame_len;
+    ssize_t ret;
+    if((frame_len = frame_encode(buffer, FRAME_MAX_LEN, type, payload, len, count)) == 0) {
+        std::cerr << "Message is too long to be sent" << std::endl;
+        return;
+    }
+    self_count(SELF_SYSCALLS);
+    if((ret = send(fd, buffer, frame_len, MSG_NOSIGNAL)) == -1) {
         print_error((char*)"Error while sending", false);
+    } else {
+        self_count(SELF_BYTES_OUT, ret);
+        self_count(SELF_MESSAGES_OUT);
     }
     #ifdef DEBUG
-	    std::cout << "Sent "<< ret <<" bytes" << std::sndl;
+	    std::cout << "Sent "<< ret <<" bytes" << std::endl;
     #endif
 }
 
 /*Receive function is a wrapper for the socket receive */
-void receive(int fd, char* buffer) {
+/*that blocks until reader holds a complete frame */
+bool receive(int fd, frame_reader* reader, frame_header* header, const char** payload) {
     int ret;
-    if((ret = recv(fd, buffer, BUF_LEN, 0)) == -1) {
-        print_error((char*)"Error while receiving", false);
-    }
-    #ifdef DEBUG
-	    std::cout<<"Received "<< ret <<" bytes" << std::sndl;
-    #endif
-}
-
-/*Function is responsible for*/
-/*checking if a given interface is up*/
-bool is_link_up(const char* interface) {
-    struct ifreq ifr;
-    int socket_fd;
-    if((socket_fd = socket(PF_INET6, SOCK_DGRAM, IPPROTO_IP)) < 0) {
-        print_error((char*)"Error while creating the socket", false);
+    while ((ret = frame_reader_next(reader, header, payload)) == 0) {
+        if((ret = frame_reader_fill(reader, fd)) <= 0) {
+            if(ret == -1)
+                print_error((char*)"Error while receiving", false);
+            return false;
+        }
+        #ifdef DEBUG
+	        std::cout<<"Received "<< ret <<" bytes" << std::endl;
+        #endif
     }
-    memset(&ifr, 0, sizeof(ifr));
-    strcpy(ifr.ifr_name, interface);
-    //check if up
-    if (ioctl(socket_fd, SIOCGIFFLAGS, &ifr) < 0) {
-        print_error((char*)"Error while IOCTL", false);
+    if(ret < 0) {
+        std::cerr << "Malformed frame received" << std::endl;
+        return false;
     }
-    close(socket_fd);
-    return !!(ifr.ifr_flags & IFF_UP);
+    return true;
 }
 
 /*Function is responsible for*/
-/*setting the given interface's state to the given flag*/
-void set_link_state(const char* interface, short flag) {
+/*setting and clearing flags of the given interface, the other flags are kept*/
+/*returns false with errno set if the interface could not be changed*/
+bool set_link_flags(const char* interface, short set, short clear) {
     struct ifreq ifr;
     int socket_fd;
-    if((socket_fd = socket(PF_INET6, SOCK_DGRAM, IPPROTO_IP)) < 0) {
-        print_error((char*)"Error while creating the socket", false);
+    bool is_set { false };
+    if((socket_fd = socket(PF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_IP)) < 0) {
+        return false;
     }
     memset(&ifr, 0, sizeof(ifr));
-    strcpy(ifr.ifr_name, interface);
-    ifr.ifr_flags = flag;
-    if (ioctl(socket_fd, SIOCSIFFLAGS, &ifr) < 0) {
-        print_error((char*)"Error while IOCTL", false);
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ-1);
+    if(ioctl(socket_fd, SIOCGIFFLAGS, &ifr) == 0) { //read first, writing the flag alone would clear every other one
+        ifr.ifr_flags = (ifr.ifr_flags | set) & ~clear;
+        is_set = ioctl(socket_fd, SIOCSIFFLAGS, &ifr) == 0;
     }
+    int error = errno;
     close(socket_fd);
+    errno = error;
+    return is_set;
 }
 
 /*Function will set the given interface to the up state*/
-void set_link_up(const char *interface, short flags) {
-    set_link_state(interface, flags | IFF_UP);
+bool set_link_up(const char *interface) {
+    return set_link_flags(interface, IFF_UP, 0);
 }
 
 /*Function will set the given interface to the down state*/
-// void set_link_down(const char *interface, short flags) {
-//     set_link_state(interface, flags & ~IFF_UP);
+// bool set_link_down(const char *interface) {
+//     return set_link_flags(interface, 0, IFF_UP);
 // }
 
 #endif //PARAMS_H
\ No newline at end of file
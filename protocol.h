@@ -0,0 +1,220 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include "statistics.h"
+#include "self_metrics.h"
+
+#define PROTOCOL_MAGIC 0x4d4e //"NM" in little endian
+#define PROTOCOL_VERSION 7 //2: sent_ns added to the header, 3: sample timestamps, 4: every counter and the queues,
+    //5: MSG_LINK_UP reported by the monitor, 6: MSG_FLOWS, 7: MSG_FLOWS before the sample ending its interval
+#define FRAME_MAX_LEN 4096 //Maximum length of a frame including its header
+#define FRAME_BUF_LEN (2 * FRAME_MAX_LEN) //Receive buffer length of a connection
+#define FLOW_TOP_K 16 //Top talkers reported with a sample
+
+/*Ways the samples travel from the monitors to networkMonitor*/
+enum sample_transport {
+    TRANSPORT_SOCKET, //MSG_SAMPLES frames on the monitor socket
+    TRANSPORT_SHM, //seqlock slots in shared memory, the socket carries control messages only
+    TRANSPORT_COUNT
+};
+
+const char* const transport_names[TRANSPORT_COUNT] { "socket", "shm" };
+
+/*Function is responsible for*/
+/*converting a transport name into a sample_transport*/
+bool parse_transport(const char* name, sample_transport* transport) {
+    for (int i = 0; i < TRANSPORT_COUNT; i++) {
+        if(strcmp(name, transport_names[i]) == 0) {
+            *transport = (sample_transport)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*Types of the messages exchanged by interfaceMonitor and networkMonitor*/
+enum message_type : uint8_t {
+    MSG_READY = 1, //monitor -> parent, payload: wire_hello
+    MSG_MONITOR, //parent -> monitor, start monitoring
+    MSG_MONITORING, //monitor -> parent, monitoring started
+    MSG_LINK_DOWN, //monitor -> parent, the link went down
+    MSG_LINK_UP, //monitor -> parent, the link is up again
+    MSG_DONE, //monitor -> parent, the monitor is leaving
+    MSG_SAMPLES, //monitor -> parent, payload: count x wire_sample
+    MSG_FLOWS, //monitor -> parent, payload: wire_flows before the sample ending its interval
+    MSG_TYPE_COUNT
+};
+
+/*Header in front of every frame, all fields are in host byte order*/
+struct frame_header {
+    uint32_t length; //frame length including the header
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type; //message_type
+    uint16_t count; //number of records in the payload
+    uint16_t reserved;
+    uint32_t reserved2;
+    uint64_t sent_ns; //CLOCK_MONOTONIC time the frame was encoded
+};
+
+/*Payload of MSG_READY*/
+struct wire_hello {
+    char interface[IFNAMSIZ];
+};
+
+/*Record of MSG_SAMPLES*/
+struct wire_sample {
+    char interface[IFNAMSIZ];
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC time the statistics were read
+    uint64_t missed_ticks; //sampling ticks the monitor missed so far
+    interface_stats stats;
+};
+
+/*Flow of the top talkers of an interface*/
+struct wire_flow {
+    uint8_t src[16]; //network byte order, an IPv4 address takes the first 4 bytes
+    uint8_t dst[16];
+    uint16_t src_port; //0 if the protocol has no ports or the packet was a later fragment
+    uint16_t dst_port;
+    uint8_t family; //AF_INET or AF_INET6
+    uint8_t protocol; //IPPROTO_*
+    uint16_t reserved;
+    uint64_t bytes; //estimated bytes of the interval, the sampled ones times the sample rate
+    uint64_t packets; //estimated packets of the interval
+};
+
+/*Payload of MSG_FLOWS, the top talkers of the interval the next sample ends*/
+struct wire_flows {
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC end of the interval
+    uint64_t interval_ns;
+    uint32_t sample_rate; //one packet out of this many was sampled
+    uint16_t count; //flows filled, largest first
+    uint16_t reserved;
+    uint64_t sampled; //packets sampled in the interval
+    uint64_t dropped; //sampled packets the ring had no room for
+    wire_flow flows[FLOW_TOP_K];
+};
+
+static_assert(sizeof(frame_header) == 24, "frame_header layout changed");
+static_assert(sizeof(wire_hello) == 16, "wire_hello layout changed");
+static_assert(sizeof(wire_sample) == 520, "wire_sample layout changed");
+static_assert(sizeof(wire_flow) == 56, "wire_flow layout changed");
+static_assert(sizeof(wire_flows) + sizeof(frame_header) <= FRAME_MAX_LEN, "wire_flows does not fit a frame");
+
+#define FRAME_MAX_SAMPLES ((FRAME_MAX_LEN - sizeof(frame_header)) / sizeof(wire_sample))
+
+/*Frame Reader reassembles frames from a stream socket*/
+/*in a fixed buffer owned by the connection*/
+struct frame_reader {
+    char buffer[FRAME_BUF_LEN];
+    size_t start; //first byte of the next frame
+    size_t end; //end of the received bytes
+};
+
+/*Frame Encode function is responsible for*/
+/*writing a frame with the given payload into buffer without allocating*/
+/*returns the frame length or 0 if it does not fit*/
+size_t frame_encode(char* buffer, size_t len, message_type type, const void* payload, size_t payload_len, uint16_t count) {
+    frame_header header;
+
+    if(sizeof(header) + payload_len > len || sizeof(header) + payload_len > FRAME_MAX_LEN) {
+        return 0;
+    }
+    memset(&header, 0, sizeof(header));
+    header.length = sizeof(header) + payload_len;
+    header.magic = PROTOCOL_MAGIC;
+    header.version = PROTOCOL_VERSION;
+    header.type = type;
+    header.count = count;
+    header.sent_ns = monotonic_ns();
+
+    memcpy(buffer, &header, sizeof(header));
+    if(payload_len > 0)
+        memcpy(buffer + sizeof(header), payload, payload_len);
+    return header.length;
+}
+
+/*Function is responsible for*/
+/*writing a MSG_SAMPLES frame holding count samples into buffer*/
+size_t frame_encode_samples(char* buffer, size_t len, const wire_sample* samples, size_t count) {
+    if(count > FRAME_MAX_SAMPLES) {
+        return 0;
+    }
+    return frame_encode(buffer, len, MSG_SAMPLES, samples, count * sizeof(wire_sample), count);
+}
+
+/*Function is responsible for*/
+/*checking that a header describes a frame this side understands*/
+bool frame_valid(const frame_header* header) {
+    return header->magic == PROTOCOL_MAGIC && header->version == PROTOCOL_VERSION
+        && header->length >= sizeof(frame_header) && header->length <= FRAME_MAX_LEN
+        && header->type >= MSG_READY && header->type < MSG_TYPE_COUNT;
+}
+
+/*Function is responsible for*/
+/*copying record i of a frame into out after checking the bounds*/
+bool frame_record(const frame_header* header, const char* payload, size_t i, void* out, size_t record_len) {
+    if(i >= header->count || sizeof(frame_header) + (i + 1) * record_len > header->length) {
+        return false;
+    }
+    memcpy(out, payload + i * record_len, record_len);
+    return true;
+}
+
+/*Function is responsible for*/
+/*preparing an empty reader*/
+inline void frame_reader_init(frame_reader* reader) {
+    reader->start = reader->end = 0;
+}
+
+/*Frame Reader Fill function is responsible for*/
+/*receiving whatever fits into the free space of the reader*/
+/*returns the recv() result*/
+ssize_t frame_reader_fill(frame_reader* reader, int fd) {
+    ssize_t ret;
+
+    if(reader->start > 0) { //move the partial frame to the front
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    ret = recv(fd, reader->buffer + reader->end, FRAME_BUF_LEN - reader->end, 0);
+    self_count(SELF_SYSCALLS);
+    if(ret > 0) {
+        reader->end += ret;
+        self_count(SELF_BYTES_IN, ret);
+    }
+    return ret;
+}
+
+/*Frame Reader Next function is responsible for*/
+/*taking the next complete frame out of the reader*/
+/*returns 1 if a frame was taken, 0 if more bytes are needed, -1 on a malformed stream*/
+int frame_reader_next(frame_reader* reader, frame_header* header, const char** payload) {
+    if(reader->end - reader->start < sizeof(frame_header)) {
+        return 0;
+    }
+    memcpy(header, reader->buffer + reader->start, sizeof(frame_header));
+    if(!frame_valid(header)) {
+        return -1;
+    }
+    if(reader->end - reader->start < header->length) {
+        return 0;
+    }
+    *payload = reader->buffer + reader->start + sizeof(frame_header);
+    reader->start += header->length;
+    if(reader->start == reader->end) {
+        reader->start = reader->end = 0;
+    }
+    self_count(SELF_MESSAGES_IN);
+    return 1;
+}
+
+#endif //PROTOCOL_H
@@ -0,0 +1,617 @@
+#ifndef RATES_H
+#define RATES_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <net/if.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RATE_KERNEL_AVX2 //the AVX2 kernel is built and picked when the CPU has it
+#endif
+
+#include "statistics.h"
+#include "protocol.h"
+
+#define RATE_WINDOWS 3 //Number of EWMA windows kept per interface
+#define COUNTER32_SPAN (1ull << 32) //Range of a 32-bit counter
+#define HOST_NAME_LEN 64 //Longest name of a federated host
+
+//Names of the federated hosts indexed by rate_state::host, set only while networkMonitor aggregates other hosts
+const char (*host_names)[HOST_NAME_LEN] { nullptr };
+
+/*Function is responsible for*/
+/*naming the host of an interface, nullptr for this one*/
+inline const char* host_name(uint16_t host) {
+    return host != 0 && host_names != nullptr ? host_names[host] : nullptr;
+}
+
+/*Function is responsible for*/
+/*counting the schema counters turned into per-second rates*/
+constexpr int count_rated() {
+    int count { 0 };
+    for (const counter_desc& desc : counter_schema)
+        count += (desc.flags & COUNTER_RATED) != 0;
+    return count;
+}
+
+constexpr int RATE_COUNT { count_rated() }; //counters turned into per-second rates
+
+/*Rate Counters lists the rated counters of the schema in order*/
+struct rate_counter_list {
+    counter_id ids[RATE_COUNT];
+};
+
+/*Function is responsible for*/
+/*collecting the rated counters of the schema at compile time*/
+constexpr rate_counter_list list_rated() {
+    rate_counter_list list {};
+    int r { 0 };
+    for (const counter_desc& desc : counter_schema) {
+        if(desc.flags & COUNTER_RATED)
+            list.ids[r++] = desc.id;
+    }
+    return list;
+}
+
+constexpr rate_counter_list rate_counters { list_rated() }; //counter of every rate
+
+/*Function is responsible for*/
+/*finding the rate of a rated counter at compile time*/
+constexpr int rate_of(counter_id id) {
+    for (int r = 0; r < RATE_COUNT; r++) {
+        if(rate_counters.ids[r] == id)
+            return r;
+    }
+    return -1;
+}
+
+//Rates the formats derive their fields from
+constexpr int RATE_RX_BYTES { rate_of(CTR_RX_BYTES) };
+constexpr int RATE_TX_BYTES { rate_of(CTR_TX_BYTES) };
+constexpr int RATE_RX_PACKETS { rate_of(CTR_RX_PACKETS) };
+constexpr int RATE_TX_PACKETS { rate_of(CTR_TX_PACKETS) };
+constexpr int RATE_RX_DROPPED { rate_of(CTR_RX_DROPPED) };
+constexpr int RATE_TX_DROPPED { rate_of(CTR_TX_DROPPED) };
+constexpr int RATE_RX_ERRORS { rate_of(CTR_RX_ERRORS) };
+constexpr int RATE_TX_ERRORS { rate_of(CTR_TX_ERRORS) };
+
+/*Function is responsible for*/
+/*checking that the rated counters are adjacent in the schema, the kernels read them as one array*/
+constexpr bool rates_adjacent() {
+    for (int r = 1; r < RATE_COUNT; r++) {
+        if(rate_counters.ids[r] != rate_counters.ids[0] + r)
+            return false;
+    }
+    return true;
+}
+
+static_assert(rates_adjacent(), "the rated counters must follow each other in counter_schema");
+static_assert(RATE_RX_BYTES >= 0 && RATE_TX_BYTES >= 0 && RATE_RX_PACKETS >= 0 && RATE_TX_PACKETS >= 0 && RATE_RX_DROPPED >= 0
+              && RATE_TX_DROPPED >= 0 && RATE_RX_ERRORS >= 0 && RATE_TX_ERRORS >= 0, "a counter the formats rely on is not rated");
+
+/*Function is responsible for*/
+/*name of the counter behind rate r*/
+inline const char* rate_name(int r) {
+    return counter_schema[rate_counters.ids[r]].name;
+}
+
+const uint64_t rate_windows_ns[RATE_WINDOWS] { 1000000000ull, 10000000000ull, 60000000000ull };
+const char* const rate_window_names[RATE_WINDOWS] { "1s", "10s", "60s" };
+
+/*What happened to a counter between two samples*/
+enum counter_change {
+    COUNTER_OK, //the counter moved forward
+    COUNTER_WRAP, //a 32-bit counter wrapped around
+    COUNTER_RESET //the counter started over, the interface was re-created
+};
+
+#define RATE_LANES 4 //Ids the tick kernels take at a time, the arrays of the engine hold whole vectors
+#define RATE_MAX_THRESHOLDS 64 //Threshold comparisons the tick kernels run on the rates of every interface
+
+/*Rate Threshold is a comparison the tick kernels run on the new rates of every interface*/
+/*value is rate times scale, or the share of rate out of rate and packets*/
+struct rate_threshold {
+    int rate; //rate compared
+    int packets; //rate of the packets the lost ones are a share of, -1 to compare the rate itself
+    double scale; //multiplies the rate, 8 for bits per second
+    double limit;
+    bool is_below; //holds below the limit instead of above
+};
+
+/*Rate State is the history of one interface kept by the rate engine*/
+/*its counters and rates are in the arrays of the engine, at its id*/
+struct rate_state {
+    char interface[IFNAMSIZ]; //empty while the entry is free
+    uint16_t host; //federated host of the interface, 0 for this one; part of the key
+    uint32_t id; //dense index below max_count, the id of a removed interface is handed out again
+    bool is_primed; //prev holds a sample to compute deltas from
+    bool is_seeded; //ewma holds rates to smooth
+    bool has_rate; //rate was computed from the last sample
+    uint64_t last_ns; //timestamp of the last sample taken, staged or in prev
+    double alpha_dt; //interval the smoothing factors were computed for
+    double alpha[RATE_WINDOWS]; //smoothing factor of every window over alpha_dt
+    uint64_t wraps;
+    uint64_t resets;
+};
+
+/*Rate Engine keeps the state of every interface in an open-addressed table*/
+/*and their counters and rates in one array per counter indexed by id, which the tick kernels sweep*/
+/*allocated once, so updating the rates never allocates*/
+struct rate_engine {
+    rate_state* states;
+    size_t mask; //capacity - 1, capacity is a power of two
+    size_t count; //entries in use
+    size_t max_count; //entries allowed, keeps the table at most half full
+    uint32_t next_id; //ids handed out so far
+    uint32_t* free_ids; //ids of removed interfaces, reused first
+    size_t num_free;
+    size_t* entries; //entry of the table every id is at, SIZE_MAX while the id is free
+    size_t stride; //ids of every array, max_count rounded up to whole vectors
+    uint64_t* prev; //RATE_COUNT arrays, counters the next deltas start from
+    uint64_t* cur; //RATE_COUNT arrays, counters of the samples staged for the tick
+    double* rate; //RATE_COUNT arrays, per second over the last sample interval
+    double* ewma; //RATE_WINDOWS x RATE_COUNT arrays, per second, smoothed over rate_windows_ns
+    double* alpha; //RATE_WINDOWS arrays, smoothing factor of every window over dt, 1 while the rates are seeded
+    double* dt; //nanoseconds between prev and cur, 0 unless a sample is staged
+    int8_t* changes; //counters that wrapped in the last tick, -1 if one was reset
+    uint64_t* holds; //bit t set while threshold t holds on the rates
+    rate_threshold thresholds[RATE_MAX_THRESHOLDS];
+    int num_thresholds;
+    size_t staged; //ids with a staged sample
+};
+
+/*Functions are responsible for*/
+/*the index of an id in the array of rate r, and of window w of rate r*/
+inline size_t rate_at(const rate_engine* engine, int r, size_t id) {
+    return r * engine->stride + id;
+}
+
+inline size_t ewma_at(const rate_engine* engine, int w, int r, size_t id) {
+    return (w * RATE_COUNT + r) * engine->stride + id;
+}
+
+/*Function is responsible for*/
+/*allocating an engine able to follow max_interfaces interfaces*/
+void rate_engine_init(rate_engine* engine, size_t max_interfaces) {
+    size_t size { 2 };
+    while (size < 2 * max_interfaces)
+        size <<= 1;
+    engine->states = new rate_state[size]();
+    engine->mask = size - 1;
+    engine->count = 0;
+    engine->max_count = max_interfaces;
+    engine->next_id = 0;
+    engine->free_ids = new uint32_t[max_interfaces];
+    engine->num_free = 0;
+    engine->entries = new size_t[max_interfaces];
+    std::fill_n(engine->entries, max_interfaces, SIZE_MAX);
+    engine->stride = (max_interfaces + RATE_LANES - 1) / RATE_LANES * RATE_LANES;
+    engine->prev = new uint64_t[RATE_COUNT * engine->stride]();
+    engine->cur = new uint64_t[RATE_COUNT * engine->stride]();
+    engine->rate = new double[RATE_COUNT * engine->stride]();
+    engine->ewma = new double[RATE_WINDOWS * RATE_COUNT * engine->stride]();
+    engine->alpha = new double[RATE_WINDOWS * engine->stride]();
+    engine->dt = new double[engine->stride]();
+    engine->changes = new int8_t[engine->stride]();
+    engine->holds = new uint64_t[engine->stride]();
+    engine->num_thresholds = 0;
+    engine->staged = 0;
+}
+
+/*Function is responsible for*/
+/*releasing the table and the arrays of the engine*/
+void rate_engine_free(rate_engine* engine) {
+    delete[] engine->states;
+    delete[] engine->free_ids;
+    delete[] engine->entries;
+    delete[] engine->prev;
+    delete[] engine->cur;
+    delete[] engine->rate;
+    delete[] engine->ewma;
+    delete[] engine->alpha;
+    delete[] engine->dt;
+    delete[] engine->changes;
+    delete[] engine->holds;
+    engine->states = nullptr;
+    engine->free_ids = nullptr;
+    engine->count = 0;
+}
+
+/*Function is responsible for*/
+/*adding a comparison the tick kernels run on every interface*/
+/*returns the bit of the engine holds it sets, -1 if there are too many*/
+int rate_engine_watch(rate_engine* engine, const rate_threshold* threshold) {
+    if(engine->num_thresholds == RATE_MAX_THRESHOLDS) {
+        return -1;
+    }
+    engine->thresholds[engine->num_thresholds] = *threshold;
+    return engine->num_thresholds++;
+}
+
+/*Function is responsible for*/
+/*hashing an interface name and its host into their home entry*/
+inline size_t rate_hash(const rate_engine* engine, const char* interface, uint16_t host) {
+    uint32_t hash { 2166136261u ^ host }; //FNV-1a
+    for (size_t i = 0; i < IFNAMSIZ && interface[i] != '\0'; i++)
+        hash = (hash ^ (uint8_t)interface[i]) * 16777619u;
+    return hash & engine->mask;
+}
+
+/*Function is responsible for*/
+/*the state of an id, nullptr if no interface has it*/
+inline rate_state* rate_engine_state(rate_engine* engine, uint32_t id) {
+    return engine->entries[id] == SIZE_MAX ? nullptr : &engine->states[engine->entries[id]];
+}
+
+/*Rate Engine Find function is responsible for*/
+/*looking up the state of an interface, claiming a free entry for a new one*/
+/*returns nullptr if the engine already follows max_count interfaces*/
+rate_state* rate_engine_find(rate_engine* engine, const char* interface, uint16_t host = 0) {
+    for (size_t i = rate_hash(engine, interface, host); ; i = (i + 1) & engine->mask) {
+        rate_state* state = &engine->states[i];
+        if(state->interface[0] == '\0') {
+            if(engine->count == engine->max_count) {
+                return nullptr;
+            }
+            strncpy(state->interface, interface, IFNAMSIZ-1);
+            state->host = host;
+            state->id = engine->num_free > 0 ? engine->free_ids[--engine->num_free] : engine->next_id++;
+            engine->entries[state->id] = i;
+            for (int r = 0; r < RATE_COUNT; r++) //the previous interface of the id left its rates
+                engine->rate[rate_at(engine, r, state->id)] = 0;
+            for (int w = 0; w < RATE_WINDOWS; w++) {
+                for (int r = 0; r < RATE_COUNT; r++)
+                    engine->ewma[ewma_at(engine, w, r, state->id)] = 0;
+            }
+            engine->holds[state->id] = 0;
+            ++engine->count;
+            return state;
+        }
+        if(state->host == host && strncmp(state->interface, interface, IFNAMSIZ) == 0) {
+            return state;
+        }
+    }
+}
+
+/*Rate Engine Remove function is responsible for*/
+/*forgetting an interface so that its entry and its id can be reused*/
+/*the entries after it are shifted back instead of leaving a tombstone*/
+/*a sample it had staged is dropped*/
+/*returns the id the interface had, -1 if it was not followed*/
+int rate_engine_remove(rate_engine* engine, const char* interface, uint16_t host = 0) {
+    size_t hole = rate_hash(engine, interface, host);
+    int id;
+
+    while (engine->states[hole].host != host || strncmp(engine->states[hole].interface, interface, IFNAMSIZ) != 0) {
+        if(engine->states[hole].interface[0] == '\0') {
+            return -1;
+        }
+        hole = (hole + 1) & engine->mask;
+    }
+    id = engine->states[hole].id;
+    engine->free_ids[engine->num_free++] = id;
+    engine->entries[id] = SIZE_MAX;
+    if(engine->dt[id] != 0) {
+        engine->dt[id] = 0;
+        --engine->staged;
+    }
+    --engine->count;
+
+    for (size_t i = (hole + 1) & engine->mask; engine->states[i].interface[0] != '\0'; i = (i + 1) & engine->mask) {
+        size_t home = rate_hash(engine, engine->states[i].interface, engine->states[i].host);
+        //an entry stays unless the hole lies between its home and itself
+        if(((i - home) & engine->mask) >= ((i - hole) & engine->mask)) {
+            engine->states[hole] = engine->states[i];
+            engine->entries[engine->states[hole].id] = hole;
+            hole = i;
+        }
+    }
+    engine->states[hole] = rate_state();
+    return id;
+}
+
+/*Counter Delta function is responsible for*/
+/*computing how far a counter moved between two samples*/
+/*a counter that went backwards from the 32-bit range wrapped if the wrapped*/
+/*delta is below half the range, anything else going backwards was reset*/
+counter_change counter_delta(uint64_t prev, uint64_t cur, uint64_t* delta) {
+    if(cur >= prev) {
+        *delta = cur - prev;
+        return COUNTER_OK;
+    }
+    if(prev < COUNTER32_SPAN && COUNTER32_SPAN - prev + cur < COUNTER32_SPAN / 2) {
+        *delta = COUNTER32_SPAN - prev + cur;
+        return COUNTER_WRAP;
+    }
+    *delta = 0;
+    return COUNTER_RESET;
+}
+
+/*Function is responsible for*/
+/*first rated counter of a sample, the others follow it*/
+inline const uint64_t* rated_counters(const wire_sample* sample) {
+    return &sample->stats.counters[rate_counters.ids[0]];
+}
+
+/*Function is responsible for*/
+/*computing the share of lost packets out of the packets and the lost ones*/
+inline double rate_ratio(double lost, double packets) {
+    return lost + packets > 0 ? lost / (lost + packets) : 0.0;
+}
+
+/*Function is responsible for*/
+/*the value threshold t compares for an id*/
+inline double rate_threshold_value(const rate_engine* engine, const rate_threshold* t, size_t id) {
+    double value = engine->rate[rate_at(engine, t->rate, id)];
+    return t->packets >= 0 ? rate_ratio(value, engine->rate[rate_at(engine, t->packets, id)]) : value * t->scale;
+}
+
+/*Rate Kernel turns the staged counters of the ids in [begin, end) into rates, folds them into every EWMA window*/
+/*and runs the thresholds on them; ids with nothing staged are left alone*/
+/*changes gets the counters that wrapped, or -1 without touching the rates if one was reset*/
+/*every staged id takes cur as its prev; every kernel gives the same bits as rate_kernel_scalar*/
+typedef void (*rate_kernel_fn)(rate_engine* engine, size_t begin, size_t end);
+
+/*Function is responsible for*/
+/*the rate kernel of any CPU, one counter of one id at a time*/
+void rate_kernel_scalar(rate_engine* engine, size_t begin, size_t end) {
+    for (size_t id = begin; id < end; id++) {
+        double dt = engine->dt[id];
+        uint64_t delta[RATE_COUNT];
+        int wraps { 0 };
+
+        if(dt == 0) { //nothing staged
+            continue;
+        }
+        for (int r = 0; r < RATE_COUNT && wraps >= 0; r++) {
+            switch (counter_delta(engine->prev[rate_at(engine, r, id)], engine->cur[rate_at(engine, r, id)], &delta[r])) {
+            case COUNTER_OK:
+                break;
+            case COUNTER_WRAP:
+                ++wraps;
+                break;
+            case COUNTER_RESET:
+                wraps = -1;
+                break;
+            }
+        }
+        if(wraps >= 0) {
+            uint64_t holds { 0 };
+            for (int r = 0; r < RATE_COUNT; r++)
+                engine->rate[rate_at(engine, r, id)] = delta[r] * 1e9 / dt;
+            for (int w = 0; w < RATE_WINDOWS; w++) {
+                double alpha = engine->alpha[w * engine->stride + id];
+                for (int r = 0; r < RATE_COUNT; r++) {
+                    double* ewma = &engine->ewma[ewma_at(engine, w, r, id)];
+                    *ewma += alpha * (engine->rate[rate_at(engine, r, id)] - *ewma);
+                }
+            }
+            for (int t = 0; t < engine->num_thresholds; t++) {
+                const rate_threshold* threshold = &engine->thresholds[t];
+                double value = rate_threshold_value(engine, threshold, id);
+                holds |= (uint64_t)(threshold->is_below ? value < threshold->limit : value > threshold->limit) << t;
+            }
+            engine->holds[id] = holds;
+        }
+        engine->changes[id] = wraps;
+        for (int r = 0; r < RATE_COUNT; r++) //a reset starts over from the new counters
+            engine->prev[rate_at(engine, r, id)] = engine->cur[rate_at(engine, r, id)];
+    }
+}
+
+#ifdef RATE_KERNEL_AVX2
+/*Rate Kernel AVX2 function is responsible for*/
+/*the rate kernel four ids at a time, every counter of them loaded from its own array*/
+/*unsigned compares flip the sign bits, the deltas become doubles through two exact 32-bit halves*/
+/*and a single rounding add, so every step rounds like the scalar kernel*/
+/*begin and end are multiples of RATE_LANES*/
+__attribute__((target("avx2")))
+void rate_kernel_avx2(rate_engine* engine, size_t begin, size_t end) {
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i span = _mm256_set1_epi64x(COUNTER32_SPAN);
+    const __m256i span_flipped = _mm256_xor_si256(span, sign);
+    const __m256i half_flipped = _mm256_xor_si256(_mm256_set1_epi64x(COUNTER32_SPAN / 2), sign);
+    const __m256i low_mask = _mm256_set1_epi64x(0xffffffffull);
+    const __m256i magic = _mm256_set1_epi64x(0x4330000000000000ull); //2^52, whose mantissa takes a 32-bit integer as is
+    const __m256d magic_value = _mm256_set1_pd(4503599627370496.0);
+    const __m256d high_scale = _mm256_set1_pd(4294967296.0);
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d rate[RATE_COUNT];
+
+    for (size_t id = begin; id < end; id += RATE_LANES) {
+        __m256d dt = _mm256_loadu_pd(engine->dt + id);
+        __m256d is_staged = _mm256_cmp_pd(dt, zero, _CMP_NEQ_OQ);
+        int staged_lanes = _mm256_movemask_pd(is_staged);
+        __m256i reset = _mm256_setzero_si256(), wraps = _mm256_setzero_si256();
+
+        if(staged_lanes == 0) {
+            continue;
+        }
+        //what happened to every counter, a reset leaves the rates of its id alone
+        for (int r = 0; r < RATE_COUNT; r++) {
+            __m256i prev = _mm256_loadu_si256((const __m256i*)(engine->prev + rate_at(engine, r, id)));
+            __m256i now = _mm256_loadu_si256((const __m256i*)(engine->cur + rate_at(engine, r, id)));
+            __m256i prev_flipped = _mm256_xor_si256(prev, sign);
+            __m256i wrapped = _mm256_add_epi64(_mm256_sub_epi64(span, prev), now);
+            __m256i is_back = _mm256_cmpgt_epi64(prev_flipped, _mm256_xor_si256(now, sign));
+            __m256i is_wrap = _mm256_and_si256(is_back, _mm256_and_si256(_mm256_cmpgt_epi64(span_flipped, prev_flipped),
+                                               _mm256_cmpgt_epi64(half_flipped, _mm256_xor_si256(wrapped, sign))));
+            reset = _mm256_or_si256(reset, _mm256_andnot_si256(is_wrap, is_back));
+            wraps = _mm256_sub_epi64(wraps, is_wrap);
+        }
+        int reset_lanes = _mm256_movemask_pd(_mm256_castsi256_pd(reset));
+        int rated_lanes = staged_lanes & ~reset_lanes;
+        __m256d is_rated = _mm256_andnot_pd(_mm256_castsi256_pd(reset), is_staged);
+        __m256d safe_dt = _mm256_blendv_pd(_mm256_set1_pd(1.0), dt, is_staged);
+
+        for (int r = 0; rated_lanes != 0 && r < RATE_COUNT; r++) {
+            double* out = engine->rate + rate_at(engine, r, id);
+            __m256i prev = _mm256_loadu_si256((const __m256i*)(engine->prev + rate_at(engine, r, id)));
+            __m256i now = _mm256_loadu_si256((const __m256i*)(engine->cur + rate_at(engine, r, id)));
+            __m256i is_back = _mm256_cmpgt_epi64(_mm256_xor_si256(prev, sign), _mm256_xor_si256(now, sign));
+            __m256i delta = _mm256_blendv_epi8(_mm256_sub_epi64(now, prev), _mm256_add_epi64(_mm256_sub_epi64(span, prev), now), is_back);
+            __m256d low = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(delta, low_mask), magic)), magic_value);
+            __m256d high = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(delta, 32), magic)), magic_value);
+            __m256d value = _mm256_add_pd(_mm256_mul_pd(high, high_scale), low);
+            rate[r] = _mm256_blendv_pd(_mm256_loadu_pd(out), _mm256_div_pd(_mm256_mul_pd(value, _mm256_set1_pd(1e9)), safe_dt), is_rated);
+            _mm256_storeu_pd(out, rate[r]);
+            for (int w = 0; w < RATE_WINDOWS; w++) {
+                double* ewma = engine->ewma + ewma_at(engine, w, r, id);
+                __m256d e = _mm256_loadu_pd(ewma);
+                __m256d alpha = _mm256_loadu_pd(engine->alpha + w * engine->stride + id);
+                _mm256_storeu_pd(ewma, _mm256_blendv_pd(e, _mm256_add_pd(e, _mm256_mul_pd(alpha, _mm256_sub_pd(rate[r], e))), is_rated));
+            }
+        }
+        if(rated_lanes != 0) {
+            __m256i holds = _mm256_setzero_si256();
+            for (int t = 0; t < engine->num_thresholds; t++) {
+                const rate_threshold* threshold = &engine->thresholds[t];
+                __m256d value = rate[threshold->rate];
+                if(threshold->packets >= 0) {
+                    __m256d sum = _mm256_add_pd(value, rate[threshold->packets]);
+                    value = _mm256_and_pd(_mm256_div_pd(value, sum), _mm256_cmp_pd(sum, zero, _CMP_GT_OQ));
+                } else {
+                    value = _mm256_mul_pd(value, _mm256_set1_pd(threshold->scale));
+                }
+                __m256d limit = _mm256_set1_pd(threshold->limit);
+                __m256d is_held = threshold->is_below ? _mm256_cmp_pd(value, limit, _CMP_LT_OQ) : _mm256_cmp_pd(value, limit, _CMP_GT_OQ);
+                holds = _mm256_or_si256(holds, _mm256_and_si256(_mm256_castpd_si256(is_held), _mm256_set1_epi64x(1ll << t)));
+            }
+            __m256i* out = (__m256i*)(engine->holds + id);
+            _mm256_storeu_si256(out, _mm256_blendv_epi8(_mm256_loadu_si256(out), holds, _mm256_castpd_si256(is_rated)));
+        }
+        int64_t lane_wraps[RATE_LANES];
+        _mm256_storeu_si256((__m256i*)lane_wraps, wraps);
+        for (int l = 0; l < RATE_LANES; l++) {
+            if(staged_lanes & (1 << l))
+                engine->changes[id + l] = reset_lanes & (1 << l) ? -1 : lane_wraps[l];
+        }
+        for (int r = 0; r < RATE_COUNT; r++) { //a reset starts over from the new counters
+            __m256i* prev = (__m256i*)(engine->prev + rate_at(engine, r, id));
+            __m256i now = _mm256_loadu_si256((const __m256i*)(engine->cur + rate_at(engine, r, id)));
+            _mm256_storeu_si256(prev, _mm256_blendv_epi8(_mm256_loadu_si256(prev), now, _mm256_castpd_si256(is_staged)));
+        }
+    }
+}
+#endif //RATE_KERNEL_AVX2
+
+/*Function is responsible for*/
+/*picking the fastest rate kernel the CPU runs*/
+rate_kernel_fn rate_kernel_select() {
+#ifdef RATE_KERNEL_AVX2
+    __builtin_cpu_init(); //runs before main, while the globals are constructed
+    if(__builtin_cpu_supports("avx2"))
+        return rate_kernel_avx2;
+#endif
+    return rate_kernel_scalar;
+}
+
+rate_kernel_fn rate_kernel { rate_kernel_select() }; //kernel rate_engine_tick runs
+
+/*Function is responsible for*/
+/*checking if a sample of the interface waits for the tick*/
+inline bool rate_is_staged(const rate_engine* engine, const rate_state* state) {
+    return engine->dt[state->id] != 0;
+}
+
+/*Function is responsible for*/
+/*keeping the counters of a sample as the base of the next deltas*/
+inline void rate_prime(rate_engine* engine, rate_state* state, const wire_sample* sample) {
+    for (int r = 0; r < RATE_COUNT; r++)
+        engine->prev[rate_at(engine, r, state->id)] = rated_counters(sample)[r];
+    state->last_ns = sample->timestamp_ns;
+    state->is_primed = true;
+}
+
+/*Rate Stage function is responsible for*/
+/*handing the counters of a sample to the next tick of the kernel*/
+/*the smoothing factor follows the real time between the samples*/
+/*the interface has no sample staged yet; returns false if no rate can be computed from the sample*/
+bool rate_stage(rate_engine* engine, rate_state* state, const wire_sample* sample) {
+    state->has_rate = false;
+    if(!state->is_primed) {
+        rate_prime(engine, state, sample);
+        return false;
+    }
+    if(sample->timestamp_ns <= state->last_ns) { //duplicate or reordered sample
+        return false;
+    }
+
+    double dt = (double)(sample->timestamp_ns - state->last_ns);
+    if(dt != state->alpha_dt) { //samples mostly come at the same interval, expm1 runs when it changes
+        for (int w = 0; w < RATE_WINDOWS; w++)
+            state->alpha[w] = -expm1(-dt / rate_windows_ns[w]);
+        state->alpha_dt = dt;
+    }
+    for (int w = 0; w < RATE_WINDOWS; w++) //the first rates are taken as they are
+        engine->alpha[w * engine->stride + state->id] = state->is_seeded ? state->alpha[w] : 1.0;
+    for (int r = 0; r < RATE_COUNT; r++)
+        engine->cur[rate_at(engine, r, state->id)] = rated_counters(sample)[r];
+    engine->dt[state->id] = dt;
+    state->last_ns = sample->timestamp_ns;
+    ++engine->staged;
+    return true;
+}
+
+/*Function is responsible for*/
+/*running the kernel once over the arrays of every id, the staged interfaces get their rates*/
+void rate_engine_tick(rate_engine* engine) {
+    if(engine->staged > 0)
+        rate_kernel(engine, 0, (engine->next_id + RATE_LANES - 1) / RATE_LANES * RATE_LANES);
+}
+
+/*Rate Settle function is responsible for*/
+/*taking the outcome of the tick for a staged interface, its next sample can be staged*/
+/*returns false if no rate was computed, every counter restarted with the interface*/
+bool rate_settle(rate_engine* engine, rate_state* state) {
+    int change = engine->changes[state->id];
+
+    engine->dt[state->id] = 0;
+    --engine->staged;
+    if(change < 0) {
+        ++state->resets;
+        return false;
+    }
+    state->wraps += change;
+    state->is_seeded = state->has_rate = true;
+    return true;
+}
+
+/*Rate Update function is responsible for*/
+/*turning a single sample into rates right away, for an interface whose sample cannot wait for the tick*/
+/*returns false if no rate could be computed from the sample*/
+bool rate_update(rate_engine* engine, rate_state* state, const wire_sample* sample) {
+    if(!rate_stage(engine, state, sample)) {
+        return false;
+    }
+    rate_kernel_scalar(engine, state->id, state->id + 1);
+    return rate_settle(engine, state);
+}
+
+/*Format Rates function is responsible for*/
+/*printing the current and the smoothed rates of an interface into data*/
+int format_rates(char* data, size_t len, const rate_engine* engine, uint32_t id) {
+    double r[RATE_COUNT], e[RATE_WINDOWS][RATE_COUNT];
+
+    for (int c = 0; c < RATE_COUNT; c++) {
+        r[c] = engine->rate[rate_at(engine, c, id)];
+        for (int w = 0; w < RATE_WINDOWS; w++)
+            e[w][c] = engine->ewma[ewma_at(engine, w, c, id)];
+    }
+    return snprintf(data, len, "rx_bps:%.0f tx_bps:%.0f rx_pps:%.0f tx_pps:%.0f "
+        "rx_drop:%.4f tx_drop:%.4f rx_err:%.4f tx_err:%.4f\n"
+        "ewma(%s/%s/%s) rx_bps:%.0f/%.0f/%.0f tx_bps:%.0f/%.0f/%.0f rx_pps:%.0f/%.0f/%.0f tx_pps:%.0f/%.0f/%.0f\n",
+        r[RATE_RX_BYTES] * 8, r[RATE_TX_BYTES] * 8, r[RATE_RX_PACKETS], r[RATE_TX_PACKETS],
+        rate_ratio(r[RATE_RX_DROPPED], r[RATE_RX_PACKETS]), rate_ratio(r[RATE_TX_DROPPED], r[RATE_TX_PACKETS]),
+        rate_ratio(r[RATE_RX_ERRORS], r[RATE_RX_PACKETS]), rate_ratio(r[RATE_TX_ERRORS], r[RATE_TX_PACKETS]),
+        rate_window_names[0], rate_window_names[1], rate_window_names[2],
+        e[0][RATE_RX_BYTES] * 8, e[1][RATE_RX_BYTES] * 8, e[2][RATE_RX_BYTES] * 8,
+        e[0][RATE_TX_BYTES] * 8, e[1][RATE_TX_BYTES] * 8, e[2][RATE_TX_BYTES] * 8,
+        e[0][RATE_RX_PACKETS], e[1][RATE_RX_PACKETS], e[2][RATE_RX_PACKETS],
+        e[0][RATE_TX_PACKETS], e[1][RATE_TX_PACKETS], e[2][RATE_TX_PACKETS]);
+}
+
+#endif //RATES_H
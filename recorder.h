@@ -0,0 +1,399 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <cinttypes>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "statistics.h"
+#include "protocol.h"
+#include "netlink.h"
+#include "spsc_queue.h"
+#include "codec.h"
+#include "rates.h"
+
+#define SEGMENT_MAGIC 0x47534d4e //"NMSG" in little endian
+#define SEGMENT_VERSION 5 //2: start_monotonic_ns, replays keep the wall clock of the recording; 3: every counter and the queues
+    //4: compressed blocks instead of fixed records; 5: the host of every interface
+#define SEGMENT_BLOCK_MAGIC 0x4b424d4e //"NMBK" in little endian
+#define SEGMENT_BLOCK_LEN 65536 //Encoded records of a block, a block decodes on its own
+#define DEFAULT_SEGMENT_MB 64 //Size a segment rotates at unless configured
+#define MAX_RECORDED_INTERFACES 4096 //Entries of the interface table of a segment
+#define MAX_RECORDED_HOSTS 4096 //Hosts numbered over the segments of one replay
+
+#define NUM_OPERSTATES (sizeof(operstate_names) / sizeof(operstate_names[0]))
+
+/*Header at the start of every segment, all fields are in host byte order*/
+struct alignas(CACHE_LINE) segment_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t block_header_len; //sizeof(segment_block)
+    uint32_t interval_ms; //sampling interval of the recording
+    uint32_t max_interfaces; //entries of the interface table following the header
+    uint32_t num_interfaces; //entries in use
+    uint32_t reserved;
+    uint64_t sequence; //position of the segment in the recording
+    uint64_t records; //offset of the first record
+    uint64_t end; //offset past the last complete record
+    uint64_t start_realtime_ns; //CLOCK_REALTIME the segment was started at
+    uint64_t start_monotonic_ns; //CLOCK_MONOTONIC at the same moment, maps record timestamps to the wall clock
+};
+
+/*Block of encoded samples, starts on an 8 byte boundary and is followed by its records*/
+/*the interface name of a record is replaced by its entry in the table, the counters are compressed by the codec*/
+struct segment_block {
+    uint32_t magic;
+    uint32_t len; //bytes of complete records following the header
+    uint32_t records;
+    uint32_t reserved;
+    uint64_t first_ns; //timestamp of the first record
+    uint64_t last_ns; //timestamp of the last record
+};
+
+/*Entry of the interface table of a segment*/
+/*an aggregator records the same interface name of several hosts under as many entries*/
+struct segment_entry {
+    char interface[IFNAMSIZ];
+    char host[HOST_NAME_LEN]; //uploading host of the interface, empty for the recording host
+};
+
+static_assert(sizeof(segment_header) == 64, "segment_header layout changed");
+static_assert(sizeof(segment_block) == 32, "segment_block layout changed");
+static_assert(sizeof(segment_entry) == 80, "segment_entry layout changed");
+
+/*Host Table numbers the hosts of replayed segments, shared by all of them so that a host keeps its number*/
+struct host_table {
+    char (*names)[HOST_NAME_LEN]; //MAX_RECORDED_HOSTS entries, 0 is the recording host
+    uint32_t count;
+};
+
+/*Recorder appends every sample to size-rotated segments written through mmap*/
+struct recorder {
+    char prefix[PATH_MAX]; //segments are named prefix.NNNNNN.nmseg
+    size_t segment_len; //mapped length of a segment
+    uint32_t interval_ms;
+    uint64_t sequence; //sequence of the open segment
+    int fd;
+    char* map;
+    segment_header* header;
+    segment_entry* names; //interface table of the recording, copied into every segment
+    uint32_t num_names;
+    uint16_t* entries; //entry of the table every rate id was last recorded under
+    sample_codec codec; //states of the entries in the open block
+    segment_block* block; //block being written, nullptr until the first record of a segment
+    size_t end; //write offset in the open segment
+    uint64_t records; //records written over all segments
+    uint64_t bytes; //encoded bytes of the records, headers left out
+    uint64_t values; //counters and queue counters recorded
+    uint64_t dropped; //samples of interfaces past MAX_RECORDED_INTERFACES
+};
+
+/*Segment Reader walks the records of one segment mapped read-only*/
+struct segment_reader {
+    int fd;
+    const char* map;
+    size_t len;
+    const segment_header* header;
+    const segment_entry* names;
+    uint16_t* hosts; //number of the host of every entry in the host table given to segment_open, 0 without one
+    sample_codec codec; //states of the entries in the current block
+    size_t offset; //next record or block
+    size_t block_end; //end of the records of the current block, 0 before the first
+};
+
+/*Function is responsible for*/
+/*computing the offset of the first record of a segment*/
+inline size_t segment_records_offset() {
+    size_t len = sizeof(segment_header) + MAX_RECORDED_INTERFACES * sizeof(segment_entry);
+    return (len + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+/*Function is responsible for*/
+/*truncating the open segment to its records and unmapping it*/
+void recorder_close_segment(recorder* rec) {
+    if(rec->map == nullptr) {
+        return;
+    }
+    rec->header->end = rec->end;
+    munmap(rec->map, rec->segment_len);
+    if(ftruncate(rec->fd, rec->end) < 0) {
+        perror("Error while truncating the segment");
+    }
+    close(rec->fd);
+    rec->map = nullptr;
+    rec->header = nullptr;
+    rec->fd = -1;
+}
+
+/*Recorder Open Segment function is responsible for*/
+/*creating the next segment file, mapping it and writing its header*/
+bool recorder_open_segment(recorder* rec) {
+    char path[PATH_MAX + 32];
+    struct timespec now;
+    void* addr;
+
+    snprintf(path, sizeof(path), "%s.%06" PRIu64 ".nmseg", rec->prefix, rec->sequence);
+    if((rec->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        return false;
+    }
+    if(ftruncate(rec->fd, rec->segment_len) < 0
+       || (addr = mmap(NULL, rec->segment_len, PROT_READ | PROT_WRITE, MAP_SHARED, rec->fd, 0)) == MAP_FAILED) {
+        close(rec->fd);
+        rec->fd = -1;
+        return false;
+    }
+    rec->map = (char*)addr;
+    rec->header = (segment_header*)addr;
+    rec->header->magic = SEGMENT_MAGIC;
+    rec->header->version = SEGMENT_VERSION;
+    rec->header->block_header_len = sizeof(segment_block);
+    rec->header->interval_ms = rec->interval_ms;
+    rec->header->max_interfaces = MAX_RECORDED_INTERFACES;
+    rec->header->num_interfaces = rec->num_names;
+    rec->header->sequence = rec->sequence;
+    rec->header->records = rec->end = segment_records_offset();
+    rec->header->end = rec->end;
+    rec->block = nullptr;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->header->start_realtime_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    rec->header->start_monotonic_ns = monotonic_ns();
+    memcpy(rec->map + sizeof(segment_header), rec->names, rec->num_names * sizeof(segment_entry));
+    return true;
+}
+
+/*Recorder Init function is responsible for*/
+/*starting a recording into segments named after prefix*/
+bool recorder_init(recorder* rec, const char* prefix, size_t segment_len, uint32_t interval_ms) {
+    memset(rec, 0, sizeof(*rec));
+    strncpy(rec->prefix, prefix, sizeof(rec->prefix)-1);
+    rec->segment_len = segment_len;
+    rec->interval_ms = interval_ms;
+    rec->fd = -1;
+    if(segment_len < segment_records_offset() + sizeof(segment_block) + CODEC_RECORD_LEN) {
+        return false;
+    }
+    rec->names = new segment_entry[MAX_RECORDED_INTERFACES]();
+    rec->entries = new uint16_t[MAX_RECORDED_INTERFACES]();
+    codec_init(&rec->codec, MAX_RECORDED_INTERFACES);
+    return recorder_open_segment(rec);
+}
+
+/*Function is responsible for*/
+/*finishing the open segment and releasing the recorder*/
+void recorder_close(recorder* rec) {
+    recorder_close_segment(rec);
+    delete[] rec->names;
+    delete[] rec->entries;
+    codec_free(&rec->codec);
+    rec->names = nullptr;
+    rec->entries = nullptr;
+}
+
+/*Function is responsible for*/
+/*converting an operstate string into its index in operstate_names*/
+uint8_t operstate_index(const char* operstate) {
+    for (size_t i = 0; i < NUM_OPERSTATES; i++) {
+        if(strncmp(operstate, operstate_names[i], OPERSTATE_LEN) == 0)
+            return i;
+    }
+    return 0; //IF_OPER_UNKNOWN
+}
+
+/*Function is responsible for*/
+/*closing the open segment and opening the next one*/
+/*returns false if the recording stopped*/
+bool recorder_rotate(recorder* rec) {
+    recorder_close_segment(rec);
+    ++rec->sequence;
+    return recorder_open_segment(rec);
+}
+
+/*Function is responsible for*/
+/*starting a block at the next 8 byte boundary of the open segment*/
+void recorder_open_block(recorder* rec, uint64_t timestamp_ns) {
+    rec->end = (rec->end + 7) & ~(size_t)7;
+    rec->block = (segment_block*)(rec->map + rec->end);
+    rec->block->magic = SEGMENT_BLOCK_MAGIC;
+    rec->block->len = rec->block->records = rec->block->reserved = 0;
+    rec->block->first_ns = rec->block->last_ns = timestamp_ns;
+    rec->end += sizeof(segment_block);
+    rec->header->end = rec->end;
+    codec_block(&rec->codec);
+}
+
+/*Recorder Append function is responsible for*/
+/*encoding a sample of interface id into the open segment*/
+/*an id reused by another interface, or by the same name of another host, gets a new entry in the interface table*/
+/*rotates to a new segment once the open one or its table is full*/
+/*returns false if the recording stopped*/
+bool recorder_append(recorder* rec, uint32_t id, const wire_sample* sample) {
+    uint32_t entry;
+    size_t len;
+
+    if(rec->map == nullptr) {
+        return false;
+    }
+    if(id >= MAX_RECORDED_INTERFACES) {
+        ++rec->dropped;
+        return true;
+    }
+    const char* host = host_name(sample->stats.host) != nullptr ? host_name(sample->stats.host) : "";
+    entry = rec->entries[id];
+    if(entry >= rec->num_names || strncmp(rec->names[entry].interface, sample->interface, IFNAMSIZ) != 0
+       || strncmp(rec->names[entry].host, host, HOST_NAME_LEN) != 0) { //first sample of the interface
+        if(rec->num_names == MAX_RECORDED_INTERFACES) { //interfaces came and went, start over with an empty table
+            rec->num_names = 0;
+            if(!recorder_rotate(rec)) {
+                return false;
+            }
+        }
+        entry = rec->num_names;
+        memcpy(rec->names[entry].interface, sample->interface, IFNAMSIZ);
+        rec->names[entry].interface[IFNAMSIZ-1] = '\0';
+        memset(rec->names[entry].host, 0, HOST_NAME_LEN);
+        strncpy(rec->names[entry].host, host, HOST_NAME_LEN-1);
+        memcpy(rec->map + sizeof(segment_header) + entry * sizeof(segment_entry), &rec->names[entry], sizeof(segment_entry));
+        rec->entries[id] = entry;
+        rec->num_names = rec->header->num_interfaces = entry + 1;
+    }
+    if(rec->end + 8 + sizeof(segment_block) + CODEC_RECORD_LEN > rec->segment_len && !recorder_rotate(rec)) {
+        return false;
+    }
+    if(rec->block == nullptr || rec->block->len + CODEC_RECORD_LEN > SEGMENT_BLOCK_LEN) {
+        recorder_open_block(rec, sample->timestamp_ns);
+    }
+
+    len = codec_encode(&rec->codec, entry, operstate_index(sample->stats.operstate), sample, (uint8_t*)rec->map + rec->end);
+    rec->end += len;
+    rec->block->len += len;
+    ++rec->block->records;
+    rec->block->last_ns = sample->timestamp_ns;
+    rec->header->end = rec->end;
+    ++rec->records;
+    rec->bytes += len;
+    rec->values += NUM_COUNTERS;
+    for (int c = 0; sample->stats.has_queue_stats && c < NUM_QUEUE_COUNTERS; c++)
+        rec->values += queues_kept(&sample->stats, queue_schema[c].dir);
+    return true;
+}
+
+/*Function is responsible for*/
+/*numbering a host in a host table, an empty name is the recording host*/
+/*returns 0 for a host past MAX_RECORDED_HOSTS*/
+uint16_t host_table_find(host_table* hosts, const char* name) {
+    if(name[0] == '\0') {
+        return 0;
+    }
+    for (uint32_t h = 1; h < hosts->count; h++) {
+        if(strncmp(hosts->names[h], name, HOST_NAME_LEN) == 0)
+            return h;
+    }
+    if(hosts->count == MAX_RECORDED_HOSTS) {
+        return 0;
+    }
+    strncpy(hosts->names[hosts->count], name, HOST_NAME_LEN-1);
+    return hosts->count++;
+}
+
+/*Segment Open function is responsible for*/
+/*mapping a segment and checking its header*/
+/*the hosts of its interfaces are numbered in hosts if given*/
+bool segment_open(segment_reader* reader, const char* path, host_table* hosts = nullptr) {
+    struct stat st;
+    void* addr;
+
+    memset(reader, 0, sizeof(*reader));
+    if((reader->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return false;
+    }
+    if(fstat(reader->fd, &st) < 0 || (size_t)st.st_size < sizeof(segment_header)
+       || (addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, reader->fd, 0)) == MAP_FAILED) {
+        close(reader->fd);
+        return false;
+    }
+    reader->map = (const char*)addr;
+    reader->len = st.st_size;
+    reader->header = (const segment_header*)addr;
+    reader->names = (const segment_entry*)(reader->map + sizeof(segment_header));
+    reader->offset = reader->header->records;
+
+    if(reader->header->magic != SEGMENT_MAGIC || reader->header->version != SEGMENT_VERSION
+       || reader->header->block_header_len != sizeof(segment_block) || reader->header->num_interfaces > reader->header->max_interfaces
+       || sizeof(segment_header) + reader->header->max_interfaces * sizeof(segment_entry) > reader->header->records
+       || reader->header->records > reader->len) {
+        munmap(addr, reader->len);
+        close(reader->fd);
+        return false;
+    }
+    madvise(addr, reader->len, MADV_SEQUENTIAL);
+    codec_init(&reader->codec, reader->header->num_interfaces > 0 ? reader->header->num_interfaces : 1);
+    reader->hosts = new uint16_t[reader->header->num_interfaces + 1]();
+    for (uint32_t e = 0; hosts != nullptr && e < reader->header->num_interfaces; e++) {
+        char host[HOST_NAME_LEN];
+        memcpy(host, reader->names[e].host, HOST_NAME_LEN);
+        host[HOST_NAME_LEN-1] = '\0';
+        reader->hosts[e] = host_table_find(hosts, host);
+    }
+    reader->block_end = 0;
+    return true;
+}
+
+/*Function is responsible for*/
+/*unmapping a segment*/
+void segment_close(segment_reader* reader) {
+    munmap((void*)reader->map, reader->len);
+    close(reader->fd);
+    codec_free(&reader->codec);
+    delete[] reader->hosts;
+}
+
+/*Segment Next function is responsible for*/
+/*decoding the next record of a segment into sample without allocating*/
+/*the rest of a block that does not decode is skipped*/
+/*returns false past the last complete record*/
+bool segment_next(segment_reader* reader, wire_sample* sample) {
+    size_t end = reader->header->end < reader->len ? reader->header->end : reader->len;
+    const uint8_t* p;
+    uint32_t entry;
+    uint8_t operstate;
+
+    while (true) {
+        if(reader->offset >= reader->block_end) { //next block
+            const segment_block* block;
+            reader->offset = (reader->offset + 7) & ~(size_t)7;
+            if(reader->offset + sizeof(segment_block) > end) {
+                return false;
+            }
+            block = (const segment_block*)(reader->map + reader->offset);
+            if(block->magic != SEGMENT_BLOCK_MAGIC) { //corrupt, nothing after it can be found
+                return false;
+            }
+            reader->offset += sizeof(segment_block);
+            reader->block_end = reader->offset + block->len < end ? reader->offset + block->len : end;
+            codec_block(&reader->codec);
+            continue;
+        }
+        p = (const uint8_t*)reader->map + reader->offset;
+        if(!codec_decode(&reader->codec, &p, (const uint8_t*)reader->map + reader->block_end, &entry, &operstate, sample)) {
+            reader->offset = reader->block_end;
+            continue;
+        }
+        reader->offset = p - (const uint8_t*)reader->map;
+        memcpy(sample->interface, reader->names[entry].interface, IFNAMSIZ);
+        sample->interface[IFNAMSIZ-1] = '\0';
+        sample->stats.host = reader->hosts[entry];
+        memset(sample->stats.operstate, 0, OPERSTATE_LEN);
+        strncpy(sample->stats.operstate, operstate_names[operstate < NUM_OPERSTATES ? operstate : 0], OPERSTATE_LEN-1);
+        return true;
+    }
+}
+
+#endif //RECORDER_H
@@ -0,0 +1,318 @@
+#ifndef REMEDIATION_H
+#define REMEDIATION_H
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/eventfd.h>
+
+#include "params.h"
+#include "spsc_queue.h"
+#include "self_metrics.h"
+
+#define DEFAULT_MAX_REMEDIATIONS 2 //Links set up at the same time unless configured
+#define REMEDIATION_BACKOFF_NS 1000000000ull //Wait after the first attempt of an outage, doubled by every further one
+#define REMEDIATION_MAX_BACKOFF_NS (5 * 60 * 1000000000ull) //Longest wait between two attempts
+#define REMEDIATION_STABLE_NS (5 * 60 * 1000000000ull) //A link staying up this long starts over at the shortest backoff
+#define FLAP_PENALTY 1000.0 //Penalty every time a link goes down
+#define FLAP_SUPPRESS 3000.0 //Penalty above which the link is left alone
+#define FLAP_REUSE 750.0 //Penalty below which a damped link is remediated again
+#define FLAP_HALF_LIFE_NS (60 * 1000000000ull) //Time the penalty takes to halve
+
+/*Where the remediation of a link stands*/
+enum remediation_phase {
+    REMEDY_IDLE, //the link is up, or nothing is known about it
+    REMEDY_WAITING, //the link is down, the next attempt waits for next_ns
+    REMEDY_RUNNING //a worker is setting the link up
+};
+
+/*Remediation Job is a link handed to a worker*/
+struct remediation_job {
+    uint32_t slot;
+    uint32_t worker;
+    char interface[IFNAMSIZ];
+};
+
+/*Remediation Result is what a worker did with a job*/
+struct remediation_result {
+    uint32_t slot;
+    uint32_t worker;
+    int error; //errno of the failed action, 0 if the link was set up
+    uint64_t action_ns; //time the action took
+};
+
+/*Remediation Link is the remediation state of one monitor slot, owned by the event loop*/
+struct remediation_link {
+    char interface[IFNAMSIZ];
+    remediation_phase phase;
+    uint64_t down_ns; //start of the outage
+    uint64_t next_ns; //no attempt before
+    uint64_t backoff_ns; //wait after the next attempt
+    uint64_t last_action_ns; //last attempt, 0 before any
+    uint32_t attempts; //attempts of the current outage
+    double penalty; //flap penalty as of penalty_ns
+    uint64_t penalty_ns;
+    bool is_damped; //flapping, left down until the penalty decays below FLAP_REUSE
+};
+
+/*Remediation Worker sets links up one at a time away from the event loop*/
+struct remediation_worker {
+    std::thread thread;
+    spsc_queue<remediation_job> jobs; //event loop -> worker
+    spsc_queue<remediation_result> results; //worker -> event loop
+    int wake_fd; //eventfd signalled for every job and on shutdown
+    bool is_busy; //the worker holds a job, event loop only
+};
+
+/*Remediation Engine brings links that went down back up*/
+/*every down link waits for a free worker, with a per-link exponential backoff between attempts*/
+/*links that keep flapping are damped and left alone until their penalty decays*/
+/*the event loop keeps collecting at full rate while the actions run*/
+struct remediation_engine {
+    remediation_link* links; //one per monitor slot
+    size_t num_links;
+    remediation_worker* workers; //one per concurrent action
+    size_t num_workers;
+    int done_fd; //eventfd signalled by the workers for every result
+    size_t waiting; //links in REMEDY_WAITING
+    std::atomic<bool> is_running;
+    uint64_t flaps;
+    uint64_t actions; //attempts finished
+    uint64_t failures; //attempts whose action failed
+    uint64_t recoveries; //outages that ended after an attempt
+    uint64_t damped; //times a link was left alone for flapping
+};
+
+/*Remediation Worker Main function is responsible for*/
+/*setting up the links of the jobs handed to a worker until the engine stops*/
+void remediation_worker_main(remediation_engine* engine, remediation_worker* worker) {
+    struct pollfd pfd { worker->wake_fd, POLLIN, 0 };
+    remediation_job job;
+    uint64_t value;
+
+    while (engine->is_running.load(std::memory_order_relaxed)) {
+        if(poll(&pfd, 1, -1) <= 0 || read(worker->wake_fd, &value, sizeof(value)) < 0) {
+            continue;
+        }
+        while (spsc_pop(&worker->jobs, &job)) {
+            remediation_result result { job.slot, job.worker, 0, 0 };
+            uint64_t start = monotonic_ns();
+            if(!set_link_up(job.interface))
+                result.error = errno;
+            result.action_ns = monotonic_ns() - start;
+            spsc_push(&worker->results, result);
+            value = 1;
+            if(write(engine->done_fd, &value, sizeof(value)) < 0) {
+                perror("Error while signalling a remediation");
+            }
+        }
+    }
+}
+
+/*Remediation Start function is responsible for*/
+/*preparing the links of num_slots slots and starting max_actions workers*/
+/*returns false if the eventfds could not be created*/
+bool remediation_start(remediation_engine* engine, size_t num_slots, size_t max_actions) {
+    engine->links = new remediation_link[num_slots]();
+    engine->num_links = num_slots;
+    engine->workers = new remediation_worker[max_actions];
+    engine->num_workers = max_actions;
+    engine->waiting = 0;
+    engine->flaps = engine->actions = engine->failures = engine->recoveries = engine->damped = 0;
+    engine->is_running.store(true);
+    if((engine->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        return false;
+    }
+    for (size_t w = 0; w < max_actions; w++) {
+        remediation_worker* worker = &engine->workers[w];
+        spsc_init(&worker->jobs, 1); //a worker holds a single job at a time
+        spsc_init(&worker->results, 1);
+        worker->is_busy = false;
+        if((worker->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+            engine->num_workers = w;
+            return false;
+        }
+        worker->thread = std::thread(remediation_worker_main, engine, worker);
+    }
+    return true;
+}
+
+/*Function is responsible for*/
+/*stopping the workers, an action under way is finished first*/
+void remediation_stop(remediation_engine* engine) {
+    uint64_t value { 1 };
+
+    if(engine->links == nullptr) {
+        return;
+    }
+    engine->is_running.store(false);
+    for (size_t w = 0; w < engine->num_workers; w++) {
+        remediation_worker* worker = &engine->workers[w];
+        if(write(worker->wake_fd, &value, sizeof(value)) < 0) {
+            perror("Error while stopping a remediation worker");
+        }
+        worker->thread.join();
+        close(worker->wake_fd);
+        spsc_free(&worker->jobs);
+        spsc_free(&worker->results);
+    }
+    if(engine->done_fd >= 0)
+        close(engine->done_fd);
+    delete[] engine->workers;
+    delete[] engine->links;
+    engine->workers = nullptr;
+    engine->links = nullptr;
+}
+
+/*Function is responsible for*/
+/*decaying the flap penalty of a link to now_ns*/
+inline void remediation_decay(remediation_link* link, uint64_t now_ns) {
+    if(now_ns > link->penalty_ns) {
+        link->penalty *= exp2(-(double)(now_ns - link->penalty_ns) / FLAP_HALF_LIFE_NS);
+        link->penalty_ns = now_ns;
+    }
+}
+
+/*Remediation Schedule function is responsible for*/
+/*handing the down links whose backoff elapsed to the idle workers*/
+void remediation_schedule(remediation_engine* engine, uint64_t now_ns) {
+    uint64_t value { 1 };
+    size_t w { 0 };
+
+    for (size_t i = 0; i < engine->num_links && engine->waiting > 0; i++) {
+        remediation_link* link = &engine->links[i];
+        if(link->phase != REMEDY_WAITING || link->next_ns > now_ns) {
+            continue;
+        }
+        if(link->is_damped) {
+            remediation_decay(link, now_ns);
+            if(link->penalty >= FLAP_REUSE)
+                continue;
+            link->is_damped = false;
+            std::cout << "NetworkMonitor: link of the interface " << link->interface << " settled, remediating it again" << std::endl;
+        }
+        while (w < engine->num_workers && engine->workers[w].is_busy)
+            ++w;
+        if(w == engine->num_workers) { //every worker is busy, the link waits for the next result
+            return;
+        }
+        remediation_job job { (uint32_t)i, (uint32_t)w, {} };
+        memcpy(job.interface, link->interface, IFNAMSIZ);
+        spsc_push(&engine->workers[w].jobs, job);
+        if(write(engine->workers[w].wake_fd, &value, sizeof(value)) < 0) {
+            perror("Error while waking a remediation worker");
+        }
+        engine->workers[w].is_busy = true;
+        link->phase = REMEDY_RUNNING;
+        --engine->waiting;
+        ++link->attempts;
+        link->last_action_ns = now_ns;
+        std::cout << "NetworkMonitor: link of the interface " << link->interface << " is down, setting it up (attempt "
+            << link->attempts << ")" << std::endl;
+    }
+}
+
+/*Remediation Link Down function is responsible for*/
+/*counting a flap of the link of a slot and queueing its remediation*/
+/*a link that flaps too often is damped instead*/
+void remediation_link_down(remediation_engine* engine, size_t slot, const char* interface, uint64_t now_ns) {
+    remediation_link* link = &engine->links[slot];
+
+    if(strncmp(link->interface, interface, IFNAMSIZ) != 0) { //first outage of the interface in this slot
+        *link = remediation_link();
+        strncpy(link->interface, interface, IFNAMSIZ-1);
+    }
+    ++engine->flaps;
+    self_count(SELF_FLAPS);
+    remediation_decay(link, now_ns);
+    link->penalty += FLAP_PENALTY;
+    if(!link->is_damped && link->penalty > FLAP_SUPPRESS) {
+        link->is_damped = true;
+        ++engine->damped;
+        std::cout << "NetworkMonitor: link of the interface " << interface << " flaps, leaving it alone until it settles" << std::endl;
+    }
+    if(link->phase != REMEDY_IDLE) { //already being remediated
+        return;
+    }
+    if(link->last_action_ns == 0 || now_ns - link->last_action_ns > REMEDIATION_STABLE_NS)
+        link->backoff_ns = REMEDIATION_BACKOFF_NS;
+    link->phase = REMEDY_WAITING;
+    link->down_ns = now_ns;
+    link->attempts = 0;
+    link->next_ns = link->last_action_ns == 0 ? now_ns : std::max<uint64_t>(now_ns, link->last_action_ns + link->backoff_ns);
+    ++engine->waiting;
+    remediation_schedule(engine, now_ns);
+}
+
+/*Remediation Link Up function is responsible for*/
+/*ending the outage of the link of a slot and recording how long it took*/
+void remediation_link_up(remediation_engine* engine, size_t slot, uint64_t now_ns) {
+    remediation_link* link = &engine->links[slot];
+
+    if(link->phase == REMEDY_IDLE) {
+        return;
+    }
+    if(link->phase == REMEDY_WAITING)
+        --engine->waiting;
+    if(link->attempts > 0) {
+        ++engine->recoveries;
+        self_record(HIST_REMEDIATION, now_ns - link->down_ns);
+        std::cout << "NetworkMonitor: link of the interface " << link->interface << " is up again after "
+            << (now_ns - link->down_ns) / 1e6 << " ms and " << link->attempts << " attempts" << std::endl;
+    }
+    link->phase = REMEDY_IDLE; //a result still under way finds the link idle
+}
+
+/*Function is responsible for*/
+/*forgetting the link of a slot that was given up, its pending attempts are dropped*/
+void remediation_forget(remediation_engine* engine, size_t slot) {
+    if(engine->links == nullptr) {
+        return;
+    }
+    if(engine->links[slot].phase == REMEDY_WAITING)
+        --engine->waiting;
+    engine->links[slot] = remediation_link();
+}
+
+/*Remediation Handle Results function is responsible for*/
+/*taking the finished actions back from the workers*/
+/*a link still down waits for its backoff before the next attempt*/
+void remediation_handle_results(remediation_engine* engine, uint64_t now_ns) {
+    remediation_result result;
+    uint64_t value;
+
+    if(read(engine->done_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        perror("Error while reading the remediation results");
+    }
+    for (size_t w = 0; w < engine->num_workers; w++) {
+        while (spsc_pop(&engine->workers[w].results, &result)) {
+            remediation_link* link = &engine->links[result.slot];
+            engine->workers[result.worker].is_busy = false;
+            ++engine->actions;
+            self_count(SELF_REMEDIATIONS);
+            if(result.error != 0) {
+                ++engine->failures;
+                std::cerr << "NetworkMonitor: cannot set the link of the interface " << link->interface << " up: "
+                    << strerror(result.error) << std::endl;
+            }
+            if(link->phase != REMEDY_RUNNING) { //up again, or forgotten, while the action ran
+                continue;
+            }
+            link->phase = REMEDY_WAITING; //until the link is reported up
+            link->next_ns = now_ns + link->backoff_ns;
+            link->backoff_ns = std::min<uint64_t>(2 * link->backoff_ns, REMEDIATION_MAX_BACKOFF_NS);
+            ++engine->waiting;
+        }
+    }
+    remediation_schedule(engine, now_ns);
+}
+
+#endif //REMEDIATION_H
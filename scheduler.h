@@ -0,0 +1,89 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "statistics.h"
+#include "self_metrics.h"
+
+#define MIN_INTERVAL_MS 10 //Shortest sampling interval
+#define MAX_INTERVAL_MS 60000 //Longest sampling interval
+#define DEFAULT_INTERVAL_MS 1000 //Sampling interval unless configured
+
+/*Sample Scheduler fires on absolute CLOCK_MONOTONIC deadlines*/
+/*that are multiples of the interval, so every process sharing the*/
+/*interval samples in phase and the period never drifts*/
+struct sample_scheduler {
+    int fd; //timerfd, readable once a deadline has passed
+    uint64_t interval_ns;
+    uint64_t next_ns; //deadline of the next tick
+    uint64_t tick_ns; //deadline of the last consumed tick
+    uint64_t ticks; //ticks consumed, missed ones included
+    uint64_t missed; //ticks that passed while the owner was busy
+};
+
+/*Function is responsible for*/
+/*checking that an interval in milliseconds is supported*/
+inline bool interval_valid(long interval_ms) {
+    return interval_ms >= MIN_INTERVAL_MS && interval_ms <= MAX_INTERVAL_MS;
+}
+
+/*Scheduler Start function is responsible for*/
+/*arming a periodic timer on the next multiple of the interval plus phase*/
+bool scheduler_start(sample_scheduler* scheduler, uint64_t interval_ns, uint64_t phase_ns) {
+    struct itimerspec spec;
+    uint64_t now = monotonic_ns();
+
+    scheduler->interval_ns = interval_ns;
+    scheduler->next_ns = (now / interval_ns + 1) * interval_ns + phase_ns % interval_ns;
+    scheduler->tick_ns = 0;
+    scheduler->ticks = 0;
+    scheduler->missed = 0;
+    if((scheduler->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        return false;
+    }
+
+    spec.it_value.tv_sec = scheduler->next_ns / 1000000000ull;
+    spec.it_value.tv_nsec = scheduler->next_ns % 1000000000ull;
+    spec.it_interval.tv_sec = interval_ns / 1000000000ull;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000ull;
+    if(timerfd_settime(scheduler->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        close(scheduler->fd);
+        scheduler->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/*Scheduler Consume function is responsible for*/
+/*acknowledging the expired deadlines once the timerfd is readable*/
+/*returns the number of expirations, more than one means missed ticks*/
+uint64_t scheduler_consume(sample_scheduler* scheduler) {
+    uint64_t expirations;
+
+    self_count(SELF_SYSCALLS);
+    if(read(scheduler->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return 0; //EAGAIN, nothing expired yet
+    }
+    scheduler->tick_ns = scheduler->next_ns + (expirations - 1) * scheduler->interval_ns;
+    scheduler->next_ns += expirations * scheduler->interval_ns;
+    scheduler->ticks += expirations;
+    scheduler->missed += expirations - 1;
+    self_count(SELF_TICKS, expirations);
+    self_count(SELF_MISSED_TICKS, expirations - 1);
+    self_record(HIST_TICK_LATENESS, monotonic_ns() - scheduler->tick_ns);
+    return expirations;
+}
+
+/*Function is responsible for*/
+/*disarming the scheduler*/
+void scheduler_stop(sample_scheduler* scheduler) {
+    if(scheduler->fd >= 0)
+        close(scheduler->fd);
+    scheduler->fd = -1;
+}
+
+#endif //SCHEDULER_H
@@ -0,0 +1,306 @@
+#ifndef SELF_METRICS_H
+#define SELF_METRICS_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "statistics.h"
+#include "spsc_queue.h"
+
+#define SELF_MAGIC 0x464c4553 //"SELF" in little endian
+#define SELF_VERSION 2 //2: flaps, remediations and their latency
+#define HISTOGRAM_SUB_BITS 4 //16 buckets per power of two, a value is known within 6.25%
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 36 //values up to 2^36 ns (68 s), longer ones land in the last bucket
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/*Counters every process and worker keeps about itself*/
+enum self_counter {
+    SELF_TICKS, //ticks consumed, missed ones included
+    SELF_MISSED_TICKS,
+    SELF_SYSCALLS, //issued on the sampling path
+    SELF_BYTES_IN,
+    SELF_BYTES_OUT,
+    SELF_MESSAGES_IN,
+    SELF_MESSAGES_OUT,
+    SELF_SAMPLES, //collected by a monitor or worker, handled by networkMonitor
+    SELF_FLAPS, //links seen going down, networkMonitor only
+    SELF_REMEDIATIONS, //attempts to set a link up, networkMonitor only
+    SELF_COUNTER_COUNT
+};
+
+const char* const self_counter_names[SELF_COUNTER_COUNT] {
+    "ticks", "missed_ticks", "syscalls", "bytes_in", "bytes_out", "messages_in", "messages_out", "samples", "flaps",
+    "remediations"
+};
+
+/*Latencies every process and worker keeps about itself, in nanoseconds*/
+enum self_histogram {
+    HIST_COLLECT, //get_statistics() of one interface, or one netlink dump
+    HIST_PUBLISH, //handing a sample to the transport
+    HIST_RECEIVE, //sample sent by a monitor until networkMonitor handled it
+    HIST_HANDSHAKE, //monitor connected until it reported monitoring
+    HIST_TICK_LATENESS, //tick deadline until its owner woke up, overruns of the previous tick show here
+    HIST_REMEDIATION, //link down until it was reported up again after a remediation
+    HIST_COUNT
+};
+
+const char* const self_histogram_names[HIST_COUNT] { "collect", "publish", "receive", "handshake", "tick_lateness",
+    "remediation" };
+
+#define SELF_PROCESSES 2 //networkMonitor and its monitors or workers merged, as exported
+const char* const self_process_names[SELF_PROCESSES] { "networkMonitor", "monitors" };
+
+/*HDR Histogram counts values in log-linear buckets of bounded relative error*/
+/*it has a single writer, readers may see a record half applied*/
+struct alignas(CACHE_LINE) hdr_histogram {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> min;
+    std::atomic<uint64_t> max;
+    std::atomic<uint32_t> lowest; //buckets in use, merges only walk them
+    std::atomic<uint32_t> highest;
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+};
+
+/*Self Metrics is the block of one process or worker*/
+/*the owner is the only writer of its counters and histograms*/
+struct alignas(CACHE_LINE) self_metrics {
+    std::atomic<uint64_t> counters[SELF_COUNTER_COUNT];
+    alignas(CACHE_LINE) std::atomic<uint64_t> queue_depth; //samples networkMonitor found waiting in its last drain of the owner
+    std::atomic<uint64_t> max_queue_depth; //both written by networkMonitor only
+    hdr_histogram histograms[HIST_COUNT];
+};
+
+/*Header at the start of the shared blocks*/
+struct alignas(CACHE_LINE) self_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_blocks;
+};
+
+/*Self Region is the memory shared by networkMonitor and its monitors*/
+/*block 0 belongs to networkMonitor, the others to a monitor or a worker each*/
+struct self_region {
+    int fd; //memfd inherited by the monitors
+    size_t len;
+    self_header* header;
+    self_metrics* blocks;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "self metrics need lock-free counters in shared memory");
+
+self_metrics self_fallback; //block of a process that was not handed one, e.g. a monitor started by hand
+thread_local self_metrics* self_block { &self_fallback }; //block the calling thread writes to
+
+/*Function is responsible for*/
+/*adding to a counter that only the calling thread writes, without a locked instruction*/
+inline void relaxed_add(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/*Function is responsible for*/
+/*raising a maximum that only the calling thread writes*/
+inline void relaxed_max(std::atomic<uint64_t>* counter, uint64_t value) {
+    if(value > counter->load(std::memory_order_relaxed))
+        counter->store(value, std::memory_order_relaxed);
+}
+
+/*Function is responsible for*/
+/*finding the bucket of a value*/
+inline uint32_t histogram_index(uint64_t value) {
+    if(value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    if(value >> HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/*Function is responsible for*/
+/*computing the largest value a bucket holds*/
+inline uint64_t histogram_upper(uint32_t index) {
+    if(index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    return ((uint64_t)(HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+/*Histogram Record function is responsible for*/
+/*counting a value, a handful of plain loads and stores*/
+void histogram_record(hdr_histogram* histogram, uint64_t value) {
+    uint64_t count = histogram->count.load(std::memory_order_relaxed);
+    uint32_t index = histogram_index(value);
+
+    if(count == 0 || value < histogram->min.load(std::memory_order_relaxed))
+        histogram->min.store(value, std::memory_order_relaxed);
+    if(count == 0 || index < histogram->lowest.load(std::memory_order_relaxed))
+        histogram->lowest.store(index, std::memory_order_relaxed);
+    if(count == 0 || index > histogram->highest.load(std::memory_order_relaxed))
+        histogram->highest.store(index, std::memory_order_relaxed);
+    relaxed_max(&histogram->max, value);
+    relaxed_add(&histogram->buckets[index], 1);
+    relaxed_add(&histogram->sum, value);
+    histogram->count.store(count + 1, std::memory_order_relaxed);
+}
+
+/*Function is responsible for*/
+/*adding the values of histogram from to histogram into*/
+void histogram_merge(hdr_histogram* into, const hdr_histogram* from) {
+    uint64_t count = from->count.load(std::memory_order_relaxed);
+    if(count == 0) {
+        return;
+    }
+    uint32_t lowest = from->lowest.load(std::memory_order_relaxed);
+    uint32_t highest = std::min<uint32_t>(from->highest.load(std::memory_order_relaxed), HISTOGRAM_BUCKETS - 1);
+    uint64_t merged = into->count.load(std::memory_order_relaxed);
+
+    if(merged == 0 || from->min.load(std::memory_order_relaxed) < into->min.load(std::memory_order_relaxed))
+        into->min.store(from->min.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    if(merged == 0 || lowest < into->lowest.load(std::memory_order_relaxed))
+        into->lowest.store(lowest, std::memory_order_relaxed);
+    if(merged == 0 || highest > into->highest.load(std::memory_order_relaxed))
+        into->highest.store(highest, std::memory_order_relaxed);
+    relaxed_max(&into->max, from->max.load(std::memory_order_relaxed));
+    for (uint32_t i = lowest; i <= highest; i++)
+        relaxed_add(&into->buckets[i], from->buckets[i].load(std::memory_order_relaxed));
+    relaxed_add(&into->sum, from->sum.load(std::memory_order_relaxed));
+    into->count.store(merged + count, std::memory_order_relaxed);
+}
+
+/*Function is responsible for*/
+/*estimating the value below which the fraction q of the values lie*/
+uint64_t histogram_quantile(const hdr_histogram* histogram, double q) {
+    uint64_t count = histogram->count.load(std::memory_order_relaxed);
+    uint64_t rank = (uint64_t)(q * count + 0.5), seen { 0 };
+    uint64_t max = histogram->max.load(std::memory_order_relaxed);
+
+    if(count == 0) {
+        return 0;
+    }
+    uint32_t highest = std::min<uint32_t>(histogram->highest.load(std::memory_order_relaxed), HISTOGRAM_BUCKETS - 1);
+    for (uint32_t i = histogram->lowest.load(std::memory_order_relaxed); i <= highest; i++) {
+        seen += histogram->buckets[i].load(std::memory_order_relaxed);
+        if(seen >= rank && seen > 0)
+            return std::min(histogram_upper(i), max);
+    }
+    return max;
+}
+
+/*Function is responsible for*/
+/*counting n events of the calling thread*/
+inline void self_count(self_counter counter, uint64_t n = 1) {
+    relaxed_add(&self_block->counters[counter], n);
+}
+
+/*Function is responsible for*/
+/*recording a latency of the calling thread*/
+inline void self_record(self_histogram histogram, uint64_t ns) {
+    histogram_record(&self_block->histograms[histogram], ns);
+}
+
+/*Function is responsible for*/
+/*recording how many samples networkMonitor found waiting in the queue of a block*/
+inline void self_queue_depth(self_metrics* block, uint64_t depth) {
+    block->queue_depth.store(depth, std::memory_order_relaxed);
+    relaxed_max(&block->max_queue_depth, depth);
+}
+
+/*Function is responsible for*/
+/*adding every counter and histogram of block from to block into*/
+/*queue depths add up, their maxima do not*/
+void self_metrics_merge(self_metrics* into, const self_metrics* from) {
+    for (int c = 0; c < SELF_COUNTER_COUNT; c++)
+        relaxed_add(&into->counters[c], from->counters[c].load(std::memory_order_relaxed));
+    relaxed_add(&into->queue_depth, from->queue_depth.load(std::memory_order_relaxed));
+    relaxed_max(&into->max_queue_depth, from->max_queue_depth.load(std::memory_order_relaxed));
+    for (int h = 0; h < HIST_COUNT; h++)
+        histogram_merge(&into->histograms[h], &from->histograms[h]);
+}
+
+/*Function is responsible for*/
+/*emptying a block that blocks are merged into, or one whose writer exited*/
+void self_metrics_clear(self_metrics* block) {
+    for (int c = 0; c < SELF_COUNTER_COUNT; c++)
+        block->counters[c].store(0, std::memory_order_relaxed);
+    block->queue_depth.store(0, std::memory_order_relaxed);
+    block->max_queue_depth.store(0, std::memory_order_relaxed);
+    for (int h = 0; h < HIST_COUNT; h++) {
+        hdr_histogram* histogram = &block->histograms[h];
+        if(histogram->count.load(std::memory_order_relaxed) > 0) { //only the buckets in use were ever written
+            for (uint32_t i = histogram->lowest; i <= histogram->highest && i < HISTOGRAM_BUCKETS; i++)
+                histogram->buckets[i].store(0, std::memory_order_relaxed);
+        }
+        histogram->count.store(0, std::memory_order_relaxed);
+        histogram->sum.store(0, std::memory_order_relaxed);
+        histogram->min.store(0, std::memory_order_relaxed);
+        histogram->max.store(0, std::memory_order_relaxed);
+    }
+}
+
+/*Function is responsible for*/
+/*computing the size of a mapping holding num_blocks blocks*/
+inline size_t self_region_size(size_t num_blocks) {
+    return sizeof(self_header) + num_blocks * sizeof(self_metrics);
+}
+
+/*Function is responsible for*/
+/*mapping the blocks of the given fd*/
+bool self_region_map(self_region* region, int fd, size_t len) {
+    void* addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED) {
+        return false;
+    }
+    region->fd = fd;
+    region->len = len;
+    region->header = (self_header*)addr;
+    region->blocks = (self_metrics*)((char*)addr + sizeof(self_header));
+    return true;
+}
+
+/*Self Region Create function is responsible for*/
+/*creating an anonymous memfd with num_blocks zeroed blocks*/
+/*the fd is left open across exec so the monitors can map it*/
+bool self_region_create(self_region* region, size_t num_blocks) {
+    int fd = memfd_create("networkMonitor-self", 0);
+    if(fd < 0) {
+        return false;
+    }
+    if(ftruncate(fd, self_region_size(num_blocks)) < 0 || !self_region_map(region, fd, self_region_size(num_blocks))) {
+        close(fd);
+        return false;
+    }
+    region->header->magic = SELF_MAGIC;
+    region->header->version = SELF_VERSION;
+    region->header->num_blocks = num_blocks;
+    return true;
+}
+
+/*Self Region Attach function is responsible for*/
+/*mapping the blocks created by networkMonitor*/
+bool self_region_attach(self_region* region, int fd) {
+    self_header header;
+    if(pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != SELF_MAGIC || header.version != SELF_VERSION) {
+        return false;
+    }
+    return self_region_map(region, fd, self_region_size(header.num_blocks));
+}
+
+/*Function is responsible for*/
+/*unmapping the blocks*/
+void self_region_close(self_region* region) {
+    if(region->header != nullptr) {
+        munmap(region->header, region->len);
+        close(region->fd);
+    }
+    memset(region, 0, sizeof(*region));
+}
+
+#endif //SELF_METRICS_H
@@ -0,0 +1,158 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "protocol.h"
+#include "spsc_queue.h"
+
+#define SHM_MAGIC 0x4d48534d //"MSHM" in little endian
+#define SHM_VERSION 3 //2: wire_sample carries timestamps, 3: every counter and the queues
+#define SHM_READ_SPINS 64 //Attempts at a slot being written before yielding the CPU once
+#define SHM_READ_YIELDS 2 //Yields before the slot is left for the next tick
+
+/*Shared Memory Slot holds the latest sample of one monitor*/
+/*guarded by a seqlock: seq is odd while the monitor writes*/
+struct alignas(CACHE_LINE) shm_slot {
+    std::atomic<uint32_t> seq;
+    uint32_t reserved;
+    uint64_t sent_ns; //CLOCK_MONOTONIC time the sample was written
+    wire_sample sample;
+};
+
+/*Header at the start of the shared memory*/
+struct alignas(CACHE_LINE) shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs a lock-free counter in shared memory");
+
+/*Shared Memory Channel is the mapping shared by networkMonitor and its monitors*/
+struct shm_channel {
+    int fd; //memfd inherited by the monitors
+    size_t len;
+    shm_header* header;
+    shm_slot* slots;
+    uint32_t* last_seq; //last sequence consumed per slot, networkMonitor only
+};
+
+/*Function is responsible for*/
+/*computing the size of a mapping holding num_slots slots*/
+inline size_t shm_channel_size(size_t num_slots) {
+    return sizeof(shm_header) + num_slots * sizeof(shm_slot);
+}
+
+/*Function is responsible for*/
+/*mapping the channel memory of the given fd*/
+bool shm_channel_map(shm_channel* channel, int fd, size_t len) {
+    void* addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED) {
+        return false;
+    }
+    channel->fd = fd;
+    channel->len = len;
+    channel->header = (shm_header*)addr;
+    channel->slots = (shm_slot*)((char*)addr + sizeof(shm_header));
+    channel->last_seq = nullptr;
+    return true;
+}
+
+/*SHM Channel Create function is responsible for*/
+/*creating an anonymous memfd with one slot per monitor*/
+/*the fd is left open across exec so the monitors can map it*/
+bool shm_channel_create(shm_channel* channel, size_t num_slots) {
+    int fd = memfd_create("networkMonitor", 0);
+    if(fd < 0) {
+        return false;
+    }
+    if(ftruncate(fd, shm_channel_size(num_slots)) < 0 || !shm_channel_map(channel, fd, shm_channel_size(num_slots))) {
+        close(fd);
+        return false;
+    }
+    //new memfd pages are zero, so every seq starts even and empty
+    channel->header->magic = SHM_MAGIC;
+    channel->header->version = SHM_VERSION;
+    channel->header->num_slots = num_slots;
+    channel->last_seq = new uint32_t[num_slots]{ 0 };
+    return true;
+}
+
+/*SHM Channel Attach function is responsible for*/
+/*mapping a channel created by networkMonitor*/
+bool shm_channel_attach(shm_channel* channel, int fd) {
+    shm_header header;
+    if(pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != SHM_MAGIC || header.version != SHM_VERSION) {
+        return false;
+    }
+    return shm_channel_map(channel, fd, shm_channel_size(header.num_slots));
+}
+
+/*Function is responsible for*/
+/*unmapping the channel*/
+void shm_channel_close(shm_channel* channel) {
+    if(channel->header != nullptr) {
+        munmap(channel->header, channel->len);
+        close(channel->fd);
+    }
+    delete[] channel->last_seq;
+    memset(channel, 0, sizeof(*channel));
+}
+
+/*SHM Slot Write function is responsible for*/
+/*publishing a sample, the single writer of a slot never waits*/
+void shm_slot_write(shm_slot* slot, const wire_sample* sample) {
+    uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+    seq += seq & 1; //the previous monitor of the slot died in the middle of a write
+    slot->seq.store(seq + 1, std::memory_order_relaxed); //odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->sent_ns = monotonic_ns();
+    memcpy(&slot->sample, sample, sizeof(*sample));
+    slot->seq.store(seq + 2, std::memory_order_release); //even: sample complete
+}
+
+/*Function is responsible for*/
+/*telling the CPU that the reader spins on a slot*/
+inline void shm_spin_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+/*SHM Slot Read function is responsible for*/
+/*copying a consistent sample out of a slot without a syscall*/
+/*a writer that does not finish in a few attempts, preempted or killed mid-write, is given up on*/
+/*returns the sequence of the copied sample, 0 if the slot was never written or is still being written*/
+uint32_t shm_slot_read(const shm_slot* slot, wire_sample* sample, uint64_t* sent_ns) {
+    uint32_t before, after;
+
+    for (int yields = 0; yields <= SHM_READ_YIELDS; yields++) {
+        if(yields > 0)
+            sched_yield(); //let a preempted writer finish
+        for (int spins = 0; spins < SHM_READ_SPINS; spins++) {
+            before = slot->seq.load(std::memory_order_acquire);
+            if(before & 1) { //writer is in the middle of an update, retry
+                shm_spin_pause();
+                continue;
+            }
+            *sent_ns = slot->sent_ns;
+            memcpy(sample, &slot->sample, sizeof(*sample));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = slot->seq.load(std::memory_order_relaxed);
+            if(before == after)
+                return before;
+        }
+    }
+    return 0;
+}
+
+#endif //SHM_CHANNEL_H
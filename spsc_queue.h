@@ -0,0 +1,71 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+#define CACHE_LINE 64 //Size of a cache line, keeps producer and consumer indexes apart
+
+/*SPSC Queue is a bounded lock-free ring shared by exactly*/
+/*one producer thread and one consumer thread*/
+template <typename T>
+struct spsc_queue {
+    T* slots;
+    size_t mask; //capacity - 1, capacity is a power of two
+    alignas(CACHE_LINE) std::atomic<size_t> head; //next slot to read, written by the consumer
+    alignas(CACHE_LINE) std::atomic<size_t> tail; //next slot to write, written by the producer
+    alignas(CACHE_LINE) size_t dropped; //items rejected because the queue was full, producer only
+};
+
+/*Function is responsible for*/
+/*allocating a queue holding at least capacity items*/
+template <typename T>
+void spsc_init(spsc_queue<T>* queue, size_t capacity) {
+    size_t size { 1 };
+    while (size < capacity)
+        size <<= 1;
+    queue->slots = new T[size];
+    queue->mask = size - 1;
+    queue->head.store(0, std::memory_order_relaxed);
+    queue->tail.store(0, std::memory_order_relaxed);
+    queue->dropped = 0;
+}
+
+/*Function is responsible for*/
+/*releasing the slots of the queue*/
+template <typename T>
+void spsc_free(spsc_queue<T>* queue) {
+    delete[] queue->slots;
+    queue->slots = nullptr;
+}
+
+/*SPSC Push function is responsible for*/
+/*appending an item, called by the producer only*/
+/*returns false if the queue is full*/
+template <typename T>
+bool spsc_push(spsc_queue<T>* queue, const T& item) {
+    size_t tail = queue->tail.load(std::memory_order_relaxed);
+    if(tail - queue->head.load(std::memory_order_acquire) > queue->mask) {
+        ++queue->dropped;
+        return false;
+    }
+    queue->slots[tail & queue->mask] = item;
+    queue->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+/*SPSC Pop function is responsible for*/
+/*taking the oldest item, called by the consumer only*/
+/*returns false if the queue is empty*/
+template <typename T>
+bool spsc_pop(spsc_queue<T>* queue, T* item) {
+    size_t head = queue->head.load(std::memory_order_relaxed);
+    if(head == queue->tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *item = queue->slots[head & queue->mask];
+    queue->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+#endif //SPSC_QUEUE_H
@@ -0,0 +1,281 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cinttypes>
+#include <cstddef>
+#include <net/if.h>
+#include <time.h>
+#include <linux/if_link.h>
+
+#define OPERSTATE_LEN 16 //Maximum length of the operstate string
+#define MAX_QUEUES 8 //Queues per direction whose counters are kept, the first ones of an interface
+
+/*Counters of an interface, in the order of counter_schema*/
+/*the first ten keep the columns the formats always had, new ones go last*/
+enum counter_id : uint8_t {
+    CTR_CARRIER_UP_COUNT,
+    CTR_CARRIER_DOWN_COUNT,
+    CTR_TX_BYTES,
+    CTR_RX_BYTES,
+    CTR_TX_PACKETS,
+    CTR_RX_PACKETS,
+    CTR_TX_DROPPED,
+    CTR_RX_DROPPED,
+    CTR_TX_ERRORS,
+    CTR_RX_ERRORS,
+    CTR_MULTICAST,
+    CTR_COLLISIONS,
+    CTR_RX_LENGTH_ERRORS,
+    CTR_RX_OVER_ERRORS,
+    CTR_RX_CRC_ERRORS,
+    CTR_RX_FRAME_ERRORS,
+    CTR_RX_FIFO_ERRORS,
+    CTR_RX_MISSED_ERRORS,
+    CTR_TX_ABORTED_ERRORS,
+    CTR_TX_CARRIER_ERRORS,
+    CTR_TX_FIFO_ERRORS,
+    CTR_TX_HEARTBEAT_ERRORS,
+    CTR_TX_WINDOW_ERRORS,
+    CTR_RX_COMPRESSED,
+    CTR_TX_COMPRESSED,
+    CTR_RX_NOHANDLER,
+    NUM_COUNTERS
+};
+
+/*Line of the text format a counter is printed on*/
+enum counter_group : uint8_t {
+    GROUP_LINK,
+    GROUP_RX,
+    GROUP_TX
+};
+
+#define COUNTER_RATED 0x1 //turned into a rate, kept in the history and smoothed
+
+/*Counter Descriptor is everything the collectors, the formats and the exporter need to know of a counter*/
+struct counter_desc {
+    counter_id id; //position in the schema, checked at compile time
+    const char* name; //field of the formats
+    const char* sysfs_path; //relative to <sysfs_root>/<interface>
+    uint16_t netlink_attr; //IFLA_* attribute holding the counter
+    uint16_t netlink_offset; //offset of the value in the attribute
+    uint8_t netlink_width; //bytes of the value in the attribute
+    counter_group group;
+    uint8_t flags; //COUNTER_*
+    const char* metric; //Prometheus name
+    const char* help;
+};
+
+#define STATS64(field) IFLA_STATS64, offsetof(struct rtnl_link_stats64, field), 8
+
+//The counter schema, a counter added here is collected, sent, recorded, printed and exported
+constexpr counter_desc counter_schema[NUM_COUNTERS] {
+    { CTR_CARRIER_UP_COUNT, "carrier_up_count", "carrier_up_count", IFLA_CARRIER_UP_COUNT, 0, 4, GROUP_LINK, 0,
+      "netmon_carrier_up_total", "times the carrier came up" },
+    { CTR_CARRIER_DOWN_COUNT, "carrier_down_count", "carrier_down_count", IFLA_CARRIER_DOWN_COUNT, 0, 4, GROUP_LINK, 0,
+      "netmon_carrier_down_total", "times the carrier went down" },
+    { CTR_TX_BYTES, "tx_bytes", "statistics/tx_bytes", STATS64(tx_bytes), GROUP_TX, COUNTER_RATED,
+      "netmon_tx_bytes_total", "bytes sent" },
+    { CTR_RX_BYTES, "rx_bytes", "statistics/rx_bytes", STATS64(rx_bytes), GROUP_RX, COUNTER_RATED,
+      "netmon_rx_bytes_total", "bytes received" },
+    { CTR_TX_PACKETS, "tx_packets", "statistics/tx_packets", STATS64(tx_packets), GROUP_TX, COUNTER_RATED,
+      "netmon_tx_packets_total", "packets sent" },
+    { CTR_RX_PACKETS, "rx_packets", "statistics/rx_packets", STATS64(rx_packets), GROUP_RX, COUNTER_RATED,
+      "netmon_rx_packets_total", "packets received" },
+    { CTR_TX_DROPPED, "tx_dropped", "statistics/tx_dropped", STATS64(tx_dropped), GROUP_TX, COUNTER_RATED,
+      "netmon_tx_dropped_total", "packets dropped before they were sent" },
+    { CTR_RX_DROPPED, "rx_dropped", "statistics/rx_dropped", STATS64(rx_dropped), GROUP_RX, COUNTER_RATED,
+      "netmon_rx_dropped_total", "packets received and dropped" },
+    { CTR_TX_ERRORS, "tx_errors", "statistics/tx_errors", STATS64(tx_errors), GROUP_TX, COUNTER_RATED,
+      "netmon_tx_errors_total", "packets that failed to be sent" },
+    { CTR_RX_ERRORS, "rx_errors", "statistics/rx_errors", STATS64(rx_errors), GROUP_RX, COUNTER_RATED,
+      "netmon_rx_errors_total", "bad packets received" },
+    { CTR_MULTICAST, "multicast", "statistics/multicast", STATS64(multicast), GROUP_LINK, 0,
+      "netmon_multicast_total", "multicast packets received" },
+    { CTR_COLLISIONS, "collisions", "statistics/collisions", STATS64(collisions), GROUP_LINK, 0,
+      "netmon_collisions_total", "collisions on the medium" },
+    { CTR_RX_LENGTH_ERRORS, "rx_length_errors", "statistics/rx_length_errors", STATS64(rx_length_errors), GROUP_RX, 0,
+      "netmon_rx_length_errors_total", "packets received with a bad length" },
+    { CTR_RX_OVER_ERRORS, "rx_over_errors", "statistics/rx_over_errors", STATS64(rx_over_errors), GROUP_RX, 0,
+      "netmon_rx_over_errors_total", "receive ring overflows" },
+    { CTR_RX_CRC_ERRORS, "rx_crc_errors", "statistics/rx_crc_errors", STATS64(rx_crc_errors), GROUP_RX, 0,
+      "netmon_rx_crc_errors_total", "packets received with a bad CRC" },
+    { CTR_RX_FRAME_ERRORS, "rx_frame_errors", "statistics/rx_frame_errors", STATS64(rx_frame_errors), GROUP_RX, 0,
+      "netmon_rx_frame_errors_total", "frame alignment errors" },
+    { CTR_RX_FIFO_ERRORS, "rx_fifo_errors", "statistics/rx_fifo_errors", STATS64(rx_fifo_errors), GROUP_RX, 0,
+      "netmon_rx_fifo_errors_total", "receive FIFO overruns" },
+    { CTR_RX_MISSED_ERRORS, "rx_missed_errors", "statistics/rx_missed_errors", STATS64(rx_missed_errors), GROUP_RX, 0,
+      "netmon_rx_missed_errors_total", "packets the host missed for lack of buffers" },
+    { CTR_TX_ABORTED_ERRORS, "tx_aborted_errors", "statistics/tx_aborted_errors", STATS64(tx_aborted_errors), GROUP_TX, 0,
+      "netmon_tx_aborted_errors_total", "transmissions aborted" },
+    { CTR_TX_CARRIER_ERRORS, "tx_carrier_errors", "statistics/tx_carrier_errors", STATS64(tx_carrier_errors), GROUP_TX, 0,
+      "netmon_tx_carrier_errors_total", "transmissions lost to carrier problems" },
+    { CTR_TX_FIFO_ERRORS, "tx_fifo_errors", "statistics/tx_fifo_errors", STATS64(tx_fifo_errors), GROUP_TX, 0,
+      "netmon_tx_fifo_errors_total", "transmit FIFO underruns" },
+    { CTR_TX_HEARTBEAT_ERRORS, "tx_heartbeat_errors", "statistics/tx_heartbeat_errors", STATS64(tx_heartbeat_errors), GROUP_TX, 0,
+      "netmon_tx_heartbeat_errors_total", "heartbeat errors" },
+    { CTR_TX_WINDOW_ERRORS, "tx_window_errors", "statistics/tx_window_errors", STATS64(tx_window_errors), GROUP_TX, 0,
+      "netmon_tx_window_errors_total", "late collisions" },
+    { CTR_RX_COMPRESSED, "rx_compressed", "statistics/rx_compressed", STATS64(rx_compressed), GROUP_RX, 0,
+      "netmon_rx_compressed_total", "compressed packets received" },
+    { CTR_TX_COMPRESSED, "tx_compressed", "statistics/tx_compressed", STATS64(tx_compressed), GROUP_TX, 0,
+      "netmon_tx_compressed_total", "compressed packets sent" },
+    { CTR_RX_NOHANDLER, "rx_nohandler", "statistics/rx_nohandler", STATS64(rx_nohandler), GROUP_RX, 0,
+      "netmon_rx_nohandler_total", "packets received without a protocol to take them" }
+};
+
+#undef STATS64
+
+/*Function is responsible for*/
+/*checking at compile time that every counter sits at its own id*/
+constexpr bool counter_schema_ordered() {
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if(counter_schema[c].id != c)
+            return false;
+    }
+    return true;
+}
+
+static_assert(counter_schema_ordered(), "counter_schema is out of the order of counter_id");
+
+//Attributes of the netdev generic netlink family (linux/netdev.h, missing from older headers)
+enum qstats_attr : uint16_t {
+    QSTATS_A_IFINDEX = 1,
+    QSTATS_A_QUEUE_TYPE = 2, //0 for rx, 1 for tx
+    QSTATS_A_QUEUE_ID = 3,
+    QSTATS_A_SCOPE = 4,
+    QSTATS_A_RX_PACKETS = 8,
+    QSTATS_A_RX_BYTES = 9,
+    QSTATS_A_TX_PACKETS = 10,
+    QSTATS_A_TX_BYTES = 11
+};
+
+/*Directions of the queues*/
+enum queue_dir : uint8_t {
+    QUEUE_RX,
+    QUEUE_TX,
+    NUM_QUEUE_DIRS
+};
+
+const char* const queue_dir_names[NUM_QUEUE_DIRS] { "rx", "tx" };
+
+/*Counters kept for every queue, in the order of queue_schema*/
+enum queue_counter_id : uint8_t {
+    QCTR_RX_BYTES,
+    QCTR_RX_PACKETS,
+    QCTR_TX_BYTES,
+    QCTR_TX_PACKETS,
+    NUM_QUEUE_COUNTERS
+};
+
+/*Queue Counter Descriptor is the schema entry of a per-queue counter*/
+struct queue_counter_desc {
+    queue_counter_id id;
+    queue_dir dir; //queues the counter belongs to
+    const char* unit; //the field is <dir>_queue<N>_<unit>
+    uint16_t qstats_attr; //QSTATS_A_* holding the counter
+    const char* metric;
+    const char* help;
+};
+
+constexpr queue_counter_desc queue_schema[NUM_QUEUE_COUNTERS] {
+    { QCTR_RX_BYTES, QUEUE_RX, "bytes", QSTATS_A_RX_BYTES, "netmon_queue_rx_bytes_total", "bytes received by the queue" },
+    { QCTR_RX_PACKETS, QUEUE_RX, "packets", QSTATS_A_RX_PACKETS, "netmon_queue_rx_packets_total", "packets received by the queue" },
+    { QCTR_TX_BYTES, QUEUE_TX, "bytes", QSTATS_A_TX_BYTES, "netmon_queue_tx_bytes_total", "bytes sent by the queue" },
+    { QCTR_TX_PACKETS, QUEUE_TX, "packets", QSTATS_A_TX_PACKETS, "netmon_queue_tx_packets_total", "packets sent by the queue" }
+};
+
+/*Function is responsible for*/
+/*checking at compile time that every queue counter sits at its own id*/
+constexpr bool queue_schema_ordered() {
+    for (int c = 0; c < NUM_QUEUE_COUNTERS; c++) {
+        if(queue_schema[c].id != c)
+            return false;
+    }
+    return true;
+}
+
+static_assert(queue_schema_ordered(), "queue_schema is out of the order of queue_counter_id");
+
+/*Statistics gathered from an interface on every sample*/
+/*struct of arrays: a column per counter, indexed by the schema, so a new counter adds no code*/
+struct interface_stats {
+    char operstate[OPERSTATE_LEN];
+    uint16_t num_queues[NUM_QUEUE_DIRS]; //queues of the interface, may be more than MAX_QUEUES
+    uint8_t has_queue_stats; //the backend read the queue counters
+    uint8_t reserved;
+    uint16_t host; //federated host the sample came from, 0 for this one; set by the aggregator
+    uint64_t counters[NUM_COUNTERS]; //indexed by counter_id
+    uint64_t queues[NUM_QUEUE_COUNTERS][MAX_QUEUES]; //indexed by queue_counter_id, then by queue
+};
+
+/*Function is responsible for*/
+/*number of queues of a direction whose counters are kept*/
+inline int queues_kept(const interface_stats* stats, queue_dir dir) {
+    return stats->num_queues[dir] < MAX_QUEUES ? stats->num_queues[dir] : MAX_QUEUES;
+}
+
+/*Function is responsible for*/
+/*reading CLOCK_MONOTONIC in nanoseconds, comparable between processes*/
+inline uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/*Backends able to gather interface statistics*/
+enum collector_backend {
+    BACKEND_SYSFS, //one pread per attribute from /sys/class/net
+    BACKEND_NETLINK, //one RTM_GETLINK round trip for all interfaces
+    BACKEND_COUNT
+};
+
+const char* const backend_names[BACKEND_COUNT] { "sysfs", "netlink" };
+
+/*Function is responsible for*/
+/*converting a backend name into a collector_backend*/
+bool parse_backend(const char* name, collector_backend* backend) {
+    for (int i = 0; i < BACKEND_COUNT; i++) {
+        if(strcmp(name, backend_names[i]) == 0) {
+            *backend = (collector_backend)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*Format Statistics function is responsible for*/
+/*printing the statistics of the given interface into data*/
+/*a line for the link, the receive and the transmit counters, one more for the queues if known*/
+int format_statistics(char* data, size_t len, const char* interface, const interface_stats* stats) {
+    int written = snprintf(data, len, "Interface:%s state:%s", interface, stats->operstate);
+
+    for (int g = GROUP_LINK; g <= GROUP_TX; g++) {
+        bool is_first { g != GROUP_LINK };
+        for (int c = 0; c < NUM_COUNTERS && written > 0 && (size_t)written < len; c++) {
+            if(counter_schema[c].group != g) continue;
+            written += snprintf(data + written, len - written, is_first ? "%s:%" PRIu64 : " %s:%" PRIu64,
+                                counter_schema[c].name, stats->counters[c]);
+            is_first = false;
+        }
+        if(written > 0 && (size_t)written < len)
+            written += snprintf(data + written, len - written, "\n");
+    }
+    if(!stats->has_queue_stats) {
+        return written;
+    }
+    for (int c = 0; c < NUM_QUEUE_COUNTERS; c++) {
+        const queue_counter_desc* desc = &queue_schema[c];
+        for (int q = 0; q < queues_kept(stats, desc->dir) && written > 0 && (size_t)written < len; q++) {
+            written += snprintf(data + written, len - written, "%s_queue%d_%s:%" PRIu64 " ",
+                                queue_dir_names[desc->dir], q, desc->unit, stats->queues[c][q]);
+        }
+    }
+    if(written > 0 && (size_t)written < len)
+        data[written - 1] = '\n'; //in place of the last blank
+    return written;
+}
+
+#endif //STATISTICS_H
@@ -0,0 +1,164 @@
+#ifndef SYSFS_COLLECTOR_H
+#define SYSFS_COLLECTOR_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <net/if.h>
+
+#include "statistics.h"
+#include "self_metrics.h"
+
+#define DEFAULT_SYSFS_ROOT "/sys/class/net" //Directory holding one directory per interface
+#define SYSFS_VALUE_LEN 32 //Maximum length of a sysfs attribute value
+
+//Directory the interfaces are looked up in, a generated tree lets benchmarks run without real interfaces
+const char* sysfs_root { DEFAULT_SYSFS_ROOT };
+
+/*Sysfs Collector keeps every attribute of an interface open*/
+/*so that a sample costs one pread per attribute*/
+struct sysfs_collector {
+    char interface[IFNAMSIZ];
+    int operstate_fd;
+    int fds[NUM_COUNTERS]; //indexed by counter_id, -1 if the kernel does not have the attribute
+    uint16_t num_queues[NUM_QUEUE_DIRS]; //counted from queues/rx-* and tx-* when opened
+    bool is_open;
+};
+
+/*Parse U64 function is responsible for*/
+/*converting leading decimal digits of a sysfs value into a number*/
+inline uint64_t parse_u64(const char* str, ssize_t len) {
+    uint64_t value { 0 };
+    for (ssize_t i = 0; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+        value = value * 10 + (str[i] - '0');
+    }
+    return value;
+}
+
+/*Function is responsible for*/
+/*closing every attribute of the collector*/
+void sysfs_collector_close(sysfs_collector* collector) {
+    if(collector->operstate_fd >= 0) {
+        close(collector->operstate_fd);
+        collector->operstate_fd = -1;
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if(collector->fds[c] >= 0) {
+            close(collector->fds[c]);
+            collector->fds[c] = -1;
+        }
+    }
+    collector->is_open = false;
+}
+
+/*Function is responsible for*/
+/*counting the rx-* and tx-* queues of the collector's interface*/
+void sysfs_count_queues(sysfs_collector* collector) {
+    char path[PATH_MAX];
+    struct dirent* entry;
+    DIR* dir;
+
+    memset(collector->num_queues, 0, sizeof(collector->num_queues));
+    snprintf(path, sizeof(path), "%s/%s/queues", sysfs_root, collector->interface);
+    self_count(SELF_SYSCALLS);
+    if((dir = opendir(path)) == nullptr) {
+        return;
+    }
+    while ((entry = readdir(dir)) != nullptr) {
+        for (int d = 0; d < NUM_QUEUE_DIRS; d++) {
+            if(strncmp(entry->d_name, queue_dir_names[d], 2) == 0 && entry->d_name[2] == '-')
+                ++collector->num_queues[d];
+        }
+    }
+    closedir(dir);
+}
+
+/*Function is responsible for*/
+/*opening every attribute of the collector's interface*/
+/*returns false if the interface does not exist*/
+bool sysfs_collector_open(sysfs_collector* collector) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s/operstate", sysfs_root, collector->interface);
+    self_count(SELF_SYSCALLS);
+    if((collector->operstate_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) { //no operstate means no interface
+        return false;
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        snprintf(path, sizeof(path), "%s/%s/%s", sysfs_root, collector->interface, counter_schema[c].sysfs_path);
+        collector->fds[c] = open(path, O_RDONLY | O_CLOEXEC);
+        self_count(SELF_SYSCALLS);
+        //attributes may be missing on older kernels and are reported as 0
+    }
+    sysfs_count_queues(collector);
+    collector->is_open = true;
+    return true;
+}
+
+/*Function is responsible for*/
+/*preparing the collector for the given interface*/
+void sysfs_collector_init(sysfs_collector* collector, const char* interface) {
+    memset(collector, 0, sizeof(*collector));
+    memcpy(collector->interface, interface, strnlen(interface, IFNAMSIZ-1));
+    collector->operstate_fd = -1;
+    for (int c = 0; c < NUM_COUNTERS; c++)
+        collector->fds[c] = -1;
+    sysfs_collector_open(collector);
+}
+
+/*Function is responsible for*/
+/*re-reading every open attribute into stats*/
+/*sysfs has no per-queue counters, only the number of queues is reported*/
+/*returns false if the interface has disappeared*/
+bool sysfs_collector_sample(sysfs_collector* collector, interface_stats* stats) {
+    char value[SYSFS_VALUE_LEN];
+    ssize_t len;
+
+    self_count(SELF_SYSCALLS);
+    if((len = pread(collector->operstate_fd, value, sizeof(value), 0)) < 0) { //ENODEV once the interface is unregistered
+        return false;
+    }
+    while (len > 0 && (value[len-1] == '\n' || len >= OPERSTATE_LEN))
+        --len;
+    memcpy(stats->operstate, value, len);
+    stats->operstate[len] = '\0';
+
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if(collector->fds[c] < 0) {
+            continue;
+        }
+        self_count(SELF_SYSCALLS);
+        if((len = pread(collector->fds[c], value, sizeof(value), 0)) < 0) {
+            return false;
+        }
+        stats->counters[c] = parse_u64(value, len);
+    }
+    memcpy(stats->num_queues, collector->num_queues, sizeof(stats->num_queues));
+    return true;
+}
+
+/*Function is responsible for*/
+/*taking a sample and reopening the attributes if the interface came back*/
+/*returns false if the interface does not exist*/
+bool sysfs_collector_read(sysfs_collector* collector, interface_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    if(collector->is_open) {
+        if(sysfs_collector_sample(collector, stats)) {
+            return true;
+        }
+        sysfs_collector_close(collector); //stale descriptors of a removed interface
+        memset(stats, 0, sizeof(*stats));
+    }
+    if(!sysfs_collector_open(collector)) {
+        sysfs_collector_close(collector);
+        return false;
+    }
+    return sysfs_collector_sample(collector, stats);
+}
+
+#endif //SYSFS_COLLECTOR_H